@@ -23,6 +23,28 @@
 
 #define MAX_IDS_PER_BLOCKLIST 2048
 
+#define CACHE_VERSIONS_BASENAME       "cache-versions"
+#define LEGACY_CACHE_VERSION_BASENAME "cache-version"
+#define CACHE_MINI_ICON_SUFFIX        "-24x24.png"
+
+/* How long the service waits after the last window closed before
+   letting go of everything only the UI needs */
+#define IDLE_TRIM_GRACE_SEC (60 * 2)
+
+/* Periodic refreshes happen this often */
+#define REFRESH_INTERVAL_SEC (60 * 60 * 24)
+/* Reconnecting does not refresh again until this long after the last
+   successful sync, so roaming between networks stays cheap */
+#define REFRESH_MIN_INTERVAL_SEC (60 * 60 * 4)
+/* Deferred or failed refreshes are retried after this long */
+#define REFRESH_RETRY_SEC (60 * 15)
+/* Waiting a bit after a network change prevents flakiness */
+#define REFRESH_SETTLE_SEC 5
+/* Random extra delay, a tenth of the requested one but within these
+   bounds, so machines which wake up together don't sync together */
+#define REFRESH_MIN_JITTER_SEC 30
+#define REFRESH_MAX_JITTER_SEC (60 * 30)
+
 #include "config.h"
 
 #include <glib/gi18n.h>
@@ -30,7 +52,9 @@
 
 #include "bz-application-map-factory.h"
 #include "bz-application.h"
+#include "bz-async-texture.h"
 #include "bz-auth-state.h"
+#include "bz-bandwidth.h"
 #include "bz-backend-notification.h"
 #include "bz-content-provider.h"
 #include "bz-entry-cache-manager.h"
@@ -52,14 +76,35 @@
 #include "bz-result.h"
 #include "bz-root-blocklist.h"
 #include "bz-root-curated-config.h"
+#include "bz-search-result.h"
 #include "bz-serializable.h"
 #include "bz-state-info.h"
+#include "bz-stats-store.h"
 #include "bz-transaction-manager.h"
 #include "bz-util.h"
 #include "bz-window.h"
 #include "bz-yaml-parser.h"
 #include "progress-bar-designs/common.h"
 
+/* Startup runs in this order. Everything the first window needs to show
+ * the catalog is done directly in init_fiber, search is usable once the
+ * flathub snapshot is in, and anything which talks to the network or only
+ * refreshes what is already on screen waits for the main loop to go idle. */
+typedef enum
+{
+  STARTUP_PHASE_CATALOG = 0,
+  STARTUP_PHASE_SEARCH,
+  STARTUP_PHASE_BACKGROUND,
+  N_STARTUP_PHASES,
+} StartupPhase;
+
+static const char *const startup_phase_names[] = {
+  [STARTUP_PHASE_CATALOG]    = "catalog",
+  [STARTUP_PHASE_SEARCH]     = "search",
+  [STARTUP_PHASE_BACKGROUND] = "background",
+};
+G_STATIC_ASSERT (G_N_ELEMENTS (startup_phase_names) == N_STARTUP_PHASES);
+
 struct _BzApplication
 {
   AdwApplication parent_instance;
@@ -71,13 +116,13 @@ struct _BzApplication
   BzContentProvider          *txt_blocklists_provider;
   BzEntryCacheManager        *cache;
   BzFlathubState             *flathub;
-  BzFlathubState             *tmp_flathub;
   BzFlatpakInstance          *flatpak;
   BzGnomeShellSearchProvider *gs_search;
   BzMainConfig               *config;
   BzNewlineParser            *txt_blocklist_parser;
   BzSearchEngine             *search_engine;
   BzStateInfo                *state;
+  BzStatsStore               *stats;
   BzTransactionManager       *transactions;
   BzYamlParser               *blocklist_parser;
   BzYamlParser               *curated_parser;
@@ -93,6 +138,7 @@ struct _BzApplication
   GListStore                 *groups;
   GListStore                 *installed_apps;
   GNetworkMonitor            *network;
+  GPowerProfileMonitor       *power_monitor;
   GPtrArray                  *blocklist_regexes;
   GPtrArray                  *txt_blocked_id_sets;
   GSettings                  *settings;
@@ -107,8 +153,15 @@ struct _BzApplication
   GtkStringList              *blocklists;
   GtkStringList              *curated_configs;
   GtkStringList              *txt_blocklists;
+  gboolean                    idle_trimmed;
+  gboolean                    refresh_deferred;
+  gboolean                    refresh_enabled;
   gboolean                    running;
-  guint                       periodic_timeout_source;
+  gint64                      last_sync_usec;
+  guint                       idle_trim_source;
+  guint                       refresh_source;
+  guint                       startup_idle_source;
+  double                      startup_marks[N_STARTUP_PHASES];
   int                         n_notifications_incoming;
 };
 
@@ -145,6 +198,20 @@ BZ_DEFINE_DATA (
     BZ_RELEASE_DATA (self, bz_weak_release);
     BZ_RELEASE_DATA (file, g_object_unref))
 
+BZ_DEFINE_DATA (
+    local_package_progress,
+    LocalPackageProgress,
+    {
+      GWeakRef   *window;
+      DexChannel *channel;
+      AdwToast   *toast;
+      gboolean    shown;
+      gboolean    finished;
+    },
+    BZ_RELEASE_DATA (window, bz_weak_release);
+    BZ_RELEASE_DATA (channel, dex_unref);
+    BZ_RELEASE_DATA (toast, g_object_unref))
+
 BZ_DEFINE_DATA (
     open_appstream,
     OpenAppstream,
@@ -155,9 +222,56 @@ BZ_DEFINE_DATA (
     BZ_RELEASE_DATA (self, g_object_unref);
     BZ_RELEASE_DATA (id, g_free))
 
+typedef enum
+{
+  CACHE_SELECT_ALL = 0,
+  CACHE_SELECT_SUBDIRS,
+  CACHE_SELECT_MINI_ICONS,
+} CacheSelect;
+
+/* Bump `version` whenever the on-disk format of a cache module changes. If
+ * the new format can still read what the previous one wrote, leave
+ * `min_compatible` alone and the module is kept across the upgrade;
+ * otherwise raise it to `version` and only that module gets wiped. */
+static const struct
+{
+  const char *key;
+  const char *module;
+  CacheSelect select;
+  guint       version;
+  guint       min_compatible;
+} cache_modules[] = {
+  /* serialized BzEntry objects */
+  {        "entries",     "entry-cache",        CACHE_SELECT_ALL, 1, 1 },
+  /* flathub-cache */
+  {  "flathub-state",            "core",        CACHE_SELECT_ALL, 1, 1 },
+  /* compiled appstream silos */
+  {          "silos",         "flatpak",        CACHE_SELECT_ALL, 1, 1 },
+  /* downloaded screenshots and icons, one directory per entry */
+  {          "media",           "entry",    CACHE_SELECT_SUBDIRS, 1, 1 },
+  /* search provider icons */
+  {     "mini-icons",           "entry", CACHE_SELECT_MINI_ICONS, 1, 1 },
+  /* columnar daily install counts */
+  {          "stats",           "stats",        CACHE_SELECT_ALL, 1, 1 },
+  /* versioned index of shell search rows and 24x24 icon pixels */
+  {"search-snapshot", "search-provider",        CACHE_SELECT_ALL, 2, 2 },
+  /* decoded pixels of small cached images */
+  {     "icon-atlas",      "icon-atlas",        CACHE_SELECT_ALL, 1, 1 },
+};
+
 static DexFuture *
 init_fiber (GWeakRef *wr);
 
+static DexFuture *
+migrate_cache_fiber (const char *root_cache_dir);
+
+static GHashTable *
+load_cache_versions (const char *root_cache_dir);
+
+static void
+discard_cache_module (const char *root_cache_dir,
+                      guint       idx);
+
 static DexFuture *
 cache_flathub_fiber (GWeakRef *wr);
 
@@ -170,6 +284,10 @@ open_appstream_fiber (OpenAppstreamData *data);
 static DexFuture *
 open_flatpakref_fiber (OpenFlatpakrefData *data);
 
+static DexFuture *
+local_package_progress_then_loop (DexFuture                *future,
+                                  LocalPackageProgressData *data);
+
 static DexFuture *
 backend_sync_finally (DexFuture *future,
                       GWeakRef  *wr);
@@ -205,11 +323,53 @@ static GFile *
 fiber_dup_flathub_cache_file (char   **path_out,
                               GError **error);
 
+static BzFlathubState *
+fiber_load_cached_flathub (BzApplication *self);
+
+static DexFuture *
+rehydrate_fiber (GWeakRef *wr);
+
+static gboolean
+idle_trim_cb (BzApplication *self);
+
+static DexFuture *
+sync_finally (DexFuture *future,
+              GWeakRef  *wr);
+
+static void
+schedule_refresh (BzApplication *self,
+                  guint          delay_sec);
+
+static DexFuture *
+snapshot_results_then (DexFuture *future,
+                       GWeakRef  *wr);
+
+static DexFuture *
+save_snapshot_catch (DexFuture *future,
+                     gpointer   user_data);
+
 static gboolean
-periodic_timeout_cb (BzApplication *self);
+refresh_timeout_cb (BzApplication *self);
 
 static gboolean
-scheduled_timeout_cb (GWeakRef *wr);
+refresh_should_defer (BzApplication *self);
+
+static void
+power_saver_changed (BzApplication        *self,
+                     GParamSpec           *pspec,
+                     GPowerProfileMonitor *monitor);
+
+static void
+transactions_active_changed (BzApplication        *self,
+                             GParamSpec           *pspec,
+                             BzTransactionManager *transactions);
+
+static gboolean
+startup_idle_cb (BzApplication *self);
+
+static void
+mark_startup_phase (BzApplication *self,
+                    StartupPhase   phase);
 
 static void
 network_status_changed (BzApplication   *self,
@@ -290,14 +450,16 @@ cmp_group (BzEntryGroup *a,
            BzEntryGroup *b,
            gpointer      user_data);
 
-static gint
-cmp_entry (BzEntry *a,
-           BzEntry *b,
-           gpointer user_data);
+static guint
+entry_replace_rank (BzEntry *entry);
 
 static gboolean
 validate_group_for_ui (BzApplication *self,
-                       BzEntryGroup  *group);
+                       BzEntryGroup  *group,
+                       gboolean       check_facets);
+
+static GStrv
+dup_search_facets (BzApplication *self);
 
 static DexFuture *
 make_sync_future (BzApplication *self);
@@ -314,7 +476,9 @@ bz_application_dispose (GObject *object)
   dex_clear (&self->notif_watch);
   dex_clear (&self->ready_to_open_files);
   dex_clear (&self->sync);
-  g_clear_handle_id (&self->periodic_timeout_source, g_source_remove);
+  g_clear_handle_id (&self->idle_trim_source, g_source_remove);
+  g_clear_handle_id (&self->refresh_source, g_source_remove);
+  g_clear_handle_id (&self->startup_idle_source, g_source_remove);
   g_clear_object (&self->appid_filter);
   g_clear_object (&self->application_factory);
   g_clear_object (&self->blocklist_parser);
@@ -335,10 +499,13 @@ bz_application_dispose (GObject *object)
   g_clear_object (&self->gs_search);
   g_clear_object (&self->installed_apps);
   g_clear_object (&self->network);
+  if (self->power_monitor != NULL)
+    g_signal_handlers_disconnect_by_data (self->power_monitor, self);
+  g_clear_object (&self->power_monitor);
   g_clear_object (&self->search_engine);
   g_clear_object (&self->settings);
   g_clear_object (&self->state);
-  g_clear_object (&self->tmp_flathub);
+  g_clear_object (&self->stats);
   g_clear_object (&self->transactions);
   g_clear_object (&self->txt_blocklist_parser);
   g_clear_object (&self->txt_blocklists);
@@ -519,11 +686,46 @@ bz_application_dbus_unregister (GApplication    *application,
   bz_gnome_shell_search_provider_set_connection (self->gs_search, NULL, NULL);
 }
 
+static void
+bz_application_window_added (GtkApplication *application,
+                             GtkWindow      *window)
+{
+  BzApplication *self = BZ_APPLICATION (application);
+
+  GTK_APPLICATION_CLASS (bz_application_parent_class)->window_added (application, window);
+
+  g_clear_handle_id (&self->idle_trim_source, g_source_remove);
+  if (self->idle_trimmed)
+    {
+      self->idle_trimmed = FALSE;
+      dex_future_disown (dex_scheduler_spawn (
+          dex_scheduler_get_default (),
+          bz_get_dex_stack_size (),
+          (DexFiberFunc) rehydrate_fiber,
+          bz_track_weak (self), bz_weak_release));
+    }
+}
+
+static void
+bz_application_window_removed (GtkApplication *application,
+                               GtkWindow      *window)
+{
+  BzApplication *self = BZ_APPLICATION (application);
+
+  GTK_APPLICATION_CLASS (bz_application_parent_class)->window_removed (application, window);
+
+  if (gtk_application_get_windows (application) == NULL &&
+      self->idle_trim_source == 0)
+    self->idle_trim_source = g_timeout_add_seconds (
+        IDLE_TRIM_GRACE_SEC, (GSourceFunc) idle_trim_cb, self);
+}
+
 static void
 bz_application_class_init (BzApplicationClass *klass)
 {
-  GObjectClass      *object_class = G_OBJECT_CLASS (klass);
-  GApplicationClass *app_class    = G_APPLICATION_CLASS (klass);
+  GObjectClass        *object_class  = G_OBJECT_CLASS (klass);
+  GApplicationClass   *app_class     = G_APPLICATION_CLASS (klass);
+  GtkApplicationClass *gtk_app_class = GTK_APPLICATION_CLASS (klass);
 
   object_class->dispose = bz_application_dispose;
 
@@ -533,6 +735,9 @@ bz_application_class_init (BzApplicationClass *klass)
   app_class->dbus_register      = bz_application_dbus_register;
   app_class->dbus_unregister    = bz_application_dbus_unregister;
 
+  gtk_app_class->window_added   = bz_application_window_added;
+  gtk_app_class->window_removed = bz_application_window_removed;
+
   g_type_ensure (BZ_TYPE_RESULT);
 }
 
@@ -839,10 +1044,18 @@ static const GActionEntry app_actions[] = {
 static void
 bz_application_init (BzApplication *self)
 {
+  g_autoptr (GError) local_error = NULL;
+
   self->running = FALSE;
   g_weak_ref_init (&self->main_window, NULL);
 
   self->gs_search = bz_gnome_shell_search_provider_new ();
+  if (!bz_gnome_shell_search_provider_load_snapshot (self->gs_search, &local_error))
+    {
+      if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Unable to load search snapshot: %s", local_error->message);
+      g_clear_error (&local_error);
+    }
 
   g_action_map_add_action_entries (
       G_ACTION_MAP (self),
@@ -898,15 +1111,13 @@ bz_state_info_get_default (void)
 static DexFuture *
 init_fiber (GWeakRef *wr)
 {
-  g_autoptr (BzApplication) self        = NULL;
-  g_autoptr (GError) local_error        = NULL;
-  g_autofree char *root_cache_dir       = NULL;
-  g_autoptr (GFile) root_cache_dir_file = NULL;
-  gboolean has_flathub                  = FALSE;
-  gboolean result                       = FALSE;
-  g_autoptr (GHashTable) cached_set     = NULL;
-  g_autofree char *flathub_cache        = NULL;
-  g_autoptr (GFile) flathub_cache_file  = NULL;
+  g_autoptr (BzApplication) self       = NULL;
+  g_autoptr (GError) local_error       = NULL;
+  g_autofree char *root_cache_dir      = NULL;
+  gboolean has_flathub                 = FALSE;
+  gboolean result                      = FALSE;
+  g_autoptr (GHashTable) cached_set    = NULL;
+  g_autoptr (BzFlathubState) flathub   = NULL;
 
   bz_weak_get_or_return_reject (self, wr);
 
@@ -914,55 +1125,14 @@ init_fiber (GWeakRef *wr)
   bz_state_info_set_busy (self->state, TRUE);
   bz_state_info_set_background_task_label (self->state, _ ("Performing setup..."));
 
-  root_cache_dir      = bz_dup_root_cache_dir ();
-  root_cache_dir_file = g_file_new_for_path (root_cache_dir);
-  if (dex_await (dex_file_query_exists (root_cache_dir_file), NULL))
-    {
-      g_autofree char *cache_version_path  = NULL;
-      g_autoptr (GFile) cache_version_file = NULL;
-      gboolean wipe_cache                  = TRUE;
-
-      cache_version_path = g_build_filename (root_cache_dir, "cache-version", NULL);
-      cache_version_file = g_file_new_for_path (cache_version_path);
-      if (dex_await (dex_file_query_exists (cache_version_file), NULL))
-        {
-          g_autoptr (GBytes) bytes = NULL;
-
-          bytes = dex_await_boxed (dex_file_load_contents_bytes (cache_version_file), NULL);
-          if (bytes != NULL)
-            {
-              g_autoptr (GVariant) variant = NULL;
-
-              variant = g_variant_new_from_bytes (G_VARIANT_TYPE_STRING, bytes, FALSE);
-              if (variant != NULL)
-                {
-                  const char *version = NULL;
-
-                  version    = g_variant_get_string (variant, NULL);
-                  wipe_cache = g_strcmp0 (version, PACKAGE_VERSION) != 0;
-                }
-            }
-        }
-
-      if (wipe_cache)
-        {
-          g_info ("Version incompatibility detected: clearing cache");
-          dex_await (bz_reap_file_dex (root_cache_dir_file), NULL);
-        }
-
-      if (dex_await (dex_file_make_directory_with_parents (root_cache_dir_file), NULL))
-        {
-          g_autoptr (GVariant) variant = NULL;
-          g_autoptr (GBytes) bytes     = NULL;
-
-          variant = g_variant_new_string (PACKAGE_VERSION);
-          bytes   = g_variant_get_data_as_bytes (variant);
-          dex_await (dex_file_replace_contents_bytes (
-                         cache_version_file, bytes, NULL, FALSE,
-                         G_FILE_CREATE_REPLACE_DESTINATION),
-                     NULL);
-        }
-    }
+  root_cache_dir = bz_dup_root_cache_dir ();
+  dex_await (
+      dex_scheduler_spawn (
+          bz_get_io_scheduler (),
+          bz_get_dex_stack_size (),
+          (DexFiberFunc) migrate_cache_fiber,
+          g_steal_pointer (&root_cache_dir), g_free),
+      NULL);
 
   g_clear_object (&self->flatpak);
   self->flatpak = dex_await_object (bz_flatpak_instance_new (), &local_error);
@@ -1052,6 +1222,7 @@ init_fiber (GWeakRef *wr)
       g_autoptr (GPtrArray) futures = NULL;
       GHashTableIter iter           = { 0 };
       g_autoptr (GPtrArray) entries = NULL;
+      g_autofree guint8 *ranks      = NULL;
 
       futures = g_ptr_array_new_with_free_func (dex_unref);
 
@@ -1094,14 +1265,19 @@ init_fiber (GWeakRef *wr)
             }
         }
 
-      g_ptr_array_sort_values_with_data (
-          entries, (GCompareDataFunc) cmp_entry, NULL);
+      /* Runtimes and addons have to land before the apps that refer to
+         them. Ranking every entry once and replaying them rank by rank
+         avoids a comparison sort over the whole cache. */
+      ranks = g_new (guint8, MAX (entries->len, 1));
       for (guint i = 0; i < entries->len; i++)
+        ranks[i] = entry_replace_rank (g_ptr_array_index (entries, i));
+      for (guint rank = 0; rank <= 2; rank++)
         {
-          BzEntry *entry = NULL;
-
-          entry = g_ptr_array_index (entries, i);
-          fiber_replace_entry (self, entry);
+          for (guint i = 0; i < entries->len; i++)
+            {
+              if (ranks[i] == rank)
+                fiber_replace_entry (self, g_ptr_array_index (entries, i));
+            }
         }
 
       gtk_filter_changed (GTK_FILTER (self->group_filter), GTK_FILTER_CHANGE_LESS_STRICT);
@@ -1112,66 +1288,326 @@ init_fiber (GWeakRef *wr)
       g_warning ("Unable to enumerate cached entries: %s", local_error->message);
       g_clear_error (&local_error);
     }
+  mark_startup_phase (self, STARTUP_PHASE_CATALOG);
+
+  flathub = fiber_load_cached_flathub (self);
+  if (flathub != NULL)
+    {
+      self->flathub = g_steal_pointer (&flathub);
+      bz_state_info_set_flathub (self->state, self->flathub);
+
+      bz_state_info_set_busy (self->state, FALSE);
+      dex_promise_resolve_boolean (self->ready_to_open_files, TRUE);
+    }
+  mark_startup_phase (self, STARTUP_PHASE_SEARCH);
+
+  return dex_future_new_true ();
+}
+
+static BzFlathubState *
+fiber_load_cached_flathub (BzApplication *self)
+{
+  g_autoptr (GError) local_error       = NULL;
+  g_autofree char *flathub_cache       = NULL;
+  g_autoptr (GFile) flathub_cache_file = NULL;
+  g_autoptr (GBytes) bytes             = NULL;
+  g_autoptr (GVariant) variant         = NULL;
+  g_autoptr (BzFlathubState) flathub   = NULL;
+  gboolean result                      = FALSE;
 
   flathub_cache_file = fiber_dup_flathub_cache_file (&flathub_cache, &local_error);
-  if (flathub_cache_file != NULL)
+  if (flathub_cache_file == NULL)
     {
-      if (dex_await (dex_file_query_exists (flathub_cache_file), NULL))
-        {
-          g_autoptr (GBytes) bytes = NULL;
+      g_warning ("Unable to ensure cache directory: %s", local_error->message);
+      return NULL;
+    }
+  if (!dex_await (dex_file_query_exists (flathub_cache_file), NULL))
+    return NULL;
 
-          bytes = dex_await_boxed (
-              dex_file_load_contents_bytes (flathub_cache_file),
-              &local_error);
-          if (bytes != NULL)
-            {
-              g_autoptr (GVariant) variant       = NULL;
-              g_autoptr (BzFlathubState) flathub = NULL;
+  bytes = dex_await_boxed (
+      dex_file_load_contents_bytes (flathub_cache_file),
+      &local_error);
+  if (bytes == NULL)
+    {
+      g_warning ("Failed to decache cache flathub state from %s: %s",
+                 flathub_cache, local_error->message);
+      return NULL;
+    }
 
-              variant = g_variant_new_from_bytes (G_VARIANT_TYPE_VARDICT, bytes, FALSE);
-              if (variant == NULL)
-                {
-                  g_warning ("Failed to interpret cached flathub state from %s: %s",
-                             flathub_cache, local_error->message);
-                  g_clear_error (&local_error);
-                }
+  variant = g_variant_new_from_bytes (G_VARIANT_TYPE_VARDICT, bytes, FALSE);
+  flathub = bz_flathub_state_new ();
+  result  = bz_serializable_deserialize (
+      BZ_SERIALIZABLE (flathub), variant, &local_error);
+  if (!result)
+    {
+      g_warning ("Failed to deserialize cached flathub state from %s: %s",
+                 flathub_cache, local_error->message);
+      return NULL;
+    }
+  bz_flathub_state_set_map_factory (flathub, self->application_factory);
 
-              flathub = bz_flathub_state_new ();
-              result  = bz_serializable_deserialize (
-                  BZ_SERIALIZABLE (flathub), variant, &local_error);
-              if (result)
-                {
-                  self->flathub = g_steal_pointer (&flathub);
-                  bz_flathub_state_set_map_factory (self->flathub, self->application_factory);
-                  bz_state_info_set_flathub (self->state, self->flathub);
+  return g_steal_pointer (&flathub);
+}
 
-                  bz_state_info_set_busy (self->state, FALSE);
-                  dex_promise_resolve_boolean (self->ready_to_open_files, TRUE);
-                }
-              else
-                {
-                  g_warning ("Failed to deserialize cached flathub state from %s: %s",
-                             flathub_cache, local_error->message);
-                  g_clear_error (&local_error);
-                }
-            }
-          else
-            {
-              g_warning ("Failed to decache cache flathub state from %s: %s",
-                         flathub_cache, local_error->message);
-              g_clear_error (&local_error);
-            }
+static DexFuture *
+rehydrate_fiber (GWeakRef *wr)
+{
+  g_autoptr (BzApplication) self     = NULL;
+  g_autoptr (BzFlathubState) flathub = NULL;
+  g_autoptr (DexFuture) future       = NULL;
+
+  bz_weak_get_or_return_reject (self, wr);
+
+  if (self->flathub == NULL)
+    flathub = fiber_load_cached_flathub (self);
+  /* A sync may have beaten us to it while the cache was loading */
+  if (self->flathub == NULL)
+    {
+      if (flathub == NULL)
+        {
+          flathub = bz_flathub_state_new ();
+          bz_flathub_state_set_map_factory (flathub, self->application_factory);
         }
+      else
+        bz_state_info_set_flathub (self->state, flathub);
+      self->flathub = g_steal_pointer (&flathub);
     }
-  else
+
+  if (bz_state_info_get_have_connection (self->state))
     {
-      g_warning ("Unable to ensure cache directory: %s", local_error->message);
-      g_clear_error (&local_error);
+      /* Only collections which went stale while we were idle are fetched */
+      future = bz_flathub_state_revalidate (self->flathub);
+      future = dex_future_finally (
+          future,
+          (DexFutureCallback) flathub_update_finally,
+          bz_track_weak (self), bz_weak_release);
+      dex_future_disown (g_steal_pointer (&future));
     }
 
   return dex_future_new_true ();
 }
 
+static gboolean
+idle_trim_cb (BzApplication *self)
+{
+  guint n_textures = 0;
+
+  self->idle_trim_source = 0;
+
+  if (gtk_application_get_windows (GTK_APPLICATION (self)) != NULL)
+    return G_SOURCE_REMOVE;
+  if (self->sync != NULL &&
+      dex_future_is_pending (self->sync))
+    {
+      /* The flathub state may still be getting swapped around */
+      self->idle_trim_source = g_timeout_add_seconds (
+          IDLE_TRIM_GRACE_SEC, (GSourceFunc) idle_trim_cb, self);
+      return G_SOURCE_REMOVE;
+    }
+
+  /* Groups, the installed set and the search index stay, they are all
+     the shell search provider and update checks need. Entries themselves
+     are only weakly held by the cache manager, so with the windows gone
+     they are already free to be swept. */
+  n_textures = bz_async_texture_unload_all ();
+  if (self->flathub != NULL)
+    {
+      bz_state_info_set_flathub (self->state, NULL);
+      g_clear_object (&self->flathub);
+    }
+  bz_search_engine_trim (self->search_engine);
+
+#ifdef __GLIBC__
+  malloc_trim (0);
+#endif
+
+  self->idle_trimmed = TRUE;
+  g_debug ("No windows for %d seconds, released %u decoded textures and the flathub state",
+           IDLE_TRIM_GRACE_SEC, n_textures);
+
+  return G_SOURCE_REMOVE;
+}
+
+static DexFuture *
+migrate_cache_fiber (const char *root_cache_dir)
+{
+  g_autoptr (GHashTable) versions     = NULL;
+  g_autoptr (GVariantBuilder) builder = NULL;
+  g_autoptr (GVariant) variant        = NULL;
+  g_autoptr (GBytes) bytes            = NULL;
+  g_autofree char *versions_path      = NULL;
+  g_autoptr (GError) local_error      = NULL;
+  gboolean result                     = FALSE;
+
+  if (!g_file_test (root_cache_dir, G_FILE_TEST_IS_DIR))
+    return dex_future_new_true ();
+
+  versions = load_cache_versions (root_cache_dir);
+  for (guint i = 0; i < G_N_ELEMENTS (cache_modules); i++)
+    {
+      gpointer stored = NULL;
+
+      if (g_hash_table_lookup_extended (versions, cache_modules[i].key, NULL, &stored) &&
+          GPOINTER_TO_UINT (stored) >= cache_modules[i].min_compatible &&
+          GPOINTER_TO_UINT (stored) <= cache_modules[i].version)
+        continue;
+
+      g_info ("Cache module \"%s\" is incompatible with this version: clearing it",
+              cache_modules[i].key);
+      discard_cache_module (root_cache_dir, i);
+    }
+
+  builder = g_variant_builder_new (G_VARIANT_TYPE ("a{su}"));
+  for (guint i = 0; i < G_N_ELEMENTS (cache_modules); i++)
+    g_variant_builder_add (builder, "{su}", cache_modules[i].key, cache_modules[i].version);
+  variant = g_variant_ref_sink (g_variant_builder_end (builder));
+  bytes   = g_variant_get_data_as_bytes (variant);
+
+  versions_path = g_build_filename (root_cache_dir, CACHE_VERSIONS_BASENAME, NULL);
+  result        = g_file_set_contents (
+      versions_path,
+      g_bytes_get_data (bytes, NULL),
+      g_bytes_get_size (bytes),
+      &local_error);
+  if (!result)
+    g_warning ("Could not write cache versions to %s: %s",
+               versions_path, local_error->message);
+
+  return dex_future_new_true ();
+}
+
+static GHashTable *
+load_cache_versions (const char *root_cache_dir)
+{
+  g_autoptr (GHashTable) versions = NULL;
+  g_autofree char *versions_path  = NULL;
+  g_autofree char *legacy_path    = NULL;
+  g_autoptr (GMappedFile) mapped  = NULL;
+  g_autoptr (GBytes) bytes        = NULL;
+  g_autoptr (GVariant) variant    = NULL;
+  gboolean legacy_version_matches = FALSE;
+
+  versions      = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  versions_path = g_build_filename (root_cache_dir, CACHE_VERSIONS_BASENAME, NULL);
+  legacy_path   = g_build_filename (root_cache_dir, LEGACY_CACHE_VERSION_BASENAME, NULL);
+
+  mapped = g_mapped_file_new (versions_path, FALSE, NULL);
+  if (mapped != NULL)
+    {
+      GVariantIter iter    = { 0 };
+      const char  *key     = NULL;
+      guint        version = 0;
+
+      bytes   = g_mapped_file_get_bytes (mapped);
+      variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("a{su}"), bytes, FALSE));
+
+      g_variant_iter_init (&iter, variant);
+      while (g_variant_iter_next (&iter, "{&su}", &key, &version))
+        g_hash_table_replace (versions, g_strdup (key), GUINT_TO_POINTER (version));
+
+      return g_steal_pointer (&versions);
+    }
+
+  mapped = g_mapped_file_new (legacy_path, FALSE, NULL);
+  if (mapped == NULL)
+    /* Nothing we can vouch for, every module gets cleared */
+    return g_steal_pointer (&versions);
+
+  /* Older releases kept a single "cache-version" file holding the package
+   * version and wiped everything whenever it changed. Everything they wrote
+   * is format version 1. Media and mini-icons never depended on the package
+   * version, so they carry over regardless; the rest only does if the
+   * version matches. */
+  bytes                  = g_mapped_file_get_bytes (mapped);
+  variant                = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE_STRING, bytes, FALSE));
+  legacy_version_matches = g_strcmp0 (g_variant_get_string (variant, NULL), PACKAGE_VERSION) == 0;
+
+  for (guint i = 0; i < G_N_ELEMENTS (cache_modules); i++)
+    {
+      if (legacy_version_matches ||
+          cache_modules[i].select != CACHE_SELECT_ALL)
+        g_hash_table_replace (versions, g_strdup (cache_modules[i].key), GUINT_TO_POINTER (1));
+    }
+
+  bz_discard_path (legacy_path);
+  return g_steal_pointer (&versions);
+}
+
+static void
+discard_cache_module (const char *root_cache_dir,
+                      guint       idx)
+{
+  g_autofree char *module_dir            = NULL;
+  g_autoptr (GFile) module_dir_file      = NULL;
+  g_autoptr (GFileEnumerator) enumerator = NULL;
+  g_autoptr (GError) local_error         = NULL;
+
+  module_dir = g_build_filename (root_cache_dir, cache_modules[idx].module, NULL);
+  if (cache_modules[idx].select == CACHE_SELECT_ALL)
+    {
+      bz_discard_path (module_dir);
+      return;
+    }
+
+  module_dir_file = g_file_new_for_path (module_dir);
+  enumerator      = g_file_enumerate_children (
+      module_dir_file,
+      G_FILE_ATTRIBUTE_STANDARD_NAME ","
+      G_FILE_ATTRIBUTE_STANDARD_TYPE,
+      G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+      NULL,
+      &local_error);
+  if (enumerator == NULL)
+    {
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        g_warning ("Could not enumerate cache module \"%s\" at %s: %s",
+                   cache_modules[idx].key, module_dir, local_error->message);
+      return;
+    }
+
+  for (;;)
+    {
+      g_autoptr (GFileInfo) info = NULL;
+      const char *name           = NULL;
+      GFileType   type           = G_FILE_TYPE_UNKNOWN;
+      gboolean    selected       = FALSE;
+
+      info = g_file_enumerator_next_file (enumerator, NULL, &local_error);
+      if (info == NULL)
+        {
+          if (local_error != NULL)
+            g_warning ("Could not enumerate cache module \"%s\" at %s: %s",
+                       cache_modules[idx].key, module_dir, local_error->message);
+          break;
+        }
+
+      name = g_file_info_get_name (info);
+      type = g_file_info_get_file_type (info);
+
+      switch (cache_modules[idx].select)
+        {
+        case CACHE_SELECT_SUBDIRS:
+          selected = type == G_FILE_TYPE_DIRECTORY;
+          break;
+        case CACHE_SELECT_MINI_ICONS:
+          selected = type == G_FILE_TYPE_REGULAR &&
+                     g_str_has_suffix (name, CACHE_MINI_ICON_SUFFIX);
+          break;
+        case CACHE_SELECT_ALL:
+        default:
+          g_assert_not_reached ();
+        }
+
+      if (selected)
+        {
+          g_autofree char *path = NULL;
+
+          path = g_build_filename (module_dir, name, NULL);
+          bz_discard_path (path);
+        }
+    }
+}
+
 static DexFuture *
 cache_flathub_fiber (GWeakRef *wr)
 {
@@ -1572,23 +2008,46 @@ open_appstream_fiber (OpenAppstreamData *data)
 static DexFuture *
 open_flatpakref_fiber (OpenFlatpakrefData *data)
 {
-  g_autoptr (BzApplication) self = NULL;
-  GFile *file                    = data->file;
-  g_autoptr (GError) local_error = NULL;
-  g_autoptr (DexFuture) future   = NULL;
-  GtkWindow    *window           = NULL;
-  const GValue *value            = NULL;
+  g_autoptr (BzApplication) self                = NULL;
+  GFile *file                                   = data->file;
+  g_autoptr (GError) local_error                = NULL;
+  g_autoptr (DexChannel) channel                = NULL;
+  g_autoptr (LocalPackageProgressData) progress = NULL;
+  g_autoptr (DexFuture) progress_loop           = NULL;
+  g_autoptr (DexFuture) future                  = NULL;
+  GtkWindow    *window                          = NULL;
+  const GValue *value                           = NULL;
 
   bz_weak_get_or_return_reject (self, data->self);
   dex_await (dex_ref (self->ready_to_open_files), NULL);
 
-  future = bz_backend_load_local_package (BZ_BACKEND (self->flatpak), file, NULL);
-  dex_await (dex_ref (future), NULL);
-
   window = gtk_application_get_active_window (GTK_APPLICATION (self));
   if (window == NULL)
     window = new_window (self);
 
+  channel = dex_channel_new (0);
+  future  = bz_backend_load_local_package (BZ_BACKEND (self->flatpak), file, channel, NULL);
+
+  /* Only bundles with a large header report progress, everything else is
+     ready before a toast would be worth showing */
+  progress          = local_package_progress_data_new ();
+  progress->window  = bz_track_weak (window);
+  progress->channel = dex_ref (channel);
+  progress->toast   = adw_toast_new (_ ("Reading bundle..."));
+  adw_toast_set_timeout (progress->toast, 0);
+  progress_loop = dex_future_then_loop (
+      dex_channel_receive (channel),
+      (DexFutureCallback) local_package_progress_then_loop,
+      local_package_progress_data_ref (progress),
+      local_package_progress_data_unref);
+
+  dex_await (dex_ref (future), NULL);
+
+  progress->finished = TRUE;
+  dex_clear (&progress_loop);
+  if (progress->shown)
+    adw_toast_dismiss (progress->toast);
+
   value = dex_future_get_value (future, &local_error);
   if (value != NULL)
     {
@@ -1635,6 +2094,31 @@ open_flatpakref_fiber (OpenFlatpakrefData *data)
   return dex_future_new_true ();
 }
 
+static DexFuture *
+local_package_progress_then_loop (DexFuture                *future,
+                                  LocalPackageProgressData *data)
+{
+  g_autoptr (BzWindow) window = NULL;
+  double fraction             = 0.0;
+  g_autofree char *title      = NULL;
+
+  if (data->finished)
+    return dex_future_new_reject (G_IO_ERROR, G_IO_ERROR_CANCELLED, "Finished");
+  bz_weak_get_or_return_reject (window, data->window);
+
+  fraction = g_value_get_double (dex_future_get_value (future, NULL));
+  title    = g_strdup_printf (_ ("Reading bundle... %d%%"), (int) (fraction * 100.0));
+  adw_toast_set_title (data->toast, title);
+
+  if (!data->shown)
+    {
+      bz_window_add_toast (window, g_object_ref (data->toast));
+      data->shown = TRUE;
+    }
+
+  return dex_channel_receive (data->channel);
+}
+
 static DexFuture *
 init_fiber_finally (DexFuture *future,
                     GWeakRef  *wr)
@@ -1642,14 +2126,18 @@ init_fiber_finally (DexFuture *future,
   g_autoptr (BzApplication) self = NULL;
   g_autoptr (GError) local_error = NULL;
   const GValue *value            = NULL;
+  g_auto (GStrv) facets          = NULL;
 
   bz_weak_get_or_return_reject (self, wr);
 
+  /* Until now the shell was answered from the last snapshot */
+  facets = dup_search_facets (self);
+  bz_gnome_shell_search_provider_set_facets (self->gs_search, (const char *const *) facets);
+  bz_gnome_shell_search_provider_set_engine (self->gs_search, self->search_engine);
+
   value = dex_future_get_value (future, &local_error);
   if (value != NULL)
     {
-      g_autoptr (DexFuture) sync_future = NULL;
-
       self->flatpak_notifs = bz_backend_create_notification_channel (
           BZ_BACKEND (self->flatpak));
       self->notif_watch = dex_future_then_loop (
@@ -1658,17 +2146,10 @@ init_fiber_finally (DexFuture *future,
           bz_track_weak (self),
           bz_weak_release);
 
-      sync_future = make_sync_future (self);
-      sync_future = dex_future_finally (
-          sync_future,
-          (DexFutureCallback) init_sync_finally,
-          bz_track_weak (self),
-          bz_weak_release);
-      self->sync = g_steal_pointer (&sync_future);
-
-      self->periodic_timeout_source = g_timeout_add_seconds (
-          /* Check every day */
-          60 * 60 * 24, (GSourceFunc) periodic_timeout_cb, self);
+      /* Let the window draw what we already have before the remote sync
+         starts competing with it for the main thread */
+      self->startup_idle_source = g_idle_add_full (
+          G_PRIORITY_LOW, (GSourceFunc) startup_idle_cb, self, NULL);
     }
   else
     {
@@ -1706,6 +2187,60 @@ init_sync_finally (DexFuture *future,
   return dex_future_new_true ();
 }
 
+static gboolean
+startup_idle_cb (BzApplication *self)
+{
+  g_autoptr (DexFuture) sync_future = NULL;
+
+  self->startup_idle_source = 0;
+  mark_startup_phase (self, STARTUP_PHASE_BACKGROUND);
+
+  dex_future_disown (bz_stats_store_load (self->stats));
+
+  /* A network change may have already kicked one off */
+  if (self->sync != NULL &&
+      dex_future_is_pending (self->sync))
+    sync_future = dex_ref (self->sync);
+  else
+    sync_future = make_sync_future (self);
+  sync_future = dex_future_finally (
+      sync_future,
+      (DexFutureCallback) init_sync_finally,
+      bz_track_weak (self),
+      bz_weak_release);
+  dex_clear (&self->sync);
+  self->sync = g_steal_pointer (&sync_future);
+
+  /* From here on sync_finally keeps the next refresh scheduled */
+  self->refresh_enabled = TRUE;
+
+  /* Started with --no-window */
+  if (gtk_application_get_windows (GTK_APPLICATION (self)) == NULL &&
+      self->idle_trim_source == 0)
+    self->idle_trim_source = g_timeout_add_seconds (
+        IDLE_TRIM_GRACE_SEC, (GSourceFunc) idle_trim_cb, self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+mark_startup_phase (BzApplication *self,
+                    StartupPhase   phase)
+{
+  double elapsed  = 0.0;
+  double previous = 0.0;
+
+  elapsed = g_timer_elapsed (self->init_timer, NULL);
+  if (phase > 0)
+    previous = self->startup_marks[phase - 1];
+  self->startup_marks[phase] = elapsed;
+
+  g_debug ("Startup phase '%s' reached after %.3f seconds (%.3f spent in it)",
+           startup_phase_names[phase], elapsed, elapsed - previous);
+  if (phase == STARTUP_PHASE_SEARCH)
+    g_debug ("Bazaar became interactive after %.3f seconds", elapsed);
+}
+
 static DexFuture *
 backend_sync_finally (DexFuture *future,
                       GWeakRef  *wr)
@@ -1729,25 +2264,23 @@ flathub_update_finally (DexFuture *future,
 
   bz_weak_get_or_return_reject (self, wr);
 
-  if (dex_future_is_resolved (future))
-    {
-      g_clear_object (&self->flathub);
-      g_assert (self->tmp_flathub != NULL);
-      self->flathub = g_steal_pointer (&self->tmp_flathub);
-      bz_flathub_state_set_map_factory (self->flathub, self->application_factory);
-      bz_state_info_set_flathub (self->state, self->flathub);
-
-      return dex_scheduler_spawn (
-          dex_scheduler_get_default (),
-          bz_get_dex_stack_size (),
-          (DexFiberFunc) cache_flathub_fiber,
-          bz_track_weak (self), bz_weak_release);
-    }
+  /* Whatever the revalidation managed to refresh has already been swapped
+     into the live state, so the page only needs to be pointed at it once
+     there is something to show */
+  if (bz_state_info_get_flathub (self->state) != self->flathub &&
+      bz_flathub_state_get_categories (self->flathub) != NULL &&
+      !bz_flathub_state_get_has_connection_error (self->flathub))
+    bz_state_info_set_flathub (self->state, self->flathub);
+
+  if (dex_future_is_resolved (future) &&
+      g_value_get_boolean (dex_future_get_value (future, NULL)))
+    return dex_scheduler_spawn (
+        dex_scheduler_get_default (),
+        bz_get_dex_stack_size (),
+        (DexFiberFunc) cache_flathub_fiber,
+        bz_track_weak (self), bz_weak_release);
   else
-    {
-      g_clear_object (&self->tmp_flathub);
-      return dex_ref (future);
-    }
+    return dex_ref (future);
 }
 
 static DexFuture *
@@ -1762,6 +2295,70 @@ sync_then (DexFuture *future,
   return dex_future_new_true ();
 }
 
+static DexFuture *
+sync_finally (DexFuture *future,
+              GWeakRef  *wr)
+{
+  g_autoptr (BzApplication) self = NULL;
+  const char *empty_terms[]      = { NULL };
+  g_auto (GStrv) facets          = NULL;
+
+  bz_weak_get_or_return_reject (self, wr);
+
+  if (dex_future_is_resolved (future))
+    {
+      self->last_sync_usec = g_get_real_time ();
+      schedule_refresh (self, REFRESH_INTERVAL_SEC);
+
+      facets = dup_search_facets (self);
+      dex_future_disown (dex_future_catch (
+          dex_future_then (
+              bz_search_engine_query_faceted (
+                  self->search_engine,
+                  (const char *const *) empty_terms,
+                  (const char *const *) facets,
+                  NULL),
+              (DexFutureCallback) snapshot_results_then,
+              bz_track_weak (self), bz_weak_release),
+          (DexFutureCallback) save_snapshot_catch,
+          NULL, NULL));
+    }
+  else
+    schedule_refresh (self, REFRESH_RETRY_SEC);
+
+  return dex_ref (future);
+}
+
+static DexFuture *
+snapshot_results_then (DexFuture *future,
+                       GWeakRef  *wr)
+{
+  g_autoptr (BzApplication) self = NULL;
+  GPtrArray *results             = NULL;
+  g_autoptr (GListStore) groups  = NULL;
+
+  bz_weak_get_or_return_reject (self, wr);
+
+  results = g_value_get_boxed (dex_future_get_value (future, NULL));
+  groups  = g_list_store_new (BZ_TYPE_ENTRY_GROUP);
+  for (guint i = 0; i < results->len; i++)
+    g_list_store_append (groups, bz_search_result_get_group (g_ptr_array_index (results, i)));
+
+  return bz_gnome_shell_search_provider_save_snapshot (self->gs_search, G_LIST_MODEL (groups));
+}
+
+static DexFuture *
+save_snapshot_catch (DexFuture *future,
+                     gpointer   user_data)
+{
+  g_autoptr (GError) local_error = NULL;
+
+  dex_future_get_value (future, &local_error);
+  g_warning ("Unable to save search snapshot: %s", local_error->message);
+
+  return dex_future_new_true ();
+}
+
 static DexFuture *
 watch_backend_notifs_then_loop_cb (DexFuture *future,
                                    GWeakRef  *wr)
@@ -1859,6 +2456,7 @@ fiber_replace_entry (BzApplication *self,
       if (group != NULL)
         {
           bz_entry_group_add (group, entry, eol_runtime);
+          bz_search_engine_invalidate (self->search_engine);
           if (installed && !g_list_store_find (self->installed_apps, group, NULL))
             g_list_store_insert_sorted (
                 self->installed_apps, group,
@@ -2034,52 +2632,6 @@ fiber_dup_flathub_cache_file (char   **path_out,
   return g_steal_pointer (&file);
 }
 
-static gboolean
-periodic_timeout_cb (BzApplication *self)
-{
-  gboolean have_connection    = FALSE;
-  gboolean metered_connection = FALSE;
-
-  if (self->sync != NULL &&
-      dex_future_is_pending (self->sync))
-    /* If for some reason the last update check is still happening, let it
-       finish */
-    goto done;
-
-  dex_clear (&self->sync);
-
-  have_connection    = bz_state_info_get_have_connection (self->state);
-  metered_connection = bz_state_info_get_metered_connection (self->state);
-  if (have_connection && !metered_connection)
-    /* Do not do periodic sync on metered connections. The user will have to
-       manually refresh instead. */
-    self->sync = make_sync_future (self);
-
-done:
-  return G_SOURCE_CONTINUE;
-}
-
-static gboolean
-scheduled_timeout_cb (GWeakRef *wr)
-{
-  g_autoptr (BzApplication) self = NULL;
-  gboolean have_connection       = FALSE;
-
-  /* Use weak ref here since the source tag of this callback won't be tracked by
-     the main application obj */
-  self = g_weak_ref_get (wr);
-  if (self == NULL)
-    goto done;
-
-  dex_clear (&self->sync);
-  have_connection = bz_state_info_get_have_connection (self->state);
-  if (have_connection)
-    self->sync = make_sync_future (self);
-
-done:
-  return G_SOURCE_REMOVE;
-}
-
 static void
 network_status_changed (BzApplication   *self,
                         GParamSpec      *pspec,
@@ -2098,20 +2650,36 @@ network_status_changed (BzApplication   *self,
   have_connection = connectivity == G_NETWORK_CONNECTIVITY_FULL;
   is_metered      = g_network_monitor_get_network_metered (network);
 
-  if (!bz_state_info_get_busy (self->state) &&
-      ((!was_connected &&
-        have_connection &&
-        !is_metered) ||
-       (was_metered &&
-        !is_metered)))
-    /* Wait a bit to prevent flakiness */
-    g_timeout_add_full (
-        G_PRIORITY_DEFAULT,
-        500, (GSourceFunc) scheduled_timeout_cb,
-        bz_track_weak (self), bz_weak_release);
-
   bz_state_info_set_have_connection (self->state, have_connection);
   bz_state_info_set_metered_connection (self->state, is_metered);
+
+  /* refresh_timeout_cb decides whether this is actually worth a sync */
+  if ((!was_connected &&
+       have_connection &&
+       !is_metered) ||
+      (was_metered &&
+       !is_metered))
+    schedule_refresh (self, REFRESH_SETTLE_SEC);
+}
+
+static void
+power_saver_changed (BzApplication        *self,
+                     GParamSpec           *pspec,
+                     GPowerProfileMonitor *monitor)
+{
+  if (self->refresh_deferred &&
+      !g_power_profile_monitor_get_power_saver_enabled (monitor))
+    schedule_refresh (self, REFRESH_SETTLE_SEC);
+}
+
+static void
+transactions_active_changed (BzApplication        *self,
+                             GParamSpec           *pspec,
+                             BzTransactionManager *transactions)
+{
+  /* Flatpak downloads do not go through our session, so hold everything
+     else back for as long as a transaction runs */
+  bz_bandwidth_set_interactive_hold (bz_transaction_manager_get_active (transactions));
 }
 
 static void
@@ -2126,7 +2694,18 @@ show_hide_app_setting_changed (BzApplication *self,
   bz_state_info_set_show_only_flathub (self->state, g_settings_get_boolean (self->settings, "show-only-flathub"));
   bz_state_info_set_show_only_verified (self->state, g_settings_get_boolean (self->settings, "show-only-verified"));
 
-  gtk_filter_changed (GTK_FILTER (self->group_filter), GTK_FILTER_CHANGE_DIFFERENT);
+  /* FOSS and verified are search facets, so toggling
+     them doesn't have to rebuild the search index */
+  if (g_strcmp0 (key, "show-only-foss") == 0 ||
+      g_strcmp0 (key, "show-only-verified") == 0)
+    {
+      g_auto (GStrv) facets = NULL;
+
+      facets = dup_search_facets (self);
+      bz_gnome_shell_search_provider_set_facets (self->gs_search, (const char *const *) facets);
+    }
+  else
+    gtk_filter_changed (GTK_FILTER (self->group_filter), GTK_FILTER_CHANGE_DIFFERENT);
   gtk_filter_changed (GTK_FILTER (self->appid_filter), GTK_FILTER_CHANGE_DIFFERENT);
 
   g_object_thaw_notify (G_OBJECT (self->state));
@@ -2602,6 +3181,12 @@ init_service_struct (BzApplication *self,
   else
     g_warning ("Unable to detect networking device! Continuing anyway...");
 
+  self->power_monitor = g_power_profile_monitor_dup_default ();
+  if (self->power_monitor != NULL)
+    g_signal_connect_swapped (
+        self->power_monitor, "notify::power-saver-enabled",
+        G_CALLBACK (power_saver_changed), self);
+
   app_id = g_application_get_application_id (G_APPLICATION (self));
   g_assert (app_id != NULL);
   g_debug ("Constructing gsettings for %s ...", app_id);
@@ -2688,17 +3273,23 @@ init_service_struct (BzApplication *self,
       g_object_ref (G_LIST_MODEL (self->groups)),
       g_object_ref (GTK_FILTER (self->group_filter)));
 
+  self->stats = bz_stats_store_new ();
+
   self->search_engine = bz_search_engine_new ();
   bz_search_engine_set_model (self->search_engine, G_LIST_MODEL (self->group_filter_model));
-  bz_gnome_shell_search_provider_set_engine (self->gs_search, self->search_engine);
+  bz_search_engine_set_stats_store (self->search_engine, self->stats);
 
   self->curated_provider = bz_content_provider_new ();
   bz_content_provider_set_input_files (
       self->curated_provider, G_LIST_MODEL (self->curated_configs_to_files));
   bz_content_provider_set_parser (self->curated_provider, BZ_PARSER (self->curated_parser));
+  bz_content_provider_set_reconcile (self->curated_provider, TRUE);
 
   self->transactions = bz_transaction_manager_new ();
   bz_transaction_manager_set_config (self->transactions, self->config);
+  g_signal_connect_swapped (
+      self->transactions, "notify::active",
+      G_CALLBACK (transactions_active_changed), self);
 
   bz_state_info_set_all_entry_groups (self->state, G_LIST_MODEL (self->groups));
   bz_state_info_set_all_installed_entry_groups (self->state, G_LIST_MODEL (self->installed_apps));
@@ -2711,6 +3302,7 @@ init_service_struct (BzApplication *self,
   bz_state_info_set_main_config (self->state, self->config);
   bz_state_info_set_search_engine (self->state, self->search_engine);
   bz_state_info_set_settings (self->state, self->settings);
+  bz_state_info_set_stats_store (self->state, self->stats);
   bz_state_info_set_transaction_manager (self->state, self->transactions);
   bz_state_info_set_txt_blocklists (self->state, G_LIST_MODEL (self->txt_blocklists));
   bz_state_info_set_txt_blocklists_provider (self->state, self->txt_blocklists_provider);
@@ -2916,7 +3508,7 @@ filter_application_ids (GtkStringObject *string,
       self->ids_to_groups,
       gtk_string_object_get_string (string));
   if (group != NULL)
-    return validate_group_for_ui (self, group);
+    return validate_group_for_ui (self, group, TRUE);
   else
     return FALSE;
 }
@@ -2925,58 +3517,47 @@ static gboolean
 filter_entry_groups (BzEntryGroup  *group,
                      BzApplication *self)
 {
-  return validate_group_for_ui (self, group);
+  /* This feeds the search engine, which applies FOSS
+     and verified itself, see dup_search_facets() */
+  return validate_group_for_ui (self, group, FALSE);
 }
 
-static gint
-cmp_group (BzEntryGroup *a,
-           BzEntryGroup *b,
-           gpointer      user_data)
+static GStrv
+dup_search_facets (BzApplication *self)
 {
-  const char *title_a = NULL;
-  const char *title_b = NULL;
-
-  title_a = bz_entry_group_get_title (a);
-  title_b = bz_entry_group_get_title (b);
+  g_autoptr (GStrvBuilder) builder = NULL;
 
-  if (title_a == NULL)
-    return 1;
-  if (title_b == NULL)
-    return -1;
+  builder = g_strv_builder_new ();
+  if (bz_state_info_get_show_only_foss (self->state))
+    g_strv_builder_add (builder, BZ_SEARCH_FACET_FLOSS);
+  if (bz_state_info_get_show_only_verified (self->state))
+    g_strv_builder_add (builder, BZ_SEARCH_FACET_VERIFIED);
 
-  return g_strcmp0 (title_a, title_b);
+  return g_strv_builder_end (builder);
 }
 
 static gint
-cmp_entry (BzEntry *a,
-           BzEntry *b,
-           gpointer user_data)
-{
-  gboolean a_is_runtime = FALSE;
-  gboolean b_is_runtime = FALSE;
-  gboolean a_is_addon   = FALSE;
-  gboolean b_is_addon   = FALSE;
-
-  a_is_runtime = bz_entry_is_of_kinds (a, BZ_ENTRY_KIND_RUNTIME);
-  b_is_runtime = bz_entry_is_of_kinds (b, BZ_ENTRY_KIND_RUNTIME);
-  if (a_is_runtime && !b_is_runtime)
-    return -1;
-  if (!a_is_runtime && b_is_runtime)
-    return 1;
+cmp_group (BzEntryGroup *a,
+           BzEntryGroup *b,
+           gpointer      user_data)
+{
+  return bz_entry_group_cmp_title (a, b);
+}
 
-  a_is_addon = bz_entry_is_of_kinds (a, BZ_ENTRY_KIND_ADDON);
-  b_is_addon = bz_entry_is_of_kinds (b, BZ_ENTRY_KIND_ADDON);
-  if (a_is_addon && !b_is_addon)
-    return -1;
-  if (!a_is_addon && b_is_addon)
+static guint
+entry_replace_rank (BzEntry *entry)
+{
+  if (bz_entry_is_of_kinds (entry, BZ_ENTRY_KIND_RUNTIME))
+    return 0;
+  if (bz_entry_is_of_kinds (entry, BZ_ENTRY_KIND_ADDON))
     return 1;
-
-  return 0;
+  return 2;
 }
 
 static gboolean
 validate_group_for_ui (BzApplication *self,
-                       BzEntryGroup  *group)
+                       BzEntryGroup  *group,
+                       gboolean       check_facets)
 {
   const char *id               = NULL;
   int         allowed_priority = G_MAXINT;
@@ -2985,13 +3566,15 @@ validate_group_for_ui (BzApplication *self,
   if (bz_state_info_get_hide_eol (self->state) &&
       bz_entry_group_get_eol (group) != NULL)
     return FALSE;
-  if (bz_state_info_get_show_only_foss (self->state) &&
+  if (check_facets &&
+      bz_state_info_get_show_only_foss (self->state) &&
       !bz_entry_group_get_is_floss (group))
     return FALSE;
   if (bz_state_info_get_show_only_flathub (self->state) &&
       !bz_entry_group_get_is_flathub (group))
     return FALSE;
-  if (bz_state_info_get_show_only_verified (self->state) &&
+  if (check_facets &&
+      bz_state_info_get_show_only_verified (self->state) &&
       !bz_entry_group_get_is_verified (group))
     return FALSE;
 
@@ -3045,13 +3628,28 @@ make_sync_future (BzApplication *self)
       (DexFutureCallback) backend_sync_finally,
       bz_track_weak (self), bz_weak_release);
 
-  g_clear_object (&self->tmp_flathub);
-  self->tmp_flathub = bz_flathub_state_new ();
-  flathub_future    = bz_flathub_state_update_to_today (self->tmp_flathub);
-  flathub_future    = dex_future_finally (
-      flathub_future,
-      (DexFutureCallback) flathub_update_finally,
-      bz_track_weak (self), bz_weak_release);
+  if (self->idle_trimmed)
+    /* Nothing without a window looks at it, rehydrate_fiber will bring it
+       back up to date */
+    flathub_future = dex_future_new_true ();
+  else
+    {
+      if (self->flathub == NULL)
+        {
+          self->flathub = bz_flathub_state_new ();
+          bz_flathub_state_set_map_factory (self->flathub, self->application_factory);
+        }
+      flathub_future = bz_flathub_state_revalidate (self->flathub);
+      flathub_future = dex_future_finally (
+          flathub_future,
+          (DexFutureCallback) flathub_update_finally,
+          bz_track_weak (self), bz_weak_release);
+    }
+
+  /* The daily payloads are a few megabytes each and nothing depends on
+     them, so keep them out of the sync result */
+  if (!bz_state_info_get_metered_connection (self->state))
+    dex_future_disown (bz_stats_store_update (self->stats));
 
   ret_future = dex_future_all (
       dex_ref (backend_future),
@@ -3061,9 +3659,87 @@ make_sync_future (BzApplication *self)
       ret_future,
       (DexFutureCallback) sync_then,
       bz_track_weak (self), bz_weak_release);
+  ret_future = dex_future_finally (
+      ret_future,
+      (DexFutureCallback) sync_finally,
+      bz_track_weak (self), bz_weak_release);
   return g_steal_pointer (&ret_future);
 }
 
+static void
+schedule_refresh (BzApplication *self,
+                  guint          delay_sec)
+{
+  guint jitter_sec = 0;
+
+  jitter_sec = g_random_int_range (
+      0, CLAMP (delay_sec / 10, REFRESH_MIN_JITTER_SEC, REFRESH_MAX_JITTER_SEC) + 1);
+
+  g_clear_handle_id (&self->refresh_source, g_source_remove);
+  self->refresh_source = g_timeout_add_seconds (
+      delay_sec + jitter_sec, (GSourceFunc) refresh_timeout_cb, self);
+}
+
+static gboolean
+refresh_timeout_cb (BzApplication *self)
+{
+  gint64 since_sec = 0;
+
+  self->refresh_source = 0;
+
+  if (!self->refresh_enabled)
+    /* The startup sync hasn't been kicked off yet */
+    return G_SOURCE_REMOVE;
+  if (self->sync != NULL &&
+      dex_future_is_pending (self->sync))
+    /* sync_finally will schedule the next one */
+    return G_SOURCE_REMOVE;
+
+  if (self->last_sync_usec > 0)
+    {
+      since_sec = (g_get_real_time () - self->last_sync_usec) / G_USEC_PER_SEC;
+      if (since_sec >= 0 && since_sec < REFRESH_MIN_INTERVAL_SEC)
+        {
+          g_debug ("Last sync was %" G_GINT64_FORMAT " seconds ago, not refreshing yet", since_sec);
+          schedule_refresh (self, REFRESH_INTERVAL_SEC - since_sec);
+          return G_SOURCE_REMOVE;
+        }
+    }
+
+  if (!bz_state_info_get_have_connection (self->state) ||
+      bz_state_info_get_metered_connection (self->state))
+    /* Do not do periodic sync on metered connections. The user will have to
+       manually refresh instead. network_status_changed will reschedule. */
+    return G_SOURCE_REMOVE;
+
+  if (refresh_should_defer (self))
+    {
+      g_debug ("Deferring background refresh");
+      self->refresh_deferred = TRUE;
+      schedule_refresh (self, REFRESH_RETRY_SEC);
+      return G_SOURCE_REMOVE;
+    }
+
+  self->refresh_deferred = FALSE;
+  dex_clear (&self->sync);
+  self->sync = make_sync_future (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+refresh_should_defer (BzApplication *self)
+{
+  if (self->power_monitor != NULL &&
+      g_power_profile_monitor_get_power_saver_enabled (self->power_monitor))
+    return TRUE;
+  if (bz_state_info_get_busy (self->state) ||
+      bz_transaction_manager_get_active (self->transactions))
+    return TRUE;
+
+  return FALSE;
+}
+
 static void
 finish_with_background_task_label (BzApplication *self)
 {
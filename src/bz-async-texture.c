@@ -34,6 +34,7 @@
 #include "bz-async-texture.h"
 #include "bz-download-worker.h"
 #include "bz-env.h"
+#include "bz-icon-atlas.h"
 #include "bz-io.h"
 #include "bz-util.h"
 
@@ -96,6 +97,11 @@ enum
 };
 static GParamSpec *props[LAST_PROP] = { 0 };
 
+/* Every texture which is alive, so bz_async_texture_unload_all() can reach
+   them without the owners keeping track */
+static GMutex      live_mutex    = { 0 };
+static GHashTable *live_textures = NULL;
+
 static DexFuture *
 load_fiber_work (LoadData *data);
 
@@ -113,11 +119,19 @@ retry_cb (DexFuture *future,
 static gboolean
 idle_notify (BzAsyncTexture *self);
 
+static gboolean
+unload (BzAsyncTexture *self);
+
 static void
 bz_async_texture_dispose (GObject *object)
 {
   BzAsyncTexture *self = BZ_ASYNC_TEXTURE (object);
 
+  g_mutex_lock (&live_mutex);
+  if (live_textures != NULL)
+    g_hash_table_remove (live_textures, self);
+  g_mutex_unlock (&live_mutex);
+
   if (self->cancellable != NULL)
     g_cancellable_cancel (self->cancellable);
   dex_clear (&self->task);
@@ -215,6 +229,12 @@ bz_async_texture_init (BzAsyncTexture *self)
   self->retries   = 0;
   self->paintable = NULL;
   g_mutex_init (&self->texture_mutex);
+
+  g_mutex_lock (&live_mutex);
+  if (live_textures == NULL)
+    live_textures = g_hash_table_new (g_direct_hash, g_direct_equal);
+  g_hash_table_add (live_textures, self);
+  g_mutex_unlock (&live_mutex);
 }
 
 static void
@@ -458,6 +478,40 @@ bz_async_texture_is_loading (BzAsyncTexture *self)
   return self->task != NULL && dex_future_is_pending (self->task);
 }
 
+void
+bz_async_texture_unload (BzAsyncTexture *self)
+{
+  g_return_if_fail (BZ_IS_ASYNC_TEXTURE (self));
+  unload (self);
+}
+
+guint
+bz_async_texture_unload_all (void)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  GHashTableIter iter             = { 0 };
+  guint          n_unloaded       = 0;
+
+  locker = g_mutex_locker_new (&live_mutex);
+  if (live_textures == NULL)
+    return 0;
+
+  /* Holding `live_mutex` keeps every texture from finishing dispose, so
+     they don't need to be reffed here */
+  g_hash_table_iter_init (&iter, live_textures);
+  for (;;)
+    {
+      BzAsyncTexture *texture = NULL;
+
+      if (!g_hash_table_iter_next (&iter, (gpointer *) &texture, NULL))
+        break;
+      if (unload (texture))
+        n_unloaded++;
+    }
+
+  return n_unloaded;
+}
+
 static void
 maybe_load (BzAsyncTexture *self)
 {
@@ -528,6 +582,7 @@ load_fiber_work (LoadData *data)
   g_autoptr (GFile) async_tex_data_file = NULL;
   g_autoptr (GdkTexture) texture        = NULL;
   g_autoptr (GlyFrame) frame            = NULL;
+  gint64 birth_unix_stamp               = 0;
 
   locker = g_mutex_locker_new (&queueing_mutex);
   if (concurrent_glycin == 0)
@@ -634,7 +689,6 @@ load_fiber_work (LoadData *data)
             variant = g_variant_new_from_bytes (G_VARIANT_TYPE ("a{sv}"), bytes, FALSE);
           if (variant != NULL)
             {
-              gint64 birth_unix_stamp               = 0;
               g_autoptr (GDateTime) birth_date_time = NULL;
 
               if (g_variant_lookup (
@@ -653,20 +707,26 @@ load_fiber_work (LoadData *data)
             {
               if (age_span < CACHE_INVALID_AGE)
                 {
-                  RATE_LIMIT_END ();
-                  RATE_LIMIT_BEGIN (glycin);
-
-                  loader = gly_loader_new (cache_into);
-                  /* We assume we exported this file, so uhhh it is safe to
-                     not use sandboxing, since it is faster :-) */
-                  gly_loader_set_sandbox_selector (loader, GLY_SANDBOX_SELECTOR_NOT_SANDBOXED);
-
-                  image = gly_loader_load (loader, &local_error);
-                  if (image != NULL)
-                    frame = gly_image_next_frame (image, &local_error);
-
-                  RATE_LIMIT_END ();
-                  RATE_LIMIT_BEGIN (io);
+                  /* Small images we decoded before come straight from the
+                     atlas, without a trip through glycin */
+                  texture = bz_icon_atlas_lookup (cache_into_path, birth_unix_stamp);
+                  if (texture == NULL)
+                    {
+                      RATE_LIMIT_END ();
+                      RATE_LIMIT_BEGIN (glycin);
+
+                      loader = gly_loader_new (cache_into);
+                      /* We assume we exported this file, so uhhh it is safe to
+                         not use sandboxing, since it is faster :-) */
+                      gly_loader_set_sandbox_selector (loader, GLY_SANDBOX_SELECTOR_NOT_SANDBOXED);
+
+                      image = gly_loader_load (loader, &local_error);
+                      if (image != NULL)
+                        frame = gly_image_next_frame (image, &local_error);
+
+                      RATE_LIMIT_END ();
+                      RATE_LIMIT_BEGIN (io);
+                    }
                 }
               else
                 g_debug ("Metadata file %s for cached texture at %s indicates this resource is too old (GTimeSpan: %zu), "
@@ -681,7 +741,7 @@ load_fiber_work (LoadData *data)
               g_clear_pointer (&local_error, g_error_free);
             }
 
-          if (frame == NULL)
+          if (frame == NULL && texture == NULL)
             {
               if (local_error != NULL)
                 g_warning ("An attempt to revive cached texture at %s has failed, "
@@ -702,6 +762,9 @@ load_fiber_work (LoadData *data)
       RATE_LIMIT_END ();
     }
 
+  if (texture != NULL)
+    return dex_future_new_for_object (texture);
+
   if (frame == NULL)
     {
       g_autoptr (GFile) load_file  = NULL;
@@ -833,11 +896,12 @@ load_fiber_work (LoadData *data)
           g_autoptr (GFileOutputStream) output = NULL;
 
           builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+          birth_unix_stamp = g_date_time_to_unix (now);
           g_variant_builder_add (
               builder,
               "{sv}",
               "birth-unix-stamp",
-              g_variant_new_int64 (g_date_time_to_unix (now)));
+              g_variant_new_int64 (birth_unix_stamp));
 
           variant = g_variant_builder_end (builder);
           bytes   = g_variant_get_data_as_bytes (variant);
@@ -877,6 +941,9 @@ load_fiber_work (LoadData *data)
         G_IO_ERROR_FAILED,
         "texture loading failed");
 
+  if (cache_into != NULL && birth_unix_stamp > 0)
+    bz_icon_atlas_store (cache_into_path, birth_unix_stamp, texture);
+
   return dex_future_new_for_object (texture);
 }
 
@@ -960,3 +1027,20 @@ idle_notify (BzAsyncTexture *self)
 
   return G_SOURCE_REMOVE;
 }
+
+static gboolean
+unload (BzAsyncTexture *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  locker = g_mutex_locker_new (&self->texture_mutex);
+  if (!GDK_IS_TEXTURE (self->paintable))
+    return FALSE;
+
+  /* The source is still around, so maybe_load() will decode it again the
+     next time anything asks for the contents */
+  g_clear_object (&self->paintable);
+  self->retries = 0;
+
+  return TRUE;
+}
@@ -66,4 +66,13 @@ bz_async_texture_cancel (BzAsyncTexture *self);
 gboolean
 bz_async_texture_is_loading (BzAsyncTexture *self);
 
+/* Drops the decoded texture, it will be loaded again on demand */
+void
+bz_async_texture_unload (BzAsyncTexture *self);
+
+/* Like bz_async_texture_unload() for every texture in the process,
+   returns how many had decoded contents */
+guint
+bz_async_texture_unload_all (void);
+
 G_END_DECLS
@@ -34,8 +34,11 @@ bz_backend_real_create_notification_channel (BzBackend *self)
 static DexFuture *
 bz_backend_real_load_local_package (BzBackend    *self,
                                     GFile        *file,
+                                    DexChannel   *channel,
                                     GCancellable *cancellable)
 {
+  if (channel != NULL)
+    dex_channel_close_send (channel);
   return dex_future_new_reject (G_IO_ERROR, G_IO_ERROR_UNKNOWN, "Unimplemented");
 }
 
@@ -96,13 +99,15 @@ bz_backend_create_notification_channel (BzBackend *self)
 DexFuture *
 bz_backend_load_local_package (BzBackend    *self,
                                GFile        *file,
+                               DexChannel   *channel,
                                GCancellable *cancellable)
 {
   dex_return_error_if_fail (BZ_IS_BACKEND (self));
   dex_return_error_if_fail (G_IS_FILE (file));
+  dex_return_error_if_fail (channel == NULL || DEX_IS_CHANNEL (channel));
   dex_return_error_if_fail (cancellable == NULL || G_IS_CANCELLABLE (self));
 
-  return BZ_BACKEND_GET_IFACE (self)->load_local_package (self, file, cancellable);
+  return BZ_BACKEND_GET_IFACE (self)->load_local_package (self, file, channel, cancellable);
 }
 
 DexFuture *
@@ -35,9 +35,11 @@ struct _BzBackendInterface
 
   DexChannel *(*create_notification_channel) (BzBackend *self);
 
-  /* DexFuture* -> char*|BzEntry* */
+  /* DexFuture* -> char*|BzEntry*
+     channel receives doubles in [0, 1] while a large file is read */
   DexFuture *(*load_local_package) (BzBackend    *self,
                                     GFile        *file,
+                                    DexChannel   *channel,
                                     GCancellable *cancellable);
 
   /* DexFuture* -> gboolean */
@@ -70,6 +72,7 @@ bz_backend_create_notification_channel (BzBackend *self);
 DexFuture *
 bz_backend_load_local_package (BzBackend    *self,
                                GFile        *file,
+                               DexChannel   *channel,
                                GCancellable *cancellable);
 
 DexFuture *
@@ -0,0 +1,264 @@
+/* bz-bandwidth.c
+ *
+ * Copyright 2025 Adam Masciola
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* for memfd_create */
+#define _GNU_SOURCE
+
+#define G_LOG_DOMAIN "BAZAAR::BANDWIDTH"
+
+/* Every process paces its traffic against one small shared mapping. The
+ * parent creates it and each download worker inherits it. Each paced
+ * lane stores the monotonic time at which its next byte may go out.
+ * Acquiring n bytes moves that time forward by n / rate, which gives
+ * one token bucket per lane shared by all processes. */
+#define SHARED_MAGIC              0x627a6277
+#define ACTIVE_LINGER_USEC        (2 * G_USEC_PER_SEC)
+#define MAX_BURST_USEC            (G_USEC_PER_SEC / 4)
+#define CONTENDED_MEDIA_RATE      (512 * 1024)
+#define CONTENDED_BACKGROUND_RATE (64 * 1024)
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bz-bandwidth.h"
+#include "bz-env.h"
+
+enum
+{
+  LANE_MEDIA = 0,
+  LANE_BACKGROUND,
+
+  N_LANES,
+};
+
+typedef struct
+{
+  guint32 magic;
+  gint32  interactive_holds;
+  guint64 background_cap;
+  /* only interactive and visible media are tracked */
+  gint64 active_until[BZ_BANDWIDTH_CLASS_BACKGROUND];
+  gint64 next_free[N_LANES];
+} SharedState;
+
+static GMutex       state_mutex   = { 0 };
+static SharedState  private_state = { 0 };
+static SharedState *state         = NULL;
+static int          shared_fd     = -1;
+static gboolean     held          = FALSE;
+
+static SharedState *
+ensure_state (void);
+
+static DexFuture *
+timeout_catch (DexFuture *future,
+               gpointer   user_data);
+
+int
+bz_bandwidth_dup_shared_fd (GError **error)
+{
+  int fd = -1;
+
+  ensure_state ();
+  if (shared_fd < 0)
+    {
+      g_set_error (
+          error,
+          G_IO_ERROR,
+          G_IO_ERROR_NOT_SUPPORTED,
+          "Bandwidth state is not shared in this process");
+      return -1;
+    }
+
+  fd = dup (shared_fd);
+  if (fd < 0)
+    {
+      int errsv = errno;
+
+      g_set_error (
+          error,
+          G_IO_ERROR,
+          g_io_error_from_errno (errsv),
+          "Could not duplicate the bandwidth state: %s",
+          g_strerror (errsv));
+    }
+  return fd;
+}
+
+gboolean
+bz_bandwidth_adopt_shared_fd (int      fd,
+                              GError **error)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  SharedState *mapped             = NULL;
+
+  mapped = mmap (NULL, sizeof (*mapped), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)
+    {
+      int errsv = errno;
+
+      g_set_error (
+          error,
+          G_IO_ERROR,
+          g_io_error_from_errno (errsv),
+          "Could not map the bandwidth state: %s",
+          g_strerror (errsv));
+      return FALSE;
+    }
+  if (mapped->magic != SHARED_MAGIC)
+    {
+      munmap (mapped, sizeof (*mapped));
+      g_set_error (
+          error,
+          G_IO_ERROR,
+          G_IO_ERROR_INVALID_DATA,
+          "The inherited bandwidth state is not valid");
+      return FALSE;
+    }
+
+  locker    = g_mutex_locker_new (&state_mutex);
+  state     = mapped;
+  shared_fd = fd;
+  return TRUE;
+}
+
+void
+bz_bandwidth_set_interactive_hold (gboolean hold)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  SharedState *shared             = NULL;
+
+  shared = ensure_state ();
+
+  locker = g_mutex_locker_new (&state_mutex);
+  if (!!hold == held)
+    return;
+  held = !!hold;
+
+  __atomic_add_fetch (&shared->interactive_holds, hold ? 1 : -1, __ATOMIC_ACQ_REL);
+}
+
+DexFuture *
+bz_bandwidth_acquire (BzBandwidthClass klass,
+                      gsize            n_bytes)
+{
+  SharedState *shared      = NULL;
+  gint64       now         = 0;
+  gboolean     interactive = FALSE;
+  gboolean     media       = FALSE;
+  guint64      rate        = 0;
+  int          lane        = 0;
+  gint64       cost        = 0;
+  gint64       old_free    = 0;
+  gint64       start       = 0;
+
+  dex_return_error_if_fail (klass < BZ_BANDWIDTH_N_CLASSES);
+
+  shared = ensure_state ();
+  now    = g_get_monotonic_time ();
+
+  if (klass < BZ_BANDWIDTH_CLASS_BACKGROUND)
+    __atomic_store_n (&shared->active_until[klass], now + ACTIVE_LINGER_USEC, __ATOMIC_RELEASE);
+  if (klass == BZ_BANDWIDTH_CLASS_INTERACTIVE)
+    return dex_future_new_true ();
+
+  interactive = __atomic_load_n (&shared->interactive_holds, __ATOMIC_ACQUIRE) > 0 ||
+                now < __atomic_load_n (&shared->active_until[BZ_BANDWIDTH_CLASS_INTERACTIVE], __ATOMIC_ACQUIRE);
+  media       = now < __atomic_load_n (&shared->active_until[BZ_BANDWIDTH_CLASS_VISIBLE_MEDIA], __ATOMIC_ACQUIRE);
+
+  if (klass == BZ_BANDWIDTH_CLASS_VISIBLE_MEDIA)
+    {
+      lane = LANE_MEDIA;
+      rate = interactive ? CONTENDED_MEDIA_RATE : 0;
+    }
+  else
+    {
+      lane = LANE_BACKGROUND;
+      rate = shared->background_cap;
+      if (interactive || media)
+        rate = rate > 0 ? MIN (rate, CONTENDED_BACKGROUND_RATE) : CONTENDED_BACKGROUND_RATE;
+      if (klass == BZ_BANDWIDTH_CLASS_PREFETCH)
+        /* Prefetching pays double, so it gets half of what background
+           refreshes would */
+        n_bytes *= 2;
+    }
+  if (rate == 0)
+    return dex_future_new_true ();
+
+  cost     = (gint64) (n_bytes * G_USEC_PER_SEC / rate);
+  old_free = __atomic_load_n (&shared->next_free[lane], __ATOMIC_ACQUIRE);
+  do
+    start = MAX (old_free, now - MAX_BURST_USEC);
+  while (!__atomic_compare_exchange_n (
+      &shared->next_free[lane], &old_free, start + cost,
+      FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  if (start <= now)
+    return dex_future_new_true ();
+
+  return dex_future_catch (
+      dex_timeout_new_usec (start - now),
+      timeout_catch, NULL, NULL);
+}
+
+static SharedState *
+ensure_state (void)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  int          fd                 = -1;
+  SharedState *mapped             = NULL;
+
+  locker = g_mutex_locker_new (&state_mutex);
+  if (state != NULL)
+    return state;
+
+  fd = memfd_create ("bazaar-bandwidth", MFD_CLOEXEC);
+  if (fd >= 0 && ftruncate (fd, sizeof (*mapped)) == 0)
+    mapped = mmap (NULL, sizeof (*mapped), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (mapped != NULL && mapped != MAP_FAILED)
+    {
+      state     = mapped;
+      shared_fd = fd;
+    }
+  else
+    {
+      g_warning ("Could not share bandwidth state, pacing this process alone: %s",
+                 g_strerror (errno));
+      if (fd >= 0)
+        close (fd);
+      state = &private_state;
+    }
+
+  state->background_cap = bz_get_background_bandwidth_cap ();
+  state->magic          = SHARED_MAGIC;
+  return state;
+}
+
+static DexFuture *
+timeout_catch (DexFuture *future,
+               gpointer   user_data)
+{
+  /* The timeout rejecting is how we know the wait is over */
+  return dex_future_new_true ();
+}
+
+/* End of bz-bandwidth.c */
@@ -0,0 +1,56 @@
+/* bz-bandwidth.h
+ *
+ * Copyright 2025 Adam Masciola
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <libdex.h>
+
+G_BEGIN_DECLS
+
+/* Ordered from most to least important. Interactive traffic is never
+ * paced. Every other class yields when a more important class has been
+ * active recently. */
+typedef enum
+{
+  BZ_BANDWIDTH_CLASS_INTERACTIVE = 0,
+  BZ_BANDWIDTH_CLASS_VISIBLE_MEDIA,
+  BZ_BANDWIDTH_CLASS_BACKGROUND,
+  BZ_BANDWIDTH_CLASS_PREFETCH,
+
+  BZ_BANDWIDTH_N_CLASSES,
+} BzBandwidthClass;
+
+int
+bz_bandwidth_dup_shared_fd (GError **error);
+
+gboolean
+bz_bandwidth_adopt_shared_fd (int      fd,
+                              GError **error);
+
+void
+bz_bandwidth_set_interactive_hold (gboolean hold);
+
+DexFuture *
+bz_bandwidth_acquire (BzBandwidthClass klass,
+                      gsize            n_bytes);
+
+G_END_DECLS
+
+/* End of bz-bandwidth.h */
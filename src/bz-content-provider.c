@@ -30,18 +30,39 @@
 #include "bz-io.h"
 #include "bz-util.h"
 
+/* Parser output is a plain tree of objects, anything deeper
+   than this is not worth comparing and is just replaced */
+#define MAX_RECONCILE_DEPTH 16
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+/* Editors tend to produce a burst of events for a single save, wait
+   for things to settle before reading anything */
+#define RELOAD_DEBOUNCE_MSEC 150
+
+#define IDENTITY_ATTRIBUTES              \
+  G_FILE_ATTRIBUTE_UNIX_DEVICE           \
+  "," G_FILE_ATTRIBUTE_UNIX_INODE        \
+  "," G_FILE_ATTRIBUTE_TIME_MODIFIED     \
+  "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC \
+  "," G_FILE_ATTRIBUTE_STANDARD_SIZE
+
 struct _BzContentProvider
 {
   GObject parent_instance;
 
   GListModel *input_files;
   BzParser   *parser;
+  gboolean    reconcile;
 
   GListStore *input_mirror;
   GHashTable *input_tracking;
 
   GListStore          *outputs;
   GtkFlattenListModel *impl_model;
+
+  GHashTable *pending_reloads;
+  guint       reload_timeout;
 };
 
 static void list_model_iface_init (GListModelInterface *iface);
@@ -59,6 +80,7 @@ enum
   PROP_INPUT_FILES,
   PROP_PARSER,
   PROP_HAS_INPUTS,
+  PROP_RECONCILE,
 
   LAST_PROP
 };
@@ -72,15 +94,34 @@ BZ_DEFINE_DATA (
 static DexFuture *
 input_init_fiber (InputInitData *data);
 
+/* What we last saw on disk for an input, so
+   redundant events don't cause another parse */
+BZ_DEFINE_DATA (
+    input_state,
+    InputState,
+    {
+      GMutex  mutex;
+      gboolean known;
+      guint32 device;
+      guint64 inode;
+      guint64 mtime;
+      goffset size;
+      char   *checksum;
+    },
+    g_mutex_clear (&self->mutex);
+    BZ_RELEASE_DATA (checksum, g_free))
+
 BZ_DEFINE_DATA (
     input_load,
     InputLoad,
     {
-      GFile    *file;
-      BzParser *parser;
+      GFile          *file;
+      BzParser       *parser;
+      InputStateData *state;
     },
     BZ_RELEASE_DATA (file, g_object_unref);
-    BZ_RELEASE_DATA (parser, g_object_unref))
+    BZ_RELEASE_DATA (parser, g_object_unref);
+    BZ_RELEASE_DATA (state, input_state_data_unref))
 static DexFuture *
 input_load_fiber (InputLoadData *data);
 
@@ -88,17 +129,20 @@ BZ_DEFINE_DATA (
     input_tracking,
     InputTracking,
     {
-      GMutex        mutex;
-      GWeakRef      self;
-      char         *path;
-      GFileMonitor *monitor;
-      GListStore   *output;
-      DexFuture    *init;
-      DexFuture    *task;
+      GMutex          mutex;
+      GWeakRef        self;
+      char           *path;
+      GFileMonitor   *monitor;
+      GListStore     *output;
+      InputStateData *state;
+      gboolean        discarded;
+      DexFuture      *init;
+      DexFuture      *task;
     },
     g_mutex_clear (&self->mutex);
     g_weak_ref_clear (&self->self);
     BZ_RELEASE_DATA (path, g_free);
+    BZ_RELEASE_DATA (state, input_state_data_unref);
     BZ_RELEASE_DATA (monitor, g_object_unref);
     BZ_RELEASE_DATA (output, g_object_unref);
     BZ_RELEASE_DATA (init, dex_unref);
@@ -131,9 +175,39 @@ input_file_changed_on_disk (InputTrackingData *data,
                             GFileMonitorEvent  event_type,
                             GFileMonitor      *monitor);
 
+static gboolean
+queue_reload (InputTrackingData *data);
+
+static gboolean
+flush_reloads (BzContentProvider *self);
+
 static gboolean
 commence_reload (InputTrackingData *data);
 
+static void
+forget_state (InputStateData *state);
+
+static guint64
+hash_value (const GValue *value,
+            guint         depth);
+
+static guint64
+hash_object (GObject *object,
+             guint    depth);
+
+static gboolean
+is_reconcilable_value (const GValue *value);
+
+static gboolean
+reconcile_object (GObject *old,
+                  GObject *fresh,
+                  guint    depth);
+
+static void
+reconcile_list (GListStore *old,
+                GListModel *fresh,
+                guint       depth);
+
 static void
 bz_content_provider_dispose (GObject *object)
 {
@@ -145,6 +219,8 @@ bz_content_provider_dispose (GObject *object)
   g_clear_pointer (&self->input_tracking, g_hash_table_unref);
   g_clear_object (&self->outputs);
   g_clear_object (&self->impl_model);
+  g_clear_handle_id (&self->reload_timeout, g_source_remove);
+  g_clear_pointer (&self->pending_reloads, g_hash_table_unref);
 
   G_OBJECT_CLASS (bz_content_provider_parent_class)->dispose (object);
 }
@@ -168,6 +244,9 @@ bz_content_provider_get_property (GObject    *object,
     case PROP_HAS_INPUTS:
       g_value_set_boolean (value, bz_content_provider_get_has_inputs (self));
       break;
+    case PROP_RECONCILE:
+      g_value_set_boolean (value, bz_content_provider_get_reconcile (self));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -189,6 +268,9 @@ bz_content_provider_set_property (GObject      *object,
     case PROP_PARSER:
       bz_content_provider_set_parser (self, g_value_get_object (value));
       break;
+    case PROP_RECONCILE:
+      bz_content_provider_set_reconcile (self, g_value_get_boolean (value));
+      break;
     case PROP_HAS_INPUTS:
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -224,6 +306,12 @@ bz_content_provider_class_init (BzContentProviderClass *klass)
           NULL, NULL, FALSE,
           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
 
+  props[PROP_RECONCILE] =
+      g_param_spec_boolean (
+          "reconcile",
+          NULL, NULL, FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
   g_object_class_install_properties (object_class, LAST_PROP, props);
 }
 
@@ -238,6 +326,10 @@ bz_content_provider_init (BzContentProvider *self)
   self->outputs    = g_list_store_new (G_TYPE_LIST_MODEL);
   self->impl_model = gtk_flatten_list_model_new (g_object_ref (G_LIST_MODEL (self->outputs)));
 
+  self->pending_reloads = g_hash_table_new_full (
+      g_direct_hash, g_direct_equal,
+      input_tracking_data_unref, NULL);
+
   g_signal_connect_swapped (
       self->impl_model,
       "items-changed",
@@ -297,6 +389,8 @@ bz_content_provider_set_input_files (BzContentProvider *self,
     }
   g_clear_object (&self->input_files);
 
+  g_clear_handle_id (&self->reload_timeout, g_source_remove);
+  g_hash_table_remove_all (self->pending_reloads);
   g_hash_table_remove_all (self->input_tracking);
   g_list_store_remove_all (self->input_mirror);
   g_list_store_remove_all (self->outputs);
@@ -349,6 +443,8 @@ bz_content_provider_set_parser (BzContentProvider *self,
               &iter, (gpointer *) &file, (gpointer *) &data))
         break;
 
+      /* Same bytes may parse differently now */
+      forget_state (data->state);
       commence_reload (data);
     }
 
@@ -371,6 +467,26 @@ bz_content_provider_get_has_inputs (BzContentProvider *self)
          g_list_model_get_n_items (G_LIST_MODEL (self)) > 0;
 }
 
+void
+bz_content_provider_set_reconcile (BzContentProvider *self,
+                                   gboolean           reconcile)
+{
+  g_return_if_fail (BZ_IS_CONTENT_PROVIDER (self));
+
+  if (!!reconcile == self->reconcile)
+    return;
+
+  self->reconcile = !!reconcile;
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_RECONCILE]);
+}
+
+gboolean
+bz_content_provider_get_reconcile (BzContentProvider *self)
+{
+  g_return_val_if_fail (BZ_IS_CONTENT_PROVIDER (self), FALSE);
+  return self->reconcile;
+}
+
 static void
 impl_model_changed (BzContentProvider *self,
                     guint              position,
@@ -410,8 +526,10 @@ input_files_changed (BzContentProvider *self,
 
           g_mutex_lock (&data->mutex);
           dex_clear (&data->task);
+          data->discarded = TRUE;
           g_mutex_unlock (&data->mutex);
 
+          g_hash_table_remove (self->pending_reloads, data);
           g_hash_table_remove (self->input_tracking, removal);
         }
     }
@@ -454,6 +572,8 @@ input_files_changed (BzContentProvider *self,
       g_weak_ref_init (&tracking_data->self, self);
       tracking_data->path   = g_file_get_path (additions[i]);
       tracking_data->output = g_steal_pointer (&new_outputs[i]);
+      tracking_data->state  = input_state_data_new ();
+      g_mutex_init (&tracking_data->state->mutex);
 
       g_mutex_lock (&tracking_data->mutex);
       future = dex_future_finally (
@@ -481,12 +601,17 @@ input_file_changed_on_disk (InputTrackingData *data,
                             GFileMonitorEvent  event_type,
                             GFileMonitor      *monitor)
 {
+  /* Editors saving through a rename show up as a move onto our file */
   if (event_type == G_FILE_MONITOR_EVENT_CHANGED ||
+      event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
       event_type == G_FILE_MONITOR_EVENT_CREATED ||
-      event_type == G_FILE_MONITOR_EVENT_DELETED)
+      event_type == G_FILE_MONITOR_EVENT_DELETED ||
+      event_type == G_FILE_MONITOR_EVENT_RENAMED ||
+      event_type == G_FILE_MONITOR_EVENT_MOVED_IN ||
+      event_type == G_FILE_MONITOR_EVENT_MOVED_OUT)
     g_idle_add_full (
         G_PRIORITY_DEFAULT,
-        (GSourceFunc) commence_reload,
+        (GSourceFunc) queue_reload,
         input_tracking_data_ref (data),
         input_tracking_data_unref);
 }
@@ -499,7 +624,7 @@ input_init_fiber (InputInitData *data)
   g_autoptr (GFileMonitor) monitor = NULL;
 
   monitor = g_file_monitor_file (
-      file, G_FILE_MONITOR_NONE, NULL, &local_error);
+      file, G_FILE_MONITOR_WATCH_MOVES, NULL, &local_error);
   if (monitor == NULL)
     return dex_future_new_for_error (g_steal_pointer (&local_error));
 
@@ -545,16 +670,69 @@ input_init_finally (DexFuture         *future,
 static DexFuture *
 input_load_fiber (InputLoadData *data)
 {
-  GFile    *file                       = data->file;
-  BzParser *parser                     = data->parser;
+  GFile          *file                 = data->file;
+  BzParser       *parser               = data->parser;
+  InputStateData *state                = data->state;
   g_autoptr (GError) local_error       = NULL;
+  g_autoptr (GFileInfo) info           = NULL;
+  g_autoptr (GMutexLocker) locker      = NULL;
+  guint32 device                       = 0;
+  guint64 inode                        = 0;
+  guint64 mtime                        = 0;
+  goffset size                         = 0;
   g_autoptr (GBytes) bytes             = NULL;
+  g_autofree char *checksum            = NULL;
   g_autoptr (GHashTable) parse_results = NULL;
   GObject *object                      = NULL;
 
-  bytes = dex_await_boxed (dex_file_load_contents_bytes (file), &local_error);
+  info = g_file_query_info (
+      file, IDENTITY_ATTRIBUTES,
+      G_FILE_QUERY_INFO_NONE,
+      NULL, &local_error);
+  if (info == NULL)
+    {
+      forget_state (state);
+      return dex_future_new_for_error (g_steal_pointer (&local_error));
+    }
+
+  device = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+  inode  = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+  mtime  = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+          g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+  size   = g_file_info_get_size (info);
+
+  /* An atomic rename replaces the inode, so
+     the same one means the same file */
+  locker = g_mutex_locker_new (&state->mutex);
+  if (state->known &&
+      state->device == device &&
+      state->inode == inode &&
+      state->mtime == mtime &&
+      state->size == size)
+    return dex_future_new_false ();
+  g_clear_pointer (&locker, g_mutex_locker_free);
+
+  bytes = g_file_load_bytes (file, NULL, NULL, &local_error);
   if (bytes == NULL)
-    return dex_future_new_for_error (g_steal_pointer (&local_error));
+    {
+      forget_state (state);
+      return dex_future_new_for_error (g_steal_pointer (&local_error));
+    }
+
+  /* Lots of editors touch or rewrite files without changing anything */
+  checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytes);
+
+  locker        = g_mutex_locker_new (&state->mutex);
+  state->known  = TRUE;
+  state->device = device;
+  state->inode  = inode;
+  state->mtime  = mtime;
+  state->size   = size;
+  if (g_strcmp0 (checksum, state->checksum) == 0)
+    return dex_future_new_false ();
+  g_clear_pointer (&state->checksum, g_free);
+  state->checksum = g_strdup (checksum);
+  g_clear_pointer (&locker, g_mutex_locker_free);
 
   parse_results = bz_parser_process_bytes (parser, bytes, &local_error);
   if (parse_results == NULL)
@@ -579,16 +757,39 @@ input_load_finally (DexFuture         *future,
   const GValue *value                = NULL;
 
   locker = g_mutex_locker_new (&data->mutex);
-  g_list_store_remove_all (data->output);
 
   bz_weak_get_or_return_reject (self, &data->self);
 
   value = dex_future_get_value (future, &local_error);
-  if (value != NULL)
-    g_list_store_append (data->output, g_value_get_object (value));
-  else if (local_error->domain != G_IO_ERROR)
-    g_warning ("Could not load object at path %s: %s",
-               data->path, local_error->message);
+  if (value != NULL && G_VALUE_HOLDS_BOOLEAN (value))
+    /* Nothing changed on disk */
+    ;
+  else if (value != NULL)
+    {
+      GObject *object             = NULL;
+      g_autoptr (GObject) current = NULL;
+
+      object = g_value_get_object (value);
+      if (g_list_model_get_n_items (G_LIST_MODEL (data->output)) > 0)
+        current = g_list_model_get_item (G_LIST_MODEL (data->output), 0);
+
+      /* Apply only what changed to the object we already handed out, so
+         views don't have to rebuild everything after every edit */
+      if (current == NULL ||
+          !self->reconcile ||
+          !reconcile_object (current, object, 0))
+        g_list_store_splice (
+            data->output, 0,
+            g_list_model_get_n_items (G_LIST_MODEL (data->output)),
+            (gpointer *) &object, 1);
+    }
+  else
+    {
+      g_list_store_remove_all (data->output);
+      if (local_error->domain != G_IO_ERROR)
+        g_warning ("Could not load object at path %s: %s",
+                   data->path, local_error->message);
+    }
 
   g_object_notify_by_pspec (G_OBJECT (self), props[PROP_HAS_INPUTS]);
   return NULL;
@@ -615,6 +816,7 @@ commence_reload (InputTrackingData *data)
   load_data         = input_load_data_new ();
   load_data->file   = g_file_new_for_path (data->path);
   load_data->parser = g_object_ref (self->parser);
+  load_data->state  = input_state_data_ref (data->state);
 
   future = dex_scheduler_spawn (
       bz_get_io_scheduler (),
@@ -632,3 +834,313 @@ commence_reload (InputTrackingData *data)
 done:
   return G_SOURCE_REMOVE;
 }
+
+static gboolean
+queue_reload (InputTrackingData *data)
+{
+  g_autoptr (BzContentProvider) self = NULL;
+
+  self = g_weak_ref_get (&data->self);
+  if (self == NULL)
+    return G_SOURCE_REMOVE;
+
+  /* The input may have been removed since the event fired */
+  if (data->discarded)
+    return G_SOURCE_REMOVE;
+
+  g_hash_table_add (self->pending_reloads, input_tracking_data_ref (data));
+
+  /* Restart the clock on every event, so a burst
+     across any number of inputs becomes one pass */
+  g_clear_handle_id (&self->reload_timeout, g_source_remove);
+  self->reload_timeout = g_timeout_add (
+      RELOAD_DEBOUNCE_MSEC, (GSourceFunc) flush_reloads, self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+flush_reloads (BzContentProvider *self)
+{
+  GHashTableIter iter = { 0 };
+  gpointer       key  = NULL;
+
+  self->reload_timeout = 0;
+
+  g_hash_table_iter_init (&iter, self->pending_reloads);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    commence_reload (key);
+  g_hash_table_remove_all (self->pending_reloads);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+forget_state (InputStateData *state)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  locker       = g_mutex_locker_new (&state->mutex);
+  state->known = FALSE;
+  g_clear_pointer (&state->checksum, g_free);
+}
+
+static guint64
+mix_hash (guint64       hash,
+          gconstpointer data,
+          gsize         size)
+{
+  const guint8 *bytes = data;
+
+  /* FNV-1a */
+  for (gsize i = 0; i < size; i++)
+    {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ULL;
+    }
+
+  return hash;
+}
+
+static guint64
+hash_value (const GValue *value,
+            guint         depth)
+{
+  g_autofree char *contents = NULL;
+
+  if (G_VALUE_HOLDS_OBJECT (value))
+    return hash_object (g_value_get_object (value), depth);
+  else if (G_VALUE_HOLDS (value, G_TYPE_STRV))
+    {
+      const char *const *strv = g_value_get_boxed (value);
+      guint64            hash = HASH_SEED;
+
+      for (; strv != NULL && *strv != NULL; strv++)
+        /* Including the terminator keeps ["ab"] and ["a", "b"] apart */
+        hash = mix_hash (hash, *strv, strlen (*strv) + 1);
+      return hash;
+    }
+
+  /* Other boxed types are printed as pointers here, see
+     is_reconcilable_value() */
+  contents = g_strdup_value_contents (value);
+  return mix_hash (HASH_SEED, contents, strlen (contents));
+}
+
+static guint64
+hash_object (GObject *object,
+             guint    depth)
+{
+  guint64     hash      = HASH_SEED;
+  const char *type_name = NULL;
+
+  if (object == NULL)
+    return hash;
+  if (depth >= MAX_RECONCILE_DEPTH)
+    return mix_hash (hash, &object, sizeof (object));
+
+  type_name = G_OBJECT_TYPE_NAME (object);
+  hash      = mix_hash (hash, type_name, strlen (type_name));
+
+  if (G_IS_LIST_MODEL (object))
+    {
+      guint n_items = 0;
+
+      n_items = g_list_model_get_n_items (G_LIST_MODEL (object));
+      for (guint i = 0; i < n_items; i++)
+        {
+          g_autoptr (GObject) item = NULL;
+          guint64 item_hash        = 0;
+
+          item      = g_list_model_get_item (G_LIST_MODEL (object), i);
+          item_hash = hash_object (item, depth + 1);
+          hash      = mix_hash (hash, &item_hash, sizeof (item_hash));
+        }
+    }
+  else
+    {
+      g_autofree GParamSpec **pspecs = NULL;
+      guint                   n_pspecs = 0;
+
+      pspecs = g_object_class_list_properties (G_OBJECT_GET_CLASS (object), &n_pspecs);
+      for (guint i = 0; i < n_pspecs; i++)
+        {
+          g_auto (GValue) value = G_VALUE_INIT;
+          guint64 value_hash    = 0;
+
+          if (!(pspecs[i]->flags & G_PARAM_READABLE))
+            continue;
+
+          g_value_init (&value, pspecs[i]->value_type);
+          g_object_get_property (object, pspecs[i]->name, &value);
+
+          value_hash = hash_value (&value, depth + 1);
+          hash       = mix_hash (hash, pspecs[i]->name, strlen (pspecs[i]->name));
+          hash       = mix_hash (hash, &value_hash, sizeof (value_hash));
+        }
+    }
+
+  return hash;
+}
+
+static gboolean
+is_reconcilable_value (const GValue *value)
+{
+  /* Equal contents of any other boxed or pointer value don't hash the
+     same, so they would always look changed. Replace the owner instead */
+  if (G_VALUE_HOLDS_BOXED (value))
+    return G_VALUE_HOLDS (value, G_TYPE_STRV);
+  return !G_VALUE_HOLDS_POINTER (value);
+}
+
+static gboolean
+reconcile_object (GObject *old,
+                  GObject *fresh,
+                  guint    depth)
+{
+  g_autofree GParamSpec **pspecs = NULL;
+  guint                   n_pspecs = 0;
+  g_autoptr (GPtrArray) to_set   = NULL;
+  g_autoptr (GPtrArray) to_diff  = NULL;
+
+  if (G_OBJECT_TYPE (old) != G_OBJECT_TYPE (fresh) ||
+      depth >= MAX_RECONCILE_DEPTH)
+    return FALSE;
+
+  /* Figure out everything first, so the object
+     isn't left half updated if we have to bail */
+  to_set  = g_ptr_array_new ();
+  to_diff = g_ptr_array_new ();
+
+  pspecs = g_object_class_list_properties (G_OBJECT_GET_CLASS (old), &n_pspecs);
+  for (guint i = 0; i < n_pspecs; i++)
+    {
+      GParamSpec *pspec         = pspecs[i];
+      g_auto (GValue) old_value = G_VALUE_INIT;
+      g_auto (GValue) new_value = G_VALUE_INIT;
+
+      if (!(pspec->flags & G_PARAM_READABLE))
+        continue;
+
+      g_value_init (&old_value, pspec->value_type);
+      g_value_init (&new_value, pspec->value_type);
+      g_object_get_property (old, pspec->name, &old_value);
+      g_object_get_property (fresh, pspec->name, &new_value);
+
+      if (hash_value (&old_value, depth + 1) == hash_value (&new_value, depth + 1))
+        continue;
+
+      if (!is_reconcilable_value (&old_value))
+        return FALSE;
+      else if (G_VALUE_HOLDS_OBJECT (&old_value) &&
+          G_IS_LIST_STORE (g_value_get_object (&old_value)) &&
+          G_VALUE_HOLDS_OBJECT (&new_value) &&
+          G_IS_LIST_MODEL (g_value_get_object (&new_value)))
+        g_ptr_array_add (to_diff, pspec);
+      else if ((pspec->flags & G_PARAM_WRITABLE) &&
+               !(pspec->flags & G_PARAM_CONSTRUCT_ONLY))
+        g_ptr_array_add (to_set, pspec);
+      else
+        return FALSE;
+    }
+
+  for (guint i = 0; i < to_diff->len; i++)
+    {
+      GParamSpec *pspec           = g_ptr_array_index (to_diff, i);
+      g_autoptr (GListStore) list = NULL;
+      g_autoptr (GListModel) with = NULL;
+
+      g_object_get (old, pspec->name, &list, NULL);
+      g_object_get (fresh, pspec->name, &with, NULL);
+      reconcile_list (list, with, depth + 1);
+    }
+
+  for (guint i = 0; i < to_set->len; i++)
+    {
+      GParamSpec *pspec     = g_ptr_array_index (to_set, i);
+      g_auto (GValue) value = G_VALUE_INIT;
+
+      g_value_init (&value, pspec->value_type);
+      g_object_get_property (fresh, pspec->name, &value);
+      g_object_set_property (old, pspec->name, &value);
+    }
+
+  return TRUE;
+}
+
+static void
+reconcile_list (GListStore *old,
+                GListModel *fresh,
+                guint       depth)
+{
+  guint old_length              = 0;
+  guint new_length              = 0;
+  g_autofree guint64 *old_hashes = NULL;
+  g_autofree guint64 *new_hashes = NULL;
+  guint prefix                  = 0;
+  guint suffix                  = 0;
+  guint old_middle              = 0;
+  guint new_middle              = 0;
+
+  old_length = g_list_model_get_n_items (G_LIST_MODEL (old));
+  new_length = g_list_model_get_n_items (fresh);
+  old_hashes = g_new0 (guint64, old_length);
+  new_hashes = g_new0 (guint64, new_length);
+
+  for (guint i = 0; i < old_length; i++)
+    {
+      g_autoptr (GObject) item = NULL;
+
+      item          = g_list_model_get_item (G_LIST_MODEL (old), i);
+      old_hashes[i] = hash_object (item, depth);
+    }
+  for (guint i = 0; i < new_length; i++)
+    {
+      g_autoptr (GObject) item = NULL;
+
+      item          = g_list_model_get_item (fresh, i);
+      new_hashes[i] = hash_object (item, depth);
+    }
+
+  /* Edits to a config are almost always confined to a single spot,
+     so trimming what's equal at both ends leaves very little */
+  while (prefix < old_length &&
+         prefix < new_length &&
+         old_hashes[prefix] == new_hashes[prefix])
+    prefix++;
+  while (suffix < old_length - prefix &&
+         suffix < new_length - prefix &&
+         old_hashes[old_length - suffix - 1] == new_hashes[new_length - suffix - 1])
+    suffix++;
+
+  old_middle = old_length - prefix - suffix;
+  new_middle = new_length - prefix - suffix;
+
+  if (old_middle == new_middle)
+    {
+      /* Same shape, so update the existing items in place if possible */
+      for (guint i = prefix; i < prefix + old_middle; i++)
+        {
+          g_autoptr (GObject) old_item = NULL;
+          g_autoptr (GObject) new_item = NULL;
+
+          old_item = g_list_model_get_item (G_LIST_MODEL (old), i);
+          new_item = g_list_model_get_item (fresh, i);
+
+          if (!reconcile_object (old_item, new_item, depth + 1))
+            g_list_store_splice (old, i, 1, (gpointer *) &new_item, 1);
+        }
+    }
+  else
+    {
+      g_autoptr (GPtrArray) additions = NULL;
+
+      additions = g_ptr_array_new_with_free_func (g_object_unref);
+      for (guint i = prefix; i < prefix + new_middle; i++)
+        g_ptr_array_add (additions, g_list_model_get_item (fresh, i));
+
+      g_list_store_splice (
+          old, prefix, old_middle,
+          additions->pdata, additions->len);
+    }
+}
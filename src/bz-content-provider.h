@@ -49,4 +49,14 @@ bz_content_provider_get_parser (BzContentProvider *self);
 gboolean
 bz_content_provider_get_has_inputs (BzContentProvider *self);
 
+/* When set, a reloaded input is diffed against the object already in the
+   model and only the changed properties and list items are updated, so
+   items-changed is not emitted for edits inside an input */
+void
+bz_content_provider_set_reconcile (BzContentProvider *self,
+                                   gboolean           reconcile);
+
+gboolean
+bz_content_provider_get_reconcile (BzContentProvider *self);
+
 G_END_DECLS
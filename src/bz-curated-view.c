@@ -36,6 +36,8 @@ struct _BzCuratedView
 
   BzContentProvider *curated_provider;
   GPtrArray         *css_providers;
+  /* The config each of css_providers was loaded from */
+  GPtrArray         *css_configs;
 
   /* Template widgets */
   AdwViewStack *stack;
@@ -69,6 +71,11 @@ items_changed (BzCuratedView *self,
                guint          added,
                GListModel    *model);
 
+static void
+config_css_changed (BzCuratedView       *self,
+                    GParamSpec          *pspec,
+                    BzRootCuratedConfig *config);
+
 static void
 online_changed (BzCuratedView *self,
                 GParamSpec    *pspec,
@@ -91,11 +98,18 @@ bz_curated_view_dispose (GObject *object)
   if (self->curated_provider != NULL)
     g_signal_handlers_disconnect_by_func (
         self->curated_provider, items_changed, self);
+  if (self->css_configs != NULL)
+    {
+      for (guint i = 0; i < self->css_configs->len; i++)
+        g_signal_handlers_disconnect_by_data (
+            g_ptr_array_index (self->css_configs, i), self);
+    }
 
   g_clear_object (&self->state);
 
   g_clear_object (&self->curated_provider);
   g_clear_pointer (&self->css_providers, g_ptr_array_unref);
+  g_clear_pointer (&self->css_configs, g_ptr_array_unref);
 
   G_OBJECT_CLASS (bz_curated_view_parent_class)->dispose (object);
 }
@@ -202,6 +216,7 @@ static void
 bz_curated_view_init (BzCuratedView *self)
 {
   self->css_providers = g_ptr_array_new_with_free_func (release_css_provider);
+  self->css_configs   = g_ptr_array_new_with_free_func (g_object_unref);
   gtk_widget_init_template (GTK_WIDGET (self));
 }
 
@@ -282,7 +297,13 @@ items_changed (BzCuratedView *self,
                GListModel    *model)
 {
   if (removed > 0)
-    g_ptr_array_remove_range (self->css_providers, position, removed);
+    {
+      for (guint i = 0; i < removed; i++)
+        g_signal_handlers_disconnect_by_data (
+            g_ptr_array_index (self->css_configs, position + i), self);
+      g_ptr_array_remove_range (self->css_providers, position, removed);
+      g_ptr_array_remove_range (self->css_configs, position, removed);
+    }
 
   for (guint i = 0; i < added; i++)
     {
@@ -304,11 +325,37 @@ items_changed (BzCuratedView *self,
       g_ptr_array_insert (self->css_providers,
                           position + i,
                           g_steal_pointer (&provider));
+      g_ptr_array_insert (self->css_configs,
+                          position + i,
+                          g_object_ref (config));
+
+      /* Reloads update configs in place, see BzContentProvider */
+      g_signal_connect_object (
+          config, "notify::css",
+          G_CALLBACK (config_css_changed),
+          self, G_CONNECT_SWAPPED);
     }
 
   set_page (self);
 }
 
+static void
+config_css_changed (BzCuratedView       *self,
+                    GParamSpec          *pspec,
+                    BzRootCuratedConfig *config)
+{
+  guint           idx      = 0;
+  const char     *css      = NULL;
+  GtkCssProvider *provider = NULL;
+
+  if (!g_ptr_array_find (self->css_configs, config, &idx))
+    return;
+
+  css      = bz_root_curated_config_get_css (config);
+  provider = g_ptr_array_index (self->css_providers, idx);
+  gtk_css_provider_load_from_string (provider, css != NULL ? css : "");
+}
+
 static void
 online_changed (BzCuratedView *self,
                 GParamSpec    *pspec,
@@ -43,6 +43,14 @@ struct _BzDataGraph
   double      transition_progress;
   double      rounded_axis_max;
 
+  /* Packed copy of the model so drawing never
+     has to touch the point objects */
+  GArray *independents;
+  GArray *dependents;
+  double  min_independent;
+  double  max_independent;
+  double  max_dependent;
+
   GskPath        *path;
   GskPathMeasure *path_measure;
   GskRenderNode  *fg;
@@ -80,11 +88,30 @@ items_changed (GListModel  *model,
                guint        added,
                BzDataGraph *self);
 
+static void
+refresh_series (BzDataGraph *self);
+
 static void
 refresh_path (BzDataGraph *self,
               double       width,
               double       height);
 
+static void
+append_decimated (BzDataGraph    *self,
+                  GskPathBuilder *builder,
+                  double          width,
+                  double          height,
+                  double          rounded_axis_max);
+
+static void
+append_point (BzDataGraph    *self,
+              GskPathBuilder *builder,
+              guint           idx,
+              double          width,
+              double          height,
+              double          rounded_axis_max,
+              gboolean       *started);
+
 static double
 calculate_axis_tick_value (double value, gboolean round_up);
 
@@ -101,6 +128,8 @@ bz_data_graph_dispose (GObject *object)
   g_clear_pointer (&self->independent_axis_label, g_free);
   g_clear_pointer (&self->dependent_axis_label, g_free);
   g_clear_pointer (&self->tooltip_prefix, g_free);
+  g_clear_pointer (&self->independents, g_array_unref);
+  g_clear_pointer (&self->dependents, g_array_unref);
   g_clear_pointer (&self->path, gsk_path_unref);
   g_clear_pointer (&self->path_measure, gsk_path_measure_unref);
   g_clear_pointer (&self->fg, gsk_render_node_unref);
@@ -267,6 +296,7 @@ bz_data_graph_snapshot (GtkWidget   *widget,
     {
       guint n_items                          = 0;
       guint hovered_idx                      = 0;
+      double hovered_dependent               = 0.0;
       g_autoptr (BzDataPoint) point          = NULL;
       g_autoptr (GskStroke) crosshair_stroke = NULL;
       g_autoptr (PangoLayout) layout1        = NULL;
@@ -292,36 +322,27 @@ bz_data_graph_snapshot (GtkWidget   *widget,
       double           rounded_axis_max      = 0.0;
       const char      *prefix                = NULL;
 
-      n_items     = g_list_model_get_n_items (self->model);
+      n_items     = self->dependents->len;
       graph_width = widget_width - LABEL_MARGIN - LABEL_MARGIN_RIGHT;
       fraction    = (self->motion_x - LABEL_MARGIN) / graph_width;
       hovered_idx = floor ((double) n_items * fraction);
       if (hovered_idx >= n_items)
         hovered_idx = n_items - 1;
 
-      point = g_list_model_get_item (self->model, hovered_idx);
+      /* Only the hovered point is fetched, for its label; the
+         value always comes from the series, never the decimated path */
+      point             = g_list_model_get_item (self->model, hovered_idx);
+      hovered_dependent = g_array_index (self->dependents, double, hovered_idx);
 
       if (self->rounded_axis_max > 0.0)
-        {
-          rounded_axis_max = self->rounded_axis_max;
-        }
+        rounded_axis_max = self->rounded_axis_max;
       else
-        {
-          double max_dependent = 0.0;
-          for (guint i = 0; i < n_items; i++)
-            {
-              g_autoptr (BzDataPoint) p = g_list_model_get_item (self->model, i);
-              double dep                = bz_data_point_get_dependent (p);
-              if (i == 0 || dep > max_dependent)
-                max_dependent = dep;
-            }
-          rounded_axis_max = calculate_axis_tick_value (max_dependent, TRUE);
-        }
+        rounded_axis_max = calculate_axis_tick_value (self->max_dependent, TRUE);
 
       graph_height = widget_height - LABEL_MARGIN;
 
       point_x = ((double) hovered_idx / (double) (n_items - 1)) * graph_width + LABEL_MARGIN;
-      point_y = (1.0 - bz_data_point_get_dependent (point) / rounded_axis_max) * graph_height;
+      point_y = (1.0 - hovered_dependent / rounded_axis_max) * graph_height;
 
       line_color       = widget_color;
       line_color.alpha = 0.5;
@@ -362,7 +383,7 @@ bz_data_graph_snapshot (GtkWidget   *widget,
 
       prefix     = self->tooltip_prefix != NULL ? self->tooltip_prefix : ("");
       layout2    = pango_layout_new (gtk_widget_get_pango_context (widget));
-      line2_text = g_strdup_printf ("%s %'.0f", prefix, bz_data_point_get_dependent (point));
+      line2_text = g_strdup_printf ("%s %'.0f", prefix, hovered_dependent);
       pango_layout_set_text (layout2, line2_text, -1);
       pango_layout_get_pixel_extents (layout2, NULL, &text2_extents);
 
@@ -602,6 +623,8 @@ bz_data_graph_init (BzDataGraph *self)
   self->motion_x         = -1.0;
   self->motion_y         = -1.0;
   self->rounded_axis_max = 0.0;
+  self->independents     = g_array_new (FALSE, FALSE, sizeof (double));
+  self->dependents       = g_array_new (FALSE, FALSE, sizeof (double));
 }
 
 GtkWidget *
@@ -672,7 +695,11 @@ bz_data_graph_set_model (BzDataGraph *self,
   g_clear_object (&self->model);
 
   if (model != NULL)
-    self->model = g_object_ref (model);
+    {
+      self->model = g_object_ref (model);
+      g_signal_connect (model, "items-changed", G_CALLBACK (items_changed), self);
+    }
+  refresh_series (self);
 
   gtk_widget_queue_allocate (GTK_WIDGET (self));
   g_object_notify_by_pspec (G_OBJECT (self), props[PROP_MODEL]);
@@ -772,6 +799,7 @@ items_changed (GListModel  *model,
                guint        added,
                BzDataGraph *self)
 {
+  refresh_series (self);
   gtk_widget_queue_allocate (GTK_WIDGET (self));
 }
 
@@ -808,6 +836,52 @@ calculate_axis_tick_value (double value, gboolean round_up)
   return rounded_axis_fraction * pow (10, exponent);
 }
 
+static void
+refresh_series (BzDataGraph *self)
+{
+  guint n_items = 0;
+
+  g_array_set_size (self->independents, 0);
+  g_array_set_size (self->dependents, 0);
+  self->min_independent = 0.0;
+  self->max_independent = 0.0;
+  self->max_dependent   = 0.0;
+
+  if (self->model == NULL)
+    return;
+
+  n_items = g_list_model_get_n_items (self->model);
+  g_array_set_size (self->independents, n_items);
+  g_array_set_size (self->dependents, n_items);
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr (BzDataPoint) point = NULL;
+      double independent            = 0.0;
+      double dependent              = 0.0;
+
+      point       = g_list_model_get_item (self->model, i);
+      independent = bz_data_point_get_independent (point);
+      dependent   = bz_data_point_get_dependent (point);
+
+      g_array_index (self->independents, double, i) = independent;
+      g_array_index (self->dependents, double, i)   = dependent;
+
+      if (i == 0)
+        {
+          self->min_independent = independent;
+          self->max_independent = independent;
+          self->max_dependent   = dependent;
+        }
+      else
+        {
+          self->min_independent = MIN (independent, self->min_independent);
+          self->max_independent = MAX (independent, self->max_independent);
+          self->max_dependent   = MAX (dependent, self->max_dependent);
+        }
+    }
+}
+
 static void
 refresh_path (BzDataGraph *self,
               double       width,
@@ -817,6 +891,7 @@ refresh_path (BzDataGraph *self,
   double            min_independent        = 0.0;
   double            max_independent        = 0.0;
   double            max_dependent          = 0.0;
+  guint             n_columns              = 0;
   PangoContext     *pango                  = NULL;
   PangoFontMetrics *metrics                = NULL;
   double            font_height            = 0.0;
@@ -839,33 +914,13 @@ refresh_path (BzDataGraph *self,
   if (width < LABEL_MARGIN || height < LABEL_MARGIN)
     return;
 
-  n_items = g_list_model_get_n_items (self->model);
+  n_items = self->dependents->len;
   if (n_items <= 1)
     return;
 
-  for (guint i = 0; i < n_items; i++)
-    {
-      g_autoptr (BzDataPoint) point = NULL;
-      double independent            = 0.0;
-      double dependent              = 0.0;
-
-      point       = g_list_model_get_item (self->model, i);
-      independent = bz_data_point_get_independent (point);
-      dependent   = bz_data_point_get_dependent (point);
-
-      if (i == 0)
-        {
-          min_independent = independent;
-          max_independent = independent;
-          max_dependent   = dependent;
-        }
-      else
-        {
-          min_independent = MIN (independent, min_independent);
-          max_independent = MAX (independent, max_independent);
-          max_dependent   = MAX (dependent, max_dependent);
-        }
-    }
+  min_independent = self->min_independent;
+  max_independent = self->max_independent;
+  max_dependent   = self->max_dependent;
 
   rounded_axis_max = calculate_axis_tick_value (max_dependent, TRUE);
 
@@ -891,72 +946,80 @@ refresh_path (BzDataGraph *self,
   snapshot      = gtk_snapshot_new ();
   grid_builder  = gsk_path_builder_new ();
 
-  for (guint i = 0; i < n_items; i++)
+  /* Past a couple of points per pixel column the line is just noise, so
+     only the extremes of each column are drawn */
+  n_columns = MAX (1, (guint) ceil (width));
+  if (n_items > n_columns * 2)
+    append_decimated (self, curve_builder, width, height, rounded_axis_max);
+  else
     {
-      g_autoptr (BzDataPoint) point = NULL;
-      double independent            = 0.0;
-      double dependent              = 0.0;
-      double x                      = 0.0;
-      double y                      = 0.0;
-
-      point       = g_list_model_get_item (self->model, i);
-      independent = bz_data_point_get_independent (point);
-      dependent   = bz_data_point_get_dependent (point);
+      for (guint i = 0; i < n_items; i++)
+        {
+          double x = 0.0;
+          double y = 0.0;
 
-      x = (independent - min_independent) / (max_independent - min_independent) * width;
-      y = (1.0 - dependent / rounded_axis_max) * height;
+          x = (g_array_index (self->independents, double, i) - min_independent) / (max_independent - min_independent) * width;
+          y = (1.0 - g_array_index (self->dependents, double, i) / rounded_axis_max) * height;
 
-      if (i == 0)
-        gsk_path_builder_move_to (curve_builder, x, y);
-      else
-        gsk_path_builder_line_to (curve_builder, x, y);
+          if (i == 0)
+            gsk_path_builder_move_to (curve_builder, x, y);
+          else
+            gsk_path_builder_line_to (curve_builder, x, y);
+        }
+    }
 
-      if (i % independent_label_step == 0)
+  for (guint i = 0; i < n_items; i += independent_label_step)
+    {
+      g_autoptr (BzDataPoint) point  = NULL;
+      g_autoptr (PangoLayout) layout = NULL;
+      const char    *label           = NULL;
+      char           buf[32]         = { 0 };
+      PangoRectangle extents         = { 0 };
+      double         independent     = 0.0;
+      double         x               = 0.0;
+
+      independent = g_array_index (self->independents, double, i);
+      x           = (independent - min_independent) / (max_independent - min_independent) * width;
+
+      point = g_list_model_get_item (self->model, i);
+      label = bz_data_point_get_label (point);
+      if (label == NULL)
         {
-          const char *label              = NULL;
-          char        buf[32]            = { 0 };
-          g_autoptr (PangoLayout) layout = NULL;
-          PangoRectangle extents;
-
-          label = bz_data_point_get_label (point);
-          if (label == NULL)
+          switch (self->independent_decimals)
             {
-              switch (self->independent_decimals)
-                {
-                case 0:
-                  g_snprintf (buf, sizeof (buf), "%d", (int) round (independent));
-                  break;
-                case 1:
-                  g_snprintf (buf, sizeof (buf), "%.1f", independent);
-                  break;
-                case 2:
-                  g_snprintf (buf, sizeof (buf), "%.2f", independent);
-                  break;
-                case 3:
-                  g_snprintf (buf, sizeof (buf), "%.3f", independent);
-                  break;
-                default:
-                  g_snprintf (buf, sizeof (buf), "%f", independent);
-                  break;
-                }
-              label = buf;
+            case 0:
+              g_snprintf (buf, sizeof (buf), "%d", (int) round (independent));
+              break;
+            case 1:
+              g_snprintf (buf, sizeof (buf), "%.1f", independent);
+              break;
+            case 2:
+              g_snprintf (buf, sizeof (buf), "%.2f", independent);
+              break;
+            case 3:
+              g_snprintf (buf, sizeof (buf), "%.3f", independent);
+              break;
+            default:
+              g_snprintf (buf, sizeof (buf), "%f", independent);
+              break;
             }
+          label = buf;
+        }
 
-          layout = pango_layout_new (pango);
-          pango_layout_set_text (layout, label, -1);
+      layout = pango_layout_new (pango);
+      pango_layout_set_text (layout, label, -1);
 
-          pango_layout_get_pixel_extents (layout, NULL, &extents);
+      pango_layout_get_pixel_extents (layout, NULL, &extents);
 
-          gtk_snapshot_save (snapshot);
-          gtk_snapshot_translate (snapshot, &GRAPHENE_POINT_INIT (x, height + LABEL_MARGIN / 10.0));
-          gtk_snapshot_rotate (snapshot, -LABEL_MARGIN_RIGHT);
-          gtk_snapshot_translate (snapshot, &GRAPHENE_POINT_INIT (-extents.width, 0));
-          gtk_snapshot_append_layout (snapshot, layout, &(GdkRGBA) { 1.0, 1.0, 1.0, 1.0 });
-          gtk_snapshot_restore (snapshot);
+      gtk_snapshot_save (snapshot);
+      gtk_snapshot_translate (snapshot, &GRAPHENE_POINT_INIT (x, height + LABEL_MARGIN / 10.0));
+      gtk_snapshot_rotate (snapshot, -LABEL_MARGIN_RIGHT);
+      gtk_snapshot_translate (snapshot, &GRAPHENE_POINT_INIT (-extents.width, 0));
+      gtk_snapshot_append_layout (snapshot, layout, &(GdkRGBA) { 1.0, 1.0, 1.0, 1.0 });
+      gtk_snapshot_restore (snapshot);
 
-          gsk_path_builder_move_to (grid_builder, x, 0.0);
-          gsk_path_builder_line_to (grid_builder, x, height);
-        }
+      gsk_path_builder_move_to (grid_builder, x, 0.0);
+      gsk_path_builder_line_to (grid_builder, x, height);
     }
   gsk_path_builder_move_to (grid_builder, width, 0);
   gsk_path_builder_line_to (grid_builder, width, height);
@@ -1013,3 +1076,88 @@ refresh_path (BzDataGraph *self,
   self->path_measure = gsk_path_measure_new (self->path);
   self->fg           = gtk_snapshot_to_node (snapshot);
 }
+
+static void
+append_decimated (BzDataGraph    *self,
+                  GskPathBuilder *builder,
+                  double          width,
+                  double          height,
+                  double          rounded_axis_max)
+{
+  guint    n_items          = 0;
+  guint    n_columns        = 0;
+  double  *independents     = NULL;
+  double  *dependents       = NULL;
+  double   independent_span = 0.0;
+  gboolean started          = FALSE;
+  guint    column           = 0;
+  guint    min_idx          = 0;
+  guint    max_idx          = 0;
+
+  n_items          = self->dependents->len;
+  n_columns        = MAX (1, (guint) ceil (width));
+  independents     = (double *) self->independents->data;
+  dependents       = (double *) self->dependents->data;
+  independent_span = self->max_independent - self->min_independent;
+
+  /* Always start with the very first point of the series */
+  append_point (self, builder, 0, width, height, rounded_axis_max, &started);
+
+  /* Points are grouped by the pixel column they land in, so
+     unevenly spaced series are decimated where they are dense */
+  for (guint i = 1; i <= n_items; i++)
+    {
+      if (i < n_items)
+        {
+          double x            = 0.0;
+          guint  point_column = 0;
+
+          x            = (independents[i] - self->min_independent) / independent_span * width;
+          point_column = MIN ((guint) MAX (x, 0.0), n_columns - 1);
+          if (point_column == column)
+            {
+              if (dependents[i] < dependents[min_idx])
+                min_idx = i;
+              if (dependents[i] > dependents[max_idx])
+                max_idx = i;
+              continue;
+            }
+          column = point_column;
+        }
+
+      /* Only the extremes of the finished column are drawn, in
+         their original order so the line doesn't double back */
+      append_point (self, builder, MIN (min_idx, max_idx), width, height, rounded_axis_max, &started);
+      if (min_idx != max_idx)
+        append_point (self, builder, MAX (min_idx, max_idx), width, height, rounded_axis_max, &started);
+
+      min_idx = i;
+      max_idx = i;
+    }
+
+  /* And end on the last one */
+  append_point (self, builder, n_items - 1, width, height, rounded_axis_max, &started);
+}
+
+static void
+append_point (BzDataGraph    *self,
+              GskPathBuilder *builder,
+              guint           idx,
+              double          width,
+              double          height,
+              double          rounded_axis_max,
+              gboolean       *started)
+{
+  double x = 0.0;
+  double y = 0.0;
+
+  x = (g_array_index (self->independents, double, idx) - self->min_independent) /
+      (self->max_independent - self->min_independent) * width;
+  y = (1.0 - g_array_index (self->dependents, double, idx) / rounded_axis_max) * height;
+
+  if (*started)
+    gsk_path_builder_line_to (builder, x, y);
+  else
+    gsk_path_builder_move_to (builder, x, y);
+  *started = TRUE;
+}
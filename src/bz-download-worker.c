@@ -20,6 +20,14 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gunixfdmessage.h>
+#include <glib/gstdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bz-bandwidth.h"
 #include "bz-download-worker.h"
 #include "bz-env.h"
 #include "bz-util.h"
@@ -30,13 +38,12 @@ struct _BzDownloadWorker
 
   char *name;
 
-  GSubprocess *subprocess;
-  GHashTable  *waiting;
-  GMutex       read_mutex;
-  DexFuture   *task;
-
-  BzGuard *write_gate;
-  GMutex   write_mutex;
+  GSubprocess       *subprocess;
+  GSocketConnection *connection;
+  GHashTable        *waiting;
+  guint64            next_id;
+  GMutex             read_mutex;
+  DexFuture         *task;
 };
 
 static void
@@ -61,6 +68,18 @@ static GParamSpec *props[LAST_PROP] = { 0 };
 static DexFuture *
 monitor_worker_fiber (GWeakRef *wr);
 
+BZ_DEFINE_DATA (
+    pending,
+    Pending,
+    {
+      DexPromise *promise;
+      char       *tmp_path;
+      char       *dest_path;
+    },
+    BZ_RELEASE_DATA (promise, dex_unref);
+    BZ_RELEASE_DATA (tmp_path, g_free);
+    BZ_RELEASE_DATA (dest_path, g_free));
+
 BZ_DEFINE_DATA (
     invoke_worker,
     InvokeWorker,
@@ -81,15 +100,8 @@ static void
 terminate (BzDownloadWorker *self);
 
 static void
-plumb_data_input_stream_read_line_async (GDataInputStream   *stream,
-                                         GCancellable       *cancellable,
-                                         GAsyncReadyCallback callback,
-                                         gpointer            user_data);
-
-static char *
-plumb_data_input_stream_read_line_finish (GDataInputStream *stream,
-                                          GAsyncResult     *result,
-                                          gpointer          user_data);
+finish_pending (PendingData *pending,
+                gboolean     success);
 
 static void
 bz_download_worker_dispose (GObject *object)
@@ -99,11 +111,9 @@ bz_download_worker_dispose (GObject *object)
   terminate (self);
 
   dex_clear (&self->task);
+  g_clear_object (&self->connection);
   g_clear_object (&self->subprocess);
 
-  g_mutex_clear (&self->write_mutex);
-  bz_clear_guard (&self->write_gate);
-
   g_mutex_clear (&self->read_mutex);
   g_clear_pointer (&self->waiting, g_hash_table_unref);
   g_clear_pointer (&self->name, g_free);
@@ -169,10 +179,9 @@ static void
 bz_download_worker_init (BzDownloadWorker *self)
 {
   g_mutex_init (&self->read_mutex);
-  g_mutex_init (&self->write_mutex);
 
   self->waiting = g_hash_table_new_full (
-      g_str_hash, g_str_equal, g_free, dex_unref);
+      g_int64_hash, g_int64_equal, g_free, pending_data_unref);
 }
 
 static gboolean
@@ -180,15 +189,53 @@ bz_download_worker_initable_init (GInitable    *initable,
                                   GCancellable *cancellable,
                                   GError      **error)
 {
-  BzDownloadWorker *self = BZ_DOWNLOAD_WORKER (initable);
+  BzDownloadWorker *self                   = BZ_DOWNLOAD_WORKER (initable);
+  int               fds[2]                 = { -1, -1 };
+  g_autoptr (GSubprocessLauncher) launcher = NULL;
+  g_autoptr (GError) local_error           = NULL;
+  int bandwidth_fd                         = -1;
+  g_autoptr (GSocket) socket               = NULL;
+
+  /* Packets keep their boundaries, so each one is exactly one message */
+  if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (
+          error,
+          G_IO_ERROR,
+          g_io_error_from_errno (errsv),
+          "Could not create a socket pair for the download worker: %s",
+          g_strerror (errsv));
+      return FALSE;
+    }
+
+  launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_NONE);
+  g_subprocess_launcher_take_fd (launcher, fds[1], BZ_DOWNLOAD_WORKER_SOCKET_FD);
 
-  self->subprocess = g_subprocess_new (
-      G_SUBPROCESS_FLAGS_STDIN_PIPE |
-          G_SUBPROCESS_FLAGS_STDOUT_PIPE,
-      error,
+  bandwidth_fd = bz_bandwidth_dup_shared_fd (&local_error);
+  if (bandwidth_fd >= 0)
+    g_subprocess_launcher_take_fd (launcher, bandwidth_fd, BZ_DOWNLOAD_WORKER_BANDWIDTH_FD);
+  else
+    g_warning ("Download worker will pace its traffic alone: %s", local_error->message);
+
+  self->subprocess = g_subprocess_launcher_spawn (
+      launcher, error,
       DL_WORKER_BIN_NAME, NULL);
   if (self->subprocess == NULL)
-    return FALSE;
+    {
+      close (fds[0]);
+      return FALSE;
+    }
+
+  socket = g_socket_new_from_fd (fds[0], error);
+  if (socket == NULL)
+    {
+      close (fds[0]);
+      g_subprocess_force_exit (self->subprocess);
+      return FALSE;
+    }
+  self->connection = g_socket_connection_factory_create_connection (socket);
 
   self->task = dex_scheduler_spawn (
       dex_scheduler_get_default (),
@@ -256,8 +303,9 @@ bz_download_worker_invoke (BzDownloadWorker *self,
   data->src     = g_object_ref (src);
   data->dest    = g_object_ref (dest);
 
+  /* Opening the destination and sending are blocking calls */
   dex_future_disown (dex_scheduler_spawn (
-      dex_scheduler_get_default (),
+      dex_thread_pool_scheduler_get_default (),
       bz_get_dex_stack_size (),
       (DexFiberFunc) invoke_worker_fiber,
       invoke_worker_data_ref (data),
@@ -330,88 +378,56 @@ bz_download_worker_get_default (void)
 static DexFuture *
 monitor_worker_fiber (GWeakRef *wr)
 {
-  g_autoptr (BzDownloadWorker) self              = NULL;
-  g_autoptr (GInputStream) input_stream          = NULL;
-  g_autoptr (GDataInputStream) subprocess_stdout = NULL;
+  g_autoptr (BzDownloadWorker) self     = NULL;
+  g_autoptr (GInputStream) input_stream = NULL;
+  g_autofree guint8 *buffer             = NULL;
 
   bz_weak_get_or_return_reject (self, wr);
-  input_stream      = g_object_ref (g_subprocess_get_stdout_pipe (self->subprocess));
-  subprocess_stdout = g_data_input_stream_new (g_object_ref (input_stream));
+  input_stream = g_object_ref (g_io_stream_get_input_stream (G_IO_STREAM (self->connection)));
   g_clear_object (&self);
 
+  buffer = g_malloc (BZ_DOWNLOAD_WORKER_MAX_PACKET);
   for (;;)
     {
-      g_autoptr (GError) local_error = NULL;
-      g_autofree char *line          = NULL;
-
-      line = dex_await_string (
-          dex_async_pair_new (
-              subprocess_stdout,
-              &DEX_ASYNC_PAIR_INFO_STRING (
-                  plumb_data_input_stream_read_line_async,
-                  plumb_data_input_stream_read_line_finish)),
+      g_autoptr (GError) local_error  = NULL;
+      gint64 bytes_read               = 0;
+      g_autoptr (GVariant) variant    = NULL;
+      guint64  id                     = 0;
+      gboolean success                = FALSE;
+      gpointer key                    = NULL;
+      g_autoptr (PendingData) pending = NULL;
+
+      /* One read returns one packet */
+      bytes_read = dex_await_int64 (
+          dex_input_stream_read (
+              input_stream,
+              buffer,
+              BZ_DOWNLOAD_WORKER_MAX_PACKET,
+              G_PRIORITY_DEFAULT_IDLE),
           &local_error);
-      if (line == NULL)
+      if (bytes_read <= 0)
         {
-          if (local_error != NULL)
-            g_warning ("Could not read stdout from download worker subprocess: %s",
+          if (bytes_read < 0)
+            g_warning ("Could not read from download worker subprocess: %s",
                        local_error->message);
           goto err;
         }
 
-      do
-        {
-          g_autoptr (GVariant) variant = NULL;
-          g_autofree char *dest_path   = NULL;
-          gboolean         success     = FALSE;
-          DexPromise      *promise     = NULL;
-
-          if (line == NULL)
-            {
-              line = g_data_input_stream_read_line_utf8 (subprocess_stdout, NULL, NULL, &local_error);
-              if (line == NULL)
-                {
-                  if (local_error != NULL)
-                    g_warning ("Could not read stdout from download worker subprocess: %s",
-                               local_error->message);
-                  goto err;
-                }
-            }
-
-          variant = g_variant_parse (G_VARIANT_TYPE ("(sb)"),
-                                     line, NULL, NULL, &local_error);
-          if (variant == NULL)
-            {
-              g_warning ("Could not interpret stdout from download worker subprocess: %s",
-                         local_error->message);
-              goto err;
-            }
-          g_variant_get (variant, "(sb)", &dest_path, &success);
-
-          bz_weak_get_or_return_reject (self, wr);
-          g_mutex_lock (&self->read_mutex);
-
-          promise = g_hash_table_lookup (self->waiting, dest_path);
-          if (promise != NULL)
-            {
-              if (success)
-                dex_promise_resolve_boolean (promise, TRUE);
-              else
-                dex_promise_reject (
-                    promise,
-                    g_error_new (G_IO_ERROR,
-                                 G_IO_ERROR_UNKNOWN,
-                                 "The subprocess reported an error downloading '%s'", dest_path));
-              promise = NULL;
-              g_hash_table_remove (self->waiting, dest_path);
-            }
-
-          g_mutex_unlock (&self->read_mutex);
-          g_clear_object (&self);
-
-          g_clear_pointer (&line, g_free);
-        }
-      while (g_input_stream_has_pending (input_stream));
+      variant = g_variant_new_from_data (
+          G_VARIANT_TYPE (BZ_DOWNLOAD_WORKER_REPLY_FORMAT),
+          buffer, bytes_read, FALSE, NULL, NULL);
+      g_variant_ref_sink (variant);
+      g_variant_get (variant, BZ_DOWNLOAD_WORKER_REPLY_FORMAT, &id, &success);
+
+      bz_weak_get_or_return_reject (self, wr);
+      g_mutex_lock (&self->read_mutex);
+      if (g_hash_table_steal_extended (self->waiting, &id, &key, (gpointer *) &pending))
+        g_free (key);
+      g_mutex_unlock (&self->read_mutex);
+      g_clear_object (&self);
+
+      if (pending != NULL)
+        finish_pending (pending, success);
     }
 
   return dex_future_new_true ();
@@ -430,74 +446,120 @@ err:
 static DexFuture *
 invoke_worker_fiber (InvokeWorkerData *data)
 {
-  DexPromise *promise                    = data->promise;
-  GFile      *src                        = data->src;
-  GFile      *dest                       = data->dest;
-  g_autoptr (BzDownloadWorker) self      = NULL;
-  g_autoptr (GError) local_error         = NULL;
-  g_autoptr (BzGuard) guard              = NULL;
-  g_autofree char *src_uri               = NULL;
-  g_autofree char *dest_path             = NULL;
-  DexPromise      *existing              = NULL;
-  g_autoptr (GVariant) variant           = NULL;
-  g_autoptr (GString) output             = NULL;
-  g_autoptr (GOutputStream) stdin_stream = NULL;
-  gint64 bytes_written                   = -1;
+  DexPromise *promise                          = data->promise;
+  GFile      *src                              = data->src;
+  GFile      *dest                             = data->dest;
+  g_autoptr (BzDownloadWorker) self            = NULL;
+  g_autoptr (GError) local_error               = NULL;
+  g_autofree char *src_uri                     = NULL;
+  g_autofree char *dest_path                   = NULL;
+  g_autoptr (PendingData) pending              = NULL;
+  int            fd                            = -1;
+  guint64        id                            = 0;
+  GHashTableIter iter                          = { 0 };
+  PendingData   *existing                      = NULL;
+  g_autoptr (GVariant) variant                 = NULL;
+  GOutputVector vector                         = { 0 };
+  g_autoptr (GSocketControlMessage) fd_message = NULL;
+  GSocket *socket                              = NULL;
+  gssize   sent                                = 0;
+
+  bz_weak_get_or_return_reject (self, data->self);
 
   src_uri   = g_file_get_uri (src);
   dest_path = g_file_get_path (dest);
 
-  bz_weak_get_or_return_reject (self, data->self);
-  g_mutex_lock (&self->read_mutex);
-  existing = g_hash_table_lookup (self->waiting, dest_path);
-  if (existing != NULL)
+  /* A request that doesn't fit in one packet would be truncated
+     by the worker and never answered, so refuse it here */
+  variant = g_variant_ref_sink (g_variant_new (
+      BZ_DOWNLOAD_WORKER_REQUEST_FORMAT, (guint64) 0, src_uri));
+  if (g_variant_get_size (variant) > BZ_DOWNLOAD_WORKER_MAX_PACKET)
+    {
+      dex_promise_reject (
+          promise,
+          g_error_new (G_IO_ERROR,
+                       G_IO_ERROR_MESSAGE_TOO_LARGE,
+                       "The uri '%.64s...' is too long for the download worker",
+                       src_uri));
+      return dex_future_new_false ();
+    }
+  g_clear_pointer (&variant, g_variant_unref);
+
+  /* The worker writes into a descriptor we opened, next to the
+     destination so the final rename stays atomic */
+  pending            = pending_data_new ();
+  pending->promise   = dex_ref (promise);
+  pending->dest_path = g_strdup (dest_path);
+  pending->tmp_path  = g_strdup_printf ("%s.XXXXXX", dest_path);
+
+  fd = g_mkstemp_full (pending->tmp_path, O_WRONLY | O_CLOEXEC, 0644);
+  if (fd < 0)
     {
+      int errsv = errno;
+
       dex_promise_reject (
-          existing,
+          promise,
           g_error_new (G_IO_ERROR,
-                       G_IO_ERROR_CANCELLED,
-                       "The operation was replaced"));
-      existing = NULL;
+                       g_io_error_from_errno (errsv),
+                       "Could not open a temporary file for '%s': %s",
+                       dest_path, g_strerror (errsv)));
+      return dex_future_new_false ();
     }
-  g_hash_table_replace (self->waiting, g_strdup (dest_path), dex_ref (promise));
-  g_mutex_unlock (&self->read_mutex);
 
-  variant = g_variant_new ("(ss)", src_uri, dest_path);
-  output  = g_string_new (NULL);
-  output  = g_variant_print_string (variant, g_steal_pointer (&output), TRUE);
-  g_string_append_c (output, '\n');
+  g_mutex_lock (&self->read_mutex);
 
-  stdin_stream = g_object_ref (g_subprocess_get_stdin_pipe (self->subprocess));
+  g_hash_table_iter_init (&iter, self->waiting);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &existing))
+    {
+      if (g_strcmp0 (existing->dest_path, dest_path) != 0)
+        continue;
 
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard, &self->write_mutex, &self->write_gate);
-  g_clear_object (&self);
+      dex_promise_reject (
+          existing->promise,
+          g_error_new (G_IO_ERROR,
+                       G_IO_ERROR_CANCELLED,
+                       "The operation was replaced"));
+      g_unlink (existing->tmp_path);
+      g_hash_table_iter_remove (&iter);
+      break;
+    }
 
-  bytes_written = dex_await_int64 (
-      dex_future_first (
-          dex_output_stream_write (
-              stdin_stream,
-              output->str,
-              output->len,
-              G_PRIORITY_DEFAULT_IDLE),
-          dex_ref (promise),
-          NULL),
-      &local_error);
-  bz_clear_guard (&guard);
+  id = self->next_id++;
+  g_hash_table_replace (
+      self->waiting,
+      g_memdup2 (&id, sizeof (id)),
+      pending_data_ref (pending));
 
-  /* Check if we've been cancelled */
-  if (!dex_future_is_pending (DEX_FUTURE (promise)))
-    return dex_future_new_false ();
+  socket = g_socket_connection_get_socket (self->connection);
+  g_mutex_unlock (&self->read_mutex);
 
-  if (bytes_written < 0)
+  variant       = g_variant_ref_sink (g_variant_new (
+      BZ_DOWNLOAD_WORKER_REQUEST_FORMAT, id, src_uri));
+  vector.buffer = g_variant_get_data (variant);
+  vector.size   = g_variant_get_size (variant);
+
+  fd_message = g_unix_fd_message_new ();
+  if (g_unix_fd_message_append_fd (G_UNIX_FD_MESSAGE (fd_message), fd, &local_error))
+    sent = g_socket_send_message (
+        socket, NULL,
+        &vector, 1,
+        &fd_message, 1,
+        G_SOCKET_MSG_NONE,
+        NULL, &local_error);
+  else
+    sent = -1;
+  /* The message holds its own duplicate */
+  close (fd);
+
+  if (sent < 0)
     {
-      bz_weak_get_or_return_reject (self, data->self);
       g_mutex_lock (&self->read_mutex);
-
-      g_hash_table_remove (self->waiting, dest_path);
-      dex_promise_reject (promise, g_steal_pointer (&local_error));
-
+      if (g_hash_table_remove (self->waiting, &id))
+        {
+          g_unlink (pending->tmp_path);
+          dex_promise_reject (promise, g_steal_pointer (&local_error));
+        }
       g_mutex_unlock (&self->read_mutex);
-      g_clear_object (&self);
     }
 
   return dex_future_new_true ();
@@ -511,48 +573,42 @@ terminate (BzDownloadWorker *self)
   g_hash_table_iter_init (&waiting_iter, self->waiting);
   for (;;)
     {
-      g_autofree char *dest_path     = NULL;
-      g_autoptr (DexPromise) promise = NULL;
+      PendingData *pending = NULL;
 
       if (!g_hash_table_iter_next (
               &waiting_iter,
-              (gpointer *) &dest_path,
-              (gpointer *) &promise))
+              NULL,
+              (gpointer *) &pending))
         break;
-      g_hash_table_iter_steal (&waiting_iter);
 
+      g_unlink (pending->tmp_path);
       dex_promise_reject (
-          promise,
+          pending->promise,
           g_error_new (G_IO_ERROR,
                        G_IO_ERROR_CANCELLED,
                        "The subprocess was terminated"));
+      g_hash_table_iter_remove (&waiting_iter);
     }
 }
 
 static void
-plumb_data_input_stream_read_line_async (GDataInputStream   *stream,
-                                         GCancellable       *cancellable,
-                                         GAsyncReadyCallback callback,
-                                         gpointer            user_data)
+finish_pending (PendingData *pending,
+                gboolean     success)
 {
-  g_data_input_stream_read_line_async (
-      stream,
-      G_PRIORITY_DEFAULT_IDLE,
-      cancellable,
-      callback,
-      user_data);
-}
+  if (success &&
+      g_rename (pending->tmp_path, pending->dest_path) == 0)
+    {
+      dex_promise_resolve_boolean (pending->promise, TRUE);
+      return;
+    }
 
-static char *
-plumb_data_input_stream_read_line_finish (GDataInputStream *stream,
-                                          GAsyncResult     *result,
-                                          gpointer          user_data)
-{
-  return g_data_input_stream_read_line_finish_utf8 (
-      stream,
-      result,
-      NULL,
-      user_data);
+  g_unlink (pending->tmp_path);
+  dex_promise_reject (
+      pending->promise,
+      g_error_new (G_IO_ERROR,
+                   G_IO_ERROR_UNKNOWN,
+                   "The subprocess reported an error downloading '%s'",
+                   pending->dest_path));
 }
 
 /* End of bz-download-worker.c */
@@ -24,6 +24,17 @@
 
 G_BEGIN_DECLS
 
+/* The worker subprocess inherits one end of a SOCK_SEQPACKET socketpair
+ * at this fd. Every packet is a single serialized GVariant in normal
+ * form. Requests carry the destination as an fd attached with
+ * SCM_RIGHTS, so the worker never sees a path. */
+#define BZ_DOWNLOAD_WORKER_SOCKET_FD      3
+/* The shared bandwidth state, see bz-bandwidth.c */
+#define BZ_DOWNLOAD_WORKER_BANDWIDTH_FD   4
+#define BZ_DOWNLOAD_WORKER_REQUEST_FORMAT "(ts)"
+#define BZ_DOWNLOAD_WORKER_REPLY_FORMAT   "(tb)"
+#define BZ_DOWNLOAD_WORKER_MAX_PACKET     16384
+
 #define BZ_TYPE_DOWNLOAD_WORKER (bz_download_worker_get_type ())
 G_DECLARE_FINAL_TYPE (BzDownloadWorker, bz_download_worker, BZ, DOWNLOAD_WORKER, GObject)
 
@@ -23,6 +23,7 @@
 
 #define MAX_CONCURRENT_WRITES       16
 #define WATCH_CLEANUP_INTERVAL_MSEC 5000
+#define LOCALES_BASENAME            ".locales"
 
 #include <malloc.h>
 
@@ -155,6 +156,12 @@ read_task_fiber (ReadTaskData *data);
 static DexFuture *
 enumerate_disk_fiber (OngoingTaskData *data);
 
+static char *
+dup_locale_fingerprint (void);
+
+static gboolean
+ensure_locale_fingerprint (const char *main_cache);
+
 static void
 bz_entry_cache_manager_dispose (GObject *object)
 {
@@ -752,7 +759,10 @@ enumerate_disk_fiber (OngoingTaskData *data)
   BZ_BEGIN_GUARD_WITH_CONTEXT (&guard, &data->writing_mutex, &data->writing_gate);
 
   main_cache = bz_dup_module_dir ();
-  if (!g_file_test (main_cache, G_FILE_TEST_EXISTS))
+
+  /* Entries only carry strings for the locales which were active when they
+     were ingested, so after a language change none of them are usable */
+  if (!ensure_locale_fingerprint (main_cache))
     goto done;
 
   main_cache_file = g_file_new_for_path (main_cache);
@@ -796,7 +806,8 @@ enumerate_disk_fiber (OngoingTaskData *data)
         continue;
 
       basename = g_file_get_basename (child);
-      if (basename != NULL)
+      if (basename != NULL &&
+          g_strcmp0 (basename, LOCALES_BASENAME) != 0)
         g_hash_table_replace (set, g_steal_pointer (&basename), NULL);
     }
 
@@ -804,6 +815,47 @@ done:
   return dex_future_new_take_boxed (G_TYPE_HASH_TABLE, g_steal_pointer (&set));
 }
 
+static char *
+dup_locale_fingerprint (void)
+{
+  /* This list always ends with "C", so the
+     fallback strings are covered too */
+  return g_strjoinv (":", (gchar **) g_get_language_names ());
+}
+
+static gboolean
+ensure_locale_fingerprint (const char *main_cache)
+{
+  g_autoptr (GError) local_error   = NULL;
+  g_autofree char *path            = NULL;
+  g_autofree char *fingerprint     = NULL;
+  g_autofree char *old_fingerprint = NULL;
+  gboolean         result          = FALSE;
+
+  path        = g_build_filename (main_cache, LOCALES_BASENAME, NULL);
+  fingerprint = dup_locale_fingerprint ();
+
+  if (g_file_get_contents (path, &old_fingerprint, NULL, NULL) &&
+      g_strcmp0 (old_fingerprint, fingerprint) == 0)
+    return TRUE;
+
+  if (g_file_test (main_cache, G_FILE_TEST_EXISTS))
+    {
+      g_info ("Active locales changed to %s, discarding cached entries so they are "
+              "ingested again on the next sync",
+              fingerprint);
+      bz_discard_path (main_cache);
+    }
+
+  g_mkdir_with_parents (main_cache, 0755);
+  result = g_file_set_contents (path, fingerprint, -1, &local_error);
+  if (!result)
+    g_warning ("Failed to record locale fingerprint at %s: %s",
+               path, local_error->message);
+
+  return FALSE;
+}
+
 static DexFuture *
 watch_init_fiber (OngoingTaskData *task_data)
 {
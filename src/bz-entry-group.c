@@ -25,6 +25,7 @@
 #include "bz-async-texture.h"
 #include "bz-env.h"
 #include "bz-io.h"
+#include "bz-search-fold.h"
 #include "bz-util.h"
 
 struct _BzEntryGroup
@@ -36,6 +37,7 @@ struct _BzEntryGroup
   GtkStringList *unique_ids;
   char          *id;
   char          *title;
+  char          *title_key;
   char          *developer;
   char          *description;
   GdkPaintable  *icon_paintable;
@@ -46,6 +48,8 @@ struct _BzEntryGroup
   gboolean       is_flathub;
   gboolean       is_verified;
   char          *search_tokens;
+  char          *folded[BZ_ENTRY_GROUP_N_SEARCH_FIELDS];
+  int            recent_downloads;
   char          *remote_repos_string;
   char          *eol;
   guint64        installed_size;
@@ -129,6 +133,13 @@ user_data_size_then (DexFuture *future,
 static void
 check_user_data_size (BzEntryGroup *self);
 
+static void
+refold_search_fields (BzEntryGroup *self);
+
+static void
+set_title (BzEntryGroup *self,
+           const char   *title);
+
 static void
 bz_entry_group_dispose (GObject *object)
 {
@@ -140,6 +151,7 @@ bz_entry_group_dispose (GObject *object)
   g_clear_object (&self->unique_ids);
   g_clear_pointer (&self->id, g_free);
   g_clear_pointer (&self->title, g_free);
+  g_clear_pointer (&self->title_key, g_free);
   g_clear_pointer (&self->developer, g_free);
   g_clear_pointer (&self->description, g_free);
   g_clear_pointer (&self->light_accent_color, g_free);
@@ -147,6 +159,8 @@ bz_entry_group_dispose (GObject *object)
   g_clear_object (&self->icon_paintable);
   g_clear_object (&self->mini_icon);
   g_clear_pointer (&self->search_tokens, g_free);
+  for (guint i = 0; i < G_N_ELEMENTS (self->folded); i++)
+    g_clear_pointer (&self->folded[i], g_free);
   g_clear_pointer (&self->remote_repos_string, g_free);
   g_clear_pointer (&self->eol, g_free);
   g_clear_pointer (&self->donation_url, g_free);
@@ -531,6 +545,26 @@ bz_entry_group_get_title (BzEntryGroup *self)
   return self->title;
 }
 
+const char *
+bz_entry_group_get_title_collate_key (BzEntryGroup *self)
+{
+  g_return_val_if_fail (BZ_IS_ENTRY_GROUP (self), NULL);
+  return self->title_key;
+}
+
+int
+bz_entry_group_cmp_title (BzEntryGroup *a,
+                          BzEntryGroup *b)
+{
+  g_return_val_if_fail (BZ_IS_ENTRY_GROUP (a), 0);
+  g_return_val_if_fail (BZ_IS_ENTRY_GROUP (b), 0);
+
+  /* Untitled groups go last */
+  if (a->title_key == NULL || b->title_key == NULL)
+    return (a->title_key == NULL) - (b->title_key == NULL);
+  return strcmp (a->title_key, b->title_key);
+}
+
 const char *
 bz_entry_group_get_developer (BzEntryGroup *self)
 {
@@ -601,6 +635,22 @@ bz_entry_group_get_search_tokens (BzEntryGroup *self)
   return self->search_tokens;
 }
 
+const char *
+bz_entry_group_get_folded_search_field (BzEntryGroup           *self,
+                                        BzEntryGroupSearchField field)
+{
+  g_return_val_if_fail (BZ_IS_ENTRY_GROUP (self), NULL);
+  g_return_val_if_fail (field < BZ_ENTRY_GROUP_N_SEARCH_FIELDS, NULL);
+  return self->folded[field];
+}
+
+int
+bz_entry_group_get_recent_downloads (BzEntryGroup *self)
+{
+  g_return_val_if_fail (BZ_IS_ENTRY_GROUP (self), 0);
+  return self->recent_downloads;
+}
+
 const char *
 bz_entry_group_get_eol (BzEntryGroup *self)
 {
@@ -808,11 +858,7 @@ bz_entry_group_add (BzEntryGroup *self,
       gtk_string_list_splice (self->unique_ids, 0, 0, (const char *const[]) { unique_id, NULL });
 
       if (title != NULL)
-        {
-          g_clear_pointer (&self->title, g_free);
-          self->title = g_strdup (title);
-          g_object_notify_by_pspec (G_OBJECT (self), props[PROP_TITLE]);
-        }
+        set_title (self, title);
       if (developer != NULL)
         {
           g_clear_pointer (&self->developer, g_free);
@@ -908,10 +954,7 @@ bz_entry_group_add (BzEntryGroup *self,
         gtk_string_list_append (self->unique_ids, unique_id);
 
       if (title != NULL && self->title == NULL)
-        {
-          self->title = g_strdup (title);
-          g_object_notify_by_pspec (G_OBJECT (self), props[PROP_TITLE]);
-        }
+        set_title (self, title);
       if (developer != NULL && self->developer == NULL)
         {
           self->developer = g_strdup (developer);
@@ -959,6 +1002,9 @@ bz_entry_group_add (BzEntryGroup *self,
         }
     }
 
+  refold_search_fields (self);
+  self->recent_downloads = MAX (self->recent_downloads, bz_entry_peek_recent_downloads (entry));
+
   if (existing == G_MAXUINT)
     {
       const char *remote_repo = NULL;
@@ -1257,3 +1303,35 @@ check_user_data_size (BzEntryGroup *self)
       bz_track_weak (self), bz_weak_release);
   self->user_data_size_future = g_steal_pointer (&future);
 }
+
+static void
+refold_search_fields (BzEntryGroup *self)
+{
+  const char *sources[BZ_ENTRY_GROUP_N_SEARCH_FIELDS] = { 0 };
+
+  sources[BZ_ENTRY_GROUP_SEARCH_FIELD_TITLE]       = self->title;
+  sources[BZ_ENTRY_GROUP_SEARCH_FIELD_DEVELOPER]   = self->developer;
+  sources[BZ_ENTRY_GROUP_SEARCH_FIELD_DESCRIPTION] = self->description;
+  sources[BZ_ENTRY_GROUP_SEARCH_FIELD_KEYWORDS]    = self->search_tokens;
+
+  for (guint i = 0; i < G_N_ELEMENTS (sources); i++)
+    {
+      g_clear_pointer (&self->folded[i], g_free);
+      if (sources[i] != NULL)
+        self->folded[i] = bz_search_fold (sources[i], -1);
+    }
+}
+
+static void
+set_title (BzEntryGroup *self,
+           const char   *title)
+{
+  g_clear_pointer (&self->title, g_free);
+  g_clear_pointer (&self->title_key, g_free);
+
+  /* Collating once here lets every sorter compare with plain strcmp */
+  self->title     = g_strdup (title);
+  self->title_key = g_utf8_collate_key (title, -1);
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_TITLE]);
+}
@@ -26,6 +26,16 @@
 
 G_BEGIN_DECLS
 
+typedef enum
+{
+  BZ_ENTRY_GROUP_SEARCH_FIELD_TITLE = 0,
+  BZ_ENTRY_GROUP_SEARCH_FIELD_DEVELOPER,
+  BZ_ENTRY_GROUP_SEARCH_FIELD_DESCRIPTION,
+  BZ_ENTRY_GROUP_SEARCH_FIELD_KEYWORDS,
+
+  BZ_ENTRY_GROUP_N_SEARCH_FIELDS,
+} BzEntryGroupSearchField;
+
 #define BZ_TYPE_ENTRY_GROUP (bz_entry_group_get_type ())
 G_DECLARE_FINAL_TYPE (BzEntryGroup, bz_entry_group, BZ, ENTRY_GROUP, GObject)
 
@@ -46,6 +56,13 @@ bz_entry_group_get_id (BzEntryGroup *self);
 const char *
 bz_entry_group_get_title (BzEntryGroup *self);
 
+const char *
+bz_entry_group_get_title_collate_key (BzEntryGroup *self);
+
+int
+bz_entry_group_cmp_title (BzEntryGroup *a,
+                          BzEntryGroup *b);
+
 const char *
 bz_entry_group_get_developer (BzEntryGroup *self);
 
@@ -76,6 +93,15 @@ bz_entry_group_get_is_verified (BzEntryGroup *self);
 const char *
 bz_entry_group_get_search_tokens (BzEntryGroup *self);
 
+/* Folded with bz_search_fold() when the group is populated, so searching
+   doesn't need to normalize anything */
+const char *
+bz_entry_group_get_folded_search_field (BzEntryGroup           *self,
+                                        BzEntryGroupSearchField field);
+
+int
+bz_entry_group_get_recent_downloads (BzEntryGroup *self);
+
 const char *
 bz_entry_group_get_eol (BzEntryGroup *self);
 
@@ -1427,11 +1427,15 @@ bz_entry_real_serialize (BzSerializable  *serializable,
                   g_variant_builder_add (builder, "{sv}", "download-stats", g_variant_builder_end (sub_builder));
                 }
             }
-          if (g_hash_table_contains (priv->flathub_prop_queries, GINT_TO_POINTER (PROP_RECENT_DOWNLOADS)))
-            g_variant_builder_add (builder, "{sv}", "recent-downloads", g_variant_new_int32 (priv->recent_downloads));
           if (g_hash_table_contains (priv->flathub_prop_queries, GINT_TO_POINTER (PROP_FAVORITES_COUNT)))
             g_variant_builder_add (builder, "{sv}", "favorites-count", g_variant_new_int32 (priv->favorites_count));
         }
+      /* A cached value isn't marked as queried, but
+         must survive being written out again */
+      if (priv->recent_downloads > 0 ||
+          (priv->flathub_prop_queries != NULL &&
+           g_hash_table_contains (priv->flathub_prop_queries, GINT_TO_POINTER (PROP_RECENT_DOWNLOADS))))
+        g_variant_builder_add (builder, "{sv}", "recent-downloads", g_variant_new_int32 (priv->recent_downloads));
     }
 }
 
@@ -1759,6 +1763,10 @@ bz_entry_real_deserialize (BzSerializable *serializable,
         }
       else if (g_strcmp0 (key, "is-flathub") == 0)
         priv->is_flathub = g_variant_get_boolean (value);
+      else if (g_strcmp0 (key, "recent-downloads") == 0)
+        /* Not marked as queried, so flathub is still
+           asked for fresh numbers when they are shown */
+        priv->recent_downloads = g_variant_get_int32 (value);
       else if (g_str_has_prefix (key, "permissions-"))
         {
           continue;
@@ -2060,6 +2068,17 @@ bz_entry_get_search_tokens (BzEntry *self)
   return priv->search_tokens;
 }
 
+int
+bz_entry_peek_recent_downloads (BzEntry *self)
+{
+  BzEntryPrivate *priv = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY (self), 0);
+  priv = bz_entry_get_instance_private (self);
+
+  return priv->recent_downloads;
+}
+
 GListModel *
 bz_entry_get_share_urls (BzEntry *self)
 {
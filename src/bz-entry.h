@@ -148,6 +148,11 @@ bz_entry_get_mini_icon (BzEntry *self);
 const char *
 bz_entry_get_search_tokens (BzEntry *self);
 
+/* Unlike reading the "recent-downloads" property,
+   this will never query flathub */
+int
+bz_entry_peek_recent_downloads (BzEntry *self);
+
 GListModel *
 bz_entry_get_share_urls (BzEntry *self);
 
@@ -69,3 +69,68 @@ bz_get_dex_stack_size (void)
 
   return stack_size;
 }
+
+guint
+bz_get_icon_atlas_max_size (void)
+{
+  static gsize max_size = 0;
+
+  if (g_once_init_enter (&max_size))
+    {
+      const char *envvar = NULL;
+      guint       value  = 128;
+
+      envvar = g_getenv ("BAZAAR_ICON_ATLAS_MAX_SIZE");
+      if (envvar != NULL)
+        {
+          g_autoptr (GError) local_error = NULL;
+          g_autoptr (GVariant) variant   = NULL;
+
+          variant = g_variant_parse (
+              G_VARIANT_TYPE_UINT32, envvar,
+              NULL, NULL, &local_error);
+          if (variant != NULL)
+            value = g_variant_get_uint32 (variant);
+          else
+            g_warning ("BAZAAR_ICON_ATLAS_MAX_SIZE is invalid: %s", local_error->message);
+        }
+
+      /* Store one more than the value so that 0 can disable the atlas */
+      g_once_init_leave (&max_size, (gsize) value + 1);
+    }
+
+  return max_size - 1;
+}
+
+guint64
+bz_get_background_bandwidth_cap (void)
+{
+  static guint64 cap = 0;
+
+  if (g_once_init_enter (&cap))
+    {
+      const char *envvar = NULL;
+      guint64     value  = 0;
+
+      /* In KiB/s, left uncapped while nothing more important is running */
+      envvar = g_getenv ("BAZAAR_BACKGROUND_BANDWIDTH");
+      if (envvar != NULL)
+        {
+          g_autoptr (GError) local_error = NULL;
+          g_autoptr (GVariant) variant   = NULL;
+
+          variant = g_variant_parse (
+              G_VARIANT_TYPE_UINT32, envvar,
+              NULL, NULL, &local_error);
+          if (variant != NULL)
+            value = (guint64) g_variant_get_uint32 (variant) * 1024;
+          else
+            g_warning ("BAZAAR_BACKGROUND_BANDWIDTH is invalid: %s", local_error->message);
+        }
+
+      /* Store one more than the value so that 0 can mean uncapped */
+      g_once_init_leave (&cap, value + 1);
+    }
+
+  return cap - 1;
+}
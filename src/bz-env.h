@@ -27,4 +27,10 @@ G_BEGIN_DECLS
 gsize
 bz_get_dex_stack_size (void);
 
+guint
+bz_get_icon_atlas_max_size (void);
+
+guint64
+bz_get_background_bandwidth_cap (void);
+
 G_END_DECLS
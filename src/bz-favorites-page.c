@@ -356,15 +356,6 @@ set_page (BzFavoritesPage *self)
     adw_view_stack_set_visible_child_name (self->stack, "empty");
 }
 
-static int
-compare_entry_groups_by_title (BzEntryGroup *group_a,
-                               BzEntryGroup *group_b)
-{
-  const char *title_a = bz_entry_group_get_title (group_a);
-  const char *title_b = bz_entry_group_get_title (group_b);
-  return g_utf8_collate (title_a, title_b);
-}
-
 static DexFuture *
 fetch_favorites_fiber (GWeakRef *wr)
 {
@@ -435,7 +426,7 @@ done:
       g_autoptr (BzEntryGroup) group = g_list_model_get_item (model, i);
       g_list_store_append (sorted_store, group);
     }
-  g_list_store_sort (sorted_store, (GCompareDataFunc) compare_entry_groups_by_title, NULL);
+  g_list_store_sort (sorted_store, (GCompareDataFunc) bz_entry_group_cmp_title, NULL);
 
   if (self->model != NULL)
     g_signal_handlers_disconnect_by_func (self->model, items_changed, self);
@@ -19,10 +19,13 @@
  */
 
 #include <glib/gi18n.h>
+#include <libdex.h>
 
 #include "appstream.h"
+#include "bz-env.h"
 #include "bz-flathub-category.h"
 #include "bz-serializable.h"
+#include "bz-util.h"
 
 struct _BzFlathubCategory
 {
@@ -34,6 +37,12 @@ struct _BzFlathubCategory
   GListModel              *quality_applications;
   int                      total_entries;
   gboolean                 is_spotlight;
+
+  /* Id lists straight out of the cache, decoded
+     the first time somebody looks at them */
+  GVariant                *applications_import;
+  GVariant                *quality_import;
+  DexFuture               *materializing;
 };
 
 static void
@@ -63,9 +72,51 @@ enum
 };
 static GParamSpec *props[LAST_PROP] = { 0 };
 
+BZ_DEFINE_DATA (
+    materialize,
+    Materialize,
+    {
+      GWeakRef      *self;
+      GVariant      *applications_import;
+      GVariant      *quality_import;
+      GtkStringList *applications;
+      GtkStringList *quality_applications;
+    },
+    BZ_RELEASE_DATA (self, bz_weak_release);
+    BZ_RELEASE_DATA (applications_import, g_variant_unref);
+    BZ_RELEASE_DATA (quality_import, g_variant_unref);
+    BZ_RELEASE_DATA (applications, g_object_unref);
+    BZ_RELEASE_DATA (quality_applications, g_object_unref))
+
+static DexFuture *
+materialize_fiber (MaterializeData *data);
+static DexFuture *
+materialize_then (DexFuture       *future,
+                  MaterializeData *data);
+
 static void
 clear (BzFlathubCategory *self);
 
+static void
+clear_imports (BzFlathubCategory *self);
+
+static gboolean
+is_materialized (BzFlathubCategory *self);
+
+static void
+ensure_materialized (BzFlathubCategory *self);
+
+static GtkStringList *
+decode_string_list (GVariant *variant);
+
+static GListModel *
+dup_mapped (BzFlathubCategory *self,
+            GListModel        *list);
+
+static gboolean
+string_models_equal (GListModel *a,
+                     GListModel *b);
+
 typedef struct
 {
   const char *id;
@@ -134,10 +185,18 @@ bz_flathub_category_get_property (GObject    *object,
       g_value_set_string (value, bz_flathub_category_get_name (self));
       break;
     case PROP_APPLICATIONS:
-      g_value_take_object (value, bz_flathub_category_dup_applications (self));
+      /* Bindings get notified once the lists are
+         decoded, so don't block the UI on it */
+      if (is_materialized (self))
+        g_value_take_object (value, bz_flathub_category_dup_applications (self));
+      else
+        dex_future_disown (bz_flathub_category_materialize (self));
       break;
     case PROP_QUALITY_APPLICATIONS:
-      g_value_take_object (value, bz_flathub_category_dup_quality_applications (self));
+      if (is_materialized (self))
+        g_value_take_object (value, bz_flathub_category_dup_quality_applications (self));
+      else
+        dex_future_disown (bz_flathub_category_materialize (self));
       break;
     case PROP_DISPLAY_NAME:
       g_value_set_string (value, bz_flathub_category_get_display_name (self));
@@ -276,7 +335,9 @@ bz_flathub_category_real_serialize (BzSerializable  *serializable,
 
   if (self->name != NULL)
     g_variant_builder_add (builder, "{sv}", "name", g_variant_new_string (self->name));
-  if (self->applications != NULL)
+  if (self->applications_import != NULL)
+    g_variant_builder_add (builder, "{sv}", "applications", self->applications_import);
+  else if (self->applications != NULL)
     {
       guint n_items = 0;
 
@@ -297,7 +358,9 @@ bz_flathub_category_real_serialize (BzSerializable  *serializable,
           g_variant_builder_add (builder, "{sv}", "applications", g_variant_builder_end (sub_builder));
         }
     }
-  if (self->quality_applications != NULL)
+  if (self->quality_import != NULL)
+    g_variant_builder_add (builder, "{sv}", "quality-applications", self->quality_import);
+  else if (self->quality_applications != NULL)
     {
       guint n_items = 0;
 
@@ -319,6 +382,7 @@ bz_flathub_category_real_serialize (BzSerializable  *serializable,
         }
     }
   g_variant_builder_add (builder, "{sv}", "total-entries", g_variant_new_int32 (self->total_entries));
+  g_variant_builder_add (builder, "{sv}", "is-spotlight", g_variant_new_boolean (self->is_spotlight));
 }
 
 static gboolean
@@ -341,46 +405,20 @@ bz_flathub_category_real_deserialize (BzSerializable *serializable,
       if (!g_variant_iter_next (iter, "{sv}", &key, &value))
         break;
 
+      /* The id lists are only kept around as they are, most categories are
+         never opened and decoding them all up front is a waste of startup */
       if (g_strcmp0 (key, "name") == 0)
         self->name = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "applications") == 0)
-        {
-          g_autoptr (GtkStringList) list     = NULL;
-          g_autoptr (GVariantIter) list_iter = NULL;
-
-          list = gtk_string_list_new (NULL);
-
-          list_iter = g_variant_iter_new (value);
-          for (;;)
-            {
-              g_autofree char *id = NULL;
-
-              if (!g_variant_iter_next (list_iter, "s", &id))
-                break;
-              gtk_string_list_append (list, id);
-            }
-
-          self->applications = (GListModel *) g_steal_pointer (&list);
-        }
-      else if (g_strcmp0 (key, "quality-applications") == 0)
-        {
-          g_autoptr (GtkStringList) list     = NULL;
-          g_autoptr (GVariantIter) list_iter = NULL;
-
-          list = gtk_string_list_new (NULL);
-
-          list_iter = g_variant_iter_new (value);
-          for (;;)
-            {
-              g_autofree char *id = NULL;
-
-              if (!g_variant_iter_next (list_iter, "s", &id))
-                break;
-              gtk_string_list_append (list, id);
-            }
-
-          self->quality_applications = (GListModel *) g_steal_pointer (&list);
-        }
+      else if (g_strcmp0 (key, "applications") == 0 &&
+               g_variant_is_of_type (value, G_VARIANT_TYPE_STRING_ARRAY))
+        self->applications_import = g_steal_pointer (&value);
+      else if (g_strcmp0 (key, "quality-applications") == 0 &&
+               g_variant_is_of_type (value, G_VARIANT_TYPE_STRING_ARRAY))
+        self->quality_import = g_steal_pointer (&value);
+      else if (g_strcmp0 (key, "total-entries") == 0)
+        self->total_entries = g_variant_get_int32 (value);
+      else if (g_strcmp0 (key, "is-spotlight") == 0)
+        self->is_spotlight = g_variant_get_boolean (value);
     }
 
   return TRUE;
@@ -418,16 +456,8 @@ bz_flathub_category_dup_applications (BzFlathubCategory *self)
 {
   g_return_val_if_fail (BZ_IS_FLATHUB_CATEGORY (self), NULL);
 
-  if (self->applications != NULL)
-    {
-      if (self->map_factory != NULL)
-        return bz_application_map_factory_generate (
-            self->map_factory, G_LIST_MODEL (self->applications));
-      else
-        return G_LIST_MODEL (g_object_ref (self->applications));
-    }
-  else
-    return NULL;
+  ensure_materialized (self);
+  return dup_mapped (self, self->applications);
 }
 
 GListModel *
@@ -435,16 +465,39 @@ bz_flathub_category_dup_quality_applications (BzFlathubCategory *self)
 {
   g_return_val_if_fail (BZ_IS_FLATHUB_CATEGORY (self), NULL);
 
-  if (self->quality_applications != NULL)
-    {
-      if (self->map_factory != NULL)
-        return bz_application_map_factory_generate (
-            self->map_factory, G_LIST_MODEL (self->quality_applications));
-      else
-        return G_LIST_MODEL (g_object_ref (self->quality_applications));
-    }
-  else
-    return NULL;
+  ensure_materialized (self);
+  return dup_mapped (self, self->quality_applications);
+}
+
+DexFuture *
+bz_flathub_category_materialize (BzFlathubCategory *self)
+{
+  g_autoptr (MaterializeData) data = NULL;
+  g_autoptr (DexFuture) future     = NULL;
+
+  dex_return_error_if_fail (BZ_IS_FLATHUB_CATEGORY (self));
+
+  if (is_materialized (self))
+    return dex_future_new_true ();
+  if (self->materializing != NULL)
+    return dex_ref (self->materializing);
+
+  data                      = materialize_data_new ();
+  data->self                = bz_track_weak (self);
+  data->applications_import = bz_maybe_ref (self->applications_import, g_variant_ref);
+  data->quality_import      = bz_maybe_ref (self->quality_import, g_variant_ref);
+
+  future = dex_scheduler_spawn (
+      dex_thread_pool_scheduler_get_default (),
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) materialize_fiber,
+      materialize_data_ref (data), materialize_data_unref);
+  future = dex_future_then (
+      future, (DexFutureCallback) materialize_then,
+      materialize_data_ref (data), materialize_data_unref);
+  self->materializing = dex_ref (future);
+
+  return g_steal_pointer (&future);
 }
 
 int
@@ -494,6 +547,7 @@ bz_flathub_category_set_applications (BzFlathubCategory *self,
 {
   g_return_if_fail (BZ_IS_FLATHUB_CATEGORY (self));
 
+  g_clear_pointer (&self->applications_import, g_variant_unref);
   g_clear_pointer (&self->applications, g_object_unref);
   if (applications != NULL)
     self->applications = g_object_ref (applications);
@@ -507,6 +561,7 @@ bz_flathub_category_set_quality_applications (BzFlathubCategory *self,
 {
   g_return_if_fail (BZ_IS_FLATHUB_CATEGORY (self));
 
+  g_clear_pointer (&self->quality_import, g_variant_unref);
   g_clear_pointer (&self->quality_applications, g_object_unref);
   if (applications != NULL)
     self->quality_applications = g_object_ref (applications);
@@ -586,6 +641,43 @@ bz_flathub_category_get_icon_name (BzFlathubCategory *self)
   return info ? info->icon_name : NULL;
 }
 
+static DexFuture *
+materialize_fiber (MaterializeData *data)
+{
+  if (data->applications_import != NULL)
+    data->applications = decode_string_list (data->applications_import);
+  if (data->quality_import != NULL)
+    data->quality_applications = decode_string_list (data->quality_import);
+
+  return dex_future_new_true ();
+}
+
+static DexFuture *
+materialize_then (DexFuture       *future,
+                  MaterializeData *data)
+{
+  g_autoptr (BzFlathubCategory) self = NULL;
+
+  bz_weak_get_or_return_reject (self, data->self);
+
+  /* The lists were replaced or decoded synchronously in the meantime */
+  if (self->applications_import != data->applications_import ||
+      self->quality_import != data->quality_import)
+    return dex_future_new_true ();
+
+  clear_imports (self);
+
+  g_clear_pointer (&self->applications, g_object_unref);
+  g_clear_pointer (&self->quality_applications, g_object_unref);
+  self->applications         = (GListModel *) g_steal_pointer (&data->applications);
+  self->quality_applications = (GListModel *) g_steal_pointer (&data->quality_applications);
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_APPLICATIONS]);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_QUALITY_APPLICATIONS]);
+
+  return dex_future_new_true ();
+}
+
 static void
 clear (BzFlathubCategory *self)
 {
@@ -593,6 +685,65 @@ clear (BzFlathubCategory *self)
   g_clear_pointer (&self->name, g_free);
   g_clear_pointer (&self->applications, g_object_unref);
   g_clear_pointer (&self->quality_applications, g_object_unref);
+  clear_imports (self);
+}
+
+static void
+clear_imports (BzFlathubCategory *self)
+{
+  g_clear_pointer (&self->applications_import, g_variant_unref);
+  g_clear_pointer (&self->quality_import, g_variant_unref);
+  dex_clear (&self->materializing);
+}
+
+static gboolean
+is_materialized (BzFlathubCategory *self)
+{
+  return self->applications_import == NULL &&
+         self->quality_import == NULL;
+}
+
+static void
+ensure_materialized (BzFlathubCategory *self)
+{
+  if (is_materialized (self))
+    return;
+
+  /* Someone needs the lists right now, so just decode them here. A
+     background materialization still in flight will notice and back off */
+  if (self->applications_import != NULL)
+    {
+      g_clear_pointer (&self->applications, g_object_unref);
+      self->applications = (GListModel *) decode_string_list (self->applications_import);
+    }
+  if (self->quality_import != NULL)
+    {
+      g_clear_pointer (&self->quality_applications, g_object_unref);
+      self->quality_applications = (GListModel *) decode_string_list (self->quality_import);
+    }
+  clear_imports (self);
+}
+
+static GtkStringList *
+decode_string_list (GVariant *variant)
+{
+  g_autofree const char **strv = NULL;
+
+  strv = g_variant_get_strv (variant, NULL);
+  return gtk_string_list_new (strv);
+}
+
+static GListModel *
+dup_mapped (BzFlathubCategory *self,
+            GListModel        *list)
+{
+  if (list == NULL)
+    return NULL;
+
+  if (self->map_factory != NULL)
+    return bz_application_map_factory_generate (self->map_factory, list);
+  else
+    return g_object_ref (list);
 }
 
 static const char *
@@ -609,6 +760,28 @@ bz_flathub_category_map_appstream_id (const char *as_category_id)
   return info ? info->id : NULL;
 }
 
+gboolean
+bz_flathub_category_equal (BzFlathubCategory *self,
+                           BzFlathubCategory *other,
+                           gboolean           compare_quality)
+{
+  g_return_val_if_fail (BZ_IS_FLATHUB_CATEGORY (self), FALSE);
+  g_return_val_if_fail (BZ_IS_FLATHUB_CATEGORY (other), FALSE);
+
+  if (self == other)
+    return TRUE;
+
+  ensure_materialized (self);
+  ensure_materialized (other);
+
+  return g_strcmp0 (self->name, other->name) == 0 &&
+         self->total_entries == other->total_entries &&
+         self->is_spotlight == other->is_spotlight &&
+         string_models_equal (self->applications, other->applications) &&
+         (!compare_quality ||
+          string_models_equal (self->quality_applications, other->quality_applications));
+}
+
 GListModel *
 bz_flathub_category_list_from_appstream (GPtrArray *as_categories)
 {
@@ -649,4 +822,29 @@ bz_flathub_category_list_from_appstream (GPtrArray *as_categories)
   return G_LIST_MODEL (g_steal_pointer (&categories));
 }
 
+static gboolean
+string_models_equal (GListModel *a,
+                     GListModel *b)
+{
+  guint n_items = 0;
+
+  n_items = a != NULL ? g_list_model_get_n_items (a) : 0;
+  if (n_items != (b != NULL ? g_list_model_get_n_items (b) : 0))
+    return FALSE;
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr (GtkStringObject) a_string = NULL;
+      g_autoptr (GtkStringObject) b_string = NULL;
+
+      a_string = g_list_model_get_item (a, i);
+      b_string = g_list_model_get_item (b, i);
+      if (g_strcmp0 (gtk_string_object_get_string (a_string),
+                     gtk_string_object_get_string (b_string)) != 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 /* End of bz-flathub-category.c */
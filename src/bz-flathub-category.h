@@ -21,6 +21,7 @@
 #pragma once
 
 #include <gtk/gtk.h>
+#include <libdex.h>
 
 #include "bz-application-map-factory.h"
 
@@ -44,6 +45,9 @@ bz_flathub_category_dup_applications (BzFlathubCategory *self);
 GListModel *
 bz_flathub_category_dup_quality_applications (BzFlathubCategory *self);
 
+DexFuture *
+bz_flathub_category_materialize (BzFlathubCategory *self);
+
 void
 bz_flathub_category_set_map_factory (BzFlathubCategory       *self,
                                      BzApplicationMapFactory *map_factory);
@@ -86,6 +90,11 @@ void
 bz_flathub_category_set_is_spotlight (BzFlathubCategory *self,
                                       gboolean           is_spotlight);
 
+gboolean
+bz_flathub_category_equal (BzFlathubCategory *self,
+                           BzFlathubCategory *other,
+                           gboolean           compare_quality);
+
 GListModel *
 bz_flathub_category_list_from_appstream (GPtrArray *as_categories);
 
@@ -24,6 +24,7 @@
 #define QUALITY_MODERATION_PAGE_SIZE 300
 #define KEYWORD_SEARCH_PAGE_SIZE     48
 #define ADWAITA_URL                  "https://arewelibadwaitayet.com"
+#define REVALIDATE_MIN_AGE_SEC       (10 * 60)
 
 #include <json-glib/json-glib.h>
 #include <libdex.h>
@@ -47,7 +48,11 @@ struct _BzFlathubState
   GListStore              *categories;
   gboolean                 has_connection_error;
 
+  /* collection name -> gint64 *, unix time of the last successful fetch */
+  GHashTable *timestamps;
+
   DexFuture *initializing;
+  DexFuture *revalidating;
 };
 
 typedef enum
@@ -57,6 +62,57 @@ typedef enum
   QUALITY_MODE_RANDOM
 } QualityMode;
 
+static const struct
+{
+  const char *name;
+  const char *path;
+} spotlight_collections[] = {
+  {         "trending",         "/collection/trending" },
+  {          "popular",          "/collection/popular" },
+  {   "recently-added",   "/collection/recently-added" },
+  { "recently-updated", "/collection/recently-updated" },
+  {           "mobile",           "/collection/mobile" },
+};
+
+BZ_DEFINE_DATA (
+    revalidate,
+    Revalidate,
+    {
+      GWeakRef      *self;
+      char          *for_day;
+      gboolean       day_changed;
+      GHashTable    *fresh;
+      char          *toolkit;
+      char          *app_of_the_day;
+      GtkStringList *apps_of_the_week;
+      GPtrArray     *categories;
+      GHashTable    *category_names;
+      GHashTable    *refreshed;
+      guint          n_failed;
+    },
+    BZ_RELEASE_DATA (self, bz_weak_release);
+    BZ_RELEASE_DATA (for_day, g_free);
+    BZ_RELEASE_DATA (fresh, g_hash_table_unref);
+    BZ_RELEASE_DATA (toolkit, g_free);
+    BZ_RELEASE_DATA (app_of_the_day, g_free);
+    BZ_RELEASE_DATA (apps_of_the_week, g_object_unref);
+    BZ_RELEASE_DATA (categories, g_ptr_array_unref);
+    BZ_RELEASE_DATA (category_names, g_hash_table_unref);
+    BZ_RELEASE_DATA (refreshed, g_hash_table_unref))
+
+BZ_DEFINE_DATA (
+    collection,
+    Collection,
+    {
+      char       *name;
+      DexFuture  *future;
+      gboolean    is_json_object;
+      QualityMode quality_mode;
+      gboolean    is_spotlight;
+    },
+    BZ_RELEASE_DATA (name, g_free);
+    BZ_RELEASE_DATA (future, dex_unref))
+
 static void
 serializable_iface_init (BzSerializableInterface *iface);
 
@@ -91,6 +147,46 @@ static DexFuture *
 initialize_finally (DexFuture *future,
                     GWeakRef  *wr);
 
+static DexFuture *
+revalidate_fiber (RevalidateData *data);
+static DexFuture *
+revalidate_then (DexFuture      *future,
+                 RevalidateData *data);
+
+static BzFlathubCategory *
+build_category (const char  *name,
+                JsonNode    *node,
+                GHashTable  *quality_set,
+                gboolean     is_json_object,
+                QualityMode  quality_mode,
+                gboolean     is_spotlight);
+
+static JsonNode *
+await_collection (RevalidateData *data,
+                  DexFuture      *future,
+                  const char     *name);
+
+static void
+add_collection (GPtrArray   *collections,
+                const char  *name,
+                DexFuture   *future,
+                gboolean     is_json_object,
+                QualityMode  quality_mode,
+                gboolean     is_spotlight);
+
+static gboolean
+find_category (GListModel *categories,
+               const char *name,
+               guint      *position_out);
+
+static gboolean
+string_lists_equal (GtkStringList *a,
+                    GtkStringList *b);
+
+static void
+bind_category (BzFlathubState    *self,
+               BzFlathubCategory *category);
+
 static void
 notify_all (BzFlathubState *self);
 
@@ -103,8 +199,10 @@ bz_flathub_state_dispose (GObject *object)
   BzFlathubState *self = BZ_FLATHUB_STATE (object);
 
   dex_clear (&self->initializing);
+  dex_clear (&self->revalidating);
   g_clear_pointer (&self->map_factory, g_object_unref);
   clear (self);
+  g_clear_pointer (&self->timestamps, g_hash_table_unref);
 
   G_OBJECT_CLASS (bz_flathub_state_parent_class)->dispose (object);
 }
@@ -243,6 +341,7 @@ bz_flathub_state_class_init (BzFlathubStateClass *klass)
 static void
 bz_flathub_state_init (BzFlathubState *self)
 {
+  self->timestamps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 }
 
 static void
@@ -305,6 +404,20 @@ bz_flathub_state_real_serialize (BzSerializable  *serializable,
           g_variant_builder_add (builder, "{sv}", "categories", g_variant_builder_end (sub_builder));
         }
     }
+  if (g_hash_table_size (self->timestamps) > 0)
+    {
+      g_autoptr (GVariantBuilder) sub_builder = NULL;
+      GHashTableIter timestamps_iter          = { 0 };
+      const char    *name                     = NULL;
+      gint64        *timestamp                = NULL;
+
+      sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sx}"));
+      g_hash_table_iter_init (&timestamps_iter, self->timestamps);
+      while (g_hash_table_iter_next (&timestamps_iter, (gpointer *) &name, (gpointer *) &timestamp))
+        g_variant_builder_add (sub_builder, "{sx}", name, *timestamp);
+
+      g_variant_builder_add (builder, "{sv}", "timestamps", g_variant_builder_end (sub_builder));
+    }
 }
 
 static gboolean
@@ -387,6 +500,23 @@ bz_flathub_state_real_deserialize (BzSerializable *serializable,
 
           self->categories = g_steal_pointer (&categories);
         }
+      else if (g_strcmp0 (key, "timestamps") == 0)
+        {
+          g_autoptr (GVariantIter) timestamps_iter = NULL;
+
+          timestamps_iter = g_variant_iter_new (value);
+          for (;;)
+            {
+              g_autofree char *name = NULL;
+              gint64           time = 0;
+
+              if (!g_variant_iter_next (timestamps_iter, "{sx}", &name, &time))
+                break;
+              g_hash_table_replace (self->timestamps,
+                                    g_steal_pointer (&name),
+                                    g_memdup2 (&time, sizeof (time)));
+            }
+        }
     }
 
   notify_all (self);
@@ -596,6 +726,20 @@ add_category (BzFlathubState *self,
               gboolean        is_json_object,
               QualityMode     quality_mode,
               gboolean        is_spotlight)
+{
+  g_autoptr (BzFlathubCategory) category = NULL;
+
+  category = build_category (name, node, quality_set, is_json_object, quality_mode, is_spotlight);
+  g_list_store_append (self->categories, category);
+}
+
+static BzFlathubCategory *
+build_category (const char  *name,
+                JsonNode    *node,
+                GHashTable  *quality_set,
+                gboolean     is_json_object,
+                QualityMode  quality_mode,
+                gboolean     is_spotlight)
 {
   JsonObject    *object = NULL;
   JsonObjectIter iter;
@@ -632,7 +776,7 @@ add_category (BzFlathubState *self,
         {
           gtk_string_list_append (store, key);
 
-          if (g_hash_table_contains (quality_set, key))
+          if (quality_set != NULL && g_hash_table_contains (quality_set, key))
             {
               if (quality_mode == QUALITY_MODE_RANDOM)
                 g_ptr_array_add (quality_apps, g_strdup (key));
@@ -660,7 +804,7 @@ add_category (BzFlathubState *self,
           app_id  = json_object_get_string_member (element, "app_id");
           gtk_string_list_append (store, app_id);
 
-          if (g_hash_table_contains (quality_set, app_id))
+          if (quality_set != NULL && g_hash_table_contains (quality_set, app_id))
             {
               if (quality_mode == QUALITY_MODE_RANDOM)
                 g_ptr_array_add (quality_apps, g_strdup (app_id));
@@ -685,7 +829,7 @@ add_category (BzFlathubState *self,
 
   bz_flathub_category_set_total_entries (category, total_entries);
   bz_flathub_category_set_quality_applications (category, G_LIST_MODEL (quality_store));
-  g_list_store_append (self->categories, category);
+  return g_steal_pointer (&category);
 }
 
 static DexFuture *
@@ -875,7 +1019,7 @@ initialize_finally (DexFuture *future,
           g_autoptr (BzFlathubCategory) category = NULL;
 
           category = g_list_model_get_item (G_LIST_MODEL (self->categories), i);
-          g_object_bind_property (self, "map-factory", category, "map-factory", G_BINDING_SYNC_CREATE);
+          bind_category (self, category);
         }
 
       g_debug ("Done syncing flathub state; notifying property listeners...");
@@ -887,6 +1031,309 @@ initialize_finally (DexFuture *future,
   return dex_ref (future);
 }
 
+static DexFuture *
+revalidate_fiber (RevalidateData *data)
+{
+  g_autoptr (GHashTable) quality_set  = NULL;
+  g_autoptr (GPtrArray) collections   = NULL;
+  g_autoptr (DexFuture) passing_f     = NULL;
+  g_autoptr (DexFuture) category_list = NULL;
+  g_autoptr (DexFuture) aotd_f        = NULL;
+  g_autoptr (DexFuture) aotw_f        = NULL;
+  JsonNode *node                      = NULL;
+
+#define NEEDS_FETCH(_name) (!g_hash_table_contains (data->fresh, (_name)))
+#define REQUEST(...)       bz_query_flathub_v2_json_take_with_class (g_strdup_printf (__VA_ARGS__), BZ_BANDWIDTH_CLASS_BACKGROUND)
+
+  collections = g_ptr_array_new_with_free_func (collection_data_unref);
+
+  /* Get everything in flight at once, then judge each collection on its
+   * own. Anything that fails simply keeps its last good data. */
+  passing_f     = REQUEST ("/quality-moderation/passing-apps?page=1&page_size=%d", QUALITY_MODERATION_PAGE_SIZE);
+  category_list = REQUEST ("/collection/category");
+  if (data->day_changed || NEEDS_FETCH ("app-of-the-day"))
+    aotd_f = REQUEST ("/app-picks/app-of-the-day/%s", data->for_day);
+  if (data->day_changed || NEEDS_FETCH ("apps-of-the-week"))
+    aotw_f = REQUEST ("/app-picks/apps-of-the-week/%s", data->for_day);
+
+  for (guint i = 0; i < G_N_ELEMENTS (spotlight_collections); i++)
+    {
+      if (NEEDS_FETCH (spotlight_collections[i].name))
+        add_collection (
+            collections,
+            spotlight_collections[i].name,
+            REQUEST ("%s?page=0&per_page=%d", spotlight_collections[i].path, COLLECTION_FETCH_SIZE),
+            FALSE, QUALITY_MODE_NONE, TRUE);
+    }
+
+  if (NEEDS_FETCH (data->toolkit))
+    {
+      if (g_strcmp0 (data->toolkit, "kde") == 0)
+        add_collection (
+            collections, data->toolkit,
+            REQUEST ("/collection/developer/kde?locale=en"),
+            FALSE, QUALITY_MODE_RANDOM, FALSE);
+      else
+        add_collection (
+            collections, data->toolkit,
+            bz_https_query_json_with_class (ADWAITA_URL "/api/apps", BZ_BANDWIDTH_CLASS_BACKGROUND),
+            TRUE, QUALITY_MODE_RANDOM, FALSE);
+    }
+
+  node = await_collection (data, category_list, "category-list");
+  if (node != NULL)
+    {
+      JsonArray *array  = NULL;
+      guint      length = 0;
+
+      array  = json_node_get_array (node);
+      length = json_array_get_length (array);
+
+      data->category_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      for (guint i = 0; i < length; i++)
+        {
+          const char *name = NULL;
+
+          name = json_array_get_string_element (array, i);
+          g_hash_table_add (data->category_names, g_strdup (name));
+
+          if (NEEDS_FETCH (name))
+            add_collection (
+                collections, name,
+                REQUEST ("/collection/category/%s?page=0&per_page=%d", name, CATEGORY_FETCH_SIZE),
+                FALSE, QUALITY_MODE_FIRST, FALSE);
+        }
+    }
+
+#undef REQUEST
+#undef NEEDS_FETCH
+
+  node = await_collection (data, passing_f, "quality-moderation");
+  if (node != NULL)
+    {
+      JsonObject *object = NULL;
+      JsonArray  *array  = NULL;
+      guint       length = 0;
+
+      object = json_node_get_object (node);
+      array  = json_object_get_array_member (object, "apps");
+      length = json_array_get_length (array);
+
+      quality_set = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      for (guint i = 0; i < length; i++)
+        g_hash_table_add (quality_set, g_strdup (json_array_get_string_element (array, i)));
+    }
+
+  node = await_collection (data, aotd_f, "app-of-the-day");
+  if (node != NULL)
+    data->app_of_the_day = g_strdup (
+        json_object_get_string_member (
+            json_node_get_object (node), "app_id"));
+
+  node = await_collection (data, aotw_f, "apps-of-the-week");
+  if (node != NULL)
+    {
+      JsonArray *array  = NULL;
+      guint      length = 0;
+
+      array  = json_object_get_array_member (json_node_get_object (node), "apps");
+      length = json_array_get_length (array);
+
+      data->apps_of_the_week = gtk_string_list_new (NULL);
+      for (guint i = 0; i < length; i++)
+        {
+          JsonObject *element = NULL;
+
+          element = json_array_get_object_element (array, i);
+          gtk_string_list_append (
+              data->apps_of_the_week,
+              json_object_get_string_member (element, "app_id"));
+        }
+    }
+
+  for (guint i = 0; i < collections->len; i++)
+    {
+      CollectionData *collection             = NULL;
+      g_autoptr (BzFlathubCategory) category = NULL;
+
+      collection = g_ptr_array_index (collections, i);
+
+      if (collection->quality_mode != QUALITY_MODE_NONE &&
+          quality_set == NULL)
+        {
+          g_warning ("Not refreshing flathub collection \"%s\" without quality "
+                     "moderation data, keeping last good data",
+                     collection->name);
+          data->n_failed++;
+          continue;
+        }
+
+      node = await_collection (data, collection->future, collection->name);
+      if (node == NULL)
+        continue;
+
+      category = build_category (
+          collection->name, node, quality_set,
+          collection->is_json_object,
+          collection->quality_mode,
+          collection->is_spotlight);
+      g_ptr_array_add (data->categories, g_steal_pointer (&category));
+    }
+
+  return dex_future_new_true ();
+}
+
+static DexFuture *
+revalidate_then (DexFuture      *future,
+                 RevalidateData *data)
+{
+  g_autoptr (BzFlathubState) self = NULL;
+  GHashTableIter iter             = { 0 };
+  const char    *name             = NULL;
+  gint64         now              = 0;
+  guint          n_categories     = 0;
+  gboolean       for_day_changed  = FALSE;
+  gboolean       aotd_changed     = FALSE;
+  gboolean       aotw_changed     = FALSE;
+  gboolean       cats_changed     = FALSE;
+  gboolean       has_error        = FALSE;
+
+  bz_weak_get_or_return_reject (self, data->self);
+
+  now = g_get_real_time () / G_USEC_PER_SEC;
+  if (self->categories == NULL)
+    self->categories = g_list_store_new (BZ_TYPE_FLATHUB_CATEGORY);
+
+  if (data->app_of_the_day != NULL &&
+      g_strcmp0 (data->app_of_the_day, self->app_of_the_day) != 0)
+    {
+      g_clear_pointer (&self->app_of_the_day, g_free);
+      self->app_of_the_day = g_steal_pointer (&data->app_of_the_day);
+      aotd_changed         = TRUE;
+    }
+
+  if (data->apps_of_the_week != NULL &&
+      !string_lists_equal (data->apps_of_the_week, self->apps_of_the_week))
+    {
+      g_clear_object (&self->apps_of_the_week);
+      self->apps_of_the_week = g_steal_pointer (&data->apps_of_the_week);
+      aotw_changed           = TRUE;
+    }
+
+  /* Only move on to the new day once both day-bound collections made it,
+   * otherwise the next revalidation has to try them again */
+  if (data->day_changed &&
+      g_hash_table_contains (data->refreshed, "app-of-the-day") &&
+      g_hash_table_contains (data->refreshed, "apps-of-the-week"))
+    {
+      g_clear_pointer (&self->for_day, g_free);
+      self->for_day   = g_strdup (data->for_day);
+      for_day_changed = TRUE;
+    }
+
+  for (guint i = 0; i < data->categories->len; i++)
+    {
+      BzFlathubCategory *category = NULL;
+      guint              position = 0;
+
+      category = g_ptr_array_index (data->categories, i);
+      name     = bz_flathub_category_get_name (category);
+
+      if (find_category (G_LIST_MODEL (self->categories), name, &position))
+        {
+          g_autoptr (BzFlathubCategory) old = NULL;
+
+          old = g_list_model_get_item (G_LIST_MODEL (self->categories), position);
+          /* Quality picks of the toolkit collection are random every time */
+          if (bz_flathub_category_equal (old, category, g_strcmp0 (name, data->toolkit) != 0))
+            continue;
+
+          bind_category (self, category);
+          g_list_store_splice (self->categories, position, 1, (gpointer *) &category, 1);
+        }
+      else
+        {
+          bind_category (self, category);
+          g_list_store_append (self->categories, category);
+        }
+      cats_changed = TRUE;
+    }
+
+  if (data->category_names != NULL)
+    {
+      n_categories = g_list_model_get_n_items (G_LIST_MODEL (self->categories));
+      for (guint i = n_categories; i > 0; i--)
+        {
+          g_autoptr (BzFlathubCategory) category = NULL;
+
+          category = g_list_model_get_item (G_LIST_MODEL (self->categories), i - 1);
+          name     = bz_flathub_category_get_name (category);
+
+          if (bz_flathub_category_get_is_spotlight (category) ||
+              g_strcmp0 (name, data->toolkit) == 0 ||
+              g_hash_table_contains (data->category_names, name))
+            continue;
+
+          g_list_store_remove (self->categories, i - 1);
+          cats_changed = TRUE;
+        }
+    }
+
+  g_hash_table_iter_init (&iter, data->refreshed);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &name, NULL))
+    g_hash_table_replace (self->timestamps, g_strdup (name), g_memdup2 (&now, sizeof (now)));
+
+  has_error = data->n_failed > 0 &&
+              self->app_of_the_day == NULL &&
+              g_list_model_get_n_items (G_LIST_MODEL (self->categories)) == 0;
+
+  g_debug ("Revalidated flathub state: %u collections refreshed, %u failed",
+           g_hash_table_size (data->refreshed), data->n_failed);
+
+  if (for_day_changed)
+    g_object_notify_by_pspec (G_OBJECT (self), props[PROP_FOR_DAY]);
+  if (has_error != self->has_connection_error)
+    {
+      self->has_connection_error = has_error;
+      g_object_notify_by_pspec (G_OBJECT (self), props[PROP_HAS_CONNECTION_ERROR]);
+    }
+  if (aotd_changed)
+    {
+      g_object_notify_by_pspec (G_OBJECT (self), props[PROP_APP_OF_THE_DAY]);
+      g_object_notify_by_pspec (G_OBJECT (self), props[PROP_APP_OF_THE_DAY_GROUP]);
+    }
+  if (aotw_changed)
+    g_object_notify_by_pspec (G_OBJECT (self), props[PROP_APPS_OF_THE_WEEK]);
+  if (aotd_changed || aotw_changed)
+    g_object_notify_by_pspec (G_OBJECT (self), props[PROP_APPS_OF_THE_DAY_WEEK]);
+  if (cats_changed)
+    g_object_notify_by_pspec (G_OBJECT (self), props[PROP_CATEGORIES]);
+
+  return dex_future_new_for_boolean (g_hash_table_size (data->refreshed) > 0);
+}
+
+static JsonNode *
+await_collection (RevalidateData *data,
+                  DexFuture      *future,
+                  const char     *name)
+{
+  g_autoptr (GError) local_error = NULL;
+
+  if (future == NULL)
+    return NULL;
+
+  if (!dex_await (dex_ref (future), &local_error))
+    {
+      g_warning ("Failed to refresh flathub collection \"%s\", keeping last good data: %s",
+                 name, local_error->message);
+      data->n_failed++;
+      return NULL;
+    }
+
+  g_hash_table_add (data->refreshed, g_strdup (name));
+  return g_value_get_boxed (dex_future_get_value (future, NULL));
+}
+
 static DexFuture *
 search_keyword_fiber (char *keyword)
 {
@@ -972,6 +1419,65 @@ bz_flathub_state_search_keyword (BzFlathubState *self,
   return g_steal_pointer (&future);
 }
 
+DexFuture *
+bz_flathub_state_revalidate (BzFlathubState *self)
+{
+  g_autoptr (RevalidateData) data = NULL;
+  g_autoptr (GDateTime) datetime  = NULL;
+  g_autoptr (DexFuture) future    = NULL;
+  GHashTableIter iter             = { 0 };
+  const char    *name             = NULL;
+  gint64        *timestamp        = NULL;
+  gint64         now              = 0;
+
+  dex_return_error_if_fail (BZ_IS_FLATHUB_STATE (self));
+
+  if (self->initializing != NULL &&
+      dex_future_is_pending (self->initializing))
+    return dex_future_new_reject (
+        G_IO_ERROR, G_IO_ERROR_BUSY,
+        "Cannot revalidate while initializing!");
+  if (self->revalidating != NULL &&
+      dex_future_is_pending (self->revalidating))
+    return dex_ref (self->revalidating);
+
+  datetime = g_date_time_new_now_utc ();
+  now      = g_date_time_to_unix (datetime);
+
+  data              = revalidate_data_new ();
+  data->self        = bz_track_weak (self);
+  data->for_day     = g_date_time_format (datetime, "%F");
+  data->day_changed = g_strcmp0 (data->for_day, self->for_day) != 0;
+  data->fresh       = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  data->toolkit     = g_strdup (is_kde_plasma () ? "kde" : "adwaita");
+  data->categories  = g_ptr_array_new_with_free_func (g_object_unref);
+  data->refreshed   = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  g_hash_table_iter_init (&iter, self->timestamps);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &name, (gpointer *) &timestamp))
+    {
+      if (*timestamp <= now && now - *timestamp < REVALIDATE_MIN_AGE_SEC)
+        g_hash_table_add (data->fresh, g_strdup (name));
+    }
+
+  g_debug ("Revalidating flathub state for day %s, %u collections still fresh",
+           data->for_day, g_hash_table_size (data->fresh));
+
+  future = dex_scheduler_spawn (
+      bz_get_io_scheduler (),
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) revalidate_fiber,
+      revalidate_data_ref (data), revalidate_data_unref);
+  future = dex_future_then (
+      future,
+      (DexFutureCallback) revalidate_then,
+      revalidate_data_ref (data), revalidate_data_unref);
+
+  dex_clear (&self->revalidating);
+  self->revalidating = dex_ref (future);
+  return g_steal_pointer (&future);
+}
+
 static void
 notify_all (BzFlathubState *self)
 {
@@ -991,7 +1497,82 @@ clear (BzFlathubState *self)
   g_clear_pointer (&self->app_of_the_day, g_free);
   g_clear_pointer (&self->apps_of_the_week, g_object_unref);
   g_clear_pointer (&self->categories, g_object_unref);
+  if (self->timestamps != NULL)
+    g_hash_table_remove_all (self->timestamps);
   self->has_connection_error = FALSE;
 }
 
+static void
+add_collection (GPtrArray   *collections,
+                const char  *name,
+                DexFuture   *future,
+                gboolean     is_json_object,
+                QualityMode  quality_mode,
+                gboolean     is_spotlight)
+{
+  g_autoptr (CollectionData) collection = NULL;
+
+  collection                 = collection_data_new ();
+  collection->name           = g_strdup (name);
+  collection->future         = future;
+  collection->is_json_object = is_json_object;
+  collection->quality_mode   = quality_mode;
+  collection->is_spotlight   = is_spotlight;
+
+  g_ptr_array_add (collections, g_steal_pointer (&collection));
+}
+
+static gboolean
+find_category (GListModel *categories,
+               const char *name,
+               guint      *position_out)
+{
+  guint n_items = 0;
+
+  n_items = g_list_model_get_n_items (categories);
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr (BzFlathubCategory) category = NULL;
+
+      category = g_list_model_get_item (categories, i);
+      if (g_strcmp0 (bz_flathub_category_get_name (category), name) == 0)
+        {
+          *position_out = i;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+static gboolean
+string_lists_equal (GtkStringList *a,
+                    GtkStringList *b)
+{
+  guint n_items = 0;
+
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  n_items = g_list_model_get_n_items (G_LIST_MODEL (a));
+  if (n_items != g_list_model_get_n_items (G_LIST_MODEL (b)))
+    return FALSE;
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      if (g_strcmp0 (gtk_string_list_get_string (a, i),
+                     gtk_string_list_get_string (b, i)) != 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+bind_category (BzFlathubState    *self,
+               BzFlathubCategory *category)
+{
+  g_object_bind_property (self, "map-factory", category, "map-factory", G_BINDING_SYNC_CREATE);
+}
+
 /* End of bz-flathub-state.c */
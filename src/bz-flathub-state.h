@@ -65,6 +65,9 @@ bz_flathub_state_get_has_connection_error (BzFlathubState *self);
 DexFuture *
 bz_flathub_state_update_to_today (BzFlathubState *self);
 
+DexFuture *
+bz_flathub_state_revalidate (BzFlathubState *self);
+
 DexFuture *
 bz_flathub_state_search_keyword (BzFlathubState *self,
                                  const char     *keyword);
@@ -62,6 +62,9 @@ struct _BzFlatpakEntry
   char    *addon_extension_of_ref;
 
   FlatpakRef *ref;
+
+  /* Set for entries opened from a local .flatpak bundle */
+  GFile *bundle_file;
 };
 
 static void
@@ -94,6 +97,15 @@ static GParamSpec *props[LAST_PROP] = { 0 };
 static void
 clear_entry (BzFlatpakEntry *self);
 
+static BzFlatpakEntry *
+new_for_ref_full (FlatpakRef    *ref,
+                  FlatpakRemote *remote,
+                  gboolean       user,
+                  AsComponent   *component,
+                  const char    *appstream_dir,
+                  GVariant      *bundle_header,
+                  GError       **error);
+
 static void
 bz_flatpak_entry_dispose (GObject *object)
 {
@@ -101,6 +113,7 @@ bz_flatpak_entry_dispose (GObject *object)
 
   clear_entry (self);
   g_clear_object (&self->ref);
+  g_clear_object (&self->bundle_file);
 
   G_OBJECT_CLASS (bz_flatpak_entry_parent_class)->dispose (object);
 }
@@ -357,9 +370,47 @@ bz_flatpak_entry_new_for_ref (FlatpakRef    *ref,
                               AsComponent   *component,
                               const char    *appstream_dir,
                               GError       **error)
+{
+  return new_for_ref_full (ref, remote, user, component, appstream_dir, NULL, error);
+}
+
+BzFlatpakEntry *
+bz_flatpak_entry_new_for_bundle (FlatpakRef  *ref,
+                                 GVariant    *header,
+                                 GFile       *file,
+                                 gboolean     user,
+                                 AsComponent *component,
+                                 const char  *appstream_dir,
+                                 GError     **error)
+{
+  BzFlatpakEntry *self = NULL;
+
+  g_return_val_if_fail (FLATPAK_IS_REF (ref), NULL);
+  g_return_val_if_fail (header != NULL, NULL);
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
+
+  self = new_for_ref_full (ref, NULL, user, component, appstream_dir, header, error);
+  if (self != NULL)
+    self->bundle_file = g_object_ref (file);
+
+  return self;
+}
+
+/* bundle_header is the leading a{sv} of a .flatpak bundle, standing in for
+ * a FlatpakBundleRef when the bundle was opened without libflatpak */
+static BzFlatpakEntry *
+new_for_ref_full (FlatpakRef    *ref,
+                  FlatpakRemote *remote,
+                  gboolean       user,
+                  AsComponent   *component,
+                  const char    *appstream_dir,
+                  GVariant      *bundle_header,
+                  GError       **error)
 {
   g_autoptr (BzFlatpakEntry) self                      = NULL;
   GBytes *bytes                                        = NULL;
+  const char *header_metadata                          = NULL;
+  g_autoptr (GBytes) header_bytes                      = NULL;
   g_autoptr (GKeyFile) key_file                        = NULL;
   gboolean         result                              = FALSE;
   guint            kinds                               = 0;
@@ -411,7 +462,10 @@ bz_flatpak_entry_new_for_ref (FlatpakRef    *ref,
   g_autoptr (BzAppPermissions) permissions             = NULL;
 
   g_return_val_if_fail (FLATPAK_IS_REF (ref), NULL);
-  g_return_val_if_fail (FLATPAK_IS_REMOTE_REF (ref) || FLATPAK_IS_BUNDLE_REF (ref), NULL);
+  g_return_val_if_fail (FLATPAK_IS_REMOTE_REF (ref) ||
+                            FLATPAK_IS_BUNDLE_REF (ref) ||
+                            bundle_header != NULL,
+                        NULL);
   g_return_val_if_fail (component == NULL || appstream_dir != NULL, NULL);
 
   self       = g_object_new (BZ_TYPE_FLATPAK_ENTRY, NULL);
@@ -422,7 +476,21 @@ bz_flatpak_entry_new_for_ref (FlatpakRef    *ref,
   if (FLATPAK_IS_REMOTE_REF (ref))
     bytes = flatpak_remote_ref_get_metadata (FLATPAK_REMOTE_REF (ref));
   else if (FLATPAK_IS_BUNDLE_REF (ref))
-    bytes = flatpak_bundle_ref_get_metadata (FLATPAK_BUNDLE_REF (ref));
+    {
+      bytes             = flatpak_bundle_ref_get_metadata (FLATPAK_BUNDLE_REF (ref));
+      self->bundle_file = flatpak_bundle_ref_get_file (FLATPAK_BUNDLE_REF (ref));
+    }
+  else if (g_variant_lookup (bundle_header, "metadata", "&s", &header_metadata))
+    {
+      header_bytes = g_bytes_new_static (header_metadata, strlen (header_metadata));
+      bytes        = header_bytes;
+    }
+  if (bytes == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Ref %s carries no metadata", flatpak_ref_get_name (ref));
+      return NULL;
+    }
 
   result = g_key_file_load_from_bytes (
       key_file, bytes, G_KEY_FILE_NONE, error);
@@ -479,14 +547,19 @@ bz_flatpak_entry_new_for_ref (FlatpakRef    *ref,
   self->flatpak_id      = flatpak_ref_format_ref (ref);
   self->flatpak_version = g_strdup (flatpak_ref_get_branch (ref));
 
-  id                 = flatpak_ref_get_name (ref);
-  unique_id          = bz_flatpak_ref_format_unique (ref, user);
-  unique_id_checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, unique_id, -1);
-
   if (remote != NULL)
     remote_name = flatpak_remote_get_name (remote);
   else if (FLATPAK_IS_BUNDLE_REF (ref))
     remote_name = flatpak_bundle_ref_get_origin (FLATPAK_BUNDLE_REF (ref));
+  else if (bundle_header != NULL)
+    g_variant_lookup (bundle_header, "origin", "&s", &remote_name);
+
+  id = flatpak_ref_get_name (ref);
+  if (bundle_header != NULL)
+    unique_id = bz_flatpak_ref_parts_format_unique (remote_name, self->flatpak_id, user);
+  else
+    unique_id = bz_flatpak_ref_format_unique (ref, user);
+  unique_id_checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, unique_id, -1);
 
   if (FLATPAK_IS_REMOTE_REF (ref))
     download_size = flatpak_remote_ref_get_download_size (FLATPAK_REMOTE_REF (ref));
@@ -495,6 +568,10 @@ bz_flatpak_entry_new_for_ref (FlatpakRef    *ref,
     installed_size = flatpak_remote_ref_get_installed_size (FLATPAK_REMOTE_REF (ref));
   else if (FLATPAK_IS_BUNDLE_REF (ref))
     installed_size = flatpak_bundle_ref_get_installed_size (FLATPAK_BUNDLE_REF (ref));
+  else if (bundle_header != NULL &&
+           g_variant_lookup (bundle_header, "installed-size", "t", &installed_size))
+    /* Stored big endian, like flatpak build-bundle writes it */
+    installed_size = GUINT64_FROM_BE (installed_size);
 
   if (component != NULL)
     {
@@ -897,14 +974,25 @@ bz_flatpak_entry_new_for_ref (FlatpakRef    *ref,
                                                          max_display_length);
     }
 
-  if (icon_paintable == NULL && FLATPAK_IS_BUNDLE_REF (ref))
+  if (icon_paintable == NULL &&
+      (FLATPAK_IS_BUNDLE_REF (ref) || bundle_header != NULL))
     {
       for (int size = 128; size > 0; size -= 64)
         {
           g_autoptr (GBytes) icon_bytes = NULL;
           GdkTexture *texture           = NULL;
 
-          icon_bytes = flatpak_bundle_ref_get_icon (FLATPAK_BUNDLE_REF (ref), size);
+          if (FLATPAK_IS_BUNDLE_REF (ref))
+            icon_bytes = flatpak_bundle_ref_get_icon (FLATPAK_BUNDLE_REF (ref), size);
+          else
+            {
+              g_autofree char *key       = NULL;
+              g_autoptr (GVariant) value = NULL;
+
+              key        = g_strdup_printf ("icon-%d", size);
+              value      = g_variant_lookup_value (bundle_header, key, G_VARIANT_TYPE_BYTESTRING);
+              icon_bytes = bz_maybe (value, g_variant_get_data_as_bytes);
+            }
           if (icon_bytes == NULL)
             continue;
 
@@ -1110,6 +1198,13 @@ bz_flatpak_entry_get_ref (BzFlatpakEntry *self)
   return self->ref;
 }
 
+GFile *
+bz_flatpak_entry_get_bundle_file (BzFlatpakEntry *self)
+{
+  g_return_val_if_fail (BZ_IS_FLATPAK_ENTRY (self), NULL);
+  return self->bundle_file;
+}
+
 char *
 bz_flatpak_id_format_unique (const char *flatpak_id,
                              gboolean    user)
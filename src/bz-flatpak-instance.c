@@ -21,6 +21,10 @@
 #define G_LOG_DOMAIN  "BAZAAR::FLATPAK"
 #define BAZAAR_MODULE "flatpak"
 
+/* Metadata, appstream and icons of a bundle are a few megabytes at most */
+#define MAX_BUNDLE_HEADER_SIZE   (64 * 1024 * 1024)
+#define BUNDLE_HEADER_CHUNK_SIZE (1024 * 1024)
+
 #include <malloc.h>
 #include <xmlb.h>
 
@@ -68,6 +72,14 @@ G_DEFINE_FINAL_TYPE_WITH_CODE (
     G_TYPE_OBJECT,
     G_IMPLEMENT_INTERFACE (BZ_TYPE_BACKEND, backend_iface_init));
 
+/* Lets the receiving side stop waiting for progress */
+static void
+close_progress_channel (DexChannel *channel)
+{
+  dex_channel_close_send (channel);
+  dex_unref (channel);
+}
+
 BZ_DEFINE_DATA (
     init,
     Init,
@@ -109,10 +121,12 @@ BZ_DEFINE_DATA (
       GWeakRef     *self;
       GCancellable *cancellable;
       GFile        *file;
+      DexChannel   *channel;
     },
     BZ_RELEASE_DATA (self, bz_weak_release);
     BZ_RELEASE_DATA (cancellable, g_object_unref);
-    BZ_RELEASE_DATA (file, g_object_unref));
+    BZ_RELEASE_DATA (file, g_object_unref);
+    BZ_RELEASE_DATA (channel, close_progress_channel));
 static DexFuture *
 load_local_ref_fiber (LoadLocalRefData *data);
 
@@ -291,6 +305,36 @@ cmp_rref (FlatpakRemoteRef *a,
           FlatpakRemoteRef *b,
           GHashTable       *hash);
 
+static char *
+dup_silo_path (FlatpakInstallation *installation,
+               const char          *remote_name,
+               const char *const   *locales);
+
+static char *
+compute_file_checksum (GFile        *file,
+                       GCancellable *cancellable,
+                       GError      **error);
+
+static gboolean
+read_at (GInputStream *stream,
+         goffset       offset,
+         void         *buffer,
+         gsize         count,
+         GCancellable *cancellable,
+         GError      **error);
+
+static GVariant *
+read_bundle_header (GFile        *file,
+                    DexChannel   *channel,
+                    char        **commit,
+                    GCancellable *cancellable,
+                    GError      **error);
+
+static AsComponent *
+parse_bundle_appstream (GVariant     *header,
+                        GCancellable *cancellable,
+                        GError      **error);
+
 static void
 bz_flatpak_instance_dispose (GObject *object)
 {
@@ -349,6 +393,7 @@ bz_flatpak_instance_create_notification_channel (BzBackend *backend)
 static DexFuture *
 bz_flatpak_instance_load_local_package (BzBackend    *backend,
                                         GFile        *file,
+                                        DexChannel   *channel,
                                         GCancellable *cancellable)
 {
   BzFlatpakInstance *self           = BZ_FLATPAK_INSTANCE (backend);
@@ -358,6 +403,7 @@ bz_flatpak_instance_load_local_package (BzBackend    *backend,
   data->self        = bz_track_weak (self);
   data->cancellable = bz_object_maybe_ref (cancellable);
   data->file        = g_object_ref (file);
+  data->channel     = bz_dex_maybe_ref (channel);
 
   return dex_scheduler_spawn (
       self->scheduler,
@@ -774,12 +820,13 @@ ensure_flathub_fiber (EnsureFlathubData *data)
 static DexFuture *
 load_local_ref_fiber (LoadLocalRefData *data)
 {
-  // GCancellable      *cancellable    = data->cancellable;
-  // BzFlatpakInstance *instance       = data->instance;
-  GFile *file                       = data->file;
+  GCancellable *cancellable         = data->cancellable;
+  GFile        *file                = data->file;
   g_autoptr (GError) local_error    = NULL;
   g_autofree char *uri              = NULL;
   g_autofree char *path             = NULL;
+  g_autoptr (GVariant) header       = NULL;
+  g_autofree char *commit           = NULL;
   g_autoptr (FlatpakBundleRef) bref = NULL;
   g_autoptr (BzFlatpakEntry) entry  = NULL;
 
@@ -849,22 +896,84 @@ load_local_ref_fiber (LoadLocalRefData *data)
       return dex_future_new_take_string (g_steal_pointer (&name));
     }
 
-  bref = flatpak_bundle_ref_new (file, &local_error);
-  if (bref == NULL)
-    return dex_future_new_reject (
-        BZ_FLATPAK_ERROR,
-        BZ_FLATPAK_ERROR_IO_MISBEHAVIOR,
-        "Failed to load local flatpak bundle '%s': %s",
-        path,
-        local_error->message);
+  header = read_bundle_header (file, data->channel, &commit, cancellable, &local_error);
+  if (header != NULL)
+    {
+      const char *full_ref              = NULL;
+      const char *collection_id         = NULL;
+      g_autoptr (FlatpakRef) parsed     = NULL;
+      g_autoptr (FlatpakRef) ref        = NULL;
+      g_autoptr (AsComponent) component = NULL;
+      g_autofree char *appstream_dir    = NULL;
+
+      g_variant_lookup (header, "ref", "&s", &full_ref);
+      g_variant_lookup (header, "collection-id", "&s", &collection_id);
+      parsed = flatpak_ref_parse (full_ref, &local_error);
+      if (parsed == NULL)
+        return dex_future_new_reject (
+            BZ_FLATPAK_ERROR,
+            BZ_FLATPAK_ERROR_IO_MISBEHAVIOR,
+            "Failed to parse the ref of flatpak bundle '%s': %s",
+            path,
+            local_error->message);
 
-  entry = bz_flatpak_entry_new_for_ref (
-      FLATPAK_REF (bref),
-      NULL,
-      FALSE,
-      NULL,
-      NULL,
-      &local_error);
+      /* Only the properties of the base class are public, the bundle
+         specific parts travel in the header instead */
+      ref = g_object_new (
+          FLATPAK_TYPE_REF,
+          "kind", flatpak_ref_get_kind (parsed),
+          "name", flatpak_ref_get_name (parsed),
+          "arch", flatpak_ref_get_arch (parsed),
+          "branch", flatpak_ref_get_branch (parsed),
+          "commit", commit,
+          "collection-id", collection_id,
+          NULL);
+
+      component = parse_bundle_appstream (header, cancellable, &local_error);
+      if (component == NULL && local_error != NULL)
+        {
+          g_debug ("Ignoring the appstream of flatpak bundle '%s': %s",
+                   path, local_error->message);
+          g_clear_error (&local_error);
+        }
+      appstream_dir = bz_dup_module_dir ();
+
+      entry = bz_flatpak_entry_new_for_bundle (
+          ref,
+          header,
+          file,
+          FALSE,
+          component,
+          appstream_dir,
+          &local_error);
+    }
+  else
+    {
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return dex_future_new_for_error (g_steal_pointer (&local_error));
+
+      g_debug ("Could not read the header of flatpak bundle '%s' directly, "
+               "letting libflatpak inspect it instead: %s",
+               path, local_error->message);
+      g_clear_error (&local_error);
+
+      bref = flatpak_bundle_ref_new (file, &local_error);
+      if (bref == NULL)
+        return dex_future_new_reject (
+            BZ_FLATPAK_ERROR,
+            BZ_FLATPAK_ERROR_IO_MISBEHAVIOR,
+            "Failed to load local flatpak bundle '%s': %s",
+            path,
+            local_error->message);
+
+      entry = bz_flatpak_entry_new_for_ref (
+          FLATPAK_REF (bref),
+          NULL,
+          FALSE,
+          NULL,
+          NULL,
+          &local_error);
+    }
   if (entry == NULL)
     return dex_future_new_reject (
         BZ_FLATPAK_ERROR,
@@ -1044,9 +1153,12 @@ retrieve_refs_for_remote_fiber (RetrieveRefsForRemoteData *data)
   g_autofree char *appstream_dir_path   = NULL;
   g_autofree char *appstream_xml_path   = NULL;
   g_autoptr (GFile) appstream_xml       = NULL;
+  g_autofree char *appstream_checksum   = NULL;
   g_autoptr (XbBuilderSource) source    = NULL;
   g_autoptr (XbBuilder) builder         = NULL;
   const gchar *const *locales           = NULL;
+  g_autofree char *silo_path            = NULL;
+  g_autoptr (GFile) silo_file           = NULL;
   g_autoptr (XbSilo) silo               = NULL;
   g_autoptr (XbNode) root               = NULL;
   g_autoptr (GPtrArray) children        = NULL;
@@ -1136,24 +1248,61 @@ retrieve_refs_for_remote_fiber (RetrieveRefsForRemoteData *data)
     xb_builder_add_locale (builder, locales[i]);
   xb_builder_import_source (builder, source);
 
-  silo = xb_builder_compile (
-      builder,
+  /* The source guid only covers the path and mtime of the bundle, and
+     flatpak may swap out the checkout underneath us, so guard the
+     persisted silo with the actual content */
+  appstream_checksum = compute_file_checksum (appstream_xml, cancellable, &local_error);
+  if (appstream_checksum != NULL)
+    {
+      xb_builder_append_guid (builder, appstream_checksum);
 
-      /* This was causing issues */
-      // // fallback for locales should be handled by AppStream as_component_get_name
-      // XB_BUILDER_COMPILE_FLAG_NONE,
+      silo_path = dup_silo_path (installation, remote_name, locales);
+      silo_file = g_file_new_for_path (silo_path);
 
-      /* This seems to work better */
-      XB_BUILDER_COMPILE_FLAG_NATIVE_LANGS,
-      cancellable,
-      &local_error);
+      /* If the appstream data didn't change since the last time, this
+         just maps the existing silo without looking at the xml at all */
+      silo = xb_builder_ensure (
+          builder,
+          silo_file,
+          XB_BUILDER_COMPILE_FLAG_NATIVE_LANGS,
+          cancellable,
+          &local_error);
+      if (silo == NULL)
+        {
+          g_warning ("Failed to persist binary xml silo for remote '%s' "
+                     "at path %s, compiling it in memory instead: %s",
+                     remote_name, silo_path, local_error->message);
+          g_clear_error (&local_error);
+        }
+    }
+  else
+    {
+      g_warning ("Failed to checksum appstream bundle download at path %s "
+                 "for remote '%s', compiling it in memory instead: %s",
+                 appstream_xml_path, remote_name, local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  if (silo == NULL)
+    silo = xb_builder_compile (
+        builder,
+
+        /* This was causing issues */
+        // // fallback for locales should be handled by AppStream as_component_get_name
+        // XB_BUILDER_COMPILE_FLAG_NONE,
+
+        /* This seems to work better */
+        XB_BUILDER_COMPILE_FLAG_NATIVE_LANGS,
+        cancellable,
+        &local_error);
 
 #ifdef __GLIBC__
   /* From gnome-software/plugins/core/gs-plugin-appstream.c
    *
    * https://gitlab.gnome.org/GNOME/gnome-software/-/issues/941
    * libxmlb <= 0.3.22 makes lots of temporary heap allocations parsing large XMLs
-   * trim the heap after parsing to control RSS growth. */
+   * trim the heap after parsing to control RSS growth. This is cheap when
+   * the silo was only mapped from disk. */
   malloc_trim (0);
 #endif
 
@@ -1459,12 +1608,14 @@ transaction_fiber (TransactionData *data)
           FlatpakRef      *ref                       = NULL;
           gboolean         is_user                   = FALSE;
           g_autofree char *ref_fmt                   = NULL;
+          GFile           *bundle_file               = NULL;
           g_autoptr (FlatpakTransaction) transaction = NULL;
 
-          entry   = g_ptr_array_index (installations, i);
-          ref     = bz_flatpak_entry_get_ref (entry);
-          is_user = bz_flatpak_entry_is_user (BZ_FLATPAK_ENTRY (entry));
-          ref_fmt = flatpak_ref_format_ref (ref);
+          entry       = g_ptr_array_index (installations, i);
+          ref         = bz_flatpak_entry_get_ref (entry);
+          is_user     = bz_flatpak_entry_is_user (BZ_FLATPAK_ENTRY (entry));
+          ref_fmt     = flatpak_ref_format_ref (ref);
+          bundle_file = bz_flatpak_entry_get_bundle_file (entry);
 
           if ((is_user && self->user == NULL) ||
               (!is_user && self->system == NULL))
@@ -1493,12 +1644,22 @@ transaction_fiber (TransactionData *data)
                   local_error->message);
             }
 
-          result = flatpak_transaction_add_install (
-              transaction,
-              bz_entry_get_remote_repo_name (BZ_ENTRY (entry)),
-              ref_fmt,
-              NULL,
-              &local_error);
+          /* A bundle opened from disk installs from that same file, the
+             way `flatpak install --bundle` does, instead of fetching the
+             ref from its origin */
+          if (bundle_file != NULL)
+            result = flatpak_transaction_add_install_bundle (
+                transaction,
+                bundle_file,
+                NULL,
+                &local_error);
+          else
+            result = flatpak_transaction_add_install (
+                transaction,
+                bz_entry_get_remote_repo_name (BZ_ENTRY (entry)),
+                ref_fmt,
+                NULL,
+                &local_error);
           if (!result)
             {
               dex_channel_close_send (channel);
@@ -2193,3 +2354,246 @@ cmp_rref (FlatpakRemoteRef *a,
 
   return 0;
 }
+
+static char *
+dup_silo_path (FlatpakInstallation *installation,
+               const char          *remote_name,
+               const char *const   *locales)
+{
+  g_autofree char *module_dir      = NULL;
+  g_autofree char *silo_dir        = NULL;
+  g_autofree char *joined_locales  = NULL;
+  g_autofree char *locale_checksum = NULL;
+  g_autofree char *basename        = NULL;
+
+  module_dir = bz_dup_module_dir ();
+  silo_dir   = g_build_filename (module_dir, "silos", NULL);
+  g_mkdir_with_parents (silo_dir, 0755);
+
+  /* Compiling with native langs strips everything else,
+     so each locale set needs its own silo */
+  joined_locales  = g_strjoinv (":", (gchar **) locales);
+  locale_checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, joined_locales, -1);
+
+  basename = g_strdup_printf (
+      "%s-%s-%s.xmlb",
+      flatpak_installation_get_is_user (installation) ? "user" : "system",
+      remote_name,
+      locale_checksum);
+  return g_build_filename (silo_dir, basename, NULL);
+}
+
+static char *
+compute_file_checksum (GFile        *file,
+                       GCancellable *cancellable,
+                       GError      **error)
+{
+  g_autoptr (GFileInputStream) stream = NULL;
+  g_autoptr (GChecksum) checksum      = NULL;
+  guchar buffer[16384]                = { 0 };
+  gssize bytes_read                   = 0;
+
+  stream = g_file_read (file, cancellable, error);
+  if (stream == NULL)
+    return NULL;
+
+  /* The compressed bundle is much smaller than what it inflates to,
+     and any change to one is a change to the other */
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  while ((bytes_read = g_input_stream_read (
+              G_INPUT_STREAM (stream), buffer, sizeof (buffer),
+              cancellable, error)) > 0)
+    g_checksum_update (checksum, buffer, bytes_read);
+  if (bytes_read < 0)
+    return NULL;
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+static gboolean
+read_at (GInputStream *stream,
+         goffset       offset,
+         void         *buffer,
+         gsize         count,
+         GCancellable *cancellable,
+         GError      **error)
+{
+  gsize bytes_read = 0;
+
+  if (!g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET, cancellable, error))
+    return FALSE;
+  if (!g_input_stream_read_all (stream, buffer, count, &bytes_read, cancellable, error))
+    return FALSE;
+  if (bytes_read != count)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                   "Unexpected end of file at offset %" G_GOFFSET_FORMAT,
+                   offset + (goffset) bytes_read);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* A bundle is one serialized (a{sv}tayay...) static delta superblock with
+ * the commit objects inlined, so nearly all of it is payload. Everything
+ * needed to show the bundle lives in the leading a{sv}, and GVariant
+ * records where each member ends in the framing offsets at the very end of
+ * the file. Only those two regions are read, the leading one in chunks so
+ * channel can be told how far along we are. */
+static GVariant *
+read_bundle_header (GFile        *file,
+                    DexChannel   *channel,
+                    char        **commit,
+                    GCancellable *cancellable,
+                    GError      **error)
+{
+  g_autoptr (GFileInputStream) stream = NULL;
+  g_autoptr (GFileInfo) info          = NULL;
+  goffset size                        = 0;
+  gsize   offset_size                 = 0;
+  guint8  tail[3 * sizeof (guint64)]  = { 0 };
+  guint64 ends[3]                     = { 0 };
+  g_autofree guint8 *head             = NULL;
+  g_autoptr (GBytes) head_bytes       = NULL;
+  g_autoptr (GBytes) metadata_bytes   = NULL;
+  g_autoptr (GVariant) metadata       = NULL;
+  const guint8 *to_csum               = NULL;
+  GString      *checksum              = NULL;
+
+  stream = g_file_read (file, cancellable, error);
+  if (stream == NULL)
+    return NULL;
+  info = g_file_input_stream_query_info (
+      stream, G_FILE_ATTRIBUTE_STANDARD_SIZE, cancellable, error);
+  if (info == NULL)
+    return NULL;
+  size = g_file_info_get_size (info);
+
+  /* Same thresholds as gvs_get_offset_size () */
+  if ((guint64) size > G_MAXUINT32)
+    offset_size = 8;
+  else if (size > G_MAXUINT16)
+    offset_size = 4;
+  else if (size > G_MAXUINT8)
+    offset_size = 2;
+  else
+    offset_size = 1;
+  if (size < (goffset) (G_N_ELEMENTS (ends) * offset_size))
+    goto invalid;
+
+  /* Offsets are stored back to front, so the last one is where the
+     metadata ends, followed by the from and to checksums */
+  if (!read_at (G_INPUT_STREAM (stream), size - G_N_ELEMENTS (ends) * offset_size,
+                tail, G_N_ELEMENTS (ends) * offset_size, cancellable, error))
+    return NULL;
+  for (guint i = 0; i < G_N_ELEMENTS (ends); i++)
+    {
+      const guint8 *at = tail + (G_N_ELEMENTS (ends) - 1 - i) * offset_size;
+
+      for (gsize b = offset_size; b > 0; b--)
+        ends[i] = (ends[i] << 8) | at[b - 1];
+    }
+  /* The timestamp `t` sits 8-aligned between the metadata and the from
+     checksum, the to checksum follows that and must be a sha256 */
+  if (ends[2] > MAX_BUNDLE_HEADER_SIZE ||
+      ends[1] < ((ends[0] + 7) & ~(guint64) 7) + 8 ||
+      ends[2] < ends[1] ||
+      ends[2] - ends[1] != 32 ||
+      ends[2] > (guint64) size)
+    goto invalid;
+
+  head = g_malloc (ends[2]);
+  for (guint64 done = 0; done < ends[2];)
+    {
+      gsize count = 0;
+
+      count = MIN (BUNDLE_HEADER_CHUNK_SIZE, ends[2] - done);
+      if (!read_at (G_INPUT_STREAM (stream), done, head + done, count, cancellable, error))
+        return NULL;
+      done += count;
+
+      if (channel != NULL && done < ends[2])
+        {
+          g_autoptr (DexFuture) sent = NULL;
+
+          /* Don't wait for the receiver */
+          sent = dex_channel_send (
+              channel,
+              dex_future_new_for_double ((double) done / (double) ends[2]));
+        }
+    }
+  head_bytes = g_bytes_new_take (g_steal_pointer (&head), ends[2]);
+  to_csum    = (const guint8 *) g_bytes_get_data (head_bytes, NULL) + ends[1];
+
+  metadata_bytes = g_bytes_new_from_bytes (head_bytes, 0, ends[0]);
+  metadata       = g_variant_new_from_bytes (G_VARIANT_TYPE_VARDICT, metadata_bytes, FALSE);
+  g_variant_ref_sink (metadata);
+
+  if (!g_variant_lookup (metadata, "ref", "&s", NULL) ||
+      !g_variant_lookup (metadata, "metadata", "&s", NULL))
+    goto invalid;
+
+  checksum = g_string_sized_new (32 * 2);
+  for (guint i = 0; i < 32; i++)
+    g_string_append_printf (checksum, "%02x", to_csum[i]);
+  *commit = g_string_free (checksum, FALSE);
+
+  return g_steal_pointer (&metadata);
+
+invalid:
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+               "Not a flatpak bundle or its header is malformed");
+  return NULL;
+}
+
+/* The appstream is stored gzipped under "appdata" */
+static AsComponent *
+parse_bundle_appstream (GVariant     *header,
+                        GCancellable *cancellable,
+                        GError      **error)
+{
+  g_autoptr (GVariant) appdata               = NULL;
+  g_autoptr (GBytes) compressed              = NULL;
+  g_autoptr (GInputStream) input             = NULL;
+  g_autoptr (GZlibDecompressor) decompressor = NULL;
+  g_autoptr (GInputStream) converted         = NULL;
+  g_autoptr (GOutputStream) output           = NULL;
+  gssize spliced                             = 0;
+  g_autoptr (GBytes) xml                     = NULL;
+  g_autoptr (AsMetadata) metadata            = NULL;
+  gboolean result                            = FALSE;
+
+  appdata = g_variant_lookup_value (header, "appdata", G_VARIANT_TYPE_BYTESTRING);
+  if (appdata == NULL)
+    return NULL;
+
+  compressed   = g_variant_get_data_as_bytes (appdata);
+  input        = g_memory_input_stream_new_from_bytes (compressed);
+  decompressor = g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+  converted    = g_converter_input_stream_new (input, G_CONVERTER (decompressor));
+  output       = g_memory_output_stream_new_resizable ();
+  spliced      = g_output_stream_splice (
+      output,
+      converted,
+      G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+          G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+      cancellable,
+      error);
+  if (spliced < 0)
+    return NULL;
+  xml = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output));
+
+  metadata = as_metadata_new ();
+  as_metadata_set_format_style (metadata, AS_FORMAT_STYLE_CATALOG);
+  result = as_metadata_parse_data (
+      metadata,
+      g_bytes_get_data (xml, NULL),
+      g_bytes_get_size (xml),
+      AS_FORMAT_KIND_XML,
+      error);
+  if (!result)
+    return NULL;
+
+  return bz_object_maybe_ref (as_metadata_get_component (metadata));
+}
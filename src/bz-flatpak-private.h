@@ -55,7 +55,19 @@ bz_flatpak_entry_new_for_ref (FlatpakRef    *ref,
                               const char    *appstream_dir,
                               GError       **error);
 
+BzFlatpakEntry *
+bz_flatpak_entry_new_for_bundle (FlatpakRef  *ref,
+                                 GVariant    *header,
+                                 GFile       *file,
+                                 gboolean     user,
+                                 AsComponent *component,
+                                 const char  *appstream_dir,
+                                 GError     **error);
+
 FlatpakRef *
 bz_flatpak_entry_get_ref (BzFlatpakEntry *self);
 
+GFile *
+bz_flatpak_entry_get_bundle_file (BzFlatpakEntry *self);
+
 G_END_DECLS
@@ -20,19 +20,24 @@
 
 #define G_LOG_DOMAIN "BAZAAR::GLOBAL-NET"
 
+#define SHAPE_CHUNK_SIZE (64 * 1024)
+
 #include <json-glib/json-glib.h>
 
 #include "bz-env.h"
 #include "bz-global-net.h"
 #include "bz-util.h"
 
+G_DEFINE_QUARK (bz-bandwidth-class, bandwidth_class);
+
 BZ_DEFINE_DATA (
     http_request,
     HttpRequest,
     {
-      SoupMessage   *message;
-      GOutputStream *splice_into;
-      gboolean       close_output;
+      SoupMessage     *message;
+      GOutputStream   *splice_into;
+      gboolean         close_output;
+      BzBandwidthClass klass;
     },
     BZ_RELEASE_DATA (message, g_object_unref);
     BZ_RELEASE_DATA (splice_into, g_object_unref));
@@ -41,9 +46,9 @@ static DexFuture *
 http_send_fiber (HttpRequestData *data);
 
 static void
-http_send_and_splice_finish (GObject      *object,
-                             GAsyncResult *result,
-                             gpointer      user_data);
+http_send_finish (GObject      *object,
+                  GAsyncResult *result,
+                  gpointer      user_data);
 
 static DexFuture *
 query_json_source_then (DexFuture     *future,
@@ -55,9 +60,10 @@ send (SoupMessage   *message,
       gboolean       close_output);
 
 static DexFuture *
-query_flathub_v2_json_with_method (const char *request,
-                                   const char *method,
-                                   const char *token);
+query_flathub_v2_json_with_method (const char      *request,
+                                   const char      *method,
+                                   const char      *token,
+                                   BzBandwidthClass klass);
 
 DexFuture *
 bz_send_with_global_http_session (SoupMessage *message)
@@ -75,8 +81,34 @@ bz_send_with_global_http_session_then_splice_into (SoupMessage   *message,
   return send (message, output, TRUE);
 }
 
+void
+bz_set_message_bandwidth_class (SoupMessage     *message,
+                                BzBandwidthClass klass)
+{
+  static const SoupMessagePriority priorities[] = {
+    [BZ_BANDWIDTH_CLASS_INTERACTIVE]   = SOUP_MESSAGE_PRIORITY_HIGH,
+    [BZ_BANDWIDTH_CLASS_VISIBLE_MEDIA] = SOUP_MESSAGE_PRIORITY_NORMAL,
+    [BZ_BANDWIDTH_CLASS_BACKGROUND]    = SOUP_MESSAGE_PRIORITY_LOW,
+    [BZ_BANDWIDTH_CLASS_PREFETCH]      = SOUP_MESSAGE_PRIORITY_VERY_LOW,
+  };
+
+  g_return_if_fail (SOUP_IS_MESSAGE (message));
+  g_return_if_fail (klass < BZ_BANDWIDTH_N_CLASSES);
+
+  /* The session orders its queue by priority, the class paces the body */
+  soup_message_set_priority (message, priorities[klass]);
+  g_object_set_qdata (G_OBJECT (message), bandwidth_class_quark (), GUINT_TO_POINTER (klass + 1));
+}
+
 DexFuture *
 bz_https_query_json (const char *uri)
+{
+  return bz_https_query_json_with_class (uri, BZ_BANDWIDTH_CLASS_INTERACTIVE);
+}
+
+DexFuture *
+bz_https_query_json_with_class (const char      *uri,
+                                BzBandwidthClass klass)
 {
   g_autoptr (GError) local_error   = NULL;
   g_autoptr (SoupMessage) message  = NULL;
@@ -89,6 +121,7 @@ bz_https_query_json (const char *uri)
   message = soup_message_new (SOUP_METHOD_GET, uri);
   headers = soup_message_get_request_headers (message);
   soup_message_headers_append (headers, "User-Agent", "Bazaar");
+  bz_set_message_bandwidth_class (message, klass);
 
   output = g_memory_output_stream_new_resizable ();
 
@@ -104,7 +137,8 @@ DexFuture *
 bz_query_flathub_v2_json (const char *request)
 {
   dex_return_error_if_fail (request != NULL);
-  return query_flathub_v2_json_with_method (request, SOUP_METHOD_GET, NULL);
+  return query_flathub_v2_json_with_method (
+      request, SOUP_METHOD_GET, NULL, BZ_BANDWIDTH_CLASS_INTERACTIVE);
 }
 
 DexFuture *
@@ -120,12 +154,27 @@ bz_query_flathub_v2_json_take (char *request)
   return future;
 }
 
+DexFuture *
+bz_query_flathub_v2_json_take_with_class (char            *request,
+                                          BzBandwidthClass klass)
+{
+  DexFuture *future = NULL;
+
+  dex_return_error_if_fail (request != NULL);
+
+  future = query_flathub_v2_json_with_method (request, SOUP_METHOD_GET, NULL, klass);
+  g_free (request);
+
+  return future;
+}
+
 DexFuture *
 bz_query_flathub_v2_json_authenticated (const char *request,
                                         const char *token)
 {
   dex_return_error_if_fail (request != NULL);
-  return query_flathub_v2_json_with_method (request, SOUP_METHOD_GET, token);
+  return query_flathub_v2_json_with_method (
+      request, SOUP_METHOD_GET, token, BZ_BANDWIDTH_CLASS_INTERACTIVE);
 }
 
 DexFuture *
@@ -133,7 +182,8 @@ bz_query_flathub_v2_json_authenticated_post (const char *request,
                                              const char *token)
 {
   dex_return_error_if_fail (request != NULL);
-  return query_flathub_v2_json_with_method (request, SOUP_METHOD_POST, token);
+  return query_flathub_v2_json_with_method (
+      request, SOUP_METHOD_POST, token, BZ_BANDWIDTH_CLASS_INTERACTIVE);
 }
 
 DexFuture *
@@ -141,13 +191,15 @@ bz_query_flathub_v2_json_authenticated_delete (const char *request,
                                                const char *token)
 {
   dex_return_error_if_fail (request != NULL);
-  return query_flathub_v2_json_with_method (request, SOUP_METHOD_DELETE, token);
+  return query_flathub_v2_json_with_method (
+      request, SOUP_METHOD_DELETE, token, BZ_BANDWIDTH_CLASS_INTERACTIVE);
 }
 
 static DexFuture *
-query_flathub_v2_json_with_method (const char *request,
-                                   const char *method,
-                                   const char *token)
+query_flathub_v2_json_with_method (const char      *request,
+                                   const char      *method,
+                                   const char      *token,
+                                   BzBandwidthClass klass)
 {
   g_autofree char *uri             = NULL;
   g_autoptr (SoupMessage) message  = NULL;
@@ -160,6 +212,7 @@ query_flathub_v2_json_with_method (const char *request,
   headers = soup_message_get_request_headers (message);
 
   soup_message_headers_append (headers, "User-Agent", "Bazaar");
+  bz_set_message_bandwidth_class (message, klass);
 
   if (token != NULL && token[0] != '\0')
     {
@@ -182,58 +235,102 @@ query_flathub_v2_json_with_method (const char *request,
 static DexFuture *
 http_send_fiber (HttpRequestData *data)
 {
-  static SoupSession      *session      = NULL;
-  SoupMessage             *message      = data->message;
-  GOutputStream           *splice_into  = data->splice_into;
-  gboolean                 close_output = data->close_output;
-  GOutputStreamSpliceFlags splice_flags = G_OUTPUT_STREAM_SPLICE_NONE;
-  g_autoptr (DexPromise) promise        = NULL;
+  static SoupSession *session     = NULL;
+  SoupMessage        *message     = data->message;
+  GOutputStream      *splice_into = data->splice_into;
+  g_autoptr (GError) local_error  = NULL;
+  g_autoptr (DexPromise) promise  = NULL;
+  g_autoptr (GInputStream) input  = NULL;
+  g_autofree guint8 *buffer       = NULL;
+  guint64            total        = 0;
 
   if (g_once_init_enter_pointer (&session))
     g_once_init_leave_pointer (&session, soup_session_new ());
 
-  splice_flags = G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE;
-  if (close_output)
-    splice_flags |= G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET;
-
   promise = dex_promise_new_cancellable ();
-  soup_session_send_and_splice_async (
+  soup_session_send_async (
       session,
       message,
-      splice_into,
-      splice_flags,
       G_PRIORITY_DEFAULT_IDLE,
       dex_promise_get_cancellable (promise),
-      http_send_and_splice_finish,
+      http_send_finish,
       dex_ref (promise));
+  input = dex_await_object (DEX_FUTURE (g_steal_pointer (&promise)), &local_error);
+  if (input == NULL)
+    {
+      g_debug ("Could not send http request: %s", local_error->message);
+      return dex_future_new_for_error (g_steal_pointer (&local_error));
+    }
+
+  /* Copy the body ourselves instead of splicing, so every chunk can be
+     paced by its bandwidth class */
+  buffer = g_malloc (SHAPE_CHUNK_SIZE);
+  for (;;)
+    {
+      gint64 bytes_read = 0;
+      gsize  offset     = 0;
+
+      bytes_read = dex_await_int64 (
+          dex_input_stream_read (
+              input, buffer, SHAPE_CHUNK_SIZE,
+              G_PRIORITY_DEFAULT_IDLE),
+          &local_error);
+      if (bytes_read < 0)
+        goto err;
+      if (bytes_read == 0)
+        break;
+
+      dex_await (bz_bandwidth_acquire (data->klass, bytes_read), NULL);
+
+      while (splice_into != NULL && offset < (gsize) bytes_read)
+        {
+          gint64 bytes_written = 0;
+
+          bytes_written = dex_await_int64 (
+              dex_output_stream_write (
+                  splice_into,
+                  buffer + offset,
+                  bytes_read - offset,
+                  G_PRIORITY_DEFAULT_IDLE),
+              &local_error);
+          if (bytes_written < 0)
+            goto err;
+          offset += bytes_written;
+        }
+      total += bytes_read;
+    }
 
-  return DEX_FUTURE (g_steal_pointer (&promise));
+  dex_await (dex_input_stream_close (input, G_PRIORITY_DEFAULT_IDLE), NULL);
+  if (splice_into != NULL && data->close_output &&
+      !dex_await (dex_output_stream_close (splice_into, G_PRIORITY_DEFAULT_IDLE), &local_error))
+    goto err;
+
+  g_debug ("Copied %" G_GUINT64_FORMAT " bytes from http reply into output stream", total);
+  return dex_future_new_for_uint64 (total);
+
+err:
+  g_debug ("Could not copy http reply into output stream: %s", local_error->message);
+  return dex_future_new_for_error (g_steal_pointer (&local_error));
 }
 
 static void
-http_send_and_splice_finish (GObject      *object,
-                             GAsyncResult *result,
-                             gpointer      user_data)
+http_send_finish (GObject      *object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
 {
   DexPromise *promise            = user_data;
   g_autoptr (GError) local_error = NULL;
-  gssize bytes_written           = 0;
+  g_autoptr (GInputStream) input = NULL;
 
   g_assert (SOUP_IS_SESSION (object));
   g_assert (G_IS_ASYNC_RESULT (result));
   g_assert (DEX_IS_PROMISE (promise));
 
-  bytes_written = soup_session_send_and_splice_finish (SOUP_SESSION (object), result, &local_error);
-  if (bytes_written >= 0)
-    {
-      g_debug ("Spliced %zu bytes from http reply into output stream", bytes_written);
-      dex_promise_resolve_uint64 (promise, bytes_written);
-    }
+  input = soup_session_send_finish (SOUP_SESSION (object), result, &local_error);
+  if (input != NULL)
+    dex_promise_resolve_object (promise, g_steal_pointer (&input));
   else
-    {
-      g_debug ("Could not splice http reply into output stream: %s", local_error->message);
-      dex_promise_reject (promise, g_steal_pointer (&local_error));
-    }
+    dex_promise_reject (promise, g_steal_pointer (&local_error));
 
   dex_unref (promise);
 }
@@ -272,6 +369,7 @@ send (SoupMessage   *message,
       gboolean       close_output)
 {
   g_autoptr (HttpRequestData) data = NULL;
+  guint klass                      = 0;
   g_autoptr (DexFuture) future     = NULL;
 
   data               = http_request_data_new ();
@@ -279,6 +377,13 @@ send (SoupMessage   *message,
   data->splice_into  = bz_object_maybe_ref (splice_into);
   data->close_output = close_output;
 
+  /* Stored off by one, so unmarked messages come out as interactive */
+  klass = GPOINTER_TO_UINT (g_object_get_qdata (G_OBJECT (message), bandwidth_class_quark ()));
+  if (klass > 0)
+    data->klass = klass - 1;
+  else
+    data->klass = BZ_BANDWIDTH_CLASS_INTERACTIVE;
+
   future = dex_scheduler_spawn (
       dex_scheduler_get_default (),
       bz_get_dex_stack_size (),
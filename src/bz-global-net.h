@@ -23,8 +23,15 @@
 #include <libdex.h>
 #include <libsoup/soup.h>
 
+#include "bz-bandwidth.h"
+
 G_BEGIN_DECLS
 
+/* Messages without a class are treated as interactive */
+void
+bz_set_message_bandwidth_class (SoupMessage     *message,
+                                BzBandwidthClass klass);
+
 DexFuture *
 bz_send_with_global_http_session (SoupMessage *message);
 
@@ -35,6 +42,10 @@ bz_send_with_global_http_session_then_splice_into (SoupMessage   *message,
 DexFuture *
 bz_https_query_json (const char *uri);
 
+DexFuture *
+bz_https_query_json_with_class (const char      *uri,
+                                BzBandwidthClass klass);
+
 DexFuture *
 bz_query_flathub_v2_json (const char *request);
 
@@ -52,4 +63,8 @@ bz_query_flathub_v2_json_authenticated_delete (const char *request,
 DexFuture *
 bz_query_flathub_v2_json_take (char *request);
 
+DexFuture *
+bz_query_flathub_v2_json_take_with_class (char            *request,
+                                          BzBandwidthClass klass);
+
 G_END_DECLS
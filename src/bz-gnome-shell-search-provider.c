@@ -18,8 +18,32 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#define G_LOG_DOMAIN  "BAZAAR::SEARCH-PROVIDER"
+#define BAZAAR_MODULE "search-provider"
+
+/* The snapshot is a self-contained, read-only index: a format version
+ * followed by rows sorted by id. Nothing in it refers back to the
+ * application, so anything able to map the file can answer metas. */
+#define SNAPSHOT_BASENAME        "snapshot"
+#define SNAPSHOT_VERSION         2
+#define SNAPSHOT_FORMAT          "(ua(ssssbay))"
+#define SNAPSHOT_ROWS_FORMAT     "a(ssssbay)"
+#define SNAPSHOT_ICON_SIZE       24
+#define SNAPSHOT_ICON_BYTES      (SNAPSHOT_ICON_SIZE * SNAPSHOT_ICON_SIZE * 4)
+#define MAX_SNAPSHOT_SNIPPET     160
+#define MAX_SNAPSHOT_RESULTS     32
+#define SNAPSHOT_FIELD_ID        0
+#define SNAPSHOT_FIELD_TITLE     1
+#define SNAPSHOT_FIELD_DESC      2
+#define SNAPSHOT_FIELD_FOLDED    3
+#define SNAPSHOT_FIELD_INST      4
+#define SNAPSHOT_FIELD_ICON      5
+
 #include "bz-gnome-shell-search-provider.h"
 #include "bz-entry-group.h"
+#include "bz-env.h"
+#include "bz-io.h"
+#include "bz-search-fold.h"
 #include "bz-search-result.h"
 #include "bz-util.h"
 #include "gs-shell-search-provider-generated.h"
@@ -30,11 +54,18 @@ struct _BzGnomeShellSearchProvider
 
   BzSearchEngine  *engine;
   GDBusConnection *connection;
+  char           **facets;
 
   BzShellSearchProvider2 *skeleton;
   DexFuture              *task;
 
   GHashTable *last_results;
+
+  /* Metas are looked up here first. Until an engine is set, queries are
+     answered from it too. Each row is (id, title, description snippet,
+     folded haystack, installed, 24x24 RGBA pixels). */
+  GMappedFile *snapshot_file;
+  GVariant    *snapshot;
 };
 
 G_DEFINE_FINAL_TYPE (BzGnomeShellSearchProvider, bz_gnome_shell_search_provider, G_TYPE_OBJECT);
@@ -69,6 +100,32 @@ start_request (BzGnomeShellSearchProvider *self,
                GDBusMethodInvocation      *invocation,
                const char *const          *terms);
 
+static GVariant *
+query_snapshot (BzGnomeShellSearchProvider *self,
+                const char *const          *terms);
+
+static GVariant *
+lookup_snapshot_row (BzGnomeShellSearchProvider *self,
+                     const char                 *id);
+
+static int
+cmp_row_id (GVariant **a,
+            GVariant **b);
+
+static void
+add_snapshot_meta (GVariantBuilder *builder,
+                   GVariant        *row);
+
+static GVariant *
+load_icon_pixels (const char *path);
+
+static DexFuture *
+save_snapshot_fiber (GPtrArray *rows);
+
+static DexFuture *
+save_snapshot_then (DexFuture *future,
+                    GWeakRef  *wr);
+
 static void
 bz_gnome_shell_search_provider_dispose (GObject *object)
 {
@@ -78,8 +135,11 @@ bz_gnome_shell_search_provider_dispose (GObject *object)
 
   g_clear_object (&self->engine);
   g_clear_object (&self->connection);
+  g_clear_pointer (&self->facets, g_strfreev);
   g_clear_object (&self->skeleton);
   g_clear_pointer (&self->last_results, g_hash_table_unref);
+  g_clear_pointer (&self->snapshot, g_variant_unref);
+  g_clear_pointer (&self->snapshot_file, g_mapped_file_unref);
 
   G_OBJECT_CLASS (bz_gnome_shell_search_provider_parent_class)->dispose (object);
 }
@@ -185,12 +245,22 @@ get_result_metas (BzShellSearchProvider2     *skeleton,
 
   for (char **result = results; *result != NULL; result++)
     {
+      g_autoptr (GVariant) row                 = NULL;
       BzEntryGroup *group                      = NULL;
       g_autoptr (GVariantBuilder) meta_builder = NULL;
       const char *title                        = NULL;
       const char *description                  = NULL;
       GIcon      *icon                         = NULL;
 
+      /* Answer from the mapped index when possible so the shell never
+         waits on the live catalog */
+      row = lookup_snapshot_row (self, *result);
+      if (row != NULL)
+        {
+          add_snapshot_meta (builder, row);
+          continue;
+        }
+
       group = g_hash_table_lookup (self->last_results, *result);
       if (group == NULL)
         {
@@ -317,6 +387,148 @@ bz_gnome_shell_search_provider_set_engine (BzGnomeShellSearchProvider *self,
   g_object_notify_by_pspec (G_OBJECT (self), props[PROP_ENGINE]);
 }
 
+void
+bz_gnome_shell_search_provider_set_facets (BzGnomeShellSearchProvider *self,
+                                           const char *const          *facets)
+{
+  g_return_if_fail (BZ_IS_GNOME_SHELL_SEARCH_PROVIDER (self));
+
+  g_clear_pointer (&self->facets, g_strfreev);
+  if (facets != NULL)
+    self->facets = g_strdupv ((gchar **) facets);
+}
+
+gboolean
+bz_gnome_shell_search_provider_load_snapshot (BzGnomeShellSearchProvider *self,
+                                              GError                    **error)
+{
+  g_autofree char *module_dir    = NULL;
+  g_autofree char *path          = NULL;
+  g_autoptr (GMappedFile) mapped = NULL;
+  g_autoptr (GBytes) bytes       = NULL;
+  g_autoptr (GVariant) snapshot  = NULL;
+  guint32 version                = 0;
+
+  g_return_val_if_fail (BZ_IS_GNOME_SHELL_SEARCH_PROVIDER (self), FALSE);
+
+  module_dir = bz_dup_module_dir ();
+  path       = g_build_filename (module_dir, SNAPSHOT_BASENAME, NULL);
+  mapped     = g_mapped_file_new (path, FALSE, error);
+  if (mapped == NULL)
+    return FALSE;
+
+  bytes    = g_mapped_file_get_bytes (mapped);
+  snapshot = g_variant_new_from_bytes (G_VARIANT_TYPE (SNAPSHOT_FORMAT), bytes, FALSE);
+  g_variant_ref_sink (snapshot);
+
+  g_variant_get_child (snapshot, 0, "u", &version);
+  if (version != SNAPSHOT_VERSION)
+    {
+      g_set_error (
+          error,
+          G_IO_ERROR,
+          G_IO_ERROR_INVALID_DATA,
+          "Search snapshot %s has version %u, expected %u",
+          path, version, SNAPSHOT_VERSION);
+      return FALSE;
+    }
+
+  g_clear_pointer (&self->snapshot, g_variant_unref);
+  g_clear_pointer (&self->snapshot_file, g_mapped_file_unref);
+  self->snapshot      = g_variant_get_child_value (snapshot, 1);
+  self->snapshot_file = g_steal_pointer (&mapped);
+
+  g_debug ("Loaded a search snapshot with %zu groups from %s",
+           g_variant_n_children (self->snapshot), path);
+  return TRUE;
+}
+
+DexFuture *
+bz_gnome_shell_search_provider_save_snapshot (BzGnomeShellSearchProvider *self,
+                                              GListModel                 *groups)
+{
+  g_autoptr (GPtrArray) rows = NULL;
+  guint n_groups             = 0;
+  DexFuture *future          = NULL;
+
+  g_return_val_if_fail (BZ_IS_GNOME_SHELL_SEARCH_PROVIDER (self), NULL);
+  g_return_val_if_fail (G_IS_LIST_MODEL (groups), NULL);
+
+  /* Collect the strings here, the icons are decoded on the io thread */
+  rows     = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  n_groups = g_list_model_get_n_items (groups);
+  for (guint i = 0; i < n_groups; i++)
+    {
+      g_autoptr (BzEntryGroup) group = NULL;
+      g_autoptr (GString) folded     = NULL;
+      const char *title              = NULL;
+      const char *description        = NULL;
+      g_autofree char *snippet       = NULL;
+      GIcon           *mini_icon     = NULL;
+      g_autofree char *icon_path     = NULL;
+
+      group = g_list_model_get_item (groups, i);
+      title = bz_entry_group_get_title (group);
+      if (title == NULL)
+        continue;
+
+      description = bz_entry_group_get_description (group);
+      if (description != NULL &&
+          g_utf8_strlen (description, -1) > MAX_SNAPSHOT_SNIPPET)
+        {
+          g_autofree char *truncated = NULL;
+
+          truncated = g_utf8_substring (description, 0, MAX_SNAPSHOT_SNIPPET - 1);
+          snippet   = g_strconcat (truncated, "…", NULL);
+        }
+      else
+        snippet = g_strdup (description != NULL ? description : "");
+
+      mini_icon = bz_entry_group_get_mini_icon (group);
+      if (G_IS_FILE_ICON (mini_icon))
+        icon_path = g_file_get_path (g_file_icon_get_file (G_FILE_ICON (mini_icon)));
+
+      /* The title comes first so a prefix match can rank it higher */
+      folded = g_string_new (NULL);
+      for (guint field = 0; field < BZ_ENTRY_GROUP_N_SEARCH_FIELDS; field++)
+        {
+          const char *text = NULL;
+
+          text = bz_entry_group_get_folded_search_field (group, field);
+          if (text == NULL)
+            continue;
+          if (folded->len > 0)
+            g_string_append_c (folded, '\n');
+          g_string_append (folded, text);
+        }
+
+      g_ptr_array_add (
+          rows,
+          g_variant_ref_sink (g_variant_new (
+              "(ssssbs)",
+              bz_entry_group_get_id (group),
+              title,
+              snippet,
+              folded->str,
+              bz_entry_group_get_removable (group) > 0,
+              icon_path != NULL ? icon_path : "")));
+    }
+  g_ptr_array_sort (rows, (GCompareFunc) cmp_row_id);
+
+  future = dex_scheduler_spawn (
+      bz_get_io_scheduler (),
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) save_snapshot_fiber,
+      g_steal_pointer (&rows),
+      (GDestroyNotify) g_ptr_array_unref);
+  future = dex_future_then (
+      future,
+      (DexFutureCallback) save_snapshot_then,
+      bz_track_weak (self),
+      bz_weak_release);
+  return future;
+}
+
 GDBusConnection *
 bz_gnome_shell_search_provider_get_connection (BzGnomeShellSearchProvider *self)
 {
@@ -436,11 +648,17 @@ start_request (BzGnomeShellSearchProvider *self,
 
   if (self->engine == NULL)
     {
-      g_warning ("search provider does not have an engine, "
-                 "returning empty response to invocation");
-      g_dbus_method_invocation_return_value (
-          invocation,
-          g_variant_new ("(as)", NULL));
+      if (self->snapshot != NULL)
+        g_dbus_method_invocation_return_value (
+            invocation, query_snapshot (self, terms));
+      else
+        {
+          g_warning ("search provider does not have an engine, "
+                     "returning empty response to invocation");
+          g_dbus_method_invocation_return_value (
+              invocation,
+              g_variant_new ("(as)", NULL));
+        }
       return;
     }
 
@@ -450,11 +668,293 @@ start_request (BzGnomeShellSearchProvider *self,
   data->application = g_application_get_default ();
   g_application_hold (data->application);
 
-  future = bz_search_engine_query (self->engine, terms);
+  future = bz_search_engine_query_faceted (
+      self->engine, terms,
+      (const char *const *) self->facets, NULL);
   future = dex_future_finally (
       future, (DexFutureCallback) request_finally,
       request_data_ref (data), request_data_unref);
   self->task = g_steal_pointer (&future);
 }
 
+static GVariant *
+query_snapshot (BzGnomeShellSearchProvider *self,
+                const char *const          *terms)
+{
+  g_autoptr (GPtrArray) folded_terms  = NULL;
+  g_autoptr (GPtrArray) prefixed      = NULL;
+  g_autoptr (GPtrArray) others        = NULL;
+  gsize n_rows                        = 0;
+  g_autoptr (GVariantBuilder) builder = NULL;
+
+  folded_terms = g_ptr_array_new_with_free_func (g_free);
+  for (guint i = 0; terms[i] != NULL; i++)
+    g_ptr_array_add (folded_terms, bz_search_fold (terms[i], -1));
+
+  prefixed = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  others   = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  n_rows   = g_variant_n_children (self->snapshot);
+  for (gsize i = 0; i < n_rows; i++)
+    {
+      g_autoptr (GVariant) row = NULL;
+      const char *haystack     = NULL;
+      gboolean    installed    = FALSE;
+      gboolean    matches      = TRUE;
+
+      row = g_variant_get_child_value (self->snapshot, i);
+      g_variant_get_child (row, SNAPSHOT_FIELD_FOLDED, "&s", &haystack);
+      g_variant_get_child (row, SNAPSHOT_FIELD_INST, "b", &installed);
+      if (installed)
+        /* Skip already installed groups */
+        continue;
+
+      for (guint j = 0; matches && j < folded_terms->len; j++)
+        matches = strstr (haystack, g_ptr_array_index (folded_terms, j)) != NULL;
+      if (!matches)
+        continue;
+
+      if (folded_terms->len > 0 &&
+          g_str_has_prefix (haystack, g_ptr_array_index (folded_terms, 0)))
+        g_ptr_array_add (prefixed, g_steal_pointer (&row));
+      else
+        g_ptr_array_add (others, g_steal_pointer (&row));
+
+      if (prefixed->len >= MAX_SNAPSHOT_RESULTS)
+        break;
+    }
+  g_ptr_array_extend_and_steal (prefixed, g_steal_pointer (&others));
+
+  builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
+  for (guint i = 0; i < MIN (prefixed->len, MAX_SNAPSHOT_RESULTS); i++)
+    {
+      const char *id = NULL;
+
+      g_variant_get_child (
+          g_ptr_array_index (prefixed, i),
+          SNAPSHOT_FIELD_ID, "&s", &id);
+      g_variant_builder_add (builder, "s", id);
+    }
+
+  return g_variant_new ("(as)", builder);
+}
+
+static GVariant *
+lookup_snapshot_row (BzGnomeShellSearchProvider *self,
+                     const char                 *id)
+{
+  gsize lo = 0;
+  gsize hi = 0;
+
+  if (self->snapshot == NULL)
+    return NULL;
+
+  /* Rows are sorted by id and child access on a mapped array is constant
+     time, so this never touches more than a few pages */
+  hi = g_variant_n_children (self->snapshot);
+  while (lo < hi)
+    {
+      gsize mid                = 0;
+      g_autoptr (GVariant) row = NULL;
+      const char *row_id       = NULL;
+      int         cmp          = 0;
+
+      mid = lo + (hi - lo) / 2;
+      row = g_variant_get_child_value (self->snapshot, mid);
+      g_variant_get_child (row, SNAPSHOT_FIELD_ID, "&s", &row_id);
+
+      cmp = strcmp (id, row_id);
+      if (cmp == 0)
+        return g_steal_pointer (&row);
+      else if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return NULL;
+}
+
+static int
+cmp_row_id (GVariant **a,
+            GVariant **b)
+{
+  const char *id_a = NULL;
+  const char *id_b = NULL;
+
+  g_variant_get_child (*a, SNAPSHOT_FIELD_ID, "&s", &id_a);
+  g_variant_get_child (*b, SNAPSHOT_FIELD_ID, "&s", &id_b);
+  return strcmp (id_a, id_b);
+}
+
+static void
+add_snapshot_meta (GVariantBuilder *builder,
+                   GVariant        *row)
+{
+  g_autoptr (GVariantBuilder) meta_builder = NULL;
+  const char *id                           = NULL;
+  const char *title                        = NULL;
+  const char *description                  = NULL;
+  g_autoptr (GVariant) pixels              = NULL;
+
+  g_variant_get (
+      row, "(&s&s&s&sb@ay)",
+      &id, &title, &description, NULL, NULL, &pixels);
+
+  meta_builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (meta_builder, "{sv}", "id", g_variant_new_string (id));
+  g_variant_builder_add (meta_builder, "{sv}", "name", g_variant_new_string (title));
+  if (*description != '\0')
+    g_variant_builder_add (meta_builder, "{sv}", "description", g_variant_new_string (description));
+  if (g_variant_n_children (pixels) == SNAPSHOT_ICON_BYTES)
+    g_variant_builder_add (
+        meta_builder, "{sv}", "icon-data",
+        g_variant_new (
+            "(iiibii@ay)",
+            SNAPSHOT_ICON_SIZE,
+            SNAPSHOT_ICON_SIZE,
+            SNAPSHOT_ICON_SIZE * 4,
+            TRUE,
+            8,
+            4,
+            pixels));
+
+  g_variant_builder_add_value (builder, g_variant_builder_end (meta_builder));
+}
+
+static GVariant *
+load_icon_pixels (const char *path)
+{
+  cairo_surface_t *surface = NULL;
+  const guchar    *data    = NULL;
+  int              stride  = 0;
+  g_autofree guchar *rgba  = NULL;
+
+  surface = cairo_image_surface_create_from_png (path);
+  if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS ||
+      cairo_image_surface_get_format (surface) != CAIRO_FORMAT_ARGB32 ||
+      cairo_image_surface_get_width (surface) != SNAPSHOT_ICON_SIZE ||
+      cairo_image_surface_get_height (surface) != SNAPSHOT_ICON_SIZE)
+    {
+      cairo_surface_destroy (surface);
+      return g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, NULL, 0, 1);
+    }
+
+  cairo_surface_flush (surface);
+  data   = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  /* Cairo stores premultiplied native-endian ARGB, the shell wants
+     straight RGBA like a GdkPixbuf */
+  rgba = g_malloc (SNAPSHOT_ICON_BYTES);
+  for (int y = 0; y < SNAPSHOT_ICON_SIZE; y++)
+    {
+      for (int x = 0; x < SNAPSHOT_ICON_SIZE; x++)
+        {
+          guint32 pixel = 0;
+          guint   alpha = 0;
+          guchar *out   = NULL;
+
+          pixel = *(const guint32 *) (data + y * stride + x * 4);
+          alpha = pixel >> 24;
+          out   = rgba + (y * SNAPSHOT_ICON_SIZE + x) * 4;
+
+          if (alpha == 0)
+            memset (out, 0, 4);
+          else
+            {
+              out[0] = (((pixel >> 16) & 0xff) * 255 + alpha / 2) / alpha;
+              out[1] = (((pixel >> 8) & 0xff) * 255 + alpha / 2) / alpha;
+              out[2] = ((pixel & 0xff) * 255 + alpha / 2) / alpha;
+              out[3] = alpha;
+            }
+        }
+    }
+  cairo_surface_destroy (surface);
+
+  return g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, rgba, SNAPSHOT_ICON_BYTES, 1);
+}
+
+static DexFuture *
+save_snapshot_fiber (GPtrArray *rows)
+{
+  g_autoptr (GError) local_error      = NULL;
+  g_autoptr (GVariantBuilder) builder = NULL;
+  g_autoptr (GVariant) snapshot       = NULL;
+  g_autoptr (GBytes) bytes            = NULL;
+  g_autofree char *module_dir         = NULL;
+  g_autoptr (GFile) module_dir_file   = NULL;
+  g_autofree char *path               = NULL;
+  g_autoptr (GFile) file              = NULL;
+  gboolean result                     = FALSE;
+
+  builder = g_variant_builder_new (G_VARIANT_TYPE (SNAPSHOT_ROWS_FORMAT));
+  for (guint i = 0; i < rows->len; i++)
+    {
+      const char *id          = NULL;
+      const char *title       = NULL;
+      const char *description = NULL;
+      const char *folded      = NULL;
+      gboolean    installed   = FALSE;
+      const char *icon_path   = NULL;
+      GVariant   *pixels      = NULL;
+
+      g_variant_get (
+          g_ptr_array_index (rows, i), "(&s&s&s&sb&s)",
+          &id, &title, &description, &folded, &installed, &icon_path);
+
+      if (*icon_path != '\0')
+        pixels = load_icon_pixels (icon_path);
+      else
+        pixels = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, NULL, 0, 1);
+
+      g_variant_builder_add (
+          builder, "(ssssb@ay)",
+          id, title, description, folded, installed, pixels);
+    }
+  snapshot = g_variant_ref_sink (g_variant_new (
+      "(u@" SNAPSHOT_ROWS_FORMAT ")",
+      SNAPSHOT_VERSION,
+      g_variant_builder_end (builder)));
+  bytes = g_variant_get_data_as_bytes (snapshot);
+
+  module_dir      = bz_dup_module_dir ();
+  module_dir_file = g_file_new_for_path (module_dir);
+  result          = dex_await (
+      dex_file_make_directory_with_parents (module_dir_file),
+      &local_error);
+  if (!result &&
+      !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_EXISTS))
+    return dex_future_new_for_error (g_steal_pointer (&local_error));
+  g_clear_error (&local_error);
+
+  /* Replacing goes through a temporary file and a rename, so readers
+     mapping the old snapshot never see a partial write */
+  path   = g_build_filename (module_dir, SNAPSHOT_BASENAME, NULL);
+  file   = g_file_new_for_path (path);
+  result = dex_await (
+      dex_file_replace_contents_bytes (
+          file, bytes, NULL, FALSE,
+          G_FILE_CREATE_REPLACE_DESTINATION),
+      &local_error);
+  if (!result)
+    return dex_future_new_for_error (g_steal_pointer (&local_error));
+
+  return dex_future_new_true ();
+}
+
+static DexFuture *
+save_snapshot_then (DexFuture *future,
+                    GWeakRef  *wr)
+{
+  g_autoptr (BzGnomeShellSearchProvider) self = NULL;
+  g_autoptr (GError) local_error              = NULL;
+
+  bz_weak_get_or_return_reject (self, wr);
+
+  if (!bz_gnome_shell_search_provider_load_snapshot (self, &local_error))
+    return dex_future_new_for_error (g_steal_pointer (&local_error));
+
+  return dex_future_new_true ();
+}
+
 /* End of bz-gnome-shell-search-provider.c */
@@ -37,6 +37,12 @@ void
 bz_gnome_shell_search_provider_set_engine (BzGnomeShellSearchProvider *self,
                                            BzSearchEngine             *engine);
 
+/* Engine queries are constrained to these, see
+   bz_search_engine_query_faceted() */
+void
+bz_gnome_shell_search_provider_set_facets (BzGnomeShellSearchProvider *self,
+                                           const char *const          *facets);
+
 GDBusConnection *
 bz_gnome_shell_search_provider_get_connection (BzGnomeShellSearchProvider *self);
 
@@ -45,6 +51,16 @@ bz_gnome_shell_search_provider_set_connection (BzGnomeShellSearchProvider *self,
                                                GDBusConnection            *connection,
                                                GError                    **error);
 
+/* Maps the snapshot index written after the last sync. Metas are served
+   from it directly, and queries too until an engine is set. */
+gboolean
+bz_gnome_shell_search_provider_load_snapshot (BzGnomeShellSearchProvider *self,
+                                              GError                    **error);
+
+DexFuture *
+bz_gnome_shell_search_provider_save_snapshot (BzGnomeShellSearchProvider *self,
+                                              GListModel                 *groups);
+
 G_END_DECLS
 
 /* End of bz-gnome-shell-search-provider.h */
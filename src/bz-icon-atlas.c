@@ -0,0 +1,696 @@
+/* bz-icon-atlas.c
+ *
+ * Copyright 2025 Adam Masciola
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN  "BAZAAR::ICON-ATLAS"
+#define BAZAAR_MODULE "icon-atlas"
+
+/* One file holding a format version and rows sorted by key:
+ * (key, birth stamp, width, height, stride, GdkMemoryFormat, pixels)
+ *
+ * Flushes only append to a journal of size-prefixed rows next to it, and
+ * the two are merged back into one sorted file once the journal grows
+ * past MAX_JOURNAL_BYTES. */
+#define ATLAS_BASENAME         "atlas"
+#define ATLAS_JOURNAL_BASENAME "atlas.journal"
+#define ATLAS_VERSION          1
+#define ATLAS_FORMAT           "(ua(sxuuuuay))"
+#define ATLAS_ROWS_FORMAT      "a(sxuuuuay)"
+#define ATLAS_ROW_FORMAT       "(sxuuuuay)"
+#define ATLAS_FIELD_KEY        0
+#define ATLAS_FIELD_BIRTH      1
+#define ATLAS_FIELD_PIXELS     6
+#define ATLAS_FLUSH_DELAY_SEC  3
+#define MAX_ATLAS_BYTES        (64 * 1024 * 1024)
+#define MAX_JOURNAL_BYTES      (8 * 1024 * 1024)
+
+/* Rows are padded so that each one starts 8-byte aligned */
+#define JOURNAL_PADDING(size) ((8 - (size) % 8) % 8)
+
+/* Written next to each cached file by bz-async-texture.c */
+#define ASYNC_TEX_DATA_SUFFIX ".bz-async-texture-data"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <libdex.h>
+
+#include "bz-env.h"
+#include "bz-icon-atlas.h"
+#include "bz-io.h"
+#include "bz-util.h"
+
+static GMutex       atlas_mutex        = { 0 };
+static gboolean     atlas_loaded       = FALSE;
+static GMappedFile *atlas_file         = NULL;
+static GVariant    *atlas_rows         = NULL;
+static GHashTable  *atlas_journal      = NULL;
+static gsize        atlas_journal_size = 0;
+static gboolean     atlas_journal_torn = FALSE;
+static GHashTable  *atlas_pending      = NULL;
+static gboolean     atlas_flush_queued = FALSE;
+
+static void
+ensure_loaded (void);
+
+static void
+map_atlas (void);
+
+static void
+load_journal (void);
+
+static void
+queue_flush_locked (void);
+
+static GVariant *
+lookup_row (const char *key);
+
+static int
+cmp_row_key (GVariant **a,
+             GVariant **b);
+
+static GHashTable *
+copy_rows (GHashTable *rows,
+           gsize      *n_bytes);
+
+static gboolean
+row_is_current (GVariant *row);
+
+static void
+add_merged_row (GPtrArray  *rows,
+                GHashTable *seen,
+                GVariant   *row,
+                gboolean    check_birth,
+                gsize      *total_bytes);
+
+static gboolean
+append_journal (GHashTable *rows,
+                gsize      *n_appended,
+                GError    **error);
+
+static gboolean
+compact_atlas (GHashTable *fresh,
+               GHashTable *journal,
+               GVariant   *old_rows,
+               GError    **error);
+
+static DexFuture *
+flush_fiber (gpointer user_data);
+
+GdkTexture *
+bz_icon_atlas_lookup (const char *key,
+                      gint64      birth)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  g_autoptr (GVariant) row        = NULL;
+  gint64  row_birth               = 0;
+  guint32 width                   = 0;
+  guint32 height                  = 0;
+  guint32 stride                  = 0;
+  guint32 format                  = 0;
+  g_autoptr (GVariant) pixels     = NULL;
+  g_autoptr (GBytes) bytes        = NULL;
+
+  g_return_val_if_fail (key != NULL, NULL);
+
+  if (bz_get_icon_atlas_max_size () == 0)
+    return NULL;
+
+  locker = g_mutex_locker_new (&atlas_mutex);
+  ensure_loaded ();
+
+  row = g_hash_table_lookup (atlas_pending, key);
+  if (row == NULL)
+    row = g_hash_table_lookup (atlas_journal, key);
+  if (row != NULL)
+    g_variant_ref (row);
+  else
+    row = lookup_row (key);
+  g_clear_pointer (&locker, g_mutex_locker_free);
+
+  if (row == NULL)
+    return NULL;
+
+  g_variant_get (
+      row, "(&sxuuuu@ay)",
+      NULL, &row_birth, &width, &height,
+      &stride, &format, &pixels);
+  if (row_birth != birth ||
+      width == 0 || height == 0 ||
+      format >= GDK_MEMORY_N_FORMATS ||
+      (guint64) stride * height != g_variant_get_size (pixels))
+    return NULL;
+
+  /* For mapped rows this references the file, nothing is copied */
+  bytes = g_variant_get_data_as_bytes (pixels);
+  return gdk_memory_texture_new (width, height, format, bytes, stride);
+}
+
+void
+bz_icon_atlas_store (const char *key,
+                     gint64      birth,
+                     GdkTexture *texture)
+{
+  guint max_size                              = 0;
+  int   width                                 = 0;
+  int   height                                = 0;
+  g_autoptr (GdkTextureDownloader) downloader = NULL;
+  gsize stride                                = 0;
+  g_autoptr (GBytes) bytes                    = NULL;
+  GVariant *row                               = NULL;
+  g_autoptr (GMutexLocker) locker             = NULL;
+
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (GDK_IS_TEXTURE (texture));
+
+  max_size = bz_get_icon_atlas_max_size ();
+  width    = gdk_texture_get_width (texture);
+  height   = gdk_texture_get_height (texture);
+  if ((guint) width > max_size || (guint) height > max_size)
+    return;
+
+  /* The default format is premultiplied and what gdk uploads without
+     converting */
+  downloader = gdk_texture_downloader_new (texture);
+  gdk_texture_downloader_set_format (downloader, GDK_MEMORY_DEFAULT);
+  bytes = gdk_texture_downloader_download_bytes (downloader, &stride);
+
+  row = g_variant_ref_sink (g_variant_new (
+      "(sxuuuu@ay)",
+      key, birth, width, height, (guint32) stride, GDK_MEMORY_DEFAULT,
+      g_variant_new_from_bytes (G_VARIANT_TYPE_BYTESTRING, bytes, TRUE)));
+
+  locker = g_mutex_locker_new (&atlas_mutex);
+  ensure_loaded ();
+  g_hash_table_replace (atlas_pending, g_strdup (key), row);
+  queue_flush_locked ();
+}
+
+static void
+ensure_loaded (void)
+{
+  if (atlas_loaded)
+    return;
+
+  atlas_journal = g_hash_table_new_full (
+      g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+  atlas_pending = g_hash_table_new_full (
+      g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+  map_atlas ();
+  load_journal ();
+  atlas_loaded = TRUE;
+}
+
+static void
+map_atlas (void)
+{
+  g_autoptr (GError) local_error = NULL;
+  g_autofree char *module_dir    = NULL;
+  g_autofree char *path          = NULL;
+  g_autoptr (GMappedFile) mapped = NULL;
+  g_autoptr (GBytes) bytes       = NULL;
+  g_autoptr (GVariant) atlas     = NULL;
+  guint32 version                = 0;
+
+  module_dir = bz_dup_module_dir ();
+  path       = g_build_filename (module_dir, ATLAS_BASENAME, NULL);
+  mapped     = g_mapped_file_new (path, FALSE, &local_error);
+  if (mapped == NULL)
+    {
+      if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Could not map icon atlas at %s: %s", path, local_error->message);
+      return;
+    }
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  atlas = g_variant_new_from_bytes (G_VARIANT_TYPE (ATLAS_FORMAT), bytes, FALSE);
+  g_variant_ref_sink (atlas);
+
+  g_variant_get_child (atlas, 0, "u", &version);
+  if (version != ATLAS_VERSION)
+    {
+      g_debug ("Ignoring icon atlas at %s with version %u", path, version);
+      return;
+    }
+
+  /* Textures handed out earlier keep the previous mapping alive */
+  g_clear_pointer (&atlas_rows, g_variant_unref);
+  g_clear_pointer (&atlas_file, g_mapped_file_unref);
+  atlas_rows = g_variant_get_child_value (atlas, 1);
+  atlas_file = g_steal_pointer (&mapped);
+
+  g_debug ("Mapped icon atlas with %zu entries from %s",
+           g_variant_n_children (atlas_rows), path);
+}
+
+static void
+load_journal (void)
+{
+  g_autoptr (GError) local_error = NULL;
+  g_autofree char *module_dir    = NULL;
+  g_autofree char *path          = NULL;
+  g_autoptr (GMappedFile) mapped = NULL;
+  g_autoptr (GBytes) bytes       = NULL;
+  const guint8 *data             = NULL;
+  gsize         size             = 0;
+  gsize         offset           = 0;
+
+  module_dir = bz_dup_module_dir ();
+  path       = g_build_filename (module_dir, ATLAS_JOURNAL_BASENAME, NULL);
+  mapped     = g_mapped_file_new (path, FALSE, &local_error);
+  if (mapped == NULL)
+    {
+      if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        {
+          g_warning ("Could not map icon atlas journal at %s: %s", path, local_error->message);
+          atlas_journal_torn = TRUE;
+        }
+      return;
+    }
+
+  /* The rows reference the mapping, which outlives the file being
+     unlinked on the next compaction */
+  bytes = g_mapped_file_get_bytes (mapped);
+  data  = g_bytes_get_data (bytes, &size);
+  while (size - offset >= sizeof (guint64))
+    {
+      guint64 row_size             = 0;
+      g_autoptr (GBytes) row_bytes = NULL;
+      GVariant   *row              = NULL;
+      const char *key              = NULL;
+
+      memcpy (&row_size, data + offset, sizeof (row_size));
+      row_size = GUINT64_FROM_LE (row_size);
+      offset += sizeof (guint64);
+      if (row_size == 0 ||
+          row_size > size - offset ||
+          JOURNAL_PADDING (row_size) > size - offset - row_size)
+        {
+          offset -= sizeof (guint64);
+          break;
+        }
+
+      row_bytes = g_bytes_new_from_bytes (bytes, offset, row_size);
+      row       = g_variant_ref_sink (g_variant_new_from_bytes (
+          G_VARIANT_TYPE (ATLAS_ROW_FORMAT), row_bytes, FALSE));
+      offset += row_size + JOURNAL_PADDING (row_size);
+
+      /* Later rows for a key replace earlier ones */
+      g_variant_get_child (row, ATLAS_FIELD_KEY, "&s", &key);
+      g_hash_table_replace (atlas_journal, g_strdup (key), row);
+    }
+
+  atlas_journal_size = size;
+  if (offset != size)
+    {
+      /* A flush was cut short; appending after it would misalign every
+         later row, so the next flush compacts instead */
+      g_debug ("Icon atlas journal at %s has a torn tail at %zu", path, offset);
+      atlas_journal_torn = TRUE;
+    }
+
+  g_debug ("Loaded %u icon atlas journal entries from %s",
+           g_hash_table_size (atlas_journal), path);
+}
+
+static void
+queue_flush_locked (void)
+{
+  /* Coalesce the stores of a page worth of icons into one write, and
+     never run two flushes at once */
+  if (atlas_flush_queued)
+    return;
+
+  atlas_flush_queued = TRUE;
+  dex_future_disown (dex_scheduler_spawn (
+      bz_get_io_scheduler (),
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) flush_fiber,
+      NULL, NULL));
+}
+
+static GVariant *
+lookup_row (const char *key)
+{
+  gsize lo = 0;
+  gsize hi = 0;
+
+  if (atlas_rows == NULL)
+    return NULL;
+
+  hi = g_variant_n_children (atlas_rows);
+  while (lo < hi)
+    {
+      gsize mid                = 0;
+      g_autoptr (GVariant) row = NULL;
+      const char *row_key      = NULL;
+      int         cmp          = 0;
+
+      mid = lo + (hi - lo) / 2;
+      row = g_variant_get_child_value (atlas_rows, mid);
+      g_variant_get_child (row, ATLAS_FIELD_KEY, "&s", &row_key);
+
+      cmp = strcmp (key, row_key);
+      if (cmp == 0)
+        return g_steal_pointer (&row);
+      else if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return NULL;
+}
+
+static int
+cmp_row_key (GVariant **a,
+             GVariant **b)
+{
+  const char *key_a = NULL;
+  const char *key_b = NULL;
+
+  g_variant_get_child (*a, ATLAS_FIELD_KEY, "&s", &key_a);
+  g_variant_get_child (*b, ATLAS_FIELD_KEY, "&s", &key_b);
+  return strcmp (key_a, key_b);
+}
+
+static GHashTable *
+copy_rows (GHashTable *rows,
+           gsize      *n_bytes)
+{
+  GHashTable    *copy = NULL;
+  GHashTableIter iter = { 0 };
+  const char    *key  = NULL;
+  GVariant      *row  = NULL;
+
+  copy = g_hash_table_new_full (
+      g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+  g_hash_table_iter_init (&iter, rows);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &key, (gpointer *) &row))
+    {
+      if (n_bytes != NULL)
+        *n_bytes += g_variant_get_size (row);
+      g_hash_table_replace (copy, g_strdup (key), g_variant_ref (row));
+    }
+
+  return copy;
+}
+
+static gboolean
+row_is_current (GVariant *row)
+{
+  const char *key              = NULL;
+  gint64      birth            = 0;
+  gint64      current_birth    = 0;
+  g_autofree char *data_path   = NULL;
+  g_autoptr (GFile) data_file  = NULL;
+  g_autoptr (GBytes) bytes     = NULL;
+  g_autoptr (GVariant) variant = NULL;
+
+  g_variant_get_child (row, ATLAS_FIELD_KEY, "&s", &key);
+  g_variant_get_child (row, ATLAS_FIELD_BIRTH, "x", &birth);
+  if (!g_file_test (key, G_FILE_TEST_EXISTS))
+    return FALSE;
+
+  data_path = g_strdup_printf ("%s" ASYNC_TEX_DATA_SUFFIX, key);
+  data_file = g_file_new_for_path (data_path);
+  bytes     = g_file_load_bytes (data_file, NULL, NULL, NULL);
+  if (bytes == NULL)
+    return FALSE;
+
+  variant = g_variant_new_from_bytes (G_VARIANT_TYPE ("a{sv}"), bytes, FALSE);
+  if (!g_variant_lookup (variant, "birth-unix-stamp", "x", &current_birth))
+    return FALSE;
+
+  return current_birth == birth;
+}
+
+static void
+add_merged_row (GPtrArray  *rows,
+                GHashTable *seen,
+                GVariant   *row,
+                gboolean    check_birth,
+                gsize      *total_bytes)
+{
+  const char *key  = NULL;
+  gsize       size = 0;
+
+  g_variant_get_child (row, ATLAS_FIELD_KEY, "&s", &key);
+  if (!g_hash_table_add (seen, g_strdup (key)))
+    return;
+
+  size = g_variant_get_size (row);
+  if (*total_bytes + size > MAX_ATLAS_BYTES)
+    return;
+  if (check_birth && !row_is_current (row))
+    return;
+
+  *total_bytes += size;
+  g_ptr_array_add (rows, g_variant_ref (row));
+}
+
+static gboolean
+append_journal (GHashTable *rows,
+                gsize      *n_appended,
+                GError    **error)
+{
+  static const guint8 padding[8]       = { 0 };
+  g_autoptr (GByteArray) buffer        = NULL;
+  GHashTableIter iter                  = { 0 };
+  GVariant      *row                   = NULL;
+  g_autofree char *module_dir          = NULL;
+  g_autofree char *path                = NULL;
+  g_autoptr (GFile) file               = NULL;
+  g_autoptr (GFileOutputStream) output = NULL;
+  gboolean result                      = FALSE;
+
+  buffer = g_byte_array_new ();
+  g_hash_table_iter_init (&iter, rows);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &row))
+    {
+      guint64 size   = 0;
+      guint64 header = 0;
+
+      size   = g_variant_get_size (row);
+      header = GUINT64_TO_LE (size);
+      g_byte_array_append (buffer, (const guint8 *) &header, sizeof (header));
+      g_byte_array_append (buffer, g_variant_get_data (row), size);
+      g_byte_array_append (buffer, padding, JOURNAL_PADDING (size));
+    }
+
+  module_dir = bz_dup_module_dir ();
+  if (g_mkdir_with_parents (module_dir, 0755) != 0)
+    {
+      g_set_error (
+          error,
+          G_IO_ERROR,
+          G_IO_ERROR_FAILED,
+          "Could not create %s", module_dir);
+      return FALSE;
+    }
+
+  path   = g_build_filename (module_dir, ATLAS_JOURNAL_BASENAME, NULL);
+  file   = g_file_new_for_path (path);
+  output = g_file_append_to (file, G_FILE_CREATE_NONE, NULL, error);
+  if (output == NULL)
+    return FALSE;
+
+  result = g_output_stream_write_all (
+      G_OUTPUT_STREAM (output),
+      buffer->data,
+      buffer->len,
+      NULL, NULL, error);
+  if (!result)
+    return FALSE;
+  result = g_output_stream_close (G_OUTPUT_STREAM (output), NULL, error);
+  if (!result)
+    return FALSE;
+
+  *n_appended = buffer->len;
+  return TRUE;
+}
+
+static gboolean
+compact_atlas (GHashTable *fresh,
+               GHashTable *journal,
+               GVariant   *old_rows,
+               GError    **error)
+{
+  g_autoptr (GPtrArray) rows          = NULL;
+  g_autoptr (GHashTable) seen         = NULL;
+  gsize total_bytes                   = 0;
+  GHashTableIter iter                 = { 0 };
+  GVariant      *row                  = NULL;
+  g_autoptr (GVariantBuilder) builder = NULL;
+  g_autoptr (GVariant) atlas          = NULL;
+  g_autofree char *module_dir         = NULL;
+  g_autofree char *path               = NULL;
+  g_autofree char *journal_path       = NULL;
+  gboolean result                     = FALSE;
+
+  /* Fresh rows win, then the journal, then whatever of the old atlas still
+     fits. Older rows are dropped once the file they were decoded from is
+     gone or was rewritten with another birth stamp */
+  rows = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_hash_table_iter_init (&iter, fresh);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &row))
+    add_merged_row (rows, seen, row, FALSE, &total_bytes);
+  g_hash_table_iter_init (&iter, journal);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &row))
+    add_merged_row (rows, seen, row, TRUE, &total_bytes);
+  if (old_rows != NULL)
+    {
+      gsize n_old = 0;
+
+      n_old = g_variant_n_children (old_rows);
+      for (gsize i = 0; i < n_old; i++)
+        {
+          g_autoptr (GVariant) old_row = NULL;
+
+          old_row = g_variant_get_child_value (old_rows, i);
+          add_merged_row (rows, seen, old_row, TRUE, &total_bytes);
+        }
+    }
+  g_ptr_array_sort (rows, (GCompareFunc) cmp_row_key);
+
+  builder = g_variant_builder_new (G_VARIANT_TYPE (ATLAS_ROWS_FORMAT));
+  for (guint i = 0; i < rows->len; i++)
+    g_variant_builder_add_value (builder, g_ptr_array_index (rows, i));
+  atlas = g_variant_ref_sink (g_variant_new (
+      "(u@" ATLAS_ROWS_FORMAT ")",
+      ATLAS_VERSION,
+      g_variant_builder_end (builder)));
+
+  module_dir = bz_dup_module_dir ();
+  if (g_mkdir_with_parents (module_dir, 0755) != 0)
+    {
+      g_set_error (
+          error,
+          G_IO_ERROR,
+          G_IO_ERROR_FAILED,
+          "Could not create %s", module_dir);
+      return FALSE;
+    }
+
+  /* Written to a temporary file and renamed over the old atlas, which
+     stays valid for anything still mapping it */
+  path   = g_build_filename (module_dir, ATLAS_BASENAME, NULL);
+  result = g_file_set_contents (
+      path,
+      g_variant_get_data (atlas),
+      g_variant_get_size (atlas),
+      error);
+  if (!result)
+    return FALSE;
+
+  /* Everything in the journal is in the atlas now. Should we die before
+     this, replaying it on the next start is harmless */
+  journal_path = g_build_filename (module_dir, ATLAS_JOURNAL_BASENAME, NULL);
+  if (g_unlink (journal_path) != 0 && errno != ENOENT)
+    {
+      g_set_error (
+          error,
+          G_IO_ERROR,
+          g_io_error_from_errno (errno),
+          "Could not remove %s: %s",
+          journal_path, g_strerror (errno));
+      return FALSE;
+    }
+
+  g_debug ("Compacted icon atlas to %u entries at %s", rows->len, path);
+  return TRUE;
+}
+
+static DexFuture *
+flush_fiber (gpointer user_data)
+{
+  g_autoptr (GError) local_error  = NULL;
+  g_autoptr (GMutexLocker) locker = NULL;
+  g_autoptr (GHashTable) flushing = NULL;
+  g_autoptr (GHashTable) journal  = NULL;
+  g_autoptr (GVariant) old_rows   = NULL;
+  gsize          flushing_bytes   = 0;
+  gsize          n_appended       = 0;
+  gboolean       compact          = FALSE;
+  gboolean       result           = FALSE;
+  GHashTableIter iter             = { 0 };
+  const char    *key              = NULL;
+  GVariant      *row              = NULL;
+
+  dex_await (dex_timeout_new_seconds (ATLAS_FLUSH_DELAY_SEC), NULL);
+
+  locker   = g_mutex_locker_new (&atlas_mutex);
+  flushing = copy_rows (atlas_pending, &flushing_bytes);
+  /* Appending is cheap, but the journal is held in memory and collects
+     replaced rows, so fold it into the sorted atlas once it is large */
+  compact = atlas_journal_torn ||
+            atlas_journal_size + flushing_bytes > MAX_JOURNAL_BYTES;
+  if (compact)
+    {
+      journal  = copy_rows (atlas_journal, NULL);
+      old_rows = bz_maybe_ref (atlas_rows, g_variant_ref);
+    }
+  g_clear_pointer (&locker, g_mutex_locker_free);
+
+  if (compact)
+    result = compact_atlas (flushing, journal, old_rows, &local_error);
+  else
+    result = append_journal (flushing, &n_appended, &local_error);
+
+  locker             = g_mutex_locker_new (&atlas_mutex);
+  atlas_flush_queued = FALSE;
+  if (!result)
+    {
+      g_warning ("Could not write icon atlas: %s", local_error->message);
+      /* A partial append leaves the journal unusable */
+      atlas_journal_torn = TRUE;
+      return dex_future_new_for_error (g_steal_pointer (&local_error));
+    }
+
+  if (compact)
+    {
+      map_atlas ();
+      g_hash_table_remove_all (atlas_journal);
+      atlas_journal_size = 0;
+      atlas_journal_torn = FALSE;
+    }
+  else
+    {
+      g_hash_table_iter_init (&iter, flushing);
+      while (g_hash_table_iter_next (&iter, (gpointer *) &key, (gpointer *) &row))
+        g_hash_table_replace (atlas_journal, g_strdup (key), g_variant_ref (row));
+      atlas_journal_size += n_appended;
+    }
+
+  g_hash_table_iter_init (&iter, flushing);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &key, (gpointer *) &row))
+    {
+      /* Only drop rows that were not replaced while we were writing */
+      if (g_hash_table_lookup (atlas_pending, key) == row)
+        g_hash_table_remove (atlas_pending, key);
+    }
+
+  /* Stores that came in while we were writing */
+  if (g_hash_table_size (atlas_pending) > 0)
+    queue_flush_locked ();
+
+  return dex_future_new_true ();
+}
+
+/* End of bz-icon-atlas.c */
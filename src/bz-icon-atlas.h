@@ -0,0 +1,43 @@
+/* bz-icon-atlas.h
+ *
+ * Copyright 2025 Adam Masciola
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* A persistent cache of decoded pixels for small images, so cached icons
+ * can be turned back into textures without another glycin round trip.
+ * Entries are keyed by the cached file and valid only for the birth
+ * stamp they were stored with. Safe to call from any thread. */
+
+GdkTexture *
+bz_icon_atlas_lookup (const char *key,
+                      gint64      birth);
+
+void
+bz_icon_atlas_store (const char *key,
+                     gint64      birth,
+                     GdkTexture *texture);
+
+G_END_DECLS
+
+/* End of bz-icon-atlas.h */
@@ -76,12 +76,12 @@ bz_newline_parser_real_process_bytes (BzParser *iface_self,
 {
   BzNewlineParser *self             = BZ_NEWLINE_PARSER (iface_self);
   gsize            size             = 0;
-  const guchar    *data             = NULL;
-  g_autofree char *contents         = NULL;
+  const char      *data             = NULL;
+  const char      *data_end         = NULL;
   g_autoptr (GHashTable) set        = NULL;
-  guint n_ids                       = 0;
-  char *beg                         = NULL;
-  char *end                         = NULL;
+  guint       n_ids                 = 0;
+  const char *beg                   = NULL;
+  const char *end                   = NULL;
   g_autoptr (BzHashTableObject) obj = NULL;
   GValue *value                     = NULL;
   g_autoptr (GHashTable) ret        = NULL;
@@ -89,40 +89,36 @@ bz_newline_parser_real_process_bytes (BzParser *iface_self,
   g_return_val_if_fail (BZ_IS_NEWLINE_PARSER (self), NULL);
   g_return_val_if_fail (bytes != NULL, NULL);
 
-  data           = g_bytes_get_data (bytes, &size);
-  contents       = g_memdup2 (data, size + 1);
-  contents[size] = '\0';
+  data     = g_bytes_get_data (bytes, &size);
+  data_end = data + size;
 
+  /* '\n' can never be part of a multibyte UTF-8 sequence, so there is no
+     need to decode anything here. Scanning the bytes in place with memchr()
+     avoids copying the whole blocklist first, and libc vectorizes it */
   set = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-  for (beg = contents, end = g_utf8_strchr (beg, -1, '\n');
-       beg != NULL && *beg != '\0';
-       beg = end + 1, end = g_utf8_strchr (beg, -1, '\n'))
+  for (beg = data; beg < data_end; beg = end + 1)
     {
+      gsize length          = 0;
       g_autofree char *line = NULL;
 
+      end = memchr (beg, '\n', data_end - beg);
       if (end == NULL)
-        g_warning ("Data has no terminating newline");
-      if ((self->comments && g_str_has_prefix (beg, "#")) ||
-          (end != NULL && end - beg <= 1) ||
-          (end == NULL && *beg == '\0'))
         {
-          if (end != NULL)
-            continue;
-          else
-            break;
+          g_warning ("Data has no terminating newline");
+          end = data_end;
         }
+      length = end - beg;
 
-      if (end != NULL)
-        line = g_strndup (beg, end - beg);
-      else
-        line = g_strdup (beg);
+      if ((self->comments && *beg == '#') ||
+          length <= 1)
+        continue;
+
+      line = g_strndup (beg, length);
       if (g_hash_table_contains (set, line))
         g_warning ("Duplicate line %s detected in data", line);
       else
-        g_hash_table_replace (set, g_steal_pointer (&line), NULL);
+        g_hash_table_add (set, g_steal_pointer (&line));
 
-      if (end == NULL)
-        break;
       if (self->max_lines > 0 &&
           ++n_ids > self->max_lines)
         {
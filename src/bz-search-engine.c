@@ -18,17 +18,116 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#include <math.h>
+
 #include "bz-search-engine.h"
 #include "bz-entry-group.h"
 #include "bz-env.h"
+#include "bz-flathub-category.h"
+#include "bz-search-fold.h"
 #include "bz-search-result.h"
 #include "bz-util.h"
 
+/* Only the last few distinct queries are worth remembering; this is mostly
+   there for people retyping "steam" or backspacing over a typo */
+#define MAX_CACHED_QUERIES 32
+
+/* Longer tokens are truncated when indexing, nobody types these */
+#define MAX_TOKEN_LENGTH 64
+
+/* Query terms shorter than this (in bytes) only match at the start of a
+   token, otherwise "e" would match practically the entire catalog. This
+   is also the length of the n-grams infixes are looked up through */
+#define INFIX_MIN_LENGTH 3
+
+/* BM25F parameters, see Robertson & Zaragoza, "The Probabilistic Relevance
+   Framework: BM25 and Beyond" */
+#define BM25_K1 1.2
+
+static const double field_weights[BZ_ENTRY_GROUP_N_SEARCH_FIELDS] = {
+  [BZ_ENTRY_GROUP_SEARCH_FIELD_TITLE]       = 4.0,
+  [BZ_ENTRY_GROUP_SEARCH_FIELD_DEVELOPER]   = 1.5,
+  [BZ_ENTRY_GROUP_SEARCH_FIELD_DESCRIPTION] = 1.0,
+  [BZ_ENTRY_GROUP_SEARCH_FIELD_KEYWORDS]    = 2.5,
+};
+
+static const double field_length_normalization[BZ_ENTRY_GROUP_N_SEARCH_FIELDS] = {
+  [BZ_ENTRY_GROUP_SEARCH_FIELD_TITLE]       = 0.5,
+  [BZ_ENTRY_GROUP_SEARCH_FIELD_DEVELOPER]   = 0.3,
+  [BZ_ENTRY_GROUP_SEARCH_FIELD_DESCRIPTION] = 0.75,
+  [BZ_ENTRY_GROUP_SEARCH_FIELD_KEYWORDS]    = 0.5,
+};
+
+/* How much recent flathub installs may boost an already matching group; the
+   most installed app in the catalog gets the full amount */
+#define POPULARITY_PRIOR_WEIGHT 0.25
+
+typedef struct
+{
+  guint   doc;
+  guint16 tf[BZ_ENTRY_GROUP_N_SEARCH_FIELDS];
+} Posting;
+
+typedef struct
+{
+  guint16 lengths[BZ_ENTRY_GROUP_N_SEARCH_FIELDS];
+  double  prior;
+} DocStats;
+
+BZ_DEFINE_DATA (
+    search_index,
+    SearchIndex,
+    {
+      GPtrArray  *snapshot;
+      GArray     *installs;
+      GMutex      mutex;
+      gboolean    built;
+      GHashTable *id_to_idx;
+      GPtrArray  *vocab;
+      GPtrArray  *postings;
+      GArray     *doc_stats;
+      double      avg_lengths[BZ_ENTRY_GROUP_N_SEARCH_FIELDS];
+      GHashTable *facets;
+      GHashTable *trigrams;
+    },
+    BZ_RELEASE_DATA (snapshot, g_ptr_array_unref);
+    BZ_RELEASE_DATA (installs, g_array_unref);
+    BZ_RELEASE_DATA (id_to_idx, g_hash_table_unref);
+    BZ_RELEASE_DATA (facets, g_hash_table_unref);
+    BZ_RELEASE_DATA (vocab, g_ptr_array_unref);
+    BZ_RELEASE_DATA (postings, g_ptr_array_unref);
+    BZ_RELEASE_DATA (doc_stats, g_array_unref);
+    BZ_RELEASE_DATA (trigrams, g_hash_table_unref);
+    g_mutex_clear (&self->mutex));
+
+BZ_DEFINE_DATA (
+    cached_query,
+    CachedQuery,
+    {
+      char        *key;
+      char        *facets_key;
+      guint64      generation;
+      SearchIndex *index;
+      GArray      *candidates;
+    },
+    BZ_RELEASE_DATA (key, g_free);
+    BZ_RELEASE_DATA (facets_key, g_free);
+    BZ_RELEASE_DATA (index, search_index_data_unref);
+    BZ_RELEASE_DATA (candidates, g_array_unref));
+
 struct _BzSearchEngine
 {
   GObject parent_instance;
 
-  GListModel *model;
+  GListModel   *model;
+  BzStatsStore *stats;
+
+  /* Protects everything below, since queries
+     finish on the thread pool */
+  GMutex       cache_mutex;
+  guint64      generation;
+  SearchIndex *index;
+  GQueue       lru;
 };
 
 G_DEFINE_FINAL_TYPE (BzSearchEngine, bz_search_engine, G_TYPE_OBJECT);
@@ -38,16 +137,12 @@ enum
   PROP_0,
 
   PROP_MODEL,
+  PROP_STATS_STORE,
 
   LAST_PROP
 };
 static GParamSpec *props[LAST_PROP] = { 0 };
 
-static double
-test_strings (const char *query,
-              const char *against,
-              gssize      accept_min_size);
-
 typedef struct
 {
   guint  idx;
@@ -58,57 +153,170 @@ static gint
 cmp_scores (Score *a,
             Score *b);
 
-#define PERFECT        1.0
-#define ALMOST_PERFECT 0.95
-#define SAME_CLASS     0.2
-#define SAME_CLUSTER   0.1
-#define NO_MATCH       0.0
+static void
+model_items_changed (BzSearchEngine *self,
+                     guint           position,
+                     guint           removed,
+                     guint           added,
+                     GListModel     *model);
+
+static void
+stats_changed (BzSearchEngine *self,
+               GParamSpec     *pspec,
+               BzStatsStore   *stats);
+
+static void
+ensure_index_locked (BzSearchEngine *self);
+
+static void
+build_index (SearchIndex *index);
+
+static void
+build_trigrams (SearchIndex *index);
+
+static inline guint
+pack_trigram (const char *p);
+
+static inline gboolean
+is_token_char (gunichar ch);
+
+static GPtrArray *
+tokenize (const char *folded);
+
+static void
+add_facet (GHashTable *facets,
+           const char *facet,
+           guint       idx);
+
+static GtkBitset *
+snapshot_installed (SearchIndex *index);
+
+static GtkBitset *
+facet_filter (SearchIndex       *index,
+              const char *const *facets,
+              GtkBitset         *installed);
+
+static GHashTable *
+count_facets (SearchIndex *index,
+              GtkBitset   *installed,
+              GArray      *candidates);
+
+static char *
+dup_facets_key (const char *const *facets);
+
+static GtkBitset *
+bitset_from_candidates (GArray *candidates);
+
+static GArray *
+score_index (SearchIndex *index,
+             const char  *key,
+             GtkBitset   *allowed,
+             gboolean     infix);
+
+static void
+score_postings (SearchIndex  *index,
+                guint         v,
+                double        match,
+                const guint8 *allowed,
+                double       *term_scores,
+                GArray       *touched);
+
+static GArray *
+list_allowed (SearchIndex *index,
+              GtkBitset   *allowed);
+
+static GArray *
+scan_titles (GPtrArray  *snapshot,
+             const char *key);
+
+static void
+send_partial (DexChannel *channel,
+              GPtrArray  *snapshot,
+              GArray     *scores);
+
+static CachedQuery *
+lookup_cached_locked (BzSearchEngine *self,
+                      const char     *key,
+                      const char     *facets_key);
+
+static CachedQuery *
+lookup_seed_locked (BzSearchEngine *self,
+                    const char     *key,
+                    const char     *facets_key);
+
+static void
+insert_cached (BzSearchEngine *self,
+               CachedQuery    *cached);
+
+static GPtrArray *
+results_from_candidates (GPtrArray *snapshot,
+                         GArray    *candidates);
+
+static DexFuture *
+dispatch_query (BzSearchEngine    *self,
+                const char *const *terms,
+                const char *const *facets,
+                DexChannel        *partials,
+                gboolean           count);
 
 BZ_DEFINE_DATA (
     query_task,
     QueryTask,
     {
-      char     **terms;
-      GPtrArray *snapshot;
+      BzSearchEngine *self;
+      char           *key;
+      char          **facets;
+      char           *facets_key;
+      guint64         generation;
+      SearchIndex    *index;
+      GArray         *seed;
+      GArray         *candidates;
+      GtkBitset      *installed;
+      DexChannel     *partials;
+      gboolean        cacheable;
+      gboolean        count;
     },
-    BZ_RELEASE_DATA (terms, g_strfreev);
-    BZ_RELEASE_DATA (snapshot, g_ptr_array_unref))
+    BZ_RELEASE_DATA (self, g_object_unref);
+    BZ_RELEASE_DATA (key, g_free);
+    BZ_RELEASE_DATA (facets, g_strfreev);
+    BZ_RELEASE_DATA (facets_key, g_free);
+    BZ_RELEASE_DATA (index, search_index_data_unref);
+    BZ_RELEASE_DATA (seed, g_array_unref);
+    BZ_RELEASE_DATA (candidates, g_array_unref);
+    BZ_RELEASE_DATA (installed, gtk_bitset_unref);
+    BZ_RELEASE_DATA (partials, dex_unref))
 static DexFuture *
 query_task_fiber (QueryTaskData *data);
 
-BZ_DEFINE_DATA (
-    query_sub_task,
-    QuerySubTask,
-    {
-      char      *query_utf8;
-      GPtrArray *shallow_mirror;
-      double     threshold;
-      guint      work_offset;
-      guint      work_length;
-    },
-    BZ_RELEASE_DATA (query_utf8, g_free);
-    BZ_RELEASE_DATA (shallow_mirror, g_ptr_array_unref));
-static DexFuture *
-query_sub_task_fiber (QuerySubTaskData *data);
-
-static inline GUnicodeType
-utf8_char_class (const char *s,
-                 gunichar   *ch_out);
-
-static inline const char *
-utf8_skip_to_next_of_class (const char **s,
-                            GUnicodeType class);
-
 static void
 bz_search_engine_dispose (GObject *object)
 {
   BzSearchEngine *self = BZ_SEARCH_ENGINE (object);
 
+  if (self->model != NULL)
+    g_signal_handlers_disconnect_by_func (self->model, model_items_changed, self);
   g_clear_object (&self->model);
 
+  if (self->stats != NULL)
+    g_signal_handlers_disconnect_by_func (self->stats, stats_changed, self);
+  g_clear_object (&self->stats);
+
+  g_clear_pointer (&self->index, search_index_data_unref);
+  g_queue_clear_full (&self->lru, cached_query_data_unref);
+
   G_OBJECT_CLASS (bz_search_engine_parent_class)->dispose (object);
 }
 
+static void
+bz_search_engine_finalize (GObject *object)
+{
+  BzSearchEngine *self = BZ_SEARCH_ENGINE (object);
+
+  g_mutex_clear (&self->cache_mutex);
+
+  G_OBJECT_CLASS (bz_search_engine_parent_class)->finalize (object);
+}
+
 static void
 bz_search_engine_get_property (GObject    *object,
                                guint       prop_id,
@@ -122,6 +330,9 @@ bz_search_engine_get_property (GObject    *object,
     case PROP_MODEL:
       g_value_set_object (value, bz_search_engine_get_model (self));
       break;
+    case PROP_STATS_STORE:
+      g_value_set_object (value, bz_search_engine_get_stats_store (self));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -140,6 +351,9 @@ bz_search_engine_set_property (GObject      *object,
     case PROP_MODEL:
       bz_search_engine_set_model (self, g_value_get_object (value));
       break;
+    case PROP_STATS_STORE:
+      bz_search_engine_set_stats_store (self, g_value_get_object (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -153,6 +367,7 @@ bz_search_engine_class_init (BzSearchEngineClass *klass)
   object_class->set_property = bz_search_engine_set_property;
   object_class->get_property = bz_search_engine_get_property;
   object_class->dispose      = bz_search_engine_dispose;
+  object_class->finalize     = bz_search_engine_finalize;
 
   props[PROP_MODEL] =
       g_param_spec_object (
@@ -161,12 +376,21 @@ bz_search_engine_class_init (BzSearchEngineClass *klass)
           G_TYPE_LIST_MODEL,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
 
+  props[PROP_STATS_STORE] =
+      g_param_spec_object (
+          "stats-store",
+          NULL, NULL,
+          BZ_TYPE_STATS_STORE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
   g_object_class_install_properties (object_class, LAST_PROP, props);
 }
 
 static void
 bz_search_engine_init (BzSearchEngine *self)
 {
+  g_mutex_init (&self->cache_mutex);
+  g_queue_init (&self->lru);
 }
 
 BzSearchEngine *
@@ -189,28 +413,144 @@ bz_search_engine_set_model (BzSearchEngine *self,
   g_return_if_fail (BZ_IS_SEARCH_ENGINE (self));
   g_return_if_fail (model == NULL || G_IS_LIST_MODEL (model));
 
+  if (self->model != NULL)
+    g_signal_handlers_disconnect_by_func (self->model, model_items_changed, self);
   g_clear_object (&self->model);
+
   if (model != NULL)
-    self->model = g_object_ref (model);
+    {
+      self->model = g_object_ref (model);
+      g_signal_connect_swapped (
+          model, "items-changed",
+          G_CALLBACK (model_items_changed), self);
+    }
+  bz_search_engine_invalidate (self);
 
   g_object_notify_by_pspec (G_OBJECT (self), props[PROP_MODEL]);
 }
 
+BzStatsStore *
+bz_search_engine_get_stats_store (BzSearchEngine *self)
+{
+  g_return_val_if_fail (BZ_IS_SEARCH_ENGINE (self), NULL);
+  return self->stats;
+}
+
+void
+bz_search_engine_set_stats_store (BzSearchEngine *self,
+                                  BzStatsStore   *stats)
+{
+  g_return_if_fail (BZ_IS_SEARCH_ENGINE (self));
+  g_return_if_fail (stats == NULL || BZ_IS_STATS_STORE (stats));
+
+  if (self->stats != NULL)
+    g_signal_handlers_disconnect_by_func (self->stats, stats_changed, self);
+  g_clear_object (&self->stats);
+
+  if (stats != NULL)
+    {
+      self->stats = g_object_ref (stats);
+      g_signal_connect_swapped (
+          stats, "notify::last-day",
+          G_CALLBACK (stats_changed), self);
+    }
+  bz_search_engine_invalidate (self);
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_STATS_STORE]);
+}
+
+void
+bz_search_engine_invalidate (BzSearchEngine *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_if_fail (BZ_IS_SEARCH_ENGINE (self));
+
+  locker = g_mutex_locker_new (&self->cache_mutex);
+
+  self->generation++;
+  g_clear_pointer (&self->index, search_index_data_unref);
+  g_queue_clear_full (&self->lru, cached_query_data_unref);
+}
+
+void
+bz_search_engine_trim (BzSearchEngine *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_if_fail (BZ_IS_SEARCH_ENGINE (self));
+
+  locker = g_mutex_locker_new (&self->cache_mutex);
+
+  /* Cached results hold on to their own arrays, the index is what
+     lets the next query avoid a rebuild, so that one stays */
+  g_queue_clear_full (&self->lru, cached_query_data_unref);
+}
+
 DexFuture *
 bz_search_engine_query (BzSearchEngine    *self,
                         const char *const *terms)
 {
-  guint n_groups = 0;
+  return bz_search_engine_query_streaming (self, terms, NULL);
+}
 
+DexFuture *
+bz_search_engine_query_streaming (BzSearchEngine    *self,
+                                  const char *const *terms,
+                                  DexChannel        *partials)
+{
   dex_return_error_if_fail (BZ_IS_SEARCH_ENGINE (self));
   dex_return_error_if_fail (terms != NULL && *terms != NULL);
+  dex_return_error_if_fail (partials == NULL || DEX_IS_CHANNEL (partials));
+
+  return dispatch_query (self, terms, NULL, partials, FALSE);
+}
+
+DexFuture *
+bz_search_engine_query_faceted (BzSearchEngine    *self,
+                                const char *const *terms,
+                                const char *const *facets,
+                                DexChannel        *partials)
+{
+  dex_return_error_if_fail (BZ_IS_SEARCH_ENGINE (self));
+  dex_return_error_if_fail (terms != NULL);
+  dex_return_error_if_fail (partials == NULL || DEX_IS_CHANNEL (partials));
+
+  return dispatch_query (self, terms, facets, partials, FALSE);
+}
+
+DexFuture *
+bz_search_engine_count_facets (BzSearchEngine    *self,
+                               const char *const *terms,
+                               const char *const *facets)
+{
+  dex_return_error_if_fail (BZ_IS_SEARCH_ENGINE (self));
+  dex_return_error_if_fail (terms != NULL);
+
+  return dispatch_query (self, terms, facets, NULL, TRUE);
+}
+
+static DexFuture *
+dispatch_query (BzSearchEngine    *self,
+                const char *const *terms,
+                const char *const *facets,
+                DexChannel        *partials,
+                gboolean           count)
+{
+  guint    n_groups = 0;
+  gboolean empty    = FALSE;
+  gboolean faceted  = FALSE;
 
   if (self->model != NULL)
     n_groups = g_list_model_get_n_items (self->model);
-
-  if (self->model == NULL ||
-      n_groups == 0 ||
-      **terms == '\0')
+  empty   = *terms == NULL || **terms == '\0';
+  faceted = facets != NULL && *facets != NULL;
+
+  if (count && n_groups == 0)
+    return dex_future_new_take_boxed (
+        G_TYPE_HASH_TABLE,
+        g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL));
+  else if (n_groups == 0 || (empty && !faceted && !count))
     {
       g_autoptr (GPtrArray) ret = NULL;
 
@@ -236,18 +576,53 @@ bz_search_engine_query (BzSearchEngine    *self,
     }
   else
     {
-      g_autoptr (GPtrArray) snapshot = NULL;
-      g_autoptr (QueryTaskData) data = NULL;
-
-      snapshot = g_ptr_array_new_with_free_func (g_object_unref);
-      g_ptr_array_set_size (snapshot, n_groups);
-
-      for (guint i = 0; i < snapshot->len; i++)
-        g_ptr_array_index (snapshot, i) = g_list_model_get_item (self->model, i);
-
-      data           = query_task_data_new ();
-      data->terms    = g_strdupv ((gchar **) terms);
-      data->snapshot = g_steal_pointer (&snapshot);
+      g_autoptr (GMutexLocker) locker = NULL;
+      g_autofree char *joined         = NULL;
+      CachedQuery     *cached         = NULL;
+      CachedQuery     *seed           = NULL;
+      g_autoptr (QueryTaskData) data  = NULL;
+
+      data             = query_task_data_new ();
+      data->self       = g_object_ref (self);
+      /* Kept NULL when there are none, see query_task_fiber() */
+      data->facets     = faceted ? g_strdupv ((gchar **) facets) : NULL;
+      data->facets_key = dup_facets_key (facets);
+      data->partials   = bz_dex_maybe_ref (partials);
+      data->count      = count;
+
+      joined = empty ? g_strdup ("") : g_strjoinv (" ", (gchar **) terms);
+      /* Groups carry pre-folded copies of their
+         searchable text, see bz_search_fold() */
+      data->key = bz_search_fold (joined, -1);
+
+      locker = g_mutex_locker_new (&self->cache_mutex);
+      ensure_index_locked (self);
+
+      data->generation = self->generation;
+      data->index      = search_index_data_ref (self->index);
+
+      /* Installed state changes all the time without the catalog changing,
+         so it is taken fresh for every query and never cached */
+      data->cacheable = !faceted || !g_strv_contains (facets, BZ_SEARCH_FACET_INSTALLED);
+      if (count || !data->cacheable)
+        data->installed = snapshot_installed (self->index);
+
+      if (data->cacheable)
+        cached = lookup_cached_locked (self, data->key, data->facets_key);
+      if (cached != NULL && !count)
+        return dex_future_new_take_boxed (
+            G_TYPE_PTR_ARRAY,
+            results_from_candidates (cached->index->snapshot, cached->candidates));
+      else if (cached != NULL)
+        /* Counting still walks every facet, so
+           leave that to the thread pool */
+        data->candidates = g_array_ref (cached->candidates);
+      else if (data->cacheable)
+        {
+          seed = lookup_seed_locked (self, data->key, data->facets_key);
+          if (seed != NULL)
+            data->seed = g_array_ref (seed->candidates);
+        }
 
       return dex_scheduler_spawn (
           dex_thread_pool_scheduler_get_default (),
@@ -260,278 +635,790 @@ bz_search_engine_query (BzSearchEngine    *self,
 static DexFuture *
 query_task_fiber (QueryTaskData *data)
 {
-  char     **terms                  = data->terms;
-  GPtrArray *shallow_mirror         = data->snapshot;
-  g_autoptr (GError) local_error    = NULL;
-  gboolean         result           = FALSE;
-  g_autofree char *query_utf8       = NULL;
-  guint            n_sub_tasks      = 0;
-  guint            scores_per_task  = 0;
-  g_autoptr (GPtrArray) sub_futures = NULL;
-  g_autoptr (GArray) scores         = NULL;
-  g_autoptr (GPtrArray) results     = NULL;
-
-  query_utf8      = g_strjoinv (" ", terms);
-  n_sub_tasks     = MAX (1, MIN (shallow_mirror->len / 512, g_get_num_processors ()));
-  scores_per_task = shallow_mirror->len / n_sub_tasks;
-
-  sub_futures = g_ptr_array_new_with_free_func (dex_unref);
-  for (guint i = 0; i < n_sub_tasks; i++)
-    {
-      g_autoptr (QuerySubTaskData) sub_data = NULL;
-      g_autoptr (DexFuture) future          = NULL;
-
-      sub_data                 = query_sub_task_data_new ();
-      sub_data->query_utf8     = g_strdup (query_utf8);
-      sub_data->shallow_mirror = g_ptr_array_ref (shallow_mirror);
-      sub_data->threshold      = 1.0;
-      sub_data->work_offset    = i * scores_per_task;
-      sub_data->work_length    = scores_per_task;
-
-      if (i >= n_sub_tasks - 1)
-        sub_data->work_length += shallow_mirror->len % n_sub_tasks;
-
-      future = dex_scheduler_spawn (
-          dex_thread_pool_scheduler_get_default (),
-          bz_get_dex_stack_size (),
-          (DexFiberFunc) query_sub_task_fiber,
-          query_sub_task_data_ref (sub_data),
-          query_sub_task_data_unref);
+  SearchIndex *index             = data->index;
+  DexChannel  *partials          = data->partials;
+  g_autoptr (GtkBitset) allowed  = NULL;
+  g_autoptr (GArray) scores      = NULL;
+  g_autoptr (CachedQuery) cached = NULL;
+
+  /* The first query after the catalog changes pays for this, so give the
+     caller something to look at in the meantime. Facets aren't known until
+     the index exists, so faceted queries have to wait */
+  g_mutex_lock (&index->mutex);
+  if (!index->built)
+    {
+      if (partials != NULL && data->facets == NULL)
+        {
+          g_autoptr (GArray) title_matches = NULL;
 
-      g_ptr_array_add (sub_futures, g_steal_pointer (&future));
+          title_matches = scan_titles (index->snapshot, data->key);
+          send_partial (partials, index->snapshot, title_matches);
+        }
+      build_index (index);
     }
+  g_mutex_unlock (&index->mutex);
 
-  result = dex_await (dex_future_allv (
-                          (DexFuture *const *) sub_futures->pdata, sub_futures->len),
-                      &local_error);
-  if (!result)
-    return dex_future_new_for_error (g_steal_pointer (&local_error));
-
-  scores = g_array_new (FALSE, FALSE, sizeof (Score));
-  for (guint i = 0; i < sub_futures->len; i++)
+  if (data->candidates == NULL)
     {
-      DexFuture *future     = NULL;
-      GArray    *scores_out = NULL;
+      /* Facets are applied before scoring, so groups
+         outside of them are never even looked at */
+      allowed = facet_filter (index, (const char *const *) data->facets, data->installed);
 
-      future     = g_ptr_array_index (sub_futures, i);
-      scores_out = g_value_get_boxed (dex_future_get_value (future, NULL));
+      /* If an earlier query was a prefix of this one, nothing outside of its
+         candidates can match */
+      if (data->seed != NULL)
+        {
+          g_autoptr (GtkBitset) seeded = NULL;
 
-      if (scores_out->len > 0)
-        g_array_append_vals (scores, scores_out->data, scores_out->len);
-    }
-  if (scores->len > 0)
-    g_array_sort (scores, (GCompareFunc) cmp_scores);
+          seeded = bitset_from_candidates (data->seed);
+          if (allowed != NULL)
+            gtk_bitset_intersect (allowed, seeded);
+          else
+            allowed = g_steal_pointer (&seeded);
+        }
 
-  results = g_ptr_array_new_with_free_func (g_object_unref);
-  g_ptr_array_set_size (results, scores->len);
-  for (guint i = 0; i < scores->len; i++)
-    {
-      Score        *score                      = NULL;
-      BzEntryGroup *group                      = NULL;
-      g_autoptr (BzSearchResult) search_result = NULL;
+      if (*data->key == '\0')
+        scores = list_allowed (index, allowed);
+      else
+        {
+          /* Prefix matches only need a binary search in the vocabulary, and
+             they are what people are looking for most of the time while
+             typing */
+          if (partials != NULL)
+            {
+              g_autoptr (GArray) prefix_matches = NULL;
 
-      score = &g_array_index (scores, Score, i);
-      group = g_ptr_array_index (shallow_mirror, score->idx);
+              prefix_matches = score_index (index, data->key, allowed, FALSE);
+              if (prefix_matches->len > 0)
+                g_array_sort (prefix_matches, (GCompareFunc) cmp_scores);
+              send_partial (partials, index->snapshot, prefix_matches);
+            }
 
-      search_result = bz_search_result_new ();
-      bz_search_result_set_group (search_result, group);
-      bz_search_result_set_original_index (search_result, score->idx);
-      bz_search_result_set_score (search_result, score->val);
+          scores = score_index (index, data->key, allowed, TRUE);
+          if (scores->len > 0)
+            g_array_sort (scores, (GCompareFunc) cmp_scores);
+        }
 
-      g_ptr_array_index (results, i) = g_steal_pointer (&search_result);
+      if (data->cacheable)
+        {
+          cached             = cached_query_data_new ();
+          cached->key        = g_strdup (data->key);
+          cached->facets_key = g_strdup (data->facets_key);
+          cached->generation = data->generation;
+          cached->index      = search_index_data_ref (index);
+          cached->candidates = g_array_ref (scores);
+          insert_cached (data->self, cached);
+        }
+
+      data->candidates = g_steal_pointer (&scores);
     }
 
-  return dex_future_new_take_boxed (
-      G_TYPE_PTR_ARRAY,
-      g_steal_pointer (&results));
+  if (data->count)
+    return dex_future_new_take_boxed (
+        G_TYPE_HASH_TABLE,
+        count_facets (index, data->installed, data->candidates));
+  else
+    return dex_future_new_take_boxed (
+        G_TYPE_PTR_ARRAY,
+        results_from_candidates (index->snapshot, data->candidates));
 }
 
-static DexFuture *
-query_sub_task_fiber (QuerySubTaskData *data)
+static void
+build_index (SearchIndex *index)
 {
-  GPtrArray *shallow_mirror     = data->shallow_mirror;
-  char      *query_utf8         = data->query_utf8;
-  double     threshold          = data->threshold;
-  guint      work_offset        = data->work_offset;
-  guint      work_length        = data->work_length;
-  g_autoptr (GArray) scores_out = NULL;
-
-  scores_out = g_array_new (FALSE, FALSE, sizeof (Score));
-
-  for (guint i = 0; i < work_length; i++)
+  GPtrArray *snapshot                      = index->snapshot;
+  g_autoptr (GHashTable) token_to_postings = NULL;
+  double         length_sums[BZ_ENTRY_GROUP_N_SEARCH_FIELDS] = { 0 };
+  int            max_downloads             = 0;
+  GHashTableIter iter                      = { 0 };
+  gpointer       key                       = NULL;
+  gpointer       value                     = NULL;
+
+  token_to_postings = g_hash_table_new_full (
+      g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_array_unref);
+
+  index->id_to_idx = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  index->facets    = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) gtk_bitset_unref);
+  index->doc_stats = g_array_sized_new (FALSE, TRUE, sizeof (DocStats), snapshot->len);
+  g_array_set_size (index->doc_stats, snapshot->len);
+
+  for (guint i = 0; i < snapshot->len; i++)
     {
-      g_autoptr (GMutexLocker) locker = NULL;
       BzEntryGroup *group             = NULL;
-      const char   *id                = NULL;
-      const char   *title             = NULL;
-      double        score             = 0.0;
+      g_autoptr (GMutexLocker) locker = NULL;
+      DocStats   *stats               = NULL;
+      const char *id                  = NULL;
+      int         downloads           = 0;
+      GListModel *categories          = NULL;
 
-      group  = g_ptr_array_index (shallow_mirror, work_offset + i);
+      group  = g_ptr_array_index (snapshot, i);
       locker = bz_entry_group_lock (group);
+      stats  = &g_array_index (index->doc_stats, DocStats, i);
+
+      id = bz_entry_group_get_id (group);
+      if (id != NULL)
+        g_hash_table_replace (index->id_to_idx, g_ascii_strdown (id, -1), GUINT_TO_POINTER (i));
 
-      id    = bz_entry_group_get_id (group);
-      title = bz_entry_group_get_title (group);
-      if ((id != NULL && g_strcmp0 (query_utf8, id) == 0) ||
-          (title != NULL && strcasecmp (query_utf8, title) == 0))
-        score = G_MAXDOUBLE;
+      /* The stats store covers the whole catalog, what entries
+         carry is only known for apps someone has looked at */
+      if (index->installs != NULL)
+        downloads = (int) MIN (g_array_index (index->installs, guint64, i), G_MAXINT);
       else
+        downloads = bz_entry_group_get_recent_downloads (group);
+      stats->prior  = downloads;
+      max_downloads = MAX (max_downloads, downloads);
+
+      if (bz_entry_group_get_is_floss (group))
+        add_facet (index->facets, BZ_SEARCH_FACET_FLOSS, i);
+      if (bz_entry_group_get_is_verified (group))
+        add_facet (index->facets, BZ_SEARCH_FACET_VERIFIED, i);
+
+      categories = bz_entry_group_get_categories (group);
+      if (categories != NULL)
         {
-          const char *developer     = NULL;
-          const char *description   = NULL;
-          const char *search_tokens = NULL;
+          guint n_categories = 0;
+
+          n_categories = g_list_model_get_n_items (categories);
+          for (guint j = 0; j < n_categories; j++)
+            {
+              g_autoptr (BzFlathubCategory) category = NULL;
+              const char *name                       = NULL;
+              g_autofree char *facet                 = NULL;
 
-          developer     = bz_entry_group_get_developer (group);
-          description   = bz_entry_group_get_description (group);
-          search_tokens = bz_entry_group_get_search_tokens (group);
+              category = g_list_model_get_item (categories, j);
+              name     = bz_flathub_category_get_name (category);
+              if (name == NULL)
+                continue;
 
-#define EVALUATE_STRING(_s, _accept_min_size)                  \
-  ((_s) != NULL                                                \
-       ? (test_strings (query_utf8, (_s), (_accept_min_size))) \
-       : 0.0)
+              facet = g_strconcat (BZ_SEARCH_FACET_CATEGORY_PREFIX, name, NULL);
+              add_facet (index->facets, facet, i);
+            }
+        }
 
-          score += EVALUATE_STRING (title, 2) * 2.0;
-          score += EVALUATE_STRING (developer, 2) * 1.0;
-          score += EVALUATE_STRING (description, 3) * 1.0;
-          score += EVALUATE_STRING (search_tokens, -1) * 1.5;
+      for (guint field = 0; field < BZ_ENTRY_GROUP_N_SEARCH_FIELDS; field++)
+        {
+          const char *folded           = NULL;
+          g_autoptr (GPtrArray) tokens = NULL;
 
-#undef EVALUATE_STRING
+          folded = bz_entry_group_get_folded_search_field (group, field);
+          if (folded == NULL)
+            continue;
+
+          tokens = tokenize (folded);
+          for (guint j = 0; j < tokens->len; j++)
+            {
+              const char *token    = NULL;
+              GArray     *postings = NULL;
+              Posting    *posting  = NULL;
+
+              token    = g_ptr_array_index (tokens, j);
+              postings = g_hash_table_lookup (token_to_postings, token);
+              if (postings == NULL)
+                {
+                  postings = g_array_new (FALSE, TRUE, sizeof (Posting));
+                  g_hash_table_replace (token_to_postings, g_steal_pointer (&g_ptr_array_index (tokens, j)), postings);
+                }
+
+              if (postings->len == 0 ||
+                  g_array_index (postings, Posting, postings->len - 1).doc != i)
+                {
+                  g_array_set_size (postings, postings->len + 1);
+                  g_array_index (postings, Posting, postings->len - 1).doc = i;
+                }
+              posting = &g_array_index (postings, Posting, postings->len - 1);
+
+              if (posting->tf[field] < G_MAXUINT16)
+                posting->tf[field]++;
+              if (stats->lengths[field] < G_MAXUINT16)
+                stats->lengths[field]++;
+            }
         }
 
-      if (score > threshold)
+      for (guint field = 0; field < BZ_ENTRY_GROUP_N_SEARCH_FIELDS; field++)
+        length_sums[field] += stats->lengths[field];
+    }
+
+  for (guint field = 0; field < BZ_ENTRY_GROUP_N_SEARCH_FIELDS; field++)
+    index->avg_lengths[field] = snapshot->len > 0
+                                    ? MAX (1.0, length_sums[field] / (double) snapshot->len)
+                                    : 1.0;
+
+  for (guint i = 0; i < index->doc_stats->len; i++)
+    {
+      DocStats *stats = NULL;
+
+      stats        = &g_array_index (index->doc_stats, DocStats, i);
+      stats->prior = max_downloads > 0
+                         ? log1p (stats->prior) / log1p (max_downloads)
+                         : 0.0;
+    }
+
+  index->vocab = g_ptr_array_new_full (
+      g_hash_table_size (token_to_postings), g_free);
+  g_hash_table_iter_init (&iter, token_to_postings);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (index->vocab, key);
+  g_ptr_array_sort_values (index->vocab, (GCompareFunc) strcmp);
+
+  index->postings = g_ptr_array_new_full (
+      index->vocab->len, (GDestroyNotify) g_array_unref);
+  for (guint i = 0; i < index->vocab->len; i++)
+    {
+      g_hash_table_steal_extended (
+          token_to_postings,
+          g_ptr_array_index (index->vocab, i),
+          NULL, &value);
+      g_ptr_array_add (index->postings, value);
+    }
+
+  build_trigrams (index);
+
+  index->built = TRUE;
+}
+
+static void
+build_trigrams (SearchIndex *index)
+{
+  index->trigrams = g_hash_table_new_full (
+      g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_array_unref);
+
+  /* Infixes are for finding "code" in "vscode" or "office" in
+     "libreoffice", so descriptions are left out. They make up most
+     of the vocabulary and would mostly contribute noise */
+  for (guint v = 0; v < index->vocab->len; v++)
+    {
+      const char *token    = NULL;
+      gsize       length   = 0;
+      GArray     *postings = NULL;
+      gboolean    wanted   = FALSE;
+
+      token  = g_ptr_array_index (index->vocab, v);
+      length = strlen (token);
+      if (length < INFIX_MIN_LENGTH)
+        continue;
+
+      postings = g_ptr_array_index (index->postings, v);
+      for (guint p = 0; p < postings->len && !wanted; p++)
         {
-          Score append = { 0 };
+          Posting *posting = &g_array_index (postings, Posting, p);
 
-          append.idx = work_offset + i;
-          append.val = score;
-          g_array_append_val (scores_out, append);
+          wanted = posting->tf[BZ_ENTRY_GROUP_SEARCH_FIELD_TITLE] > 0 ||
+                   posting->tf[BZ_ENTRY_GROUP_SEARCH_FIELD_KEYWORDS] > 0;
+        }
+      if (!wanted)
+        continue;
+
+      for (gsize i = 0; i + INFIX_MIN_LENGTH <= length; i++)
+        {
+          guint   trigram = 0;
+          GArray *tokens  = NULL;
+
+          trigram = pack_trigram (token + i);
+          tokens  = g_hash_table_lookup (index->trigrams, GUINT_TO_POINTER (trigram));
+          if (tokens == NULL)
+            {
+              tokens = g_array_new (FALSE, FALSE, sizeof (guint));
+              g_hash_table_replace (index->trigrams, GUINT_TO_POINTER (trigram), tokens);
+            }
+
+          /* Tokens like "aaaa" repeat a trigram */
+          if (tokens->len == 0 ||
+              g_array_index (tokens, guint, tokens->len - 1) != v)
+            g_array_append_val (tokens, v);
         }
     }
+}
 
-  return dex_future_new_take_boxed (G_TYPE_ARRAY, g_steal_pointer (&scores_out));
+static inline guint
+pack_trigram (const char *p)
+{
+  /* Bytes, not characters, which is all strstr() cares about too */
+  return (guint) (guint8) p[0] |
+         (guint) (guint8) p[1] << 8 |
+         (guint) (guint8) p[2] << 16;
 }
 
-#define UTF8_FOREACH_FORWARD(_var, _s) \
-  for (const char *_var = (_s);        \
-       _var != NULL && *_var != '\0';  \
-       _var = g_utf8_next_char (_var))
+static GPtrArray *
+tokenize (const char *folded)
+{
+  g_autoptr (GPtrArray) tokens = NULL;
+  const char *start            = NULL;
+
+  tokens = g_ptr_array_new_with_free_func (g_free);
+
+  for (const char *p = folded;; p = g_utf8_next_char (p))
+    {
+      gboolean boundary = FALSE;
+
+      boundary = *p == '\0' || !is_token_char (g_utf8_get_char (p));
+      if (!boundary)
+        {
+          if (start == NULL)
+            start = p;
+        }
+      else if (start != NULL)
+        {
+          gsize length = 0;
+
+          length = p - start;
+          if (length > MAX_TOKEN_LENGTH)
+            length = g_utf8_find_prev_char (start, start + MAX_TOKEN_LENGTH + 1) - start;
+
+          g_ptr_array_add (tokens, g_strndup (start, length));
+          start = NULL;
+        }
 
-#define UTF8_FOREACH_FORWARD_WITH_END(_var, _s, _end)  \
-  for (const char *_var = (_s);                        \
-       _var != NULL && *_var != '\0' && _var < (_end); \
-       _var = g_utf8_next_char (_var))
+      if (*p == '\0')
+        break;
+    }
 
-#define UTF8_FOREACH_BACKWARD(_var, _s, _start) \
-  for (const char *_var = (_s);                 \
-       _var != NULL && _var >= (_start);        \
-       _var = g_utf8_prev_char (_var))
+  return g_steal_pointer (&tokens);
+}
 
-#define UTF8_FOREACH_TOKEN_FORWARDS(_start_var, _end_var, _s)                                                          \
-  for (const char *_start_var = (_s), *_end_var = utf8_skip_to_next_of_class (&_start_var, G_UNICODE_SPACE_SEPARATOR); \
-       _start_var != NULL && *_start_var != '\0';                                                                      \
-       _start_var = _end_var, _end_var = utf8_skip_to_next_of_class (&_start_var, G_UNICODE_SPACE_SEPARATOR))
+static inline gboolean
+is_token_char (gunichar ch)
+{
+  /* Marks must not split tokens, bz_search_fold() leaves the kana voicing
+     marks in place */
+  return g_unichar_isalnum (ch) || g_unichar_ismark (ch);
+}
 
-static double
-test_strings (const char *query,
-              const char *against,
-              gssize      accept_min_size)
+static GArray *
+score_index (SearchIndex *index,
+             const char  *key,
+             GtkBitset   *allowed_set,
+             gboolean     infix)
 {
-  gsize  query_length   = 0;
-  gsize  against_length = 0;
-  double score          = 0.0;
+  guint n_docs                    = 0;
+  g_autofree double *scores       = NULL;
+  g_autofree double *term_scores  = NULL;
+  g_autofree guint8 *allowed      = NULL;
+  g_autoptr (GArray) touched      = NULL;
+  g_autoptr (GPtrArray) terms     = NULL;
+  g_autoptr (GArray) candidates   = NULL;
+  gpointer exact_idx              = NULL;
+
+  n_docs      = index->snapshot->len;
+  scores      = g_new0 (double, n_docs);
+  term_scores = g_new0 (double, n_docs);
+  touched     = g_array_new (FALSE, FALSE, sizeof (guint));
+  candidates  = g_array_new (FALSE, FALSE, sizeof (Score));
+
+  /* Checked for every posting, so flatten it out */
+  if (allowed_set != NULL)
+    {
+      GtkBitsetIter bitset_iter = { 0 };
+      guint         doc         = 0;
+
+      allowed = g_new0 (guint8, n_docs);
+      for (gboolean valid = gtk_bitset_iter_init_first (&bitset_iter, allowed_set, &doc);
+           valid;
+           valid = gtk_bitset_iter_next (&bitset_iter, &doc))
+        allowed[doc] = TRUE;
+    }
+
+  terms = tokenize (key);
+  for (guint t = 0; t < terms->len; t++)
+    {
+      const char *term     = NULL;
+      gsize       term_len = 0;
+      guint       lo       = 0;
+      guint       hi       = 0;
+
+      term     = g_ptr_array_index (terms, t);
+      term_len = strlen (term);
+
+      /* Binary search for the first token >= term; every
+         token starting with term follows immediately */
+      hi = index->vocab->len;
+      while (lo < hi)
+        {
+          guint mid = lo + (hi - lo) / 2;
+
+          if (strcmp (g_ptr_array_index (index->vocab, mid), term) < 0)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+
+      for (guint v = lo; v < index->vocab->len; v++)
+        {
+          const char *token     = NULL;
+          gsize       token_len = 0;
+          double      match     = 0.0;
+
+          token = g_ptr_array_index (index->vocab, v);
+          if (strncmp (token, term, term_len) != 0)
+            break;
+          token_len = strlen (token);
+
+          /* Exact token match or a prefix of one, which is
+             what most people are doing when typing */
+          match = token_len == term_len
+                      ? 1.0
+                      : 0.5 + 0.5 * (double) term_len / (double) token_len;
+          score_postings (index, v, match, allowed, term_scores, touched);
+        }
 
-  query_length   = strlen (query);
-  against_length = strlen (against);
-  if (accept_min_size > 0 &&
-      against_length < accept_min_size)
-    return 0.0;
+      if (infix && term_len >= INFIX_MIN_LENGTH)
+        {
+          GArray *infixes = NULL;
+
+          /* Every token containing the term contains each of its
+             trigrams, so only the rarest one needs to be checked */
+          for (gsize i = 0; i + INFIX_MIN_LENGTH <= term_len; i++)
+            {
+              GArray *tokens = NULL;
+
+              tokens = g_hash_table_lookup (index->trigrams, GUINT_TO_POINTER (pack_trigram (term + i)));
+              if (tokens == NULL)
+                {
+                  infixes = NULL;
+                  break;
+                }
+              if (infixes == NULL || tokens->len < infixes->len)
+                infixes = tokens;
+            }
+
+          for (guint k = 0; infixes != NULL && k < infixes->len; k++)
+            {
+              guint       v     = g_array_index (infixes, guint, k);
+              const char *token = NULL;
+
+              token = g_ptr_array_index (index->vocab, v);
+              /* Prefixes were scored above */
+              if (strncmp (token, term, term_len) == 0 ||
+                  strstr (token, term) == NULL)
+                continue;
+
+              score_postings (
+                  index, v,
+                  0.4 * (double) term_len / (double) strlen (token),
+                  allowed, term_scores, touched);
+            }
+        }
 
-  if (query_length <= against_length &&
-      strcasestr (against, query) != NULL)
-    return (double) query_length;
+      for (guint i = 0; i < touched->len; i++)
+        {
+          guint doc = g_array_index (touched, guint, i);
 
-  UTF8_FOREACH_TOKEN_FORWARDS (q_s, q_e, query)
-  {
-    gssize q_len = q_e - q_s;
+          scores[doc] += term_scores[doc];
+          term_scores[doc] = 0.0;
+        }
+      g_array_set_size (touched, 0);
+    }
 
-    UTF8_FOREACH_TOKEN_FORWARDS (a_s, a_e, against)
+  for (guint doc = 0; doc < n_docs; doc++)
     {
-      gssize   a_len = a_e - a_s;
-      gboolean match = FALSE;
+      BzEntryGroup *group             = NULL;
+      g_autoptr (GMutexLocker) locker = NULL;
+      const char *title               = NULL;
+      Score       append              = { 0 };
 
-      if (q_len > a_len)
+      if (scores[doc] <= 0.0)
         continue;
 
-      if (accept_min_size > 0 &&
-          a_len < accept_min_size)
-        continue;
+      group  = g_ptr_array_index (index->snapshot, doc);
+      locker = bz_entry_group_lock (group);
+      title  = bz_entry_group_get_folded_search_field (group, BZ_ENTRY_GROUP_SEARCH_FIELD_TITLE);
 
-      UTF8_FOREACH_FORWARD_WITH_END (a, a_s, a_e)
-      {
-        gunichar a_ch = 0;
+      append.idx = doc;
+      if (title != NULL && strcmp (title, key) == 0)
+        append.val = G_MAXDOUBLE;
+      else
+        append.val = scores[doc] * (1.0 + POPULARITY_PRIOR_WEIGHT *
+                                              g_array_index (index->doc_stats, DocStats, doc).prior);
+      g_array_append_val (candidates, append);
+    }
 
-        match = TRUE;
+  /* An exact id match is not necessarily a match for
+     any of the tokens, so look it up on its own */
+  if (g_hash_table_lookup_extended (index->id_to_idx, key, NULL, &exact_idx) &&
+      (allowed == NULL || allowed[GPOINTER_TO_UINT (exact_idx)]))
+    {
+      Score    exact = { 0 };
+      gboolean found = FALSE;
 
-        a_ch = g_unichar_tolower (g_utf8_get_char (a));
-        UTF8_FOREACH_FORWARD_WITH_END (q, q_s, q_e)
-        {
-          gunichar q_ch = 0;
+      exact.idx = GPOINTER_TO_UINT (exact_idx);
+      exact.val = G_MAXDOUBLE;
 
-          q_ch = g_unichar_tolower (g_utf8_get_char (q));
-          if (a_ch != q_ch)
+      for (guint i = 0; i < candidates->len; i++)
+        {
+          if (g_array_index (candidates, Score, i).idx == exact.idx)
             {
-              match = FALSE;
+              g_array_index (candidates, Score, i).val = exact.val;
+              found                                    = TRUE;
               break;
             }
         }
+      if (!found)
+        g_array_append_val (candidates, exact);
+    }
 
-        if (match)
-          break;
-      }
+  return g_steal_pointer (&candidates);
+}
+
+static void
+score_postings (SearchIndex  *index,
+                guint         v,
+                double        match,
+                const guint8 *allowed,
+                double       *term_scores,
+                GArray       *touched)
+{
+  GArray *postings = NULL;
+  guint   n_docs   = 0;
+  double  idf      = 0.0;
+
+  n_docs   = index->snapshot->len;
+  postings = g_ptr_array_index (index->postings, v);
+  idf      = log (1.0 + ((double) n_docs - postings->len + 0.5) / (postings->len + 0.5));
+
+  for (guint p = 0; p < postings->len; p++)
+    {
+      Posting  *posting = NULL;
+      DocStats *stats   = NULL;
+      double    tf      = 0.0;
+      double    score   = 0.0;
+
+      posting = &g_array_index (postings, Posting, p);
+      if (allowed != NULL && !allowed[posting->doc])
+        continue;
 
-      if (match)
-        score += (double) (q_len * q_len) / (double) a_len;
+      stats = &g_array_index (index->doc_stats, DocStats, posting->doc);
+      for (guint field = 0; field < BZ_ENTRY_GROUP_N_SEARCH_FIELDS; field++)
+        {
+          double b = field_length_normalization[field];
+
+          if (posting->tf[field] == 0)
+            continue;
+
+          tf += field_weights[field] * posting->tf[field] /
+                (1.0 - b + b * stats->lengths[field] / index->avg_lengths[field]);
+        }
+
+      /* A term counts once per group, through the best token it
+         matched, so "ste" doesn't favor groups mentioning both
+         "steam" and "stem" */
+      score = match * idf * tf / (BM25_K1 + tf);
+      if (term_scores[posting->doc] == 0.0)
+        g_array_append_val (touched, posting->doc);
+      term_scores[posting->doc] = MAX (term_scores[posting->doc], score);
+    }
+}
+
+static GArray *
+list_allowed (SearchIndex *index,
+              GtkBitset   *allowed)
+{
+  g_autoptr (GArray) candidates = NULL;
+
+  candidates = g_array_new (FALSE, FALSE, sizeof (Score));
+
+  for (guint doc = 0; doc < index->snapshot->len; doc++)
+    {
+      Score append = { 0 };
+
+      if (allowed != NULL && !gtk_bitset_contains (allowed, doc))
+        continue;
+
+      append.idx = doc;
+      g_array_append_val (candidates, append);
+    }
+
+  return g_steal_pointer (&candidates);
+}
+
+static void
+add_facet (GHashTable *facets,
+           const char *facet,
+           guint       idx)
+{
+  GtkBitset *bitset = NULL;
+
+  bitset = g_hash_table_lookup (facets, facet);
+  if (bitset == NULL)
+    {
+      bitset = gtk_bitset_new_empty ();
+      g_hash_table_replace (facets, g_strdup (facet), bitset);
+    }
+  gtk_bitset_add (bitset, idx);
+}
+
+static GtkBitset *
+snapshot_installed (SearchIndex *index)
+{
+  g_autoptr (GtkBitset) installed = NULL;
+
+  installed = gtk_bitset_new_empty ();
+  for (guint i = 0; i < index->snapshot->len; i++)
+    {
+      BzEntryGroup *group = g_ptr_array_index (index->snapshot, i);
+
+      if (bz_entry_group_get_removable (group) > 0)
+        gtk_bitset_add (installed, i);
     }
-  }
 
-  return score;
+  return g_steal_pointer (&installed);
+}
+
+static GtkBitset *
+facet_filter (SearchIndex       *index,
+              const char *const *facets,
+              GtkBitset         *installed)
+{
+  g_autoptr (GtkBitset) filter = NULL;
+
+  if (facets == NULL || *facets == NULL)
+    return NULL;
+
+  for (const char *const *facet = facets; *facet != NULL; facet++)
+    {
+      GtkBitset *bitset = NULL;
+
+      if (g_strcmp0 (*facet, BZ_SEARCH_FACET_INSTALLED) == 0)
+        bitset = installed;
+      else
+        bitset = g_hash_table_lookup (index->facets, *facet);
+
+      /* Nothing has this facet, so nothing can match */
+      if (bitset == NULL)
+        return gtk_bitset_new_empty ();
+
+      if (filter == NULL)
+        filter = gtk_bitset_copy (bitset);
+      else
+        gtk_bitset_intersect (filter, bitset);
+    }
+
+  return g_steal_pointer (&filter);
+}
+
+static GHashTable *
+count_facets (SearchIndex *index,
+              GtkBitset   *installed,
+              GArray      *candidates)
+{
+  g_autoptr (GHashTable) counts = NULL;
+  g_autoptr (GtkBitset) matched = NULL;
+  GHashTableIter iter           = { 0 };
+  gpointer       key            = NULL;
+  gpointer       value          = NULL;
+
+  counts  = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  matched = bitset_from_candidates (candidates);
+
+  g_hash_table_iter_init (&iter, index->facets);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      g_autoptr (GtkBitset) intersection = NULL;
+
+      intersection = gtk_bitset_copy (matched);
+      gtk_bitset_intersect (intersection, value);
+      g_hash_table_replace (
+          counts, g_strdup (key),
+          GUINT_TO_POINTER ((guint) gtk_bitset_get_size (intersection)));
+    }
+
+  if (installed != NULL)
+    {
+      g_autoptr (GtkBitset) intersection = NULL;
+
+      intersection = gtk_bitset_copy (matched);
+      gtk_bitset_intersect (intersection, installed);
+      g_hash_table_replace (
+          counts, g_strdup (BZ_SEARCH_FACET_INSTALLED),
+          GUINT_TO_POINTER ((guint) gtk_bitset_get_size (intersection)));
+    }
+
+  return g_steal_pointer (&counts);
+}
+
+static char *
+dup_facets_key (const char *const *facets)
+{
+  g_autoptr (GPtrArray) sorted = NULL;
+
+  if (facets == NULL || *facets == NULL)
+    return g_strdup ("");
+
+  /* Order doesn't matter for the cache */
+  sorted = g_ptr_array_new ();
+  for (const char *const *facet = facets; *facet != NULL; facet++)
+    g_ptr_array_add (sorted, (gpointer) *facet);
+  g_ptr_array_sort_values (sorted, (GCompareFunc) strcmp);
+  g_ptr_array_add (sorted, NULL);
+
+  return g_strjoinv ("\n", (gchar **) sorted->pdata);
+}
+
+static GtkBitset *
+bitset_from_candidates (GArray *candidates)
+{
+  g_autoptr (GtkBitset) bitset = NULL;
+
+  bitset = gtk_bitset_new_empty ();
+  for (guint i = 0; i < candidates->len; i++)
+    gtk_bitset_add (bitset, g_array_index (candidates, Score, i).idx);
+
+  return g_steal_pointer (&bitset);
 }
 
-static inline GUnicodeType
-utf8_char_class (const char *s,
-                 gunichar   *ch_out)
+static GArray *
+scan_titles (GPtrArray  *snapshot,
+             const char *key)
 {
-  gunichar     ch = 0;
-  GUnicodeType cl = 0;
+  g_autoptr (GArray) candidates = NULL;
+  gsize key_len                 = 0;
+
+  candidates = g_array_new (FALSE, FALSE, sizeof (Score));
+  key_len    = strlen (key);
+
+  for (guint i = 0; i < snapshot->len; i++)
+    {
+      BzEntryGroup *group             = NULL;
+      g_autoptr (GMutexLocker) locker = NULL;
+      const char *title               = NULL;
+      const char *match               = NULL;
+      Score       append              = { 0 };
+
+      group  = g_ptr_array_index (snapshot, i);
+      locker = bz_entry_group_lock (group);
+      title  = bz_entry_group_get_folded_search_field (group, BZ_ENTRY_GROUP_SEARCH_FIELD_TITLE);
+      if (title == NULL)
+        continue;
 
-  ch = g_utf8_get_char (s);
-  cl = g_unichar_type (ch);
+      match = strstr (title, key);
+      if (match == NULL)
+        continue;
 
-  if (ch_out != NULL)
-    *ch_out = ch;
-  return cl;
+      append.idx = i;
+      if (match == title && title[key_len] == '\0')
+        append.val = G_MAXDOUBLE;
+      else
+        /* Favor short titles and matches near the start */
+        append.val = (double) key_len / (double) (strlen (title) + (match - title));
+      g_array_append_val (candidates, append);
+    }
+
+  if (candidates->len > 0)
+    g_array_sort (candidates, (GCompareFunc) cmp_scores);
+  return g_steal_pointer (&candidates);
 }
 
-static inline const char *
-utf8_skip_to_next_of_class (const char **s,
-                            GUnicodeType class)
+static void
+send_partial (DexChannel *channel,
+              GPtrArray  *snapshot,
+              GArray     *scores)
 {
-  gboolean skipped = FALSE;
+  g_autoptr (DexFuture) future = NULL;
 
-  UTF8_FOREACH_FORWARD (p, *s)
-  {
-    if (utf8_char_class (p, NULL) == class)
-      {
-        if (skipped)
-          return p;
-      }
-    else if (!skipped)
-      {
-        *s      = p;
-        skipped = TRUE;
-      }
-  }
-  /* return the end of the string if nothing was found */
-  return *s + strlen (*s);
+  /* Don't wait for the receiver, the final result matters more */
+  future = dex_channel_send (
+      channel,
+      dex_future_new_take_boxed (
+          G_TYPE_PTR_ARRAY,
+          results_from_candidates (snapshot, scores)));
 }
 
 static gint
@@ -541,4 +1428,202 @@ cmp_scores (Score *a,
   return (b->val - a->val < 0.0) ? -1 : 1;
 }
 
+static void
+model_items_changed (BzSearchEngine *self,
+                     guint           position,
+                     guint           removed,
+                     guint           added,
+                     GListModel     *model)
+{
+  bz_search_engine_invalidate (self);
+}
+
+static void
+stats_changed (BzSearchEngine *self,
+               GParamSpec     *pspec,
+               BzStatsStore   *stats)
+{
+  /* Popularity priors are baked into the index */
+  bz_search_engine_invalidate (self);
+}
+
+static void
+ensure_index_locked (BzSearchEngine *self)
+{
+  guint n_groups = 0;
+
+  if (self->index != NULL)
+    return;
+
+  n_groups = g_list_model_get_n_items (self->model);
+
+  /* Only take the snapshot here, tokenizing
+     happens later on the thread pool */
+  self->index           = search_index_data_new ();
+  self->index->snapshot = g_ptr_array_new_with_free_func (g_object_unref);
+  g_mutex_init (&self->index->mutex);
+  g_ptr_array_set_size (self->index->snapshot, n_groups);
+
+  for (guint i = 0; i < n_groups; i++)
+    g_ptr_array_index (self->index->snapshot, i) = g_list_model_get_item (self->model, i);
+
+  /* The store isn't thread safe, so read it here
+     rather than in build_index() */
+  if (self->stats != NULL &&
+      bz_stats_store_get_n_days (self->stats) > 0)
+    {
+      self->index->installs = g_array_sized_new (FALSE, TRUE, sizeof (guint64), n_groups);
+      g_array_set_size (self->index->installs, n_groups);
+
+      for (guint i = 0; i < n_groups; i++)
+        {
+          BzEntryGroup *group = NULL;
+          const char   *id    = NULL;
+
+          group = g_ptr_array_index (self->index->snapshot, i);
+          id    = bz_entry_group_get_id (group);
+          if (id != NULL)
+            g_array_index (self->index->installs, guint64, i) =
+                bz_stats_store_get_installs (self->stats, id, 0);
+        }
+    }
+}
+
+static CachedQuery *
+lookup_cached_locked (BzSearchEngine *self,
+                      const char     *key,
+                      const char     *facets_key)
+{
+  for (GList *link = self->lru.head; link != NULL; link = link->next)
+    {
+      CachedQuery *cached = link->data;
+
+      if (cached->generation == self->generation &&
+          g_strcmp0 (cached->key, key) == 0 &&
+          g_strcmp0 (cached->facets_key, facets_key) == 0)
+        {
+          g_queue_unlink (&self->lru, link);
+          g_queue_push_head_link (&self->lru, link);
+          return cached;
+        }
+    }
+
+  return NULL;
+}
+
+static CachedQuery *
+lookup_seed_locked (BzSearchEngine *self,
+                    const char     *key,
+                    const char     *facets_key)
+{
+  CachedQuery *best     = NULL;
+  gsize        best_len = 0;
+
+  for (GList *link = self->lru.head; link != NULL; link = link->next)
+    {
+      CachedQuery *cached     = link->data;
+      gsize        len        = 0;
+      gboolean     extends    = TRUE;
+      gsize        last_token = 0;
+
+      if (cached->generation != self->generation ||
+          g_strcmp0 (cached->facets_key, facets_key) != 0)
+        continue;
+
+      len = strlen (cached->key);
+      if (len == 0 || len <= best_len ||
+          !g_str_has_prefix (key, cached->key))
+        continue;
+
+      /* The extension must only lengthen the last term, since a new term may
+         match groups the prefix could not */
+      for (const char *p = key + len; *p != '\0'; p = g_utf8_next_char (p))
+        {
+          if (!is_token_char (g_utf8_get_char (p)))
+            {
+              extends = FALSE;
+              break;
+            }
+        }
+      if (!extends)
+        continue;
+
+      /* Short terms only match at the start of tokens,
+         while their extensions may match anywhere */
+      for (const char *p = cached->key + len; p > cached->key;)
+        {
+          p = g_utf8_prev_char (p);
+          if (!is_token_char (g_utf8_get_char (p)))
+            break;
+          last_token = cached->key + len - p;
+        }
+      if (last_token < INFIX_MIN_LENGTH)
+        continue;
+
+      best     = cached;
+      best_len = len;
+    }
+
+  return best;
+}
+
+static void
+insert_cached (BzSearchEngine *self,
+               CachedQuery    *cached)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  locker = g_mutex_locker_new (&self->cache_mutex);
+
+  /* The catalog changed while we were working */
+  if (cached->generation != self->generation)
+    return;
+
+  for (GList *link = self->lru.head; link != NULL; link = link->next)
+    {
+      CachedQuery *existing = link->data;
+
+      if (g_strcmp0 (existing->key, cached->key) == 0 &&
+          g_strcmp0 (existing->facets_key, cached->facets_key) == 0)
+        {
+          cached_query_data_unref (existing);
+          g_queue_delete_link (&self->lru, link);
+          break;
+        }
+    }
+
+  g_queue_push_head (&self->lru, cached_query_data_ref (cached));
+  while (self->lru.length > MAX_CACHED_QUERIES)
+    cached_query_data_unref (g_queue_pop_tail (&self->lru));
+}
+
+static GPtrArray *
+results_from_candidates (GPtrArray *snapshot,
+                         GArray    *candidates)
+{
+  g_autoptr (GPtrArray) results = NULL;
+
+  results = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_set_size (results, candidates->len);
+
+  for (guint i = 0; i < candidates->len; i++)
+    {
+      Score        *score                      = NULL;
+      BzEntryGroup *group                      = NULL;
+      g_autoptr (BzSearchResult) search_result = NULL;
+
+      score = &g_array_index (candidates, Score, i);
+      group = g_ptr_array_index (snapshot, score->idx);
+
+      search_result = bz_search_result_new ();
+      bz_search_result_set_group (search_result, group);
+      bz_search_result_set_original_index (search_result, score->idx);
+      bz_search_result_set_score (search_result, score->val);
+
+      g_ptr_array_index (results, i) = g_steal_pointer (&search_result);
+    }
+
+  return g_steal_pointer (&results);
+}
+
 /* End of bz-search-engine.c */
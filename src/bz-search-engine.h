@@ -23,8 +23,17 @@
 #include <gtk/gtk.h>
 #include <libdex.h>
 
+#include "bz-stats-store.h"
+
 G_BEGIN_DECLS
 
+/* Facets a query may be constrained to, categories
+   are named like "category:Game" */
+#define BZ_SEARCH_FACET_FLOSS           "floss"
+#define BZ_SEARCH_FACET_VERIFIED        "verified"
+#define BZ_SEARCH_FACET_INSTALLED       "installed"
+#define BZ_SEARCH_FACET_CATEGORY_PREFIX "category:"
+
 #define BZ_TYPE_SEARCH_ENGINE (bz_search_engine_get_type ())
 G_DECLARE_FINAL_TYPE (BzSearchEngine, bz_search_engine, BZ, SEARCH_ENGINE, GObject)
 
@@ -38,10 +47,52 @@ void
 bz_search_engine_set_model (BzSearchEngine *self,
                             GListModel     *model);
 
+BzStatsStore *
+bz_search_engine_get_stats_store (BzSearchEngine *self);
+
+/* Recent installs from here rank popular groups higher */
+void
+bz_search_engine_set_stats_store (BzSearchEngine *self,
+                                  BzStatsStore   *stats);
+
+/* Drops cached results, call this after mutating
+   groups which are already in the model */
+void
+bz_search_engine_invalidate (BzSearchEngine *self);
+
+/* Drops cached results but keeps the index, for when memory is
+   more important than the next few queries being instant */
+void
+bz_search_engine_trim (BzSearchEngine *self);
+
 DexFuture *
 bz_search_engine_query (BzSearchEngine    *self,
                         const char *const *terms);
 
+/* Like bz_search_engine_query(), but before the returned future resolves,
+   progressively better ranked GPtrArrays of BzSearchResult objects may be
+   sent to `partials` */
+DexFuture *
+bz_search_engine_query_streaming (BzSearchEngine    *self,
+                                  const char *const *terms,
+                                  DexChannel        *partials);
+
+/* Like bz_search_engine_query_streaming(), but only groups matching every
+   one of `facets` are considered. `terms` may be empty here, in which case
+   all matching groups are returned in model order */
+DexFuture *
+bz_search_engine_query_faceted (BzSearchEngine    *self,
+                                const char *const *terms,
+                                const char *const *facets,
+                                DexChannel        *partials);
+
+/* Resolves to a GHashTable mapping every known facet to the number of
+   results bz_search_engine_query_faceted() would yield which match it */
+DexFuture *
+bz_search_engine_count_facets (BzSearchEngine    *self,
+                               const char *const *terms,
+                               const char *const *facets);
+
 G_END_DECLS
 
 /* End of bz-search-engine.h */
@@ -0,0 +1,97 @@
+/* bz-search-fold.c
+ *
+ * Copyright 2025 Adam Masciola
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "bz-search-fold.h"
+
+static inline gboolean
+is_strippable_mark (gunichar ch);
+
+static inline gunichar
+fold_undecomposable (gunichar ch);
+
+char *
+bz_search_fold (const char *text,
+                gssize      length)
+{
+  g_autofree char *valid      = NULL;
+  g_autofree char *decomposed = NULL;
+  g_autoptr (GString) string  = NULL;
+
+  g_return_val_if_fail (text != NULL, NULL);
+
+  valid      = g_utf8_make_valid (text, length);
+  decomposed = g_utf8_normalize (valid, -1, G_NORMALIZE_NFKD);
+  if (decomposed == NULL)
+    return g_utf8_casefold (valid, -1);
+
+  string = g_string_sized_new (strlen (decomposed));
+  for (const char *p = decomposed; *p != '\0'; p = g_utf8_next_char (p))
+    {
+      gunichar ch = 0;
+
+      ch = g_utf8_get_char (p);
+      if (is_strippable_mark (ch))
+        continue;
+
+      g_string_append_unichar (string, fold_undecomposable (ch));
+    }
+
+  return g_utf8_casefold (string->str, string->len);
+}
+
+static inline gboolean
+is_strippable_mark (gunichar ch)
+{
+  GUnicodeType type = 0;
+
+  /* The kana voicing marks change the sound entirely,
+     so "が" must not be reduced to "か" */
+  if (ch == 0x3099 || ch == 0x309A)
+    return FALSE;
+
+  type = g_unichar_type (ch);
+  return type == G_UNICODE_NON_SPACING_MARK ||
+         type == G_UNICODE_ENCLOSING_MARK;
+}
+
+static inline gunichar
+fold_undecomposable (gunichar ch)
+{
+  /* These letters are not composed of a base and a mark as far as NFKD is
+     concerned, but people type them without the stroke all the time */
+  switch (ch)
+    {
+    case 0x0131: /* ı (Turkish dotless i) */
+      return 'i';
+    case 0x0110: /* Đ */
+    case 0x0111: /* đ (Vietnamese) */
+      return 'd';
+    case 0x0141: /* Ł */
+    case 0x0142: /* ł */
+      return 'l';
+    case 0x00D8: /* Ø */
+    case 0x00F8: /* ø */
+      return 'o';
+    default:
+      return ch;
+    }
+}
+
+/* End of bz-search-fold.c */
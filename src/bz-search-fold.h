@@ -0,0 +1,42 @@
+/* bz-search-fold.h
+ *
+ * Copyright 2025 Adam Masciola
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Returns a case folded and diacritic stripped version of `text` suitable for
+   locale independent matching. For example:
+
+     "Café", "CAFE" and "Cafe\u0301" -> "cafe"
+     "İstanbul", "ışık"             -> "istanbul", "isik"
+     "Tiếng Việt", "Đà Nẵng"        -> "tieng viet", "da nang"
+     "ＡＢＣ", "ｶﾞ"                    -> "abc", "ガ"
+
+   Ideographs pass through untouched */
+char *
+bz_search_fold (const char *text,
+                gssize      length);
+
+G_END_DECLS
+
+/* End of bz-search-fold.h */
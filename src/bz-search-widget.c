@@ -24,13 +24,20 @@
 #include "bz-async-texture.h"
 #include "bz-category-tile.h"
 #include "bz-dynamic-list-view.h"
+#include "bz-flathub-state.h"
 #include "bz-group-tile-css-watcher.h"
 #include "bz-rich-app-tile.h"
 #include "bz-screenshot.h"
+#include "bz-search-engine.h"
 #include "bz-search-result.h"
 #include "bz-search-widget.h"
 #include "bz-util.h"
 
+/* When a better ranking arrives after results are already showing, this many
+   of the top results keep their place so things don't shuffle around under
+   the cursor */
+#define N_PINNED_RESULTS 12
+
 struct _BzSearchWidget
 {
   AdwBin parent_instance;
@@ -46,6 +53,16 @@ struct _BzSearchWidget
   GtkSelectionModel *selection_model;
   guint              search_update_timeout;
   DexFuture         *search_query;
+  DexChannel        *search_partials;
+  DexFuture         *search_partials_loop;
+  gboolean           search_showing_partial;
+  char             **search_terms;
+  DexFuture         *facet_counts;
+
+  /* Picked from the facet bar, the category
+     is a full facet like "category:Game" */
+  char              *category_facet;
+  gboolean           installed_facet;
 
   /* Template widgets */
   GtkText     *search_bar;
@@ -53,6 +70,7 @@ struct _BzSearchWidget
   GtkBox      *content_box;
   GtkStack    *search_stack;
   GtkGridView *grid_view;
+  GtkBox      *facet_bar;
 };
 
 G_DEFINE_FINAL_TYPE (BzSearchWidget, bz_search_widget, ADW_TYPE_BIN)
@@ -105,9 +123,34 @@ static DexFuture *
 search_query_then (DexFuture *future,
                    GWeakRef  *wr);
 
+static DexFuture *
+search_partials_then_loop (DexFuture *future,
+                           GWeakRef  *wr);
+
+static void
+apply_results (BzSearchWidget *self,
+               GPtrArray      *results,
+               gboolean        final);
+
 static void
 update_filter (BzSearchWidget *self);
 
+static GStrv
+dup_facets (BzSearchWidget *self,
+            gboolean        with_picked);
+
+static DexFuture *
+facet_counts_then (DexFuture *future,
+                   GWeakRef  *wr);
+
+static void
+rebuild_facet_bar (BzSearchWidget *self,
+                   GHashTable     *counts);
+
+static void
+facet_toggled (BzSearchWidget  *self,
+               GtkToggleButton *button);
+
 static void
 emit_idx (BzSearchWidget *self,
           GListModel     *model,
@@ -127,6 +170,11 @@ bz_search_widget_dispose (GObject *object)
 
   g_clear_handle_id (&self->search_update_timeout, g_source_remove);
   dex_clear (&self->search_query);
+  dex_clear (&self->search_partials_loop);
+  dex_clear (&self->search_partials);
+  dex_clear (&self->facet_counts);
+  g_clear_pointer (&self->search_terms, g_strfreev);
+  g_clear_pointer (&self->category_facet, g_free);
 
   g_clear_object (&self->state);
   g_clear_object (&self->selected);
@@ -419,6 +467,7 @@ bz_search_widget_class_init (BzSearchWidgetClass *klass)
   gtk_widget_class_bind_template_child (widget_class, BzSearchWidget, content_box);
   gtk_widget_class_bind_template_child (widget_class, BzSearchWidget, search_stack);
   gtk_widget_class_bind_template_child (widget_class, BzSearchWidget, grid_view);
+  gtk_widget_class_bind_template_child (widget_class, BzSearchWidget, facet_bar);
   gtk_widget_class_bind_template_callback (widget_class, bind_category_tile_cb);
   gtk_widget_class_bind_template_callback (widget_class, unbind_category_tile_cb);
   gtk_widget_class_bind_template_callback (widget_class, tile_install_clicked_cb);
@@ -682,26 +731,156 @@ search_query_then (DexFuture *future,
                    GWeakRef  *wr)
 {
   g_autoptr (BzSearchWidget) self = NULL;
-  GPtrArray  *results             = NULL;
-  guint       old_length          = 0;
-  const char *page_name           = NULL;
+  GPtrArray      *results         = NULL;
+  BzSearchEngine *engine          = NULL;
 
   bz_weak_get_or_return_reject (self, wr);
 
-  results    = g_value_get_boxed (dex_future_get_value (future, NULL));
+  /* Anything still in flight is outdated now */
+  dex_clear (&self->search_partials_loop);
+  dex_clear (&self->search_partials);
+
+  results = g_value_get_boxed (dex_future_get_value (future, NULL));
+  apply_results (self, results, TRUE);
+
+  dex_clear (&self->search_query);
+
+  /* Counted without what was picked in the facet bar, so every button
+     says what picking it instead would yield. With nothing picked this
+     is the query which just finished, which the engine has cached */
+  engine = bz_state_info_get_search_engine (self->state);
+  if (engine != NULL && self->search_terms != NULL)
+    {
+      g_auto (GStrv) facets        = NULL;
+      g_autoptr (DexFuture) counts = NULL;
+
+      facets = dup_facets (self, FALSE);
+      counts = bz_search_engine_count_facets (
+          engine,
+          (const char *const *) self->search_terms,
+          (const char *const *) facets);
+      counts = dex_future_then (
+          counts,
+          (DexFutureCallback) facet_counts_then,
+          bz_track_weak (self), bz_weak_release);
+      self->facet_counts = g_steal_pointer (&counts);
+    }
+
+  return NULL;
+}
+
+static DexFuture *
+search_partials_then_loop (DexFuture *future,
+                           GWeakRef  *wr)
+{
+  g_autoptr (BzSearchWidget) self = NULL;
+  GPtrArray *results              = NULL;
+
+  bz_weak_get_or_return_reject (self, wr);
+
+  results = g_value_get_boxed (dex_future_get_value (future, NULL));
+  apply_results (self, results, FALSE);
+
+  return dex_channel_receive (self->search_partials);
+}
+
+static void
+apply_results (BzSearchWidget *self,
+               GPtrArray      *results,
+               gboolean        final)
+{
+  guint       old_length = 0;
+  const char *page_name  = NULL;
+
   old_length = g_list_model_get_n_items (G_LIST_MODEL (self->search_model));
 
-  g_list_store_splice (
-      self->search_model,
-      0, old_length,
-      (gpointer *) results->pdata, results->len);
-  gtk_widget_set_visible (GTK_WIDGET (self->search_busy), FALSE);
+  if (self->search_showing_partial && old_length > 0)
+    {
+      g_autoptr (GPtrArray) merged = NULL;
+      guint n_same                 = 0;
 
-  if (results->len > 0)
+      if (final)
+        /* The final ranking is authoritative, lay it out as is */
+        merged = g_ptr_array_ref (results);
+      else
+        {
+          g_autoptr (GHashTable) group_to_result = NULL;
+          guint n_pinned                         = 0;
+
+          /* Refine what is already on screen: keep the first few results
+             where they are if they still match, then lay out the rest by
+             the new ranking */
+          group_to_result = g_hash_table_new (g_direct_hash, g_direct_equal);
+          for (guint i = 0; i < results->len; i++)
+            {
+              BzSearchResult *result = g_ptr_array_index (results, i);
+
+              g_hash_table_insert (group_to_result, bz_search_result_get_group (result), result);
+            }
+
+          merged   = g_ptr_array_new_with_free_func (g_object_unref);
+          n_pinned = MIN (old_length, N_PINNED_RESULTS);
+          for (guint i = 0; i < n_pinned; i++)
+            {
+              g_autoptr (BzSearchResult) old = NULL;
+              BzSearchResult *result         = NULL;
+
+              old    = g_list_model_get_item (G_LIST_MODEL (self->search_model), i);
+              result = g_hash_table_lookup (group_to_result, bz_search_result_get_group (old));
+              if (result == NULL)
+                continue;
+
+              g_ptr_array_add (merged, g_object_ref (result));
+              g_hash_table_remove (group_to_result, bz_search_result_get_group (old));
+            }
+          for (guint i = 0; i < results->len; i++)
+            {
+              BzSearchResult *result = g_ptr_array_index (results, i);
+
+              if (g_hash_table_contains (group_to_result, bz_search_result_get_group (result)))
+                g_ptr_array_add (merged, g_object_ref (result));
+            }
+        }
+
+      /* Only touch the part of the store that differs */
+      for (; n_same < MIN (old_length, merged->len); n_same++)
+        {
+          g_autoptr (BzSearchResult) old = NULL;
+          BzSearchResult *result         = NULL;
+
+          old    = g_list_model_get_item (G_LIST_MODEL (self->search_model), n_same);
+          result = g_ptr_array_index (merged, n_same);
+          if (bz_search_result_get_group (old) != bz_search_result_get_group (result))
+            break;
+
+          /* Same tile, just update it in place */
+          bz_search_result_set_score (old, bz_search_result_get_score (result));
+        }
+
+      g_list_store_splice (
+          self->search_model,
+          n_same, old_length - n_same,
+          (gpointer *) merged->pdata + n_same, merged->len - n_same);
+    }
+  else
     {
-      page_name = "results";
-      gtk_widget_activate_action (GTK_WIDGET (self->grid_view), "list.scroll-to-item", "u", 0);
+      g_list_store_splice (
+          self->search_model,
+          0, old_length,
+          (gpointer *) results->pdata, results->len);
+      if (results->len > 0)
+        gtk_widget_activate_action (GTK_WIDGET (self->grid_view), "list.scroll-to-item", "u", 0);
     }
+
+  self->search_showing_partial = self->search_showing_partial || results->len > 0;
+  if (final)
+    gtk_widget_set_visible (GTK_WIDGET (self->search_busy), FALSE);
+
+  if (g_list_model_get_n_items (G_LIST_MODEL (self->search_model)) > 0)
+    page_name = "results";
+  else if (!final)
+    /* Keep whatever is showing until we know for sure */
+    return;
   else
     {
       const char *search_text = gtk_editable_get_text (GTK_EDITABLE (self->search_bar));
@@ -709,9 +888,6 @@ search_query_then (DexFuture *future,
     }
 
   gtk_stack_set_visible_child_name (self->search_stack, page_name);
-
-  dex_clear (&self->search_query);
-  return NULL;
 }
 
 static void
@@ -722,11 +898,16 @@ update_filter (BzSearchWidget *self)
   g_autoptr (GStrvBuilder) builder = NULL;
   guint n_terms                    = 0;
   g_auto (GStrv) terms             = NULL;
+  g_auto (GStrv) facets            = NULL;
   g_autoptr (DexFuture) future     = NULL;
   g_autofree gchar **tokens        = NULL;
 
   g_clear_handle_id (&self->search_update_timeout, g_source_remove);
   dex_clear (&self->search_query);
+  dex_clear (&self->search_partials_loop);
+  dex_clear (&self->search_partials);
+  dex_clear (&self->facet_counts);
+  self->search_showing_partial = FALSE;
 
   gtk_widget_set_visible (GTK_WIDGET (self->search_busy), FALSE);
 
@@ -766,22 +947,198 @@ update_filter (BzSearchWidget *self)
       return;
     }
 
-  terms = g_strv_builder_end (builder);
+  terms  = g_strv_builder_end (builder);
+  facets = dup_facets (self, TRUE);
 
   self->search_in_progress = TRUE;
 
-  future = bz_search_engine_query (
+  self->search_partials = dex_channel_new (0);
+  future                = bz_search_engine_query_faceted (
       engine,
-      (const char *const *) terms);
+      (const char *const *) terms,
+      (const char *const *) facets,
+      self->search_partials);
   gtk_widget_set_visible (
       GTK_WIDGET (self->search_busy),
       dex_future_is_pending (future));
 
+  if (dex_future_is_pending (future))
+    self->search_partials_loop = dex_future_then_loop (
+        dex_channel_receive (self->search_partials),
+        (DexFutureCallback) search_partials_then_loop,
+        bz_track_weak (self), bz_weak_release);
+
   future = dex_future_then (
       future,
       (DexFutureCallback) search_query_then,
       bz_track_weak (self), bz_weak_release);
   self->search_query = g_steal_pointer (&future);
+
+  g_clear_pointer (&self->search_terms, g_strfreev);
+  self->search_terms = g_steal_pointer (&terms);
+}
+
+static GStrv
+dup_facets (BzSearchWidget *self,
+            gboolean        with_picked)
+{
+  g_autoptr (GStrvBuilder) builder = NULL;
+
+  builder = g_strv_builder_new ();
+  if (bz_state_info_get_show_only_foss (self->state))
+    g_strv_builder_add (builder, BZ_SEARCH_FACET_FLOSS);
+  if (bz_state_info_get_show_only_verified (self->state))
+    g_strv_builder_add (builder, BZ_SEARCH_FACET_VERIFIED);
+  if (with_picked && self->installed_facet)
+    g_strv_builder_add (builder, BZ_SEARCH_FACET_INSTALLED);
+  if (with_picked && self->category_facet != NULL)
+    g_strv_builder_add (builder, self->category_facet);
+
+  return g_strv_builder_end (builder);
+}
+
+static DexFuture *
+facet_counts_then (DexFuture *future,
+                   GWeakRef  *wr)
+{
+  g_autoptr (BzSearchWidget) self = NULL;
+  GHashTable *counts              = NULL;
+
+  bz_weak_get_or_return_reject (self, wr);
+
+  counts = g_value_get_boxed (dex_future_get_value (future, NULL));
+  rebuild_facet_bar (self, counts);
+
+  dex_clear (&self->facet_counts);
+  return NULL;
+}
+
+static gint
+cmp_facet_counts (gconstpointer a,
+                  gconstpointer b,
+                  gpointer      user_data)
+{
+  GHashTable *counts  = user_data;
+  guint       count_a = 0;
+  guint       count_b = 0;
+
+  count_a = GPOINTER_TO_UINT (g_hash_table_lookup (counts, *(const char **) a));
+  count_b = GPOINTER_TO_UINT (g_hash_table_lookup (counts, *(const char **) b));
+  if (count_a != count_b)
+    return count_a < count_b ? 1 : -1;
+  return g_strcmp0 (*(const char **) a, *(const char **) b);
+}
+
+static void
+add_facet_button (BzSearchWidget *self,
+                  const char     *facet,
+                  const char     *title,
+                  guint           count,
+                  gboolean        active)
+{
+  g_autofree char *label  = NULL;
+  GtkWidget       *button = NULL;
+
+  label  = g_strdup_printf ("%s (%u)", title, count);
+  button = gtk_toggle_button_new_with_label (label);
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (button), active);
+  g_object_set_data_full (G_OBJECT (button), "facet", g_strdup (facet), g_free);
+  g_signal_connect_swapped (button, "toggled", G_CALLBACK (facet_toggled), self);
+
+  gtk_box_append (self->facet_bar, button);
+}
+
+static void
+rebuild_facet_bar (BzSearchWidget *self,
+                   GHashTable     *counts)
+{
+  GtkWidget  *child                     = NULL;
+  GListModel *categories                = NULL;
+  g_autoptr (GPtrArray) category_facets = NULL;
+  GHashTableIter iter                   = { 0 };
+  gpointer       key                    = NULL;
+  gpointer       value                  = NULL;
+  guint          n_installed            = 0;
+
+  while ((child = gtk_widget_get_first_child (GTK_WIDGET (self->facet_bar))) != NULL)
+    gtk_box_remove (self->facet_bar, child);
+
+  n_installed = GPOINTER_TO_UINT (g_hash_table_lookup (counts, BZ_SEARCH_FACET_INSTALLED));
+  if (n_installed > 0 || self->installed_facet)
+    add_facet_button (self, BZ_SEARCH_FACET_INSTALLED, _ ("Installed"), n_installed, self->installed_facet);
+
+  category_facets = g_ptr_array_new ();
+  g_hash_table_iter_init (&iter, counts);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (g_str_has_prefix (key, BZ_SEARCH_FACET_CATEGORY_PREFIX) &&
+          (GPOINTER_TO_UINT (value) > 0 || g_strcmp0 (key, self->category_facet) == 0))
+        g_ptr_array_add (category_facets, key);
+    }
+  g_ptr_array_sort_with_data (category_facets, cmp_facet_counts, counts);
+
+  if (bz_state_info_get_flathub (self->state) != NULL)
+    categories = bz_flathub_state_get_categories (bz_state_info_get_flathub (self->state));
+
+  for (guint i = 0; i < category_facets->len; i++)
+    {
+      const char *facet        = NULL;
+      const char *name         = NULL;
+      const char *title        = NULL;
+      guint       n_categories = 0;
+
+      facet = g_ptr_array_index (category_facets, i);
+      name  = facet + strlen (BZ_SEARCH_FACET_CATEGORY_PREFIX);
+      title = name;
+
+      /* Facets only carry the id, flathub knows the
+         translated name if it has been loaded yet */
+      if (categories != NULL)
+        n_categories = g_list_model_get_n_items (categories);
+      for (guint j = 0; j < n_categories; j++)
+        {
+          g_autoptr (BzFlathubCategory) category = NULL;
+
+          category = g_list_model_get_item (categories, j);
+          if (g_strcmp0 (bz_flathub_category_get_name (category), name) == 0)
+            {
+              title = bz_flathub_category_get_display_name (category);
+              break;
+            }
+        }
+
+      add_facet_button (
+          self, facet, title,
+          GPOINTER_TO_UINT (g_hash_table_lookup (counts, facet)),
+          g_strcmp0 (facet, self->category_facet) == 0);
+    }
+
+  gtk_widget_set_visible (
+      GTK_WIDGET (self->facet_bar),
+      gtk_widget_get_first_child (GTK_WIDGET (self->facet_bar)) != NULL);
+}
+
+static void
+facet_toggled (BzSearchWidget  *self,
+               GtkToggleButton *button)
+{
+  const char *facet  = NULL;
+  gboolean    active = FALSE;
+
+  facet  = g_object_get_data (G_OBJECT (button), "facet");
+  active = gtk_toggle_button_get_active (button);
+
+  if (g_strcmp0 (facet, BZ_SEARCH_FACET_INSTALLED) == 0)
+    self->installed_facet = active;
+  else if (active)
+    {
+      g_clear_pointer (&self->category_facet, g_free);
+      self->category_facet = g_strdup (facet);
+    }
+  else if (g_strcmp0 (facet, self->category_facet) == 0)
+    g_clear_pointer (&self->category_facet, g_free);
+
+  update_filter (self);
 }
 
 static void
@@ -76,6 +76,14 @@ static void
 refresh_dark_light_classes (BzSectionView   *self,
                             AdwStyleManager *mgr);
 
+static void
+refresh_classes (BzSectionView *self);
+
+static void
+section_classes_changed (BzSectionView    *self,
+                         GParamSpec       *pspec,
+                         BzCuratedSection *section);
+
 static BzAsyncTexture *
 choose_image (const char *default_variant_uri,
               const char *light_variant_uri,
@@ -88,6 +96,9 @@ bz_section_view_dispose (GObject *object)
 
   g_signal_handlers_disconnect_by_func (
       self->style_manager, dark_changed, self);
+  if (self->section != NULL)
+    g_signal_handlers_disconnect_by_func (
+        self->section, section_classes_changed, self);
 
   g_clear_object (&self->section);
   g_clear_object (&self->classes);
@@ -340,8 +351,64 @@ bz_section_view_set_section (BzSectionView    *self,
   g_return_if_fail (BZ_IS_SECTION_VIEW (self));
   g_return_if_fail (section == NULL || BZ_IS_CURATED_SECTION (section));
 
+  if (self->section != NULL)
+    g_signal_handlers_disconnect_by_func (
+        self->section, section_classes_changed, self);
   g_clear_object (&self->section);
 
+  if (section != NULL)
+    {
+      self->section = g_object_ref (section);
+
+      /* Reloads update sections in place, see BzContentProvider */
+      g_signal_connect_swapped (
+          section, "notify::classes",
+          G_CALLBACK (section_classes_changed), self);
+      g_signal_connect_swapped (
+          section, "notify::light-classes",
+          G_CALLBACK (section_classes_changed), self);
+      g_signal_connect_swapped (
+          section, "notify::dark-classes",
+          G_CALLBACK (section_classes_changed), self);
+    }
+
+  refresh_classes (self);
+  refresh_dark_light_classes (self, NULL);
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_SECTION]);
+}
+
+BzCuratedSection *
+bz_section_view_get_section (BzSectionView *self)
+{
+  g_return_val_if_fail (BZ_IS_SECTION_VIEW (self), NULL);
+  return self->section;
+}
+
+static void
+tile_clicked (BzEntryGroup *group,
+              GtkButton    *button)
+{
+  GtkWidget *self = NULL;
+
+  self = gtk_widget_get_ancestor (GTK_WIDGET (button), BZ_TYPE_SECTION_VIEW);
+  g_signal_emit (self, signals[SIGNAL_GROUP_ACTIVATED], 0, group);
+}
+
+static void
+section_classes_changed (BzSectionView    *self,
+                         GParamSpec       *pspec,
+                         BzCuratedSection *section)
+{
+  if (g_strcmp0 (pspec->name, "classes") == 0)
+    refresh_classes (self);
+  else
+    refresh_dark_light_classes (self, NULL);
+}
+
+static void
+refresh_classes (BzSectionView *self)
+{
   if (self->classes != NULL)
     {
       guint n_classes = 0;
@@ -360,49 +427,26 @@ bz_section_view_set_section (BzSectionView    *self,
     }
   g_clear_object (&self->classes);
 
-  if (section != NULL)
+  if (self->section == NULL)
+    return;
+
+  g_object_get (self->section, "classes", &self->classes, NULL);
+  if (self->classes != NULL)
     {
-      self->section = g_object_ref (section);
-      g_object_get (section, "classes", &self->classes, NULL);
+      guint n_classes = 0;
 
-      if (self->classes != NULL)
+      n_classes = g_list_model_get_n_items (self->classes);
+      for (guint i = 0; i < n_classes; i++)
         {
-          guint n_classes = 0;
-
-          n_classes = g_list_model_get_n_items (self->classes);
-          for (guint i = 0; i < n_classes; i++)
-            {
-              g_autoptr (GtkStringObject) string = NULL;
-              const char *class                  = NULL;
+          g_autoptr (GtkStringObject) string = NULL;
+          const char *class                  = NULL;
 
-              string = g_list_model_get_item (self->classes, i);
-              class  = gtk_string_object_get_string (string);
+          string = g_list_model_get_item (self->classes, i);
+          class  = gtk_string_object_get_string (string);
 
-              gtk_widget_add_css_class (GTK_WIDGET (self), class);
-            }
+          gtk_widget_add_css_class (GTK_WIDGET (self), class);
         }
-
-      refresh_dark_light_classes (self, NULL);
     }
-
-  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_SECTION]);
-}
-
-BzCuratedSection *
-bz_section_view_get_section (BzSectionView *self)
-{
-  g_return_val_if_fail (BZ_IS_SECTION_VIEW (self), NULL);
-  return self->section;
-}
-
-static void
-tile_clicked (BzEntryGroup *group,
-              GtkButton    *button)
-{
-  GtkWidget *self = NULL;
-
-  self = gtk_widget_get_ancestor (GTK_WIDGET (button), BZ_TYPE_SECTION_VIEW);
-  g_signal_emit (self, signals[SIGNAL_GROUP_ACTIVATED], 0, group);
 }
 
 static void
@@ -0,0 +1,915 @@
+/* bz-stats-store.c
+ *
+ * Copyright 2025 Adam Masciola
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN  "BAZAAR::STATS"
+#define BAZAAR_MODULE "stats"
+
+/* Days of history kept in the store */
+#define STATS_WINDOW_DAYS 30
+/* Most daily payloads fetched in one update, so that coming back after a
+ * long time offline doesn't download a month of stats at once */
+#define STATS_MAX_FETCH_DAYS 7
+#define STATS_URL            "https://flathub.org/stats"
+#define STATS_BASENAME       "installs"
+/* days, app ids, then one column of install counts per day */
+#define STATS_FORMAT "(asasaau)"
+
+#include <json-glib/json-glib.h>
+
+#include "bz-data-point.h"
+#include "bz-env.h"
+#include "bz-global-net.h"
+#include "bz-io.h"
+#include "bz-stats-store.h"
+#include "bz-util.h"
+
+struct _BzStatsStore
+{
+  GObject parent_instance;
+
+  GVariant    *data;
+  const char **days;
+  const char **apps;
+  gsize        n_days;
+  gsize        n_apps;
+  GPtrArray   *columns;
+  GHashTable  *app_index;
+
+  DexFuture *loading;
+  DexFuture *updating;
+};
+
+G_DEFINE_FINAL_TYPE (BzStatsStore, bz_stats_store, G_TYPE_OBJECT)
+
+enum
+{
+  PROP_0,
+
+  PROP_LAST_DAY,
+
+  LAST_PROP
+};
+static GParamSpec *props[LAST_PROP] = { 0 };
+
+BZ_DEFINE_DATA (
+    update,
+    Update,
+    {
+      GVariant *current;
+      char     *path;
+    },
+    BZ_RELEASE_DATA (current, g_variant_unref);
+    BZ_RELEASE_DATA (path, g_free))
+
+static DexFuture *
+load_fiber (char *path);
+
+static DexFuture *
+update_fiber (UpdateData *data);
+
+static DexFuture *
+start_update (BzStatsStore *self);
+
+static DexFuture *
+loaded_finally (DexFuture *future,
+                GWeakRef  *wr);
+
+static DexFuture *
+apply_then (DexFuture *future,
+            GWeakRef  *wr);
+
+static GVariant *
+map_data (const char *path,
+          GError    **error);
+
+static GHashTable *
+fetch_day (GDateTime *day,
+           GError   **error);
+
+static void
+ingest_ref_foreach (JsonObject *object,
+                    const char *app_id,
+                    JsonNode   *member_node,
+                    GHashTable *installs);
+
+static GVariant *
+merge (GVariant  *current,
+       GPtrArray *new_days,
+       GPtrArray *new_installs);
+
+static GDateTime *
+parse_day (const char *day);
+
+static int
+cmp_totals (const guint   *a,
+            const guint   *b,
+            const guint64 *totals);
+
+static gboolean
+set_data (BzStatsStore *self,
+          GVariant     *data);
+
+static const guint32 *
+get_column (BzStatsStore *self,
+            guint         day);
+
+static char *
+dup_path (void);
+
+static void
+bz_stats_store_dispose (GObject *object)
+{
+  BzStatsStore *self = BZ_STATS_STORE (object);
+
+  dex_clear (&self->loading);
+  dex_clear (&self->updating);
+  set_data (self, NULL);
+
+  G_OBJECT_CLASS (bz_stats_store_parent_class)->dispose (object);
+}
+
+static void
+bz_stats_store_get_property (GObject    *object,
+                             guint       prop_id,
+                             GValue     *value,
+                             GParamSpec *pspec)
+{
+  BzStatsStore *self = BZ_STATS_STORE (object);
+
+  switch (prop_id)
+    {
+    case PROP_LAST_DAY:
+      g_value_set_string (value, bz_stats_store_get_last_day (self));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+bz_stats_store_class_init (BzStatsStoreClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose      = bz_stats_store_dispose;
+  object_class->get_property = bz_stats_store_get_property;
+
+  props[PROP_LAST_DAY] =
+      g_param_spec_string (
+          "last-day",
+          NULL, NULL, NULL,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  g_object_class_install_properties (object_class, LAST_PROP, props);
+}
+
+static void
+bz_stats_store_init (BzStatsStore *self)
+{
+}
+
+BzStatsStore *
+bz_stats_store_new (void)
+{
+  return g_object_new (BZ_TYPE_STATS_STORE, NULL);
+}
+
+const char *
+bz_stats_store_get_last_day (BzStatsStore *self)
+{
+  g_return_val_if_fail (BZ_IS_STATS_STORE (self), NULL);
+  return self->n_days > 0 ? self->days[self->n_days - 1] : NULL;
+}
+
+guint
+bz_stats_store_get_n_days (BzStatsStore *self)
+{
+  g_return_val_if_fail (BZ_IS_STATS_STORE (self), 0);
+  return self->n_days;
+}
+
+guint
+bz_stats_store_get_n_apps (BzStatsStore *self)
+{
+  g_return_val_if_fail (BZ_IS_STATS_STORE (self), 0);
+  return self->n_apps;
+}
+
+guint64
+bz_stats_store_get_installs (BzStatsStore *self,
+                             const char   *app_id,
+                             guint         n_days)
+{
+  gpointer idx_p = NULL;
+  guint    idx   = 0;
+  guint64  total = 0;
+
+  g_return_val_if_fail (BZ_IS_STATS_STORE (self), 0);
+  g_return_val_if_fail (app_id != NULL, 0);
+
+  if (self->app_index == NULL ||
+      !g_hash_table_lookup_extended (self->app_index, app_id, NULL, &idx_p))
+    return 0;
+  idx = GPOINTER_TO_UINT (idx_p);
+
+  if (n_days == 0 || n_days > self->n_days)
+    n_days = self->n_days;
+  for (guint i = self->n_days - n_days; i < self->n_days; i++)
+    total += get_column (self, i)[idx];
+
+  return total;
+}
+
+GListModel *
+bz_stats_store_dup_installs_per_day (BzStatsStore *self,
+                                     const char   *app_id)
+{
+  g_autoptr (GListStore) store = NULL;
+  gpointer idx_p               = NULL;
+  guint    idx                 = 0;
+
+  g_return_val_if_fail (BZ_IS_STATS_STORE (self), NULL);
+  g_return_val_if_fail (app_id != NULL, NULL);
+
+  if (self->app_index == NULL ||
+      !g_hash_table_lookup_extended (self->app_index, app_id, NULL, &idx_p))
+    return NULL;
+  idx = GPOINTER_TO_UINT (idx_p);
+
+  store = g_list_store_new (BZ_TYPE_DATA_POINT);
+  for (guint i = 0; i < self->n_days; i++)
+    {
+      g_autoptr (GDateTime) date    = NULL;
+      g_autofree char *label        = NULL;
+      g_autoptr (BzDataPoint) point = NULL;
+
+      date = parse_day (self->days[i]);
+      if (date == NULL)
+        continue;
+      label = g_date_time_format (date, "%-d %b");
+
+      point = g_object_new (
+          BZ_TYPE_DATA_POINT,
+          "independent", (double) g_date_time_to_unix (date),
+          "dependent", (double) get_column (self, i)[idx],
+          "label", label,
+          NULL);
+      g_list_store_append (store, point);
+    }
+
+  return G_LIST_MODEL (g_steal_pointer (&store));
+}
+
+GListModel *
+bz_stats_store_dup_top_apps (BzStatsStore *self,
+                             guint         n_days,
+                             guint         max)
+{
+  g_autofree guint64 *totals      = NULL;
+  g_autoptr (GArray) order        = NULL;
+  g_autoptr (GtkStringList) store = NULL;
+
+  g_return_val_if_fail (BZ_IS_STATS_STORE (self), NULL);
+
+  store = gtk_string_list_new (NULL);
+  if (self->n_apps == 0)
+    return G_LIST_MODEL (g_steal_pointer (&store));
+
+  if (n_days == 0 || n_days > self->n_days)
+    n_days = self->n_days;
+
+  /* Walking whole columns keeps this a handful of linear passes over
+   * contiguous memory, even with the full catalog in the store */
+  totals = g_new0 (guint64, self->n_apps);
+  for (guint i = self->n_days - n_days; i < self->n_days; i++)
+    {
+      const guint32 *column = NULL;
+
+      column = get_column (self, i);
+      for (guint j = 0; j < self->n_apps; j++)
+        totals[j] += column[j];
+    }
+
+  order = g_array_sized_new (FALSE, FALSE, sizeof (guint), self->n_apps);
+  for (guint j = 0; j < self->n_apps; j++)
+    {
+      if (totals[j] > 0)
+        g_array_append_val (order, j);
+    }
+  g_array_sort_with_data (order, (GCompareDataFunc) cmp_totals, totals);
+
+  for (guint i = 0; i < order->len && (max == 0 || i < max); i++)
+    gtk_string_list_append (store, self->apps[g_array_index (order, guint, i)]);
+
+  return G_LIST_MODEL (g_steal_pointer (&store));
+}
+
+DexFuture *
+bz_stats_store_load (BzStatsStore *self)
+{
+  g_autoptr (DexFuture) future = NULL;
+
+  dex_return_error_if_fail (BZ_IS_STATS_STORE (self));
+
+  if (self->loading != NULL &&
+      dex_future_is_pending (self->loading))
+    return dex_ref (self->loading);
+
+  future = dex_scheduler_spawn (
+      bz_get_io_scheduler (),
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) load_fiber,
+      dup_path (), g_free);
+  future = dex_future_then (
+      future,
+      (DexFutureCallback) apply_then,
+      bz_track_weak (self), bz_weak_release);
+
+  dex_clear (&self->loading);
+  self->loading = dex_ref (future);
+  return g_steal_pointer (&future);
+}
+
+DexFuture *
+bz_stats_store_update (BzStatsStore *self)
+{
+  g_autoptr (DexFuture) future = NULL;
+
+  dex_return_error_if_fail (BZ_IS_STATS_STORE (self));
+
+  if (self->updating != NULL &&
+      dex_future_is_pending (self->updating))
+    return dex_ref (self->updating);
+
+  /* The days on disk are the merge base, so
+     don't start before they are in */
+  if (self->loading != NULL &&
+      dex_future_is_pending (self->loading))
+    future = dex_future_finally (
+        dex_ref (self->loading),
+        (DexFutureCallback) loaded_finally,
+        bz_track_weak (self), bz_weak_release);
+  else
+    future = start_update (self);
+
+  dex_clear (&self->updating);
+  self->updating = dex_ref (future);
+  return g_steal_pointer (&future);
+}
+
+static DexFuture *
+start_update (BzStatsStore *self)
+{
+  g_autoptr (UpdateData) data  = NULL;
+  g_autoptr (DexFuture) future = NULL;
+
+  data          = update_data_new ();
+  data->current = bz_maybe_ref (self->data, g_variant_ref);
+  data->path    = dup_path ();
+
+  future = dex_scheduler_spawn (
+      bz_get_io_scheduler (),
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) update_fiber,
+      update_data_ref (data), update_data_unref);
+  future = dex_future_then (
+      future,
+      (DexFutureCallback) apply_then,
+      bz_track_weak (self), bz_weak_release);
+
+  return g_steal_pointer (&future);
+}
+
+static DexFuture *
+loaded_finally (DexFuture *future,
+                GWeakRef  *wr)
+{
+  g_autoptr (BzStatsStore) self = NULL;
+
+  bz_weak_get_or_return_reject (self, wr);
+  return start_update (self);
+}
+
+static DexFuture *
+load_fiber (char *path)
+{
+  g_autoptr (GError) local_error = NULL;
+  g_autoptr (GVariant) data      = NULL;
+
+  data = map_data (path, &local_error);
+  if (data == NULL)
+    {
+      if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Could not load download statistics from %s: %s",
+                   path, local_error->message);
+      return dex_future_new_false ();
+    }
+
+  return dex_future_new_take_variant (g_steal_pointer (&data));
+}
+
+static DexFuture *
+update_fiber (UpdateData *data)
+{
+  g_autoptr (GError) local_error     = NULL;
+  g_autoptr (GDateTime) now          = NULL;
+  g_autoptr (GDateTime) yesterday    = NULL;
+  g_autoptr (GDateTime) day          = NULL;
+  g_autoptr (GPtrArray) new_days     = NULL;
+  g_autoptr (GPtrArray) new_installs = NULL;
+  g_autoptr (GVariant) merged        = NULL;
+  g_autoptr (GBytes) bytes           = NULL;
+  g_autofree char *dirname           = NULL;
+  gboolean result                    = FALSE;
+
+  now       = g_date_time_new_now_utc ();
+  day       = g_date_time_new_utc (
+      g_date_time_get_year (now),
+      g_date_time_get_month (now),
+      g_date_time_get_day_of_month (now),
+      0, 0, 0);
+  /* Today's payload is still being written server side */
+  yesterday = g_date_time_add_days (day, -1);
+  g_clear_pointer (&day, g_date_time_unref);
+
+  if (data->current != NULL)
+    {
+      g_autoptr (GVariant) days = NULL;
+      gsize       n_days        = 0;
+      const char *last          = NULL;
+
+      days   = g_variant_get_child_value (data->current, 0);
+      n_days = g_variant_n_children (days);
+      if (n_days > 0)
+        {
+          g_variant_get_child (days, n_days - 1, "&s", &last);
+          day = parse_day (last);
+        }
+    }
+
+  if (day != NULL)
+    {
+      GDateTime *next = NULL;
+
+      next = g_date_time_add_days (day, 1);
+      g_date_time_unref (day);
+      day = next;
+    }
+  if (day == NULL ||
+      g_date_time_difference (yesterday, day) >= (GTimeSpan) STATS_MAX_FETCH_DAYS * G_TIME_SPAN_DAY)
+    {
+      g_clear_pointer (&day, g_date_time_unref);
+      day = g_date_time_add_days (yesterday, 1 - STATS_MAX_FETCH_DAYS);
+    }
+
+  new_days     = g_ptr_array_new_with_free_func (g_free);
+  new_installs = g_ptr_array_new_with_free_func ((GDestroyNotify) g_hash_table_unref);
+
+  while (g_date_time_compare (day, yesterday) <= 0)
+    {
+      g_autoptr (GHashTable) installs = NULL;
+      GDateTime *next                 = NULL;
+
+      installs = fetch_day (day, &local_error);
+      if (installs == NULL)
+        {
+          g_autofree char *label = NULL;
+
+          /* Stop at the first gap, the missing day can be picked up on
+           * the next update */
+          label = g_date_time_format (day, "%F");
+          g_debug ("Could not fetch download statistics for %s: %s",
+                   label, local_error->message);
+          g_clear_error (&local_error);
+          break;
+        }
+
+      g_ptr_array_add (new_days, g_date_time_format (day, "%F"));
+      g_ptr_array_add (new_installs, g_steal_pointer (&installs));
+
+      next = g_date_time_add_days (day, 1);
+      g_date_time_unref (day);
+      day = next;
+    }
+
+  if (new_days->len == 0)
+    return dex_future_new_false ();
+
+  merged = merge (data->current, new_days, new_installs);
+  bytes  = g_variant_get_data_as_bytes (merged);
+
+  dirname = g_path_get_dirname (data->path);
+  g_mkdir_with_parents (dirname, 0755);
+  /* g_file_set_contents() swaps the file in by rename, so a store that is
+   * still mapped from the previous file is never pulled out from under us */
+  result = g_file_set_contents (
+      data->path,
+      g_bytes_get_data (bytes, NULL),
+      g_bytes_get_size (bytes),
+      &local_error);
+  if (!result)
+    g_warning ("Could not write download statistics to %s: %s",
+               data->path, local_error->message);
+
+  g_debug ("Ingested download statistics for %u day(s)", new_days->len);
+  return dex_future_new_take_variant (g_steal_pointer (&merged));
+}
+
+static DexFuture *
+apply_then (DexFuture *future,
+            GWeakRef  *wr)
+{
+  g_autoptr (BzStatsStore) self = NULL;
+  const GValue *value           = NULL;
+
+  bz_weak_get_or_return_reject (self, wr);
+
+  value = dex_future_get_value (future, NULL);
+  if (!G_VALUE_HOLDS (value, G_TYPE_VARIANT))
+    return dex_future_new_false ();
+
+  return dex_future_new_for_boolean (
+      set_data (self, g_value_get_variant (value)));
+}
+
+static GVariant *
+map_data (const char *path,
+          GError    **error)
+{
+  g_autoptr (GMappedFile) mapped = NULL;
+  g_autoptr (GBytes) bytes       = NULL;
+  g_autoptr (GVariant) data      = NULL;
+  g_autoptr (GVariant) days      = NULL;
+  g_autoptr (GVariant) apps      = NULL;
+  g_autoptr (GVariant) columns   = NULL;
+  gsize n_apps                   = 0;
+
+  mapped = g_mapped_file_new (path, FALSE, error);
+  if (mapped == NULL)
+    return NULL;
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  data  = g_variant_ref_sink (
+      g_variant_new_from_bytes (G_VARIANT_TYPE (STATS_FORMAT), bytes, FALSE));
+
+  days    = g_variant_get_child_value (data, 0);
+  apps    = g_variant_get_child_value (data, 1);
+  columns = g_variant_get_child_value (data, 2);
+  n_apps  = g_variant_n_children (apps);
+
+  if (g_variant_n_children (columns) != g_variant_n_children (days))
+    goto invalid;
+  for (gsize i = 0; i < g_variant_n_children (columns); i++)
+    {
+      g_autoptr (GVariant) column = NULL;
+
+      column = g_variant_get_child_value (columns, i);
+      if (g_variant_n_children (column) != n_apps)
+        goto invalid;
+    }
+
+  return g_steal_pointer (&data);
+
+invalid:
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+               "Download statistics are malformed");
+  return NULL;
+}
+
+static GHashTable *
+fetch_day (GDateTime *day,
+           GError   **error)
+{
+  g_autofree char *uri            = NULL;
+  g_autoptr (JsonNode) node       = NULL;
+  JsonObject *refs                = NULL;
+  g_autoptr (GHashTable) installs = NULL;
+
+  uri  = g_date_time_format (day, STATS_URL "/%Y/%m/%d.json");
+  /* Nothing on screen waits on these, let them trail everything else */
+  node = dex_await_boxed (
+      bz_https_query_json_with_class (uri, BZ_BANDWIDTH_CLASS_PREFETCH),
+      error);
+  if (node == NULL)
+    return NULL;
+
+  if (JSON_NODE_HOLDS_OBJECT (node))
+    refs = json_object_get_object_member (json_node_get_object (node), "refs");
+  if (refs == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Unexpected JSON response format");
+      return NULL;
+    }
+
+  installs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  json_object_foreach_member (refs, (JsonObjectForeach) ingest_ref_foreach, installs);
+
+  return g_steal_pointer (&installs);
+}
+
+static void
+ingest_ref_foreach (JsonObject *object,
+                    const char *app_id,
+                    JsonNode   *member_node,
+                    GHashTable *installs)
+{
+  JsonObject    *arches = NULL;
+  JsonObjectIter iter   = { 0 };
+  const char    *arch   = NULL;
+  JsonNode      *counts = NULL;
+  guint64        total  = 0;
+
+  if (!JSON_NODE_HOLDS_OBJECT (member_node) ||
+      g_str_has_suffix (app_id, ".Locale") ||
+      g_str_has_suffix (app_id, ".Debug") ||
+      g_str_has_suffix (app_id, ".Sources"))
+    return;
+
+  /* Each arch maps to [downloads, updates]; whatever wasn't an update is a
+   * new install, matching what the per-app endpoint reports */
+  arches = json_node_get_object (member_node);
+  json_object_iter_init (&iter, arches);
+  while (json_object_iter_next (&iter, &arch, &counts))
+    {
+      JsonArray *array     = NULL;
+      gint64     downloads = 0;
+      gint64     updates   = 0;
+
+      if (!JSON_NODE_HOLDS_ARRAY (counts))
+        continue;
+      array = json_node_get_array (counts);
+      if (json_array_get_length (array) < 2)
+        continue;
+
+      downloads = json_array_get_int_element (array, 0);
+      updates   = json_array_get_int_element (array, 1);
+      if (downloads > updates)
+        total += downloads - updates;
+    }
+
+  if (total > 0)
+    g_hash_table_replace (
+        installs, g_strdup (app_id),
+        GUINT_TO_POINTER ((guint) MIN (total, G_MAXUINT32)));
+}
+
+static GVariant *
+merge (GVariant  *current,
+       GPtrArray *new_days,
+       GPtrArray *new_installs)
+{
+  g_autoptr (GVariant) days                   = NULL;
+  g_autoptr (GVariant) apps                   = NULL;
+  g_autoptr (GVariant) columns                = NULL;
+  g_autofree const char **old_days            = NULL;
+  g_autofree const char **old_apps            = NULL;
+  gsize n_old_days                            = 0;
+  gsize n_old_apps                            = 0;
+  gsize first_old                             = 0;
+  gsize n_days                                = 0;
+  g_autoptr (GHashTable) app_set              = NULL;
+  g_autoptr (GPtrArray) app_ids               = NULL;
+  g_autofree guint32 *matrix                  = NULL;
+  g_autofree guint64 *totals                  = NULL;
+  g_autoptr (GArray) kept                     = NULL;
+  g_autoptr (GVariantBuilder) days_builder    = NULL;
+  g_autoptr (GVariantBuilder) apps_builder    = NULL;
+  g_autoptr (GVariantBuilder) columns_builder = NULL;
+
+  app_set = g_hash_table_new (g_str_hash, g_str_equal);
+
+  if (current != NULL)
+    {
+      days     = g_variant_get_child_value (current, 0);
+      apps     = g_variant_get_child_value (current, 1);
+      columns  = g_variant_get_child_value (current, 2);
+      old_days = g_variant_get_strv (days, &n_old_days);
+      old_apps = g_variant_get_strv (apps, &n_old_apps);
+
+      for (gsize j = 0; j < n_old_apps; j++)
+        g_hash_table_add (app_set, (gpointer) old_apps[j]);
+    }
+  for (guint i = 0; i < new_installs->len; i++)
+    {
+      GHashTableIter iter = { 0 };
+      const char    *id   = NULL;
+
+      g_hash_table_iter_init (&iter, g_ptr_array_index (new_installs, i));
+      while (g_hash_table_iter_next (&iter, (gpointer *) &id, NULL))
+        g_hash_table_add (app_set, (gpointer) id);
+    }
+
+  n_days    = MIN (n_old_days + new_days->len, STATS_WINDOW_DAYS);
+  first_old = n_old_days + new_days->len - n_days;
+
+  app_ids = g_ptr_array_new ();
+  {
+    GHashTableIter iter = { 0 };
+    const char    *id   = NULL;
+
+    g_hash_table_iter_init (&iter, app_set);
+    while (g_hash_table_iter_next (&iter, (gpointer *) &id, NULL))
+      g_ptr_array_add (app_ids, (gpointer) id);
+  }
+  g_ptr_array_sort_values (app_ids, (GCompareFunc) strcmp);
+
+  /* Lay the window out day-major, so every day becomes one contiguous
+   * column and an app is an index shared by all of them */
+  matrix = g_new0 (guint32, n_days * app_ids->len);
+  totals = g_new0 (guint64, app_ids->len);
+  for (gsize j = 0; j < app_ids->len; j++)
+    g_hash_table_insert (app_set, g_ptr_array_index (app_ids, j), GSIZE_TO_POINTER (j));
+
+  for (gsize d = first_old; d < n_old_days; d++)
+    {
+      g_autoptr (GVariant) column = NULL;
+      const guint32 *values       = NULL;
+      gsize          n_values     = 0;
+      guint32       *row          = NULL;
+
+      column = g_variant_get_child_value (columns, d);
+      values = g_variant_get_fixed_array (column, &n_values, sizeof (guint32));
+      row    = matrix + (d - first_old) * app_ids->len;
+
+      for (gsize j = 0; j < n_values && j < n_old_apps; j++)
+        {
+          gsize idx = 0;
+
+          idx = GPOINTER_TO_SIZE (g_hash_table_lookup (app_set, old_apps[j]));
+          row[idx] = values[j];
+          totals[idx] += values[j];
+        }
+    }
+  for (guint i = 0; i < new_days->len; i++)
+    {
+      GHashTableIter iter = { 0 };
+      const char    *id   = NULL;
+      gpointer       n    = NULL;
+      gsize          d    = 0;
+      guint32       *row  = NULL;
+
+      d = n_old_days + i;
+      if (d < first_old)
+        continue;
+      row = matrix + (d - first_old) * app_ids->len;
+
+      g_hash_table_iter_init (&iter, g_ptr_array_index (new_installs, i));
+      while (g_hash_table_iter_next (&iter, (gpointer *) &id, &n))
+        {
+          gsize idx = 0;
+
+          idx = GPOINTER_TO_SIZE (g_hash_table_lookup (app_set, id));
+          row[idx] = GPOINTER_TO_UINT (n);
+          totals[idx] += GPOINTER_TO_UINT (n);
+        }
+    }
+
+  /* Apps that fell out of the window entirely aren't worth a row */
+  kept = g_array_new (FALSE, FALSE, sizeof (gsize));
+  for (gsize j = 0; j < app_ids->len; j++)
+    {
+      if (totals[j] > 0)
+        g_array_append_val (kept, j);
+    }
+
+  days_builder    = g_variant_builder_new (G_VARIANT_TYPE ("as"));
+  apps_builder    = g_variant_builder_new (G_VARIANT_TYPE ("as"));
+  columns_builder = g_variant_builder_new (G_VARIANT_TYPE ("aau"));
+
+  for (gsize d = first_old; d < n_old_days; d++)
+    g_variant_builder_add (days_builder, "s", old_days[d]);
+  for (guint i = 0; i < new_days->len; i++)
+    {
+      if (n_old_days + i >= first_old)
+        g_variant_builder_add (days_builder, "s", g_ptr_array_index (new_days, i));
+    }
+
+  for (guint k = 0; k < kept->len; k++)
+    g_variant_builder_add (
+        apps_builder, "s",
+        g_ptr_array_index (app_ids, g_array_index (kept, gsize, k)));
+
+  for (gsize d = 0; d < n_days; d++)
+    {
+      g_autofree guint32 *column = NULL;
+      const guint32      *row    = NULL;
+
+      row    = matrix + d * app_ids->len;
+      column = g_new (guint32, MAX (kept->len, 1));
+      for (guint k = 0; k < kept->len; k++)
+        column[k] = row[g_array_index (kept, gsize, k)];
+
+      g_variant_builder_add_value (
+          columns_builder,
+          g_variant_new_fixed_array (
+              G_VARIANT_TYPE_UINT32, column,
+              kept->len, sizeof (guint32)));
+    }
+
+  return g_variant_ref_sink (
+      g_variant_new (
+          STATS_FORMAT,
+          days_builder,
+          apps_builder,
+          columns_builder));
+}
+
+static GDateTime *
+parse_day (const char *day)
+{
+  g_autofree char *iso = NULL;
+
+  iso = g_strdup_printf ("%sT00:00:00Z", day);
+  return g_date_time_new_from_iso8601 (iso, NULL);
+}
+
+static int
+cmp_totals (const guint   *a,
+            const guint   *b,
+            const guint64 *totals)
+{
+  if (totals[*a] != totals[*b])
+    return totals[*a] < totals[*b] ? 1 : -1;
+  return (*a > *b) - (*a < *b);
+}
+
+static gboolean
+set_data (BzStatsStore *self,
+          GVariant     *data)
+{
+  g_autoptr (GVariant) days    = NULL;
+  g_autoptr (GVariant) apps    = NULL;
+  g_autoptr (GVariant) columns = NULL;
+
+  g_clear_pointer (&self->days, g_free);
+  g_clear_pointer (&self->apps, g_free);
+  g_clear_pointer (&self->columns, g_ptr_array_unref);
+  g_clear_pointer (&self->app_index, g_hash_table_unref);
+  g_clear_pointer (&self->data, g_variant_unref);
+  self->n_days = 0;
+  self->n_apps = 0;
+
+  if (data != NULL)
+    {
+      self->data = g_variant_ref (data);
+
+      days       = g_variant_get_child_value (data, 0);
+      apps       = g_variant_get_child_value (data, 1);
+      columns    = g_variant_get_child_value (data, 2);
+      self->days = g_variant_get_strv (days, &self->n_days);
+      self->apps = g_variant_get_strv (apps, &self->n_apps);
+
+      /* Strings point straight into the (mapped) data */
+      self->app_index = g_hash_table_new (g_str_hash, g_str_equal);
+      for (gsize j = 0; j < self->n_apps; j++)
+        g_hash_table_insert (self->app_index, (gpointer) self->apps[j], GSIZE_TO_POINTER (j));
+
+      self->columns = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+      for (gsize i = 0; i < self->n_days; i++)
+        g_ptr_array_add (self->columns, g_variant_get_child_value (columns, i));
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_LAST_DAY]);
+  return data != NULL;
+}
+
+static const guint32 *
+get_column (BzStatsStore *self,
+            guint         day)
+{
+  gsize n_values = 0;
+
+  return g_variant_get_fixed_array (
+      g_ptr_array_index (self->columns, day),
+      &n_values, sizeof (guint32));
+}
+
+static char *
+dup_path (void)
+{
+  g_autofree char *module_dir = NULL;
+
+  module_dir = bz_dup_module_dir ();
+  return g_build_filename (module_dir, STATS_BASENAME, NULL);
+}
+
+/* End of bz-stats-store.c */
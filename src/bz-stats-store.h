@@ -0,0 +1,65 @@
+/* bz-stats-store.h
+ *
+ * Copyright 2025 Adam Masciola
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+#include <libdex.h>
+
+G_BEGIN_DECLS
+
+#define BZ_TYPE_STATS_STORE (bz_stats_store_get_type ())
+G_DECLARE_FINAL_TYPE (BzStatsStore, bz_stats_store, BZ, STATS_STORE, GObject)
+
+BzStatsStore *
+bz_stats_store_new (void);
+
+const char *
+bz_stats_store_get_last_day (BzStatsStore *self);
+
+guint
+bz_stats_store_get_n_days (BzStatsStore *self);
+
+guint
+bz_stats_store_get_n_apps (BzStatsStore *self);
+
+guint64
+bz_stats_store_get_installs (BzStatsStore *self,
+                             const char   *app_id,
+                             guint         n_days);
+
+GListModel *
+bz_stats_store_dup_installs_per_day (BzStatsStore *self,
+                                     const char   *app_id);
+
+GListModel *
+bz_stats_store_dup_top_apps (BzStatsStore *self,
+                             guint         n_days,
+                             guint         max);
+
+DexFuture *
+bz_stats_store_load (BzStatsStore *self);
+
+DexFuture *
+bz_stats_store_update (BzStatsStore *self);
+
+G_END_DECLS
+
+/* End of bz-stats-store.h */
@@ -857,13 +857,12 @@ void
 bz_window_show_entry (BzWindow *self,
                       BzEntry  *entry)
 {
-  /* TODO: IMPLEMENT ME! */
-  bz_show_error_for_widget (
-      GTK_WIDGET (self),
-      _ ("The ability to inspect and install local .flatpak bundle files is coming soon! "
-         "In the meantime, try running\n\n"
-         "flatpak install --bundle your-bundle.flatpak\n\n"
-         "on the command line."));
+  g_return_if_fail (BZ_IS_WINDOW (self));
+  g_return_if_fail (BZ_IS_ENTRY (entry));
+
+  /* Entries without a group, like a bundle opened from disk, get the
+     install dialog which shows what is about to be installed */
+  try_transact (self, entry, NULL, FALSE, FALSE, NULL);
 }
 
 void
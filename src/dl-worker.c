@@ -18,8 +18,16 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+
 #define G_LOG_DOMAIN "BAZAAR::DL-WORKER-SUBPROCESS"
 
+#include <gio/gunixfdmessage.h>
+#include <gio/gunixoutputstream.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bz-bandwidth.h"
+#include "bz-download-worker.h"
 #include "bz-env.h"
 #include "bz-global-net.h"
 #include "bz-util.h"
@@ -28,56 +36,72 @@ BZ_DEFINE_DATA (
     main,
     Main,
     {
-      GMainLoop  *loop;
-      GIOChannel *stdout_channel;
+      GMainLoop *loop;
+      GSocket   *socket;
     },
     BZ_RELEASE_DATA (loop, g_main_loop_unref);
-    BZ_RELEASE_DATA (stdout_channel, g_io_channel_unref));
+    BZ_RELEASE_DATA (socket, g_object_unref));
 
 BZ_DEFINE_DATA (
     download,
     Download,
     {
-      char       *src;
-      char       *dest;
-      GIOChannel *stdout_channel;
+      guint64        id;
+      char          *src;
+      GOutputStream *dest;
+      GSocket       *socket;
     },
     BZ_RELEASE_DATA (src, g_free);
-    BZ_RELEASE_DATA (dest, g_free);
-    BZ_RELEASE_DATA (stdout_channel, g_io_channel_unref));
+    BZ_RELEASE_DATA (dest, g_object_unref);
+    BZ_RELEASE_DATA (socket, g_object_unref));
 
 static DexFuture *
-read_stdin (MainData *data);
+read_socket (MainData *data);
 
 static DexFuture *
 download_fiber (DownloadData *data);
 
+static void
+send_reply (GSocket *socket,
+            guint64  id,
+            gboolean success);
+
 int
 main (int   argc,
       char *argv[])
 {
-  g_autoptr (GIOChannel) stdout_channel = NULL;
-  g_autoptr (GMainLoop) main_loop       = NULL;
-  g_autoptr (MainData) data             = NULL;
-  g_autoptr (DexFuture) future          = NULL;
+  g_autoptr (GError) local_error  = NULL;
+  g_autoptr (GSocket) socket      = NULL;
+  g_autoptr (GMainLoop) main_loop = NULL;
+  g_autoptr (MainData) data       = NULL;
+  g_autoptr (DexFuture) future    = NULL;
 
   g_log_writer_default_set_use_stderr (TRUE);
   dex_init ();
 
-  stdout_channel = g_io_channel_unix_new (STDOUT_FILENO);
-  g_assert (g_io_channel_set_encoding (stdout_channel, NULL, NULL));
-  g_io_channel_set_buffered (stdout_channel, FALSE);
+  if (!bz_bandwidth_adopt_shared_fd (BZ_DOWNLOAD_WORKER_BANDWIDTH_FD, &local_error))
+    {
+      g_warning ("Pacing downloads without the parent: %s", local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  socket = g_socket_new_from_fd (BZ_DOWNLOAD_WORKER_SOCKET_FD, &local_error);
+  if (socket == NULL)
+    {
+      g_warning ("FATAL: Could not adopt the parent socket: %s", local_error->message);
+      return EXIT_FAILURE;
+    }
 
   main_loop = g_main_loop_new (NULL, FALSE);
 
-  data                 = main_data_new ();
-  data->loop           = g_main_loop_ref (main_loop);
-  data->stdout_channel = g_io_channel_ref (stdout_channel);
+  data         = main_data_new ();
+  data->loop   = g_main_loop_ref (main_loop);
+  data->socket = g_object_ref (socket);
 
   future = dex_scheduler_spawn (
       dex_thread_pool_scheduler_get_default (),
       bz_get_dex_stack_size (),
-      (DexFiberFunc) read_stdin,
+      (DexFiberFunc) read_socket,
       main_data_ref (data), main_data_unref);
   g_main_loop_run (main_loop);
 
@@ -85,53 +109,89 @@ main (int   argc,
 }
 
 static DexFuture *
-read_stdin (MainData *data)
+read_socket (MainData *data)
 {
-  g_autoptr (GIOChannel) stdin_channel = NULL;
+  g_autofree guint8 *buffer = NULL;
 
-  stdin_channel = g_io_channel_unix_new (STDIN_FILENO);
+  buffer = g_malloc (BZ_DOWNLOAD_WORKER_MAX_PACKET);
   for (;;)
     {
-      g_autoptr (GError) local_error   = NULL;
-      g_autofree char *string          = NULL;
-      char            *newline         = NULL;
-      g_autoptr (GVariant) variant     = NULL;
-      g_autofree char *src_uri         = NULL;
-      g_autofree char *dest_path       = NULL;
-      g_autoptr (DownloadData) dl_data = NULL;
-
-      g_io_channel_read_line (
-          stdin_channel, &string, NULL, NULL, &local_error);
-      if (string == NULL)
+      g_autoptr (GError) local_error     = NULL;
+      GInputVector            vector     = { 0 };
+      GSocketControlMessage **messages   = NULL;
+      int                     n_messages = 0;
+      int                     flags      = 0;
+      gssize                  received   = 0;
+      int                     dest_fd    = -1;
+      g_autoptr (GVariant) variant       = NULL;
+      guint64          id                = 0;
+      g_autofree char *src_uri           = NULL;
+      g_autoptr (DownloadData) dl_data   = NULL;
+
+      vector.buffer = buffer;
+      vector.size   = BZ_DOWNLOAD_WORKER_MAX_PACKET;
+
+      received = g_socket_receive_message (
+          data->socket, NULL,
+          &vector, 1,
+          &messages, &n_messages,
+          &flags, NULL, &local_error);
+      if (received <= 0)
         {
-          if (local_error != NULL)
-            g_warning ("FATAL: Failure reading stdin channel: %s", local_error->message);
+          if (received < 0)
+            g_warning ("FATAL: Failure reading parent socket: %s", local_error->message);
           g_main_loop_quit (data->loop);
           return NULL;
         }
 
-      newline = g_utf8_strchr (string, -1, '\n');
-      if (newline != NULL)
-        *newline = '\0';
+      for (int i = 0; i < n_messages; i++)
+        {
+          if (G_IS_UNIX_FD_MESSAGE (messages[i]))
+            {
+              g_autofree int *fds = NULL;
+              int             n   = 0;
+
+              fds = g_unix_fd_message_steal_fds (G_UNIX_FD_MESSAGE (messages[i]), &n);
+              for (int j = 0; j < n; j++)
+                {
+                  if (dest_fd < 0)
+                    dest_fd = fds[j];
+                  else
+                    close (fds[j]);
+                }
+            }
+          g_object_unref (messages[i]);
+        }
+      g_free (messages);
 
-      variant = g_variant_parse (
-          G_VARIANT_TYPE ("(ss)"),
-          string, NULL, NULL,
-          &local_error);
-      if (variant == NULL)
+      /* The parent never sends packets this large, so
+         there is no id we could answer to */
+      if ((flags & MSG_TRUNC) != 0)
         {
-          g_warning ("Failure parsing variant text '%s' into structure: %s\n",
-                     string, local_error->message);
-          g_main_loop_quit (data->loop);
+          g_warning ("Dropping a truncated request from the parent");
+          if (dest_fd >= 0)
+            close (dest_fd);
           continue;
         }
 
-      g_variant_get (variant, "(ss)", &src_uri, &dest_path);
+      variant = g_variant_new_from_data (
+          G_VARIANT_TYPE (BZ_DOWNLOAD_WORKER_REQUEST_FORMAT),
+          buffer, received, FALSE, NULL, NULL);
+      g_variant_ref_sink (variant);
+      g_variant_get (variant, BZ_DOWNLOAD_WORKER_REQUEST_FORMAT, &id, &src_uri);
 
-      dl_data                 = download_data_new ();
-      dl_data->src            = g_steal_pointer (&src_uri);
-      dl_data->dest           = g_steal_pointer (&dest_path);
-      dl_data->stdout_channel = g_io_channel_ref (data->stdout_channel);
+      if (dest_fd < 0)
+        {
+          g_warning ("Request for %s came without a destination", src_uri);
+          send_reply (data->socket, id, FALSE);
+          continue;
+        }
+
+      dl_data         = download_data_new ();
+      dl_data->id     = id;
+      dl_data->src    = g_steal_pointer (&src_uri);
+      dl_data->dest   = g_unix_output_stream_new (dest_fd, TRUE);
+      dl_data->socket = g_object_ref (data->socket);
 
       dex_future_disown (dex_scheduler_spawn (
           dex_scheduler_get_default (),
@@ -146,29 +206,20 @@ read_stdin (MainData *data)
 static DexFuture *
 download_fiber (DownloadData *data)
 {
-  gboolean success                          = FALSE;
-  g_autoptr (GError) local_error            = NULL;
-  g_autoptr (GFile) dest_file               = NULL;
-  g_autoptr (GFileOutputStream) dest_output = NULL;
-  g_autoptr (SoupMessage) message           = NULL;
-  g_autoptr (GVariant) variant              = NULL;
-  g_autofree char *output                   = NULL;
-  g_autofree char *output_plus_nl           = NULL;
-
-  dest_file   = g_file_new_for_path (data->dest);
-  dest_output = g_file_replace (
-      dest_file, NULL, FALSE,
-      G_FILE_CREATE_REPLACE_DESTINATION,
-      NULL, &local_error);
-  if (dest_output == NULL)
+  gboolean success                = FALSE;
+  g_autoptr (GError) local_error  = NULL;
+  g_autoptr (SoupMessage) message = NULL;
+
+  message = soup_message_new (SOUP_METHOD_GET, data->src);
+  if (message == NULL)
     {
-      g_warning ("%s", local_error->message);
+      g_warning ("Could not parse uri %s", data->src);
       goto done;
     }
+  bz_set_message_bandwidth_class (message, BZ_BANDWIDTH_CLASS_VISIBLE_MEDIA);
 
-  message = soup_message_new (SOUP_METHOD_GET, data->src);
   success = dex_await (bz_send_with_global_http_session_then_splice_into (
-                           message, G_OUTPUT_STREAM (dest_output)),
+                           message, data->dest),
                        &local_error);
   if (!success)
     {
@@ -177,11 +228,28 @@ download_fiber (DownloadData *data)
     }
 
 done:
-  variant        = g_variant_new ("(sb)", data->dest, success);
-  output         = g_variant_print (variant, TRUE);
-  output_plus_nl = g_strdup_printf ("%s\n", output);
-
-  g_io_channel_write_chars (data->stdout_channel, output_plus_nl, -1, NULL, NULL);
+  g_output_stream_close (data->dest, NULL, NULL);
+  send_reply (data->socket, data->id, success);
 
   return dex_future_new_true ();
 }
+
+static void
+send_reply (GSocket *socket,
+            guint64  id,
+            gboolean success)
+{
+  g_autoptr (GError) local_error = NULL;
+  g_autoptr (GVariant) variant   = NULL;
+  gssize sent                    = 0;
+
+  variant = g_variant_ref_sink (g_variant_new (
+      BZ_DOWNLOAD_WORKER_REPLY_FORMAT, id, success));
+  sent    = g_socket_send (
+      socket,
+      g_variant_get_data (variant),
+      g_variant_get_size (variant),
+      NULL, &local_error);
+  if (sent < 0)
+    g_warning ("Could not reply to the parent: %s", local_error->message);
+}